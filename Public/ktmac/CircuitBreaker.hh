@@ -0,0 +1,100 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_CIRCUIT_BREAKER_HH
+#define KTMAC_CIRCUIT_BREAKER_HH
+
+#include <chrono>
+#include <cstdint>
+
+namespace ktmac
+{
+
+enum class CircuitState
+{
+    Closed,
+    Open,
+    HalfOpen,
+};
+
+struct CircuitBreakerConfig
+{
+    uint32_t                  failureThreshold;
+    std::chrono::milliseconds probeInterval;
+};
+
+struct DeliveryMetrics
+{
+    uint64_t numTimeouts;
+    uint64_t numRejected;
+    uint64_t numBreakerOpened;
+    uint64_t numBreakerClosed;
+    uint64_t numProbes;
+};
+
+// Not thread-safe; the owner guards each breaker with its own lock. The breaker opens after
+// `failureThreshold` consecutive timeouts and stays open until a probe succeeds.
+class CircuitBreaker
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+  private:
+    CircuitState      _state;
+    uint32_t          _numFailures;
+    Clock::time_point _nextProbe;
+
+  public:
+    CircuitBreaker() : _state { CircuitState::Closed }, _numFailures { 0 }, _nextProbe {} {}
+
+  public:
+    CircuitState GetState() const
+    {
+        return _state;
+    }
+
+    bool Allow() const
+    {
+        return _state == CircuitState::Closed;
+    }
+
+    // Returns true if this failure opened the breaker.
+    bool RecordFailure(CircuitBreakerConfig const& config, Clock::time_point now)
+    {
+        if (_state == CircuitState::Closed && ++_numFailures < config.failureThreshold)
+            return false;
+
+        bool opened = _state == CircuitState::Closed;
+        _state      = CircuitState::Open;
+        _nextProbe  = now + config.probeInterval;
+        return opened;
+    }
+
+    // Returns true if this success closed the breaker.
+    bool RecordSuccess()
+    {
+        bool closed  = _state != CircuitState::Closed;
+        _state       = CircuitState::Closed;
+        _numFailures = 0;
+        return closed;
+    }
+
+    // Moves an open breaker whose probe is due into the half-open state.
+    bool BeginProbe(Clock::time_point now)
+    {
+        if (_state != CircuitState::Open || now < _nextProbe)
+            return false;
+
+        _state = CircuitState::HalfOpen;
+        return true;
+    }
+
+    Clock::time_point GetNextProbe() const
+    {
+        return _nextProbe;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_CONTROL_SERVER_HH
+#define KTMAC_CONTROL_SERVER_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ktmac
+{
+
+constexpr int ControlServerPort = 23458;
+
+// Sends one message and returns whether it was delivered. Runs on the server's send thread.
+using ControlSendHandler = std::function<bool(std::string const& message)>;
+
+// Lets other programs drive a core over loopback HTTP and WebSocket:
+//
+//   GET  /state   {"state":"..."}
+//   POST /send    the body is the message; {"success":true}
+//   POST /batch   the body is a JSON array of messages; {"success":[true,false,...]}
+//   GET  /events  upgrades to a WebSocket, which gets {"type":"state","state":"..."} at once and
+//                 on every change, and takes {"type":"send","id":1,"message":"..."} and
+//                 {"type":"batch","id":2,"messages":[...]}, answered by
+//                 {"type":"result","id":1,"success":...}.
+//
+// Messages are UTF-8. Requests carrying an Origin header, or a Host other than the loopback
+// address, come from web pages and are refused. All sockets are served from a single thread
+// blocked in poll(), WSAPoll() on Windows, as in ProcessWatcherBroker. Sends run in order on one
+// more thread, since they may block for as long as the core takes to deliver them. On Windows,
+// WinSock must be initialized before construction.
+class ControlServer
+{
+  private:
+    struct Client
+    {
+        intptr_t    socket;
+        uint64_t    id;
+        bool        webSocket;
+        bool        busy;
+        bool        closing;
+        size_t      numPending;
+        std::string inbound;
+        size_t      numParsed;
+        std::string message;
+        uint8_t     messageOpcode;
+        std::string outbound;
+        size_t      numSent;
+    };
+
+    struct SendJob
+    {
+        uint64_t                 clientId;
+        int64_t                  requestId;
+        bool                     batch;
+        std::vector<std::string> messageList;
+    };
+
+    struct SendResult
+    {
+        uint64_t          clientId;
+        int64_t           requestId;
+        bool              batch;
+        std::vector<bool> successList;
+    };
+
+  public:
+    // A client that falls this far behind is dropped rather than buffered without limit.
+    static constexpr size_t MaxBufferedBytes = 1024 * 1024;
+
+    // Longer requests and WebSocket messages are refused.
+    static constexpr size_t MaxRequestBytes = 1024 * 1024;
+
+    // Sends a WebSocket client may have waiting before further ones are refused.
+    static constexpr size_t MaxPendingSends = 4096;
+
+  private:
+    intptr_t           _listener;
+    intptr_t           _wakeup;
+    int                _portNumber;
+    ControlSendHandler _sendHandler;
+
+    std::mutex              _pendingMtx;
+    std::string             _pendingState;
+    bool                    _statePending;
+    std::vector<SendResult> _resultList;
+    std::vector<SendResult> _batch;
+    std::atomic<bool>       _wakeupPending;
+
+    std::mutex              _jobMtx;
+    std::condition_variable _jobCv;
+    std::deque<SendJob>     _jobList;
+    bool                    _sendStopping;
+    std::thread             _sendThread;
+
+    std::string         _state;
+    std::vector<Client> _clientList;
+    uint64_t            _nextClientId;
+    std::atomic<size_t> _numClients;
+    std::atomic<bool>   _stopping;
+
+  public:
+    // Listens on 127.0.0.1:`portNumber`, or on an ephemeral port if it is 0. Throws if the port is
+    // taken.
+    explicit ControlServer(ControlSendHandler&& sendHandler, int portNumber = ControlServerPort);
+    ~ControlServer();
+
+    ControlServer(ControlServer const&) = delete;
+    ControlServer& operator=(ControlServer const&) = delete;
+
+  public:
+    int GetPortNumber() const
+    {
+        return _portNumber;
+    }
+
+    size_t GetNumClients() const
+    {
+        return _numClients.load(std::memory_order_relaxed);
+    }
+
+    // May be called from any thread. Subscribers get the latest state; one that is replaced before
+    // the server thread gets to it is not sent.
+    void PublishState(std::string_view state);
+
+    // Serves clients on the calling thread until Stop() is called.
+    void Run();
+    void Stop();
+
+  private:
+    void Wake();
+    void RunSends();
+    void Accept();
+    bool Receive(Client& client);
+    void Process(Client& client);
+    bool ProcessHttpRequest(Client& client);
+    bool ProcessWebSocketFrame(Client& client);
+    void HandleWebSocketMessage(Client& client);
+    void HandleResult(SendResult const& result);
+    void Queue(Client& client, std::string_view data);
+    void QueueHttpResponse(Client& client, int status, std::string_view body, bool close = false);
+    void QueueFrame(Client& client, uint8_t opcode, std::string_view payload);
+    bool Flush(Client& client);
+    void Drop(size_t index);
+};
+
+}
+
+#endif
@@ -0,0 +1,189 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_HOOK_TABLE_HH
+#define KTMAC_HOOK_TABLE_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace ktmac
+{
+
+// Fixed-capacity open-addressing table for hook registrations. Lookups take no lock and allocate
+// nothing; registrations are serialized among themselves and reclaim removed entries only after
+// every reader that might still see them has left (a two-epoch grace period).
+template <typename Value, size_t Capacity = 64>
+class HookTable
+{
+  private:
+    static constexpr uintptr_t EmptyKey   = 0;
+    static constexpr uintptr_t RemovedKey = ~uintptr_t { 0 };
+
+    struct Slot
+    {
+        std::atomic<uintptr_t> key;
+        std::atomic<Value*>    value;
+    };
+
+  private:
+    static size_t GetIndex(uintptr_t key)
+    {
+        uint64_t hash = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(hash >> 32) % Capacity;
+    }
+
+  private:
+    Slot                  _slotList[Capacity];
+    std::atomic<uint64_t> _epoch;
+    std::atomic<uint64_t> _numReaders[2];
+    std::mutex            _writerMtx;
+
+  public:
+    HookTable() : _slotList {}, _epoch { 0 }, _numReaders {}, _writerMtx {} {}
+
+    ~HookTable()
+    {
+        for (auto& slot : _slotList) delete slot.value.load(std::memory_order_relaxed);
+    }
+
+    HookTable(HookTable const&) = delete;
+    HookTable& operator=(HookTable const&) = delete;
+
+  public:
+    // Calls `func` with the entry registered for `key`, if any, inside a read-side critical
+    // section. `func` must not call Insert() or Erase() on the same table.
+    template <typename Func>
+    bool Find(uintptr_t key, Func&& func)
+    {
+        if (key == EmptyKey || key == RemovedKey)
+            return false;
+
+        size_t parity = EnterRead();
+        bool   found  = false;
+
+        size_t index = GetIndex(key);
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            Slot&     slot    = _slotList[(index + i) % Capacity];
+            uintptr_t current = slot.key.load(std::memory_order_acquire);
+            if (current == EmptyKey)
+                break;
+
+            if (current == key)
+            {
+                if (Value* value = slot.value.load(std::memory_order_acquire); value != nullptr)
+                {
+                    func(static_cast<Value const&>(*value));
+                    found = true;
+                }
+                break;
+            }
+        }
+
+        ExitRead(parity);
+        return found;
+    }
+
+    bool Insert(uintptr_t key, Value const& value)
+    {
+        if (key == EmptyKey || key == RemovedKey)
+            return false;
+
+        std::lock_guard<std::mutex> guard { _writerMtx };
+
+        Slot*  target = nullptr;
+        size_t index  = GetIndex(key);
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            Slot&     slot    = _slotList[(index + i) % Capacity];
+            uintptr_t current = slot.key.load(std::memory_order_relaxed);
+            if (current == key)
+                return false;
+
+            if (current == RemovedKey && target == nullptr)
+                target = &slot;
+            else if (current == EmptyKey)
+            {
+                if (target == nullptr)
+                    target = &slot;
+                break;
+            }
+        }
+
+        if (target == nullptr)
+            return false;
+
+        target->value.store(new Value(value), std::memory_order_release);
+        target->key.store(key, std::memory_order_release);
+        return true;
+    }
+
+    bool Erase(uintptr_t key)
+    {
+        if (key == EmptyKey || key == RemovedKey)
+            return false;
+
+        std::lock_guard<std::mutex> guard { _writerMtx };
+
+        size_t index = GetIndex(key);
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            Slot&     slot    = _slotList[(index + i) % Capacity];
+            uintptr_t current = slot.key.load(std::memory_order_relaxed);
+            if (current == EmptyKey)
+                return false;
+
+            if (current == key)
+            {
+                Value* value = slot.value.exchange(nullptr, std::memory_order_acq_rel);
+                slot.key.store(RemovedKey, std::memory_order_release);
+
+                Synchronize();
+                delete value;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+  private:
+    size_t EnterRead()
+    {
+        while (true)
+        {
+            uint64_t epoch  = _epoch.load();
+            size_t   parity = static_cast<size_t>(epoch & 1);
+
+            _numReaders[parity].fetch_add(1);
+            if (_epoch.load() == epoch)
+                return parity;
+
+            // A writer flipped the epoch in between; retry so the writer does not wait on us.
+            _numReaders[parity].fetch_sub(1);
+        }
+    }
+
+    void ExitRead(size_t parity)
+    {
+        _numReaders[parity].fetch_sub(1, std::memory_order_release);
+    }
+
+    // Waits until every reader that entered before the epoch flip has left.
+    void Synchronize()
+    {
+        uint64_t epoch  = _epoch.fetch_add(1);
+        size_t   parity = static_cast<size_t>(epoch & 1);
+
+        while (_numReaders[parity].load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+    }
+};
+
+}
+
+#endif
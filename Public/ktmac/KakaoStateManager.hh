@@ -4,8 +4,15 @@
 #ifndef KTMAC_KAKAO_STATE_MANAGER_HH
 #define KTMAC_KAKAO_STATE_MANAGER_HH
 
+#include <ktmac/CircuitBreaker.hh>
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/ProcessEventSource.hh>
+#include <ktmac/ProcessWatcherChannel.hh>
 #include <ktmac/ProcessWatcherMessage.hh>
+#include <ktmac/RateLimiter.hh>
+#include <ktmac/TextInjector.hh>
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -29,6 +36,83 @@ enum class KakaoState
     ChatroomIsVisible,
 };
 
+// The names the front ends use for each state.
+inline char const* GetKakaoStateName(KakaoState state)
+{
+    switch (state)
+    {
+    case KakaoState::NotRunning: return "not-running";
+    case KakaoState::LoggedOut: return "logged-out";
+    case KakaoState::Background: return "background";
+    case KakaoState::Locked: return "locked";
+    case KakaoState::ContactListIsVisible: return "contact-list-is-visible";
+    case KakaoState::ChatroomListIsVisible: return "chatroom-list-is-visible";
+    case KakaoState::MiscIsVisible: return "misc-is-visible";
+    case KakaoState::ChatroomIsVisible: return "chatroom-is-visible";
+    }
+    return "";
+}
+
+// Window events the hook library forwarded to the core or filtered out before they got there,
+// the events the core lost because its queue was full, each of which forces a resync, and the
+// events it ignored because a newer event for the same window, or a resync, had been applied.
+struct WindowEventStatistics
+{
+    uint64_t numForwarded;
+    uint64_t numDropped;
+    uint64_t numOverflowed;
+    uint64_t numResyncs;
+    uint64_t numStale;
+};
+
+// `eventToState` runs from the time the system stamped an event to the end of its state
+// evaluation and has the resolution of GetTickCount(); `queueDelay` is the time the event spent
+// waiting for the state worker.
+struct WindowEventLatency
+{
+    LatencyHistogramSnapshot eventToState;
+    LatencyHistogramSnapshot queueDelay;
+};
+
+// Heartbeats of the current process hook channel or shared hook broker, which start over with every
+// channel, and the times the hook was restarted because it stopped answering them; a shared hook
+// is replaced by one of this instance. `connected` is false while a restart is in progress, after
+// one failed, and when the hook is reached over a socket, which has no heartbeats.
+struct ProcessHookHealth
+{
+    HeartbeatStatistics heartbeat;
+    uint64_t            numRestarts;
+    uint64_t            numFailedRestarts;
+    bool                connected;
+};
+
+// How long each phase of the construction took. Looking for KakaoTalk's processes and waiting for
+// its main window happen on a thread of their own while the process hook is started, so the phases
+// add up to more than `total`. `hookLaunch` includes the elevation prompt and is zero if a shared
+// process hook answered; `initialState` is the time the constructor still waited for the scans
+// once the hook was connected, plus evaluating the state.
+struct StartupTimings
+{
+    std::chrono::microseconds subscribe;
+    std::chrono::microseconds processScan;
+    std::chrono::microseconds windowScan;
+    std::chrono::microseconds hookLaunch;
+    std::chrono::microseconds initialState;
+    std::chrono::microseconds threadStart;
+    std::chrono::microseconds total;
+    bool                      sharedHook;
+};
+
+// In the threaded mode, window events are queued from the thread pumping messages to a state
+// thread, and process events are applied on the thread receiving them from the process hook. In
+// the reactor mode, a single thread waits on window messages, the process hook channel and a work
+// queue at once, and applies every change in the order it arrived.
+enum class KakaoThreadingMode
+{
+    Threaded,
+    Reactor,
+};
+
 #ifdef KTMAC_CORE_SHARED
 #    ifdef KTMAC_CORE_EXPORT
 class __declspec(dllexport) KakaoStateManager
@@ -62,6 +146,7 @@ class KakaoStateManager
 
     KakaoStateManager& operator=(KakaoStateManager&& manager) noexcept;
     KakaoStateManager(std::initializer_list<HandlerPairType> init);
+    KakaoStateManager(KakaoThreadingMode mode, std::initializer_list<HandlerPairType> init = {});
     ~KakaoStateManager();
 
   public:
@@ -95,6 +180,43 @@ class KakaoStateManager
 #undef SendMessage
     bool SendMessage();
 #pragma pop_macro("SendMessage")
+
+    void              SetGlobalRateLimit(RateLimit limit);
+    void              SetChatroomRateLimit(RateLimit limit);
+    RateLimit         GetGlobalRateLimit();
+    RateLimit         GetChatroomRateLimit();
+    RateLimiterLevels GetRateLimiterLevels();
+
+    // Messages of at least `minLength` characters are injected with `method` until a larger
+    // threshold takes over. By default, every message uses TextInjectionMethod::SetText.
+    void SetTextInjectionMethod(size_t minLength, TextInjectionMethod method);
+
+    // Every synchronous call to a KakaoTalk window on the send path waits at most `timeoutMs`.
+    // Repeated timeouts open the window's circuit breaker, and sends to it then fail immediately
+    // until a background probe gets a reply.
+    void            SetDeliveryTimeout(uint32_t timeoutMs);
+    void            SetCircuitBreakerConfig(CircuitBreakerConfig config);
+    DeliveryMetrics GetDeliveryMetrics();
+
+    WindowEventStatistics GetWindowEventStatistics();
+
+    WindowEventLatency GetWindowEventLatency();
+
+    // Metadata of the KakaoTalk process whose windows are being tracked, including its executable
+    // version, or a zeroed event if there is none.
+    ProcessEvent GetProcessInfo();
+
+    // Threads the manager runs at the moment, including the one receiving from the process hook
+    // if the transport needs one.
+    size_t GetNumThreads();
+
+    // Once the process hook misses `missThreshold` heartbeats in a row, it is terminated if the
+    // system allows it and started again, which asks for elevation again. Processes that exited in
+    // the meantime are reported as stopped. A zero interval turns heartbeats off.
+    void              SetHeartbeatConfig(HeartbeatConfig config);
+    ProcessHookHealth GetProcessHookHealth();
+
+    StartupTimings GetStartupTimings();
 };
 
 }
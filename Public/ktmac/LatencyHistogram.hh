@@ -0,0 +1,127 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_LATENCY_HISTOGRAM_HH
+#define KTMAC_LATENCY_HISTOGRAM_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace ktmac
+{
+
+struct LatencyHistogramSnapshot
+{
+    static constexpr size_t NumBuckets = 64;
+
+    // Bucket 0 holds zero; bucket i > 0 holds values in [2^(i-1), 2^i).
+    uint64_t bucketList[NumBuckets];
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+
+    double GetMean() const
+    {
+        return count == 0 ? 0.0 : (double)sumNs / (double)count;
+    }
+
+    // Interpolates linearly inside the bucket the percentile falls into, so the result is exact
+    // only to within a factor of two, which is enough to tell microseconds from milliseconds.
+    uint64_t GetPercentile(double percentile) const
+    {
+        if (count == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(percentile * (double)(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NumBuckets; ++i)
+        {
+            if (bucketList[i] == 0 || seen + bucketList[i] < rank)
+            {
+                seen += bucketList[i];
+                continue;
+            }
+
+            if (i == 0)
+                return 0;
+
+            uint64_t lower = uint64_t { 1 } << (i - 1);
+            uint64_t upper = i == NumBuckets - 1 ? maxNs : (uint64_t { 1 } << i) - 1;
+            if (upper > maxNs)
+                upper = maxNs;
+
+            double fraction = (double)(rank - seen) / (double)bucketList[i];
+            return lower + (uint64_t)(fraction * (double)(upper - lower));
+        }
+
+        return maxNs;
+    }
+};
+
+// Log2-bucketed histogram of durations in nanoseconds. Recording is wait-free and may happen from
+// any number of threads; a snapshot taken concurrently may miss the latest few samples.
+class LatencyHistogram
+{
+  private:
+    static constexpr size_t NumBuckets = LatencyHistogramSnapshot::NumBuckets;
+
+  private:
+    static size_t GetBucket(uint64_t ns)
+    {
+        size_t bucket = 0;
+        while (ns != 0 && bucket < NumBuckets - 1)
+        {
+            ns >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+  private:
+    std::atomic<uint64_t> _bucketList[NumBuckets];
+    std::atomic<uint64_t> _sumNs;
+    std::atomic<uint64_t> _maxNs;
+
+  public:
+    LatencyHistogram() : _bucketList {}, _sumNs { 0 }, _maxNs { 0 } {}
+
+    LatencyHistogram(LatencyHistogram const&) = delete;
+    LatencyHistogram& operator=(LatencyHistogram const&) = delete;
+
+  public:
+    void Record(uint64_t ns)
+    {
+        _bucketList[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        _sumNs.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t max = _maxNs.load(std::memory_order_relaxed);
+        while (ns > max && !_maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+            continue;
+    }
+
+    LatencyHistogramSnapshot GetSnapshot() const
+    {
+        LatencyHistogramSnapshot rtn {};
+        for (size_t i = 0; i < NumBuckets; ++i)
+        {
+            rtn.bucketList[i] = _bucketList[i].load(std::memory_order_relaxed);
+            rtn.count += rtn.bucketList[i];
+        }
+        rtn.sumNs = _sumNs.load(std::memory_order_relaxed);
+        rtn.maxNs = _maxNs.load(std::memory_order_relaxed);
+
+        return rtn;
+    }
+
+    void Reset()
+    {
+        for (auto& bucket : _bucketList) bucket.store(0, std::memory_order_relaxed);
+        _sumNs.store(0, std::memory_order_relaxed);
+        _maxNs.store(0, std::memory_order_relaxed);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_PROCESS_EVENT_SOURCE_HH
+#define KTMAC_PROCESS_EVENT_SOURCE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace ktmac
+{
+
+enum class ProcessState
+{
+    Running,
+    Stopped,
+};
+
+using ProcessStateHandler = std::function<void(ProcessState state, uint32_t processId)>;
+
+constexpr size_t ProcessImageNameLength = 64;
+
+// Fixed-size and trivially copyable, so it can be sent as is. Everything after `processId` is
+// zero if the source could not tell; `creationTime` is in FILETIME units on Windows and in clock
+// ticks since boot on Linux and, together with `processId`, identifies a process even after its ID
+// has been reused.
+struct ProcessEvent
+{
+    ProcessState state;
+    uint32_t     processId;
+    uint32_t     parentProcessId;
+    uint32_t     sessionId;
+    uint64_t     creationTime;
+    uint16_t     version[4];
+    char         imageName[ProcessImageNameLength];
+};
+
+// Called once per delivery from the system, with every event in that delivery.
+using ProcessEventBatchHandler = std::function<void(ProcessEvent const* events, size_t numEvents)>;
+
+// For receivers that only need the state and the ID of each process.
+inline ProcessEventBatchHandler MakeBatchHandler(ProcessStateHandler&& stateHandler)
+{
+    return [stateHandler = std::move(stateHandler)](ProcessEvent const* events, size_t numEvents) {
+        if (stateHandler)
+        {
+            for (size_t i = 0; i < numEvents; ++i)
+                stateHandler(events[i].state, events[i].processId);
+        }
+    };
+}
+
+// Reports starts and exits of processes with any of a list of names, each batch through the
+// handler given to the constructor. A source starts watching when it is constructed and stops when
+// it is destroyed; the handler may be called from any thread in between, and from the constructor.
+// Processes that already run when the source is created are reported as Running in one batch, and
+// the exit of a process carries the same metadata as its start.
+class ProcessEventSource
+{
+  private:
+    ProcessEventBatchHandler _batchHandler;
+
+  protected:
+    explicit ProcessEventSource(ProcessEventBatchHandler&& batchHandler) :
+        _batchHandler { std::move(batchHandler) }
+    {}
+
+  public:
+    virtual ~ProcessEventSource() {}
+
+    ProcessEventSource(ProcessEventSource const&) = delete;
+    ProcessEventSource& operator=(ProcessEventSource const&) = delete;
+
+  public:
+    virtual char const* GetName() const = 0;
+
+  protected:
+    void Report(ProcessEvent const* events, size_t numEvents) const
+    {
+        if (numEvents != 0 && _batchHandler)
+            _batchHandler(events, numEvents);
+    }
+};
+
+}
+
+#endif
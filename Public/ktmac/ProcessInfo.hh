@@ -0,0 +1,21 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_PROCESS_INFO_HH
+#define KTMAC_PROCESS_INFO_HH
+
+#include <ktmac/ProcessEventSource.hh>
+
+namespace ktmac
+{
+
+// Fills the creation time, session ID, executable version and, if it is still empty, the image
+// name of `event` from `process`, which must have been opened with at least
+// PROCESS_QUERY_LIMITED_INFORMATION. Executable versions are cached by path.
+bool QueryProcessInfo(void* process, ProcessEvent& event);
+
+void SetProcessImageName(ProcessEvent& event, char const* imageName);
+
+}
+
+#endif
@@ -4,29 +4,42 @@
 #ifndef KTMAC_PROCESS_WATCHER_HH
 #define KTMAC_PROCESS_WATCHER_HH
 
+#include <ktmac/ProcessEventSource.hh>
 #include <ktmac/WmiEventSink.hh>
 
 #include <WbemIdl.h>
 #include <wrl.h>
 
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace ktmac
 {
 
-enum class ProcessState
-{
-    Running,
-    Stopped,
-};
-
-using ProcessStateHandler = std::function<void(ProcessState state, uint32_t processId)>;
-
-class ProcessWatcher
+// Receives Win32_ProcessStartTrace through WMI, which requires COM to be initialized and
+// administrator privileges. Exits are not taken from Win32_ProcessStopTrace, which can lag by
+// hundreds of milliseconds; every process found is waited on through its handle instead. Process
+// names are matched exactly, ignoring case. Every event carries the process metadata, and the exit
+// of a process carries the same metadata as its start.
+class ProcessWatcher : public ProcessEventSource
 {
     template <typename I>
     using ComPtr = Microsoft::WRL::ComPtr<I>;
 
+    struct ExitWait
+    {
+        ProcessWatcher* watcher;
+        ProcessEvent    info;
+        HANDLE          process;
+        HANDLE          wait;
+    };
+
   public:
     static bool CheckAdministratorPrivilege();
     static bool InitializeCom();
@@ -36,14 +49,37 @@ class ProcessWatcher
     ComPtr<IWbemLocator>        _wbemLocator;
     ComPtr<IWbemServices>       _services;
     ComPtr<IUnsecuredApartment> _unsecuredApt;
-    WmiEventSink *              _processStartDetector, *_processStopDetector;
-    ComPtr<IWbemObjectSink>     _processStartSink, _processStopSink;
-    std::string                 _processName;
-    ProcessStateHandler         _stateHandler;
+    WmiEventSink*               _processStartDetector;
+    ComPtr<IWbemObjectSink>     _processStartSink;
+    std::vector<std::string>    _processNameList;
+
+    std::mutex                                              _waitMtx;
+    std::condition_variable                                 _waitCondition;
+    std::unordered_map<uint32_t, std::unique_ptr<ExitWait>> _waitList;
+    size_t                                                  _numActiveCallbacks;
+    bool                                                    _stopping;
 
   public:
     ProcessWatcher(std::string&& processName, ProcessStateHandler&& stateHandler);
+    ProcessWatcher(std::vector<std::string>&& processNameList,
+                   ProcessEventBatchHandler&& batchHandler);
     ~ProcessWatcher();
+
+  public:
+    virtual char const* GetName() const override
+    {
+        return "wmi";
+    }
+
+  private:
+    static void CALLBACK HandleExit(PVOID context, BOOLEAN timedOut);
+
+  private:
+    void HandleStart(long numObjects, IWbemClassObject** objects);
+    bool IsWatched(char const* processName) const;
+    bool Open(ProcessEvent& event, HANDLE& process);
+    void Watch(ProcessEvent const& event, HANDLE process);
+    void WatchExisting();
 };
 
 }
@@ -0,0 +1,203 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_PROCESS_WATCHER_BROKER_HH
+#define KTMAC_PROCESS_WATCHER_BROKER_HH
+
+#include <ktmac/ProcessEventSource.hh>
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/ProcessWatcherChannel.hh>
+#include <ktmac/ProcessWatcherCodec.hh>
+#include <ktmac/ProcessWatcherSocket.hh>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ktmac
+{
+
+// Lets any number of cores share one process hook. Subscribers connect over a Unix domain socket,
+// AF_UNIX on Windows as well, say Hello with the last sequence number they received, and get
+// either the events they missed or a snapshot of the running processes, followed by every event
+// published afterwards. All sockets are served from a single thread blocked in poll(), WSAPoll() on
+// Windows; Publish() only queues and wakes it through a loopback datagram to itself. On Windows,
+// WinSock must be initialized before construction.
+class ProcessWatcherBroker
+{
+  private:
+    struct Client
+    {
+        intptr_t              socket;
+        bool                  attached;
+        ProcessWatcherDecoder inbound;
+        std::vector<char>     outbound;
+        size_t                numSent;
+    };
+
+  public:
+    // A subscriber that falls this far behind is dropped rather than buffered without limit.
+    static constexpr size_t MaxBufferedBytes = 1024 * 1024;
+
+    // A subscriber that reconnects after missing more events than this gets a snapshot instead.
+    static constexpr size_t ReplayCapacity = 4096;
+
+  private:
+    std::string _endpoint;
+    intptr_t    _listener;
+    intptr_t    _wakeup;
+    uint64_t    _instanceId;
+
+    std::mutex                _pendingMtx;
+    std::vector<ProcessEvent> _pending;
+    std::vector<ProcessEvent> _batch;
+    std::atomic<bool>         _wakeupPending;
+
+    uint64_t                                   _sequence;
+    std::deque<ProcessEvent>                   _replayList;
+    std::unordered_map<uint32_t, ProcessEvent> _runningList;
+    ProcessWatcherEncoder                      _encoder;
+
+    std::vector<Client> _clientList;
+    std::atomic<size_t> _numClients;
+    std::atomic<bool>   _stopping;
+    std::atomic<bool>   _stopWhenIdle;
+
+  public:
+    // Cores look for a shared hook at this path, which is the same for every core of the user in
+    // the current session, Windows session or user ID on Linux, and lies in a directory private to
+    // the user. The one-to-one socket between a core and the hook it started uses an endpoint
+    // private to that core instead.
+    static std::string MakeEndpoint();
+
+  public:
+    // Listens on `endpoint`, replacing a socket file a crashed broker left behind. Throws if
+    // another broker is already listening there.
+    explicit ProcessWatcherBroker(std::string const& endpoint = MakeEndpoint());
+    ~ProcessWatcherBroker();
+
+    ProcessWatcherBroker(ProcessWatcherBroker const&) = delete;
+    ProcessWatcherBroker& operator=(ProcessWatcherBroker const&) = delete;
+
+  public:
+    std::string const& GetEndpoint() const
+    {
+        return _endpoint;
+    }
+
+    size_t GetNumClients() const
+    {
+        return _numClients.load(std::memory_order_relaxed);
+    }
+
+    // May be called from any thread.
+    void Publish(ProcessEvent const* events, size_t numEvents);
+
+    // Serves subscribers on the calling thread until Stop() is called, or, after StopWhenIdle(),
+    // until no subscriber is left.
+    void Run();
+    void Stop();
+    void StopWhenIdle();
+
+  private:
+    void Wake();
+    void Apply(std::vector<ProcessEvent> const& batch);
+    void Attach(Client& client, ProcessWatcherSequence const& hello);
+    bool Receive(Client& client);
+    void Accept();
+    bool Flush(Client& client);
+    void Drop(size_t index);
+};
+
+// Keeps a core subscribed to a ProcessWatcherBroker. A dropped connection is retried within
+// milliseconds; if the broker still has the events that were missed they are replayed, otherwise,
+// e.g. after the hook was restarted, the difference to the new snapshot is reported as Running and
+// Stopped events. Either way the handler sees every change exactly once and in order. Like the
+// server side of a ProcessWatcherChannel, it can send heartbeats, which the broker answers, so a
+// broker that stopped serving or is gone for good can be told apart from one with nothing to
+// report. Heartbeats that come due while disconnected count as missed.
+class ProcessWatcherSubscriber
+{
+  public:
+    static constexpr std::chrono::milliseconds MinRetryDelay { 1 };
+    static constexpr std::chrono::milliseconds MaxRetryDelay { 100 };
+
+  private:
+    std::string                 _endpoint;
+    ProcessWatcherSocketHandler _handler;
+
+    std::mutex                _socketMtx;
+    intptr_t                  _socket;
+    bool                      _stopping;
+    std::condition_variable   _stopCv;
+    bool                      _attached;
+    bool                      _unreachable;
+    std::condition_variable   _attachCv;
+    std::vector<ProcessEvent> _snapshot;
+    std::atomic<size_t>       _numAttaches;
+
+    // Only touched by the receiving thread.
+    ProcessWatcherSequence                     _lastSequence;
+    std::unordered_map<uint32_t, ProcessEvent> _runningList;
+
+    // Heartbeat state, only touched by the receiving thread unless atomic. The miss handler is
+    // guarded by `_socketMtx`.
+    std::atomic<uint32_t> _heartbeatIntervalMs;
+    std::atomic<uint32_t> _missThreshold;
+    HeartbeatMissHandler  _missHandler;
+    int64_t               _nextHeartbeatNs;
+    uint64_t              _lastPing;
+    uint64_t              _lastPong;
+    LatencyHistogram      _roundTrip;
+    std::atomic<uint64_t> _numHeartbeats;
+    std::atomic<uint64_t> _numAnswered;
+    std::atomic<uint64_t> _numMissed;
+    std::atomic<uint32_t> _numConsecutiveMissed;
+
+    std::thread _recvThread;
+
+  public:
+    ProcessWatcherSubscriber(std::string const& endpoint, ProcessWatcherSocketHandler&& handler);
+    ~ProcessWatcherSubscriber();
+
+    ProcessWatcherSubscriber(ProcessWatcherSubscriber const&) = delete;
+    ProcessWatcherSubscriber& operator=(ProcessWatcherSubscriber const&) = delete;
+
+  public:
+    // Waits for the first attach and returns the processes running at that point. Their Running
+    // events are not passed to the handler, so this replaces a scan of its own. Returns false at
+    // once if the first attempt to connect failed, as there is most likely no broker at all.
+    bool WaitForSnapshot(std::vector<ProcessEvent>& snapshot, std::chrono::milliseconds timeout);
+
+    size_t GetNumAttaches() const
+    {
+        return _numAttaches.load(std::memory_order_relaxed);
+    }
+
+    // May be called at any time. Heartbeats are off until a config with a nonzero interval is set,
+    // and the miss handler is called from the receiving thread once `missThreshold` heartbeats in
+    // a row went unanswered. The broker does not beat on its own, so `numClientBeats` stays zero.
+    void                SetHeartbeatConfig(HeartbeatConfig config);
+    void                SetHeartbeatMissHandler(HeartbeatMissHandler&& handler);
+    HeartbeatStatistics GetHeartbeatStatistics() const;
+
+  private:
+    void     HandleIncomingData();
+    bool     Serve(intptr_t socket);
+    uint32_t Heartbeat(intptr_t socket);
+    void     ReceivePong(uint64_t pong);
+    void HandleSnapshot(ProcessWatcherSequence const&    sequence,
+                        std::vector<ProcessEvent> const& snapshot);
+    void HandleEvent(ProcessEvent const& event);
+};
+
+}
+
+#endif
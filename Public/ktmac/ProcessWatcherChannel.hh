@@ -0,0 +1,166 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_PROCESS_WATCHER_CHANNEL_HH
+#define KTMAC_PROCESS_WATCHER_CHANNEL_HH
+
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/ProcessEventSource.hh>
+#include <ktmac/ProcessWatcherSocket.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace ktmac
+{
+
+// A zero interval turns heartbeats off. A heartbeat counts as missed if it has not been answered
+// by the time the next one is due.
+struct HeartbeatConfig
+{
+    std::chrono::milliseconds interval;
+    uint32_t                  missThreshold;
+};
+
+// `roundTrip` runs from sending a heartbeat to taking in its answer. `numClientBeats` counts the
+// beats the client sends on its own, which keep coming even if no heartbeat reaches it.
+struct HeartbeatStatistics
+{
+    LatencyHistogramSnapshot roundTrip;
+    uint64_t                 numSent;
+    uint64_t                 numAnswered;
+    uint64_t                 numMissed;
+    uint32_t                 numConsecutiveMissed;
+    uint64_t                 numClientBeats;
+};
+
+using HeartbeatMissHandler = std::function<void(uint32_t numConsecutiveMissed)>;
+
+// Shared memory counterpart of ProcessWatcherSocket. Events are pushed into an SpscRing inside a
+// named shared memory block, and the receiving side only sleeps on a doorbell (a named event on
+// Windows, a futex on Linux) while the ring is empty, so a burst of events costs one wakeup. The
+// server also sends heartbeats, which the client answers from WaitUntilQuit(), so a client that
+// stopped working can be told apart from one that has nothing to report.
+class ProcessWatcherChannel
+{
+  private:
+    struct Block;
+
+    enum class ChannelType
+    {
+        Invalid,
+        Server,
+        Client
+    };
+
+  public:
+    static constexpr size_t RingSize  = 256;
+    static constexpr size_t BatchSize = 32;
+
+    // How often Heartbeat() asks to be called while heartbeats are off.
+    static constexpr uint32_t HeartbeatRecheckMs = 1000;
+
+  public:
+    // Name of the channel a server running as `serverProcessId` creates; a server that replaces
+    // its client creates the next `generation`, as the old client may still hold the old one.
+    static std::string MakeName(uint32_t serverProcessId, uint32_t generation = 0);
+    static ProcessWatcherChannel MakeServerChannel(std::string const&            name,
+                                                   ProcessWatcherSocketHandler&& handler);
+
+    // `server` is an optional handle to the server process; WaitUntilQuit() also returns when it
+    // exits. The channel takes ownership of it.
+    static ProcessWatcherChannel MakeClientChannel(std::string const& name, void* server = nullptr);
+
+  private:
+    std::string                 _name;
+    Block*                      _block;
+    void*                       _mapping;
+    void*                       _readyEvent;
+    void*                       _clientEvent;
+    void*                       _peer;
+    ChannelType                 _channelType;
+    ProcessWatcherSocketHandler _handler;
+    std::thread                 _recvThread;
+
+    // The ring has a single producer, but Send() may be called from several threads at once.
+    std::mutex _sendMtx;
+
+    // Heartbeat state, only touched by the thread running Heartbeat() unless atomic.
+    std::atomic<uint32_t> _heartbeatIntervalMs;
+    std::atomic<uint32_t> _missThreshold;
+    HeartbeatMissHandler  _missHandler;
+    int64_t               _nextHeartbeatNs;
+    uint64_t              _lastPing;
+    uint64_t              _lastPong;
+    uint64_t              _lastClientBeat;
+    LatencyHistogram      _roundTrip;
+    std::atomic<uint64_t> _numHeartbeats;
+    std::atomic<uint64_t> _numAnswered;
+    std::atomic<uint64_t> _numMissed;
+    std::atomic<uint32_t> _numConsecutiveMissed;
+    std::atomic<uint64_t> _numClientBeats;
+
+  public:
+    ~ProcessWatcherChannel();
+
+  private:
+    ProcessWatcherChannel(std::string const&            name,
+                          ChannelType                   channelType,
+                          void*                         peer    = nullptr,
+                          ProcessWatcherSocketHandler&& handler = nullptr);
+
+  public:
+    // Server side. Blocks until a client has opened the channel and then starts delivering events
+    // from a thread of its own or, if `receive` is false, from Poll(), which the caller runs
+    // whenever GetDoorbell() is signaled. Returns false if `client`, a handle to the client process
+    // the channel takes ownership of, exits first.
+    bool WaitForClient(void* client, bool receive = true);
+
+    // The auto-reset event a polled channel signals for every batch sent. Windows only; on Linux
+    // the doorbell is a futex and this returns null.
+    void* GetDoorbell() const
+    {
+        return _readyEvent;
+    }
+
+    // Delivers the events in the ring without blocking.
+    void Poll();
+
+    // Server side. Gives up on a client that stopped answering: the channel is closed, so the
+    // client quits if it ever recovers, the client is terminated if the system allows it, and the
+    // destructor no longer waits for it to exit.
+    void Abandon();
+
+    // Server side. May be changed at any time; the handler has to be set before WaitForClient().
+    void                SetHeartbeatConfig(HeartbeatConfig config);
+    void                SetHeartbeatMissHandler(HeartbeatMissHandler&& handler);
+    HeartbeatStatistics GetHeartbeatStatistics() const;
+
+    // Server side. Takes in the client's answers, sends a heartbeat if one is due and returns the
+    // milliseconds until the next. The receiving thread calls it on its own; the owner of a polled
+    // channel has to. The miss handler is called from here once `missThreshold` heartbeats in a
+    // row went unanswered.
+    uint32_t Heartbeat();
+
+    // Client side. Also answers heartbeats until the server closes the channel or exits.
+    void WaitUntilQuit();
+
+    // Blocks while the ring is full rather than dropping events. May be called from any thread.
+    void Send(ProcessEvent const* events, size_t numEvents);
+
+  private:
+    void HandleIncomingData();
+    void ReceiveHeartbeat();
+    bool HasHeartbeatNews() const;
+    void AnswerHeartbeat(int64_t& lastBeatNs);
+    void Close();
+};
+
+}
+
+#endif
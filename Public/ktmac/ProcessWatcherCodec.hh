@@ -0,0 +1,284 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_PROCESS_WATCHER_CODEC_HH
+#define KTMAC_PROCESS_WATCHER_CODEC_HH
+
+#include <ktmac/ProcessEventSource.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace ktmac
+{
+
+// Every frame starts with this header and is followed by `length` bytes of payload. Frame types a
+// peer does not know are skipped, so types can be added without a new version; the version only
+// changes when the layout of an existing frame does, and a mismatch is a protocol error.
+struct ProcessWatcherFrameHeader
+{
+    uint16_t magic;
+    uint8_t  version;
+    uint8_t  type;
+    uint32_t length;
+};
+
+static_assert(sizeof(ProcessWatcherFrameHeader) == 8, "The frame header must not have padding");
+
+enum class ProcessWatcherFrameType : uint8_t
+{
+    // A sequence of `ProcessEvent`s.
+    Events = 1,
+
+    // No payload. Sent by the server when it is shutting down.
+    Quit = 2,
+
+    // Sent by a broker subscriber right after connecting. The payload is the
+    // `ProcessWatcherSequence` of the last event it received, all zero on the first attach.
+    Hello = 3,
+
+    // A `ProcessWatcherSequence` followed by the `ProcessEvent`s of every running process. The
+    // sequence is that of the last event the snapshot reflects.
+    Snapshot = 4,
+
+    // A `ProcessWatcherSequence` followed by `ProcessEvent`s numbered consecutively from its
+    // sequence.
+    SequencedEvents = 5,
+
+    // Sent by a broker subscriber as a heartbeat. The payload is a `uint64_t` the broker echoes
+    // back in a Pong; its meaning is up to the subscriber.
+    Ping = 6,
+
+    // The answer of a broker to a Ping, with the same payload.
+    Pong = 7,
+};
+
+// A broker numbers its events from 1. `instanceId` tells brokers apart, so a subscriber never
+// resumes from a sequence number given out by a broker that has since been restarted.
+struct ProcessWatcherSequence
+{
+    uint64_t instanceId;
+    uint64_t sequence;
+};
+
+constexpr uint16_t ProcessWatcherFrameMagic      = 0x544B;
+constexpr uint8_t  ProcessWatcherProtocolVersion = 1;
+constexpr uint32_t ProcessWatcherMaxPayload      = 64 * 1024;
+
+// Appends frames to a buffer that is kept between uses, so that whatever is queued can be written
+// with a single call.
+class ProcessWatcherEncoder
+{
+  private:
+    static constexpr size_t MaxEventsPerFrame = ProcessWatcherMaxPayload / sizeof(ProcessEvent);
+    static constexpr size_t MaxEventsPerSequencedFrame
+        = (ProcessWatcherMaxPayload - sizeof(ProcessWatcherSequence)) / sizeof(ProcessEvent);
+
+  private:
+    std::vector<char> _buffer;
+
+  public:
+    char const* GetData() const
+    {
+        return _buffer.data();
+    }
+
+    size_t GetSize() const
+    {
+        return _buffer.size();
+    }
+
+    void Clear()
+    {
+        _buffer.clear();
+    }
+
+    // Splits `events` into as few frames as the payload limit allows.
+    void AddEvents(ProcessEvent const* events, size_t numEvents)
+    {
+        while (numEvents != 0)
+        {
+            size_t count = numEvents < MaxEventsPerFrame ? numEvents : MaxEventsPerFrame;
+            AddFrame(ProcessWatcherFrameType::Events, events, count * sizeof(ProcessEvent));
+            events += count;
+            numEvents -= count;
+        }
+    }
+
+    // Numbers `events` from `sequence.sequence`, splitting them like AddEvents(). Writes a frame
+    // even if there are no events, which tells a resuming subscriber it has missed nothing.
+    void AddSequencedEvents(ProcessWatcherSequence sequence,
+                            ProcessEvent const*    events,
+                            size_t                 numEvents)
+    {
+        do
+        {
+            size_t count = numEvents < MaxEventsPerSequencedFrame ? numEvents
+                                                                  : MaxEventsPerSequencedFrame;
+            AddFrame(ProcessWatcherFrameType::SequencedEvents,
+                     &sequence,
+                     sizeof sequence,
+                     events,
+                     count * sizeof(ProcessEvent));
+            sequence.sequence += count;
+            events += count;
+            numEvents -= count;
+        } while (numEvents != 0);
+    }
+
+    // A snapshot has to fit in one frame; processes past the limit are left out. Only a handful
+    // of processes are ever watched.
+    void AddSnapshot(ProcessWatcherSequence sequence, ProcessEvent const* events, size_t numEvents)
+    {
+        size_t count = numEvents < MaxEventsPerSequencedFrame ? numEvents
+                                                              : MaxEventsPerSequencedFrame;
+        AddFrame(ProcessWatcherFrameType::Snapshot,
+                 &sequence,
+                 sizeof sequence,
+                 events,
+                 count * sizeof(ProcessEvent));
+    }
+
+    void AddFrame(ProcessWatcherFrameType type, void const* payload, size_t length)
+    {
+        AddFrame(type, payload, length, nullptr, 0);
+    }
+
+  private:
+    // The payload is `prefix` followed by `payload`.
+    void AddFrame(ProcessWatcherFrameType type,
+                  void const*             prefix,
+                  size_t                  prefixLength,
+                  void const*             payload,
+                  size_t                  length)
+    {
+        ProcessWatcherFrameHeader header {
+            ProcessWatcherFrameMagic,
+            ProcessWatcherProtocolVersion,
+            (uint8_t)type,
+            (uint32_t)(prefixLength + length),
+        };
+
+        size_t offset = _buffer.size();
+        _buffer.resize(offset + sizeof header + prefixLength + length);
+
+        char* data = _buffer.data() + offset;
+        std::memcpy(data, &header, sizeof header);
+        if (prefixLength != 0)
+            std::memcpy(data + sizeof header, prefix, prefixLength);
+        if (length != 0)
+            std::memcpy(data + sizeof header + prefixLength, payload, length);
+    }
+};
+
+// Reassembles frames from a byte stream in a fixed buffer allocated once. Receive directly into
+// GetWriteBuffer(), then Commit() and Decode().
+class ProcessWatcherDecoder
+{
+  private:
+    std::vector<char> _buffer;
+    size_t            _begin;
+    size_t            _end;
+    uint32_t          _maxPayload;
+
+  public:
+    // Frames with a longer payload are rejected; a peer that only expects small frames can keep
+    // its buffer small.
+    explicit ProcessWatcherDecoder(uint32_t maxPayload = ProcessWatcherMaxPayload) :
+        _buffer(2 * (sizeof(ProcessWatcherFrameHeader) + maxPayload)),
+        _begin { 0 },
+        _end { 0 },
+        _maxPayload { maxPayload }
+    {}
+
+  public:
+    // Always leaves room for at least one whole frame.
+    char* GetWriteBuffer(size_t& size)
+    {
+        size_t maxFrameSize = sizeof(ProcessWatcherFrameHeader) + _maxPayload;
+        if (_begin != 0 && _buffer.size() - _end < maxFrameSize)
+        {
+            std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+            _end -= _begin;
+            _begin = 0;
+        }
+
+        size = _buffer.size() - _end;
+        return _buffer.data() + _end;
+    }
+
+    void Commit(size_t size)
+    {
+        _end += size;
+    }
+
+    // Calls `handler(type, payload, length)` for every complete frame. Returns false if the stream
+    // is not a valid one, after which the connection should be dropped.
+    template <typename Handler>
+    bool Decode(Handler&& handler)
+    {
+        while (_end - _begin >= sizeof(ProcessWatcherFrameHeader))
+        {
+            ProcessWatcherFrameHeader header;
+            std::memcpy(&header, _buffer.data() + _begin, sizeof header);
+            if (header.magic != ProcessWatcherFrameMagic
+                || header.version != ProcessWatcherProtocolVersion
+                || header.length > _maxPayload)
+                return false;
+
+            size_t frameSize = sizeof header + header.length;
+            if (_end - _begin < frameSize)
+                break;
+
+            char const* payload = _buffer.data() + _begin + sizeof header;
+            _begin += frameSize;
+            if (!handler((ProcessWatcherFrameType)header.type, payload, header.length))
+                return false;
+        }
+
+        if (_begin == _end)
+            _begin = _end = 0;
+
+        return true;
+    }
+
+  public:
+    // Payloads are not aligned, so every event is copied out before it is handed over.
+    template <typename Handler>
+    static bool ForEachEvent(char const* payload, uint32_t length, Handler&& handler)
+    {
+        if (length % sizeof(ProcessEvent) != 0)
+            return false;
+
+        for (uint32_t offset = 0; offset < length; offset += sizeof(ProcessEvent))
+        {
+            ProcessEvent event;
+            std::memcpy(&event, payload + offset, sizeof event);
+            handler(event);
+        }
+        return true;
+    }
+
+    // For Snapshot and SequencedEvents payloads.
+    template <typename Handler>
+    static bool ForEachSequencedEvent(char const*             payload,
+                                      uint32_t                length,
+                                      ProcessWatcherSequence& sequence,
+                                      Handler&&               handler)
+    {
+        if (length < sizeof sequence)
+            return false;
+
+        std::memcpy(&sequence, payload, sizeof sequence);
+        return ForEachEvent(payload + sizeof sequence,
+                            length - (uint32_t)sizeof sequence,
+                            std::forward<Handler>(handler));
+    }
+};
+
+}
+
+#endif
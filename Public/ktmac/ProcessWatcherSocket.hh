@@ -4,18 +4,30 @@
 #ifndef KTMAC_PROCESS_WATCHER_SOCKET_HH
 #define KTMAC_PROCESS_WATCHER_SOCKET_HH
 
+#include <ktmac/ProcessEventSource.hh>
+#include <ktmac/ProcessWatcherCodec.hh>
 #include <ktmac/ProcessWatcherMessage.hh>
 
 #include <cstdint>
 #include <functional>
+#include <mutex>
+#include <string>
 #include <thread>
 
 namespace ktmac
 {
 
-using ProcessWatcherSocketHandler
-    = std::function<void(ProcessWatcherMessage message, uint32_t processId)>;
+using ProcessWatcherSocketHandler = std::function<void(ProcessEvent const& event)>;
 
+// Starts ktmac-process-hook.exe elevated with `arguments` and returns its process handle, or null
+// if it could not be started, e.g. because the user declined the elevation prompt.
+void* LaunchProcessHook(char const* arguments);
+
+// Speaks the framed protocol in ProcessWatcherCodec.hh over an AF_UNIX stream socket, which Windows
+// supports since Windows 10 version 1803. Every server listens on an endpoint of its own, a socket
+// file in the user's temporary directory, and removes it once its client has connected, so neither
+// another instance nor any other program can take it, and nothing is reachable over the network.
+// InitializeWinSock() and UninitializeWinSock() do nothing on other systems.
 class ProcessWatcherSocket
 {
   private:
@@ -27,32 +39,50 @@ class ProcessWatcherSocket
     };
 
   public:
-    static bool                 InitializeWinSock();
-    static void                 UninitializeWinSock();
-    static ProcessWatcherSocket MakeServerSocket(int                           portNumber,
+    static bool InitializeWinSock();
+    static void UninitializeWinSock();
+
+    // A path no other server uses. The server passes it to the client on its command line.
+    static std::string MakeEndpoint(uint32_t serverProcessId);
+
+    // Only listens; WaitForClient() accepts.
+    static ProcessWatcherSocket MakeServerSocket(std::string const&            endpoint,
                                                  ProcessWatcherSocketHandler&& handler);
-    static ProcessWatcherSocket MakeClientSocket(int portNumber);
+    static ProcessWatcherSocket MakeClientSocket(std::string const& endpoint);
 
   private:
+    std::string                 _endpoint;
+    intptr_t                    _listener;
+    intptr_t                    _socket;
     void*                       _client;
-    void*                       _socket;
     SocketType                  _socketType;
     ProcessWatcherSocketHandler _handler;
+    std::mutex                  _sendMtx;
+    ProcessWatcherEncoder       _encoder;
     std::thread                 _recvThread;
 
   public:
     ~ProcessWatcherSocket();
 
   private:
-    ProcessWatcherSocket(void*                         socket,
+    ProcessWatcherSocket(std::string const&            endpoint,
+                         intptr_t                      listener,
+                         intptr_t                      socket,
                          SocketType                    socketType,
-                         void*                         client  = nullptr,
                          ProcessWatcherSocketHandler&& handler = nullptr);
 
   public:
+    // Server side. Accepts the client and starts receiving from it. `client` is an optional handle
+    // to the client process the socket takes ownership of; if it exits before connecting, this
+    // returns false. The endpoint is removed either way.
+    bool WaitForClient(void* client);
+
     void WaitUntilQuit();
     void Send(ProcessWatcherMessage message, uint32_t processId);
 
+    // Writes every event with a single send() call, in as few frames as possible.
+    void Send(ProcessEvent const* events, size_t numEvents);
+
   private:
     void HandleIncomingData();
 };
@@ -0,0 +1,105 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_PROCFS_PROCESS_WATCHER_HH
+#define KTMAC_PROCFS_PROCESS_WATCHER_HH
+
+#include <ktmac/ProcessEventSource.hh>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ktmac
+{
+
+struct ProcfsWatcherConfig
+{
+    // How often /proc is scanned for new processes.
+    std::chrono::milliseconds scanInterval;
+
+    // A forked child keeps its parent's name until it calls exec(), so a process that does not
+    // match is looked at again until it is this old.
+    std::chrono::milliseconds recheckWindow;
+
+    // Detect exits through pidfd + epoll. Otherwise tracked processes are checked on every scan.
+    bool usePidfd;
+};
+
+// Linux backend: finds new processes by scanning /proc and compares their `comm` with the process
+// names, which the kernel truncates to 15 characters. Each scan is reported as one batch, as are
+// the exits found in one wakeup. The parent process ID and the start time come from
+// /proc/<pid>/stat; the image name is the name in the list that matched.
+class ProcfsProcessWatcher : public ProcessEventSource
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr ProcfsWatcherConfig DefaultConfig {
+        std::chrono::milliseconds { 10 },
+        std::chrono::milliseconds { 200 },
+        true,
+    };
+
+  private:
+    enum class Kind
+    {
+        Candidate,
+        Tracked,
+        Exited,
+        Ignored,
+    };
+
+    struct Known
+    {
+        Kind              kind;
+        int               pidfd;
+        Clock::time_point firstSeen;
+        uint64_t          lastScan;
+        ProcessEvent      event;
+    };
+
+  private:
+    std::vector<std::string> _processNameList;
+    std::vector<std::string> _commList;
+    ProcfsWatcherConfig      _config;
+
+    int _epoll;
+    int _wakeup;
+
+    std::unordered_map<int, Known> _knownList;
+    uint64_t                       _numScans;
+    std::vector<ProcessEvent>      _batch;
+
+    std::thread _thread;
+
+  public:
+    ProcfsProcessWatcher(std::vector<std::string>&& processNameList,
+                         ProcessEventBatchHandler&& batchHandler,
+                         ProcfsWatcherConfig        config = DefaultConfig);
+    ~ProcfsProcessWatcher();
+
+    ProcfsProcessWatcher(ProcfsProcessWatcher const&) = delete;
+    ProcfsProcessWatcher& operator=(ProcfsProcessWatcher const&) = delete;
+
+  public:
+    virtual char const* GetName() const override
+    {
+        return _config.usePidfd ? "procfs+pidfd" : "procfs";
+    }
+
+  private:
+    void Run();
+    void Scan(bool initial);
+    bool Track(int processId, Known& known);
+    void Stop(int processId);
+    bool Matches(int processId, ProcessEvent& event) const;
+    void Flush();
+};
+
+}
+
+#endif
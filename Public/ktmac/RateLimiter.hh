@@ -0,0 +1,95 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_RATE_LIMITER_HH
+#define KTMAC_RATE_LIMITER_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace ktmac
+{
+
+// A limit of zero messages per second disables the bucket.
+struct RateLimit
+{
+    double   messagesPerSecond;
+    uint32_t burst;
+};
+
+// Token levels can be negative while deferred sends are waiting for their turn.
+struct RateLimiterLevels
+{
+    double globalTokens;
+    double roomTokens;
+};
+
+// Lock-free token buckets implemented with GCRA: each bucket is a single atomic "theoretical
+// arrival time", so reserving a token is one compare-and-swap and never blocks other senders.
+class RateLimiter
+{
+  public:
+    using Clock     = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    static constexpr size_t MaxRooms = 64;
+
+  private:
+    struct Limit
+    {
+        std::atomic<int64_t> interval;
+        std::atomic<int64_t> burst;
+    };
+
+    struct Bucket
+    {
+        std::atomic<int64_t> theoreticalArrivalTime;
+    };
+
+    struct RoomSlot
+    {
+        std::atomic<uintptr_t> room;
+        Bucket                 bucket;
+    };
+
+  private:
+    static void      StoreLimit(Limit& limit, RateLimit newLimit);
+    static RateLimit LoadLimit(Limit const& limit);
+    static int64_t   Reserve(Bucket& bucket, Limit const& limit, int64_t arrival);
+    static double    GetTokens(Bucket const& bucket, Limit const& limit, int64_t now);
+
+  private:
+    Limit                          _globalLimit;
+    Limit                          _roomLimit;
+    Bucket                         _globalBucket;
+    std::array<RoomSlot, MaxRooms> _rooms;
+
+  public:
+    RateLimiter(RateLimit globalLimit = {}, RateLimit roomLimit = {});
+
+  public:
+    void      SetGlobalLimit(RateLimit limit);
+    void      SetRoomLimit(RateLimit limit);
+    RateLimit GetGlobalLimit() const;
+    RateLimit GetRoomLimit() const;
+
+    // Reserves a token from the room bucket and the global bucket and returns the time at which
+    // the send may happen. Reservations are never refused; over-budget sends are scheduled later.
+    TimePoint Reserve(uintptr_t room);
+
+    // Reserves a token and sleeps until the send is allowed.
+    void Acquire(uintptr_t room);
+
+    RateLimiterLevels GetLevels(uintptr_t room) const;
+
+  private:
+    Bucket&       FindRoomBucket(uintptr_t room, int64_t now);
+    Bucket const* FindRoomBucket(uintptr_t room) const;
+};
+
+}
+
+#endif
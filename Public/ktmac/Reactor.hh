@@ -0,0 +1,122 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_REACTOR_HH
+#define KTMAC_REACTOR_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ktmac
+{
+
+// Serves every event source of a component from the one thread calling Run(): waitable handles,
+// file descriptors on Linux, the window messages of that thread on Windows, and work posted from
+// other threads. Handlers run one at a time, so the state they share needs no locking among
+// themselves, and posted work runs in the order it was posted. Sources are level-triggered; on
+// Windows they are usually auto-reset events. Either way a handler has to consume whatever made its
+// source ready.
+class Reactor
+{
+  public:
+    using Handler = std::function<void()>;
+
+    // Returns the delay until the timer is to run again, or StopTimer.
+    using TimerHandler = std::function<std::chrono::milliseconds()>;
+
+    // Returned by a timer handler that is not to run again.
+    static constexpr std::chrono::milliseconds StopTimer { -1 };
+
+    // MsgWaitForMultipleObjectsEx() takes at most MAXIMUM_WAIT_OBJECTS - 1 handles, one of which
+    // is the work queue's.
+    static constexpr size_t MaxSources = 62;
+
+  private:
+    // Shared, so a handler that removes its own source is not destroyed while it runs.
+    struct Source
+    {
+        intptr_t                 handle;
+        std::shared_ptr<Handler> handler;
+    };
+
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point deadline;
+        std::shared_ptr<TimerHandler>         handler;
+    };
+
+  private:
+    intptr_t _workEvent;
+    intptr_t _poller;
+
+    std::vector<Source> _sourceList;
+    std::atomic<size_t> _numSources;
+    std::vector<Timer>  _timerList;
+
+    std::mutex           _workMtx;
+    std::vector<Handler> _workList;
+    std::vector<Handler> _runList;
+    std::atomic<bool>    _workPending;
+    bool                 _stopping;
+
+    std::atomic<std::thread::id> _threadId;
+    std::atomic<uint64_t>        _numWakeups;
+
+  public:
+    Reactor();
+    ~Reactor();
+
+    Reactor(Reactor const&) = delete;
+    Reactor& operator=(Reactor const&) = delete;
+
+  public:
+    // May be called from any thread. On the reactor thread they take effect at once, elsewhere in
+    // order with posted work. AddSource() fails once MaxSources are registered. On Linux, a source
+    // removed while its readiness was already reported may still see one call if its descriptor
+    // number is reused right away.
+    bool AddSource(intptr_t handle, Handler&& handler);
+    void RemoveSource(intptr_t handle);
+
+    // Runs `handler` after `delay`, and again after every delay it returns. May be called from any
+    // thread.
+    void AddTimer(std::chrono::milliseconds delay, TimerHandler&& handler);
+
+    // May be called from any thread. Work runs in the order it was posted.
+    void Post(Handler&& work);
+
+    // Dispatches on the calling thread until Stop() or, on Windows, WM_QUIT.
+    void Run();
+
+    // Work posted before the call still runs.
+    void Stop();
+
+    bool IsReactorThread() const
+    {
+        return _threadId.load(std::memory_order_relaxed) == std::this_thread::get_id();
+    }
+
+    // Returns from the wait, each of which may dispatch any number of handlers.
+    uint64_t GetNumWakeups() const
+    {
+        return _numWakeups.load(std::memory_order_relaxed);
+    }
+
+  private:
+    void RunWork();
+    void Dispatch(intptr_t handle);
+    void RunTimers();
+    int  GetTimeout() const;
+    void Register(intptr_t handle, std::shared_ptr<Handler> const& handler);
+    void Unregister(intptr_t handle);
+};
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_SPSC_RING_HH
+#define KTMAC_SPSC_RING_HH
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+namespace ktmac
+{
+
+// Bounded wait-free queue for exactly one producer thread and one consumer thread. Each side keeps
+// a private copy of the other side's index and only reloads it when the ring looks full or empty,
+// so the shared cache lines are touched once per batch rather than once per element.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+  private:
+    static constexpr size_t CacheLineSize = 64;
+    static constexpr size_t Mask          = Capacity - 1;
+
+  private:
+    alignas(CacheLineSize) std::atomic<size_t> _head;
+    size_t _cachedTail;
+
+    alignas(CacheLineSize) std::atomic<size_t> _tail;
+    size_t _cachedHead;
+
+    alignas(CacheLineSize) T _buffer[Capacity];
+
+  public:
+    SpscRing() : _head { 0 }, _cachedTail { 0 }, _tail { 0 }, _cachedHead { 0 }, _buffer {} {}
+
+    SpscRing(SpscRing const&) = delete;
+    SpscRing& operator=(SpscRing const&) = delete;
+
+  public:
+    // Producer side. Returns false without blocking if the ring is full.
+    bool TryPush(T const& value)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _cachedHead == Capacity)
+        {
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if (tail - _cachedHead == Capacity)
+                return false;
+        }
+
+        _buffer[tail & Mask] = value;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Moves up to `maxCount` elements into `out` and returns how many were moved.
+    size_t PopBatch(T* out, size_t maxCount)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (_cachedTail == head)
+        {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if (_cachedTail == head)
+                return 0;
+        }
+
+        size_t count = _cachedTail - head;
+        if (count > maxCount)
+            count = maxCount;
+
+        for (size_t i = 0; i < count; ++i) out[i] = _buffer[(head + i) & Mask];
+        _head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    bool TryPop(T& out)
+    {
+        return PopBatch(&out, 1) == 1;
+    }
+
+    // Exact only when called from the consumer thread with the producer idle; otherwise a hint.
+    bool IsEmpty() const
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+};
+
+}
+
+#endif
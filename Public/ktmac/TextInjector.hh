@@ -0,0 +1,110 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_TEXT_INJECTOR_HH
+#define KTMAC_TEXT_INJECTOR_HH
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ktmac
+{
+
+// Every method reaches an edit control in another process. EM_STREAMIN is not offered, as the
+// system does not marshal its callback pointer across processes.
+enum class TextInjectionMethod
+{
+    SetText,
+    ReplaceSelection,
+    ClipboardPaste,
+};
+
+enum class TextInjectionResult
+{
+    Succeeded,
+    Failed,
+    TimedOut,
+};
+
+class TextInjector
+{
+  public:
+    virtual ~TextInjector() = default;
+
+  public:
+    virtual char const* GetName() const = 0;
+
+    // `window` is the target edit control and `text` is null-terminated at `text[length]`. Each
+    // synchronous window call made by the injector waits at most `timeoutMs` milliseconds.
+    virtual TextInjectionResult Inject(void*          window,
+                                       wchar_t const* text,
+                                       size_t         length,
+                                       uint32_t       timeoutMs)
+        = 0;
+};
+
+std::unique_ptr<TextInjector> MakeTextInjector(TextInjectionMethod method);
+
+// Picks an injector by message length. Each injector covers lengths from its own minimum up to the
+// next injector's minimum.
+class TextInjectorSelector
+{
+  private:
+    struct Entry
+    {
+        size_t                        minLength;
+        std::unique_ptr<TextInjector> injector;
+    };
+
+  private:
+    std::vector<Entry> _entryList;
+
+  public:
+    void Set(size_t minLength, std::unique_ptr<TextInjector>&& injector)
+    {
+        auto it = std::lower_bound(_entryList.begin(),
+                                   _entryList.end(),
+                                   minLength,
+                                   [](Entry const& entry, size_t length) {
+                                       return entry.minLength < length;
+                                   });
+
+        if (it != _entryList.end() && it->minLength == minLength)
+        {
+            if (injector)
+                it->injector = std::move(injector);
+            else
+                _entryList.erase(it);
+        }
+        else if (injector)
+            _entryList.insert(it, Entry { minLength, std::move(injector) });
+    }
+
+    TextInjector* Select(size_t length) const
+    {
+        auto it = std::upper_bound(_entryList.begin(),
+                                   _entryList.end(),
+                                   length,
+                                   [](size_t length, Entry const& entry) {
+                                       return length < entry.minLength;
+                                   });
+        if (it == _entryList.begin())
+            return nullptr;
+
+        return std::prev(it)->injector.get();
+    }
+
+    void Clear()
+    {
+        _entryList.clear();
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_WINDOW_EVENT_ORDER_HH
+#define KTMAC_WINDOW_EVENT_ORDER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+namespace ktmac
+{
+
+// Decides which window events arriving out of order are stale. Events are applied one at a time,
+// so an older event is only superseded by a newer one for the same window: an old DESTROY of one
+// window still has to be applied after a newer SHOW of another. A resync reflects every window at
+// once, so nothing older than it is applied afterwards. Times are tick counts in milliseconds and
+// may wrap around.
+class WindowEventOrder
+{
+  public:
+    // The windows with the oldest events are forgotten past this; KakaoTalk only has a few dozen.
+    static constexpr size_t Capacity = 256;
+
+    // Events are never this far out of order. One that seems older by more is newer, and either
+    // the tick count wrapped around or the window was last heard of long ago.
+    static constexpr uint32_t MaxReorderMs = 60 * 1000;
+
+  private:
+    static bool IsBefore(uint32_t timeMs, uint32_t appliedMs)
+    {
+        uint32_t lagMs = appliedMs - timeMs;
+        return lagMs != 0 && lagMs < MaxReorderMs;
+    }
+
+  private:
+    std::unordered_map<uintptr_t, uint32_t> _appliedList;
+    bool                                    _resynced;
+    uint32_t                                _resyncTimeMs;
+
+  public:
+    WindowEventOrder() : _appliedList {}, _resynced { false }, _resyncTimeMs { 0 } {}
+
+  public:
+    // Returns false if the event is stale, and records it as applied otherwise.
+    bool Admit(uintptr_t window, uint32_t timeMs)
+    {
+        if (_resynced && IsBefore(timeMs, _resyncTimeMs))
+            return false;
+
+        auto it = _appliedList.find(window);
+        if (it != _appliedList.end())
+        {
+            if (IsBefore(timeMs, it->second))
+                return false;
+            it->second = timeMs;
+            return true;
+        }
+
+        if (_appliedList.size() >= Capacity)
+            ForgetOldest();
+        _appliedList.emplace(window, timeMs);
+        return true;
+    }
+
+    void Resync(uint32_t timeMs)
+    {
+        _appliedList.clear();
+        _resynced     = true;
+        _resyncTimeMs = timeMs;
+    }
+
+    size_t GetNumWindows() const
+    {
+        return _appliedList.size();
+    }
+
+  private:
+    void ForgetOldest()
+    {
+        auto oldest = _appliedList.begin();
+        for (auto it = _appliedList.begin(); it != _appliedList.end(); ++it)
+        {
+            if ((int32_t)(it->second - oldest->second) < 0)
+                oldest = it;
+        }
+        _appliedList.erase(oldest);
+    }
+};
+
+}
+
+#endif
@@ -12,6 +12,9 @@
 
 #include <Windows.h>
 
+#include <cstddef>
+#include <cstdint>
+
 namespace ktmac
 {
 
@@ -19,12 +22,66 @@ using HookEventContext = void*;
 
 using HookEventHandler = void (*)(HookEventContext context, HWND window, DWORD event);
 
-KTMAC_WINDOW_HOOK_PUBLIC HWINEVENTHOOK HookStart(DWORD            processId,
-                                                 HookEventHandler handler,
-                                                 HookEventContext context);
+// Everything WinEventProc is told about an event. Only top-level window events are forwarded, so
+// `objectId` and `childId` are OBJID_WINDOW and CHILDID_SELF today; `eventTimeMs` is on the
+// GetTickCount() clock.
+struct HookEventRecord
+{
+    DWORD event;
+    HWND  window;
+    LONG  objectId;
+    LONG  childId;
+    DWORD eventThread;
+    DWORD eventTimeMs;
+};
+
+using HookEventRecordHandler = void (*)(HookEventContext context, HookEventRecord const& record);
+
+constexpr DWORD HookEventCreate  = 1 << 0;
+constexpr DWORD HookEventDestroy = 1 << 1;
+constexpr DWORD HookEventShow    = 1 << 2;
+constexpr DWORD HookEventHide    = 1 << 3;
+constexpr DWORD HookEventAll     = HookEventCreate | HookEventDestroy | HookEventShow | HookEventHide;
+
+constexpr size_t HookFilterMaxClassNames = 4;
+constexpr size_t HookFilterMaxWindows    = 8;
+
+// An event is forwarded only if its kind is in `events` and its window is either one of `windows`
+// or has one of `classNames` as its class. Unused entries are null.
+struct HookFilter
+{
+    DWORD       events;
+    char const* classNames[HookFilterMaxClassNames];
+    HWND        windows[HookFilterMaxWindows];
+};
+
+struct HookStatistics
+{
+    uint64_t numForwarded;
+    uint64_t numDropped;
+};
+
+// Without a filter, every event between EVENT_OBJECT_CREATE and EVENT_OBJECT_HIDE is forwarded.
+// With one, the hook only covers the event kinds the filter asks for.
+KTMAC_WINDOW_HOOK_PUBLIC HWINEVENTHOOK HookStart(DWORD             processId,
+                                                 HookEventHandler  handler,
+                                                 HookEventContext  context,
+                                                 HookFilter const* filter = nullptr);
+
+KTMAC_WINDOW_HOOK_PUBLIC HWINEVENTHOOK HookStart(DWORD                  processId,
+                                                 HookEventRecordHandler handler,
+                                                 HookEventContext       context,
+                                                 HookFilter const*      filter = nullptr);
 
 KTMAC_WINDOW_HOOK_PUBLIC void HookStop(HWINEVENTHOOK hook);
 
+// Replaces the windows of interest of a filtered hook.
+KTMAC_WINDOW_HOOK_PUBLIC bool HookSetWindows(HWINEVENTHOOK hook,
+                                             HWND const*   windows,
+                                             size_t        numWindows);
+
+KTMAC_WINDOW_HOOK_PUBLIC bool HookGetStatistics(HWINEVENTHOOK hook, HookStatistics* statistics);
+
 }
 
-#endif
\ No newline at end of file
+#endif
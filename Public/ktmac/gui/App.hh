@@ -6,6 +6,10 @@
 
 #include <include/cef_app.h>
 
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
 namespace ktmac::gui
 {
 
@@ -28,11 +32,18 @@ class App :
         return this;
     }
 
+    virtual void OnBeforeCommandLineProcessing(const CefString&          processType,
+                                               CefRefPtr<CefCommandLine> commandLine) override;
+    virtual void OnRegisterCustomSchemes(CefRawPtr<CefSchemeRegistrar> registrar) override;
+
     virtual void                 OnContextInitialized() override;
     virtual CefRefPtr<CefClient> GetDefaultClient() override;
     virtual void                 OnContextCreated(CefRefPtr<CefBrowser>   browser,
                                                   CefRefPtr<CefFrame>     frame,
                                                   CefRefPtr<CefV8Context> context) override;
+    virtual void                 OnContextReleased(CefRefPtr<CefBrowser>   browser,
+                                                   CefRefPtr<CefFrame>     frame,
+                                                   CefRefPtr<CefV8Context> context) override;
     virtual bool                 Execute(const CefString&       name,
                                          CefRefPtr<CefV8Value>  object,
                                          const CefV8ValueList&  arguments,
@@ -43,9 +54,44 @@ class App :
                                                           CefProcessId                 source_process,
                                                           CefRefPtr<CefProcessMessage> message) override;
 
+  private:
+    // A call from the page waiting for the browser process to reply.
+    struct PendingRequest
+    {
+        CefRefPtr<CefV8Context>               context;
+        CefRefPtr<CefV8Value>                 resolve;
+        std::chrono::steady_clock::time_point start;
+        bool                                  batch;
+    };
+
+  private:
+    void                  DeliverState();
+    CefRefPtr<CefV8Value> MakePromise(int requestId, bool batch);
+    CefRefPtr<CefV8Value> SendMessages(CefRefPtr<CefListValue> messageList, bool batch);
+    bool                  EnterRequest(int requestId, PendingRequest& request);
+    void                  ResolveSendResult(CefRefPtr<CefListValue> arguments);
+    void                  ResolveCurrentState(CefRefPtr<CefListValue> arguments);
+    void                  ResolveStartupTimings(CefRefPtr<CefListValue> arguments);
+
   private:
     CefRefPtr<CefBrowser> _browser;
 
+    // Renderer side. Each call returning a Promise keeps its resolve function until the reply
+    // arrives. The function making them is compiled once per context.
+    CefRefPtr<CefV8Context>                 _promiseContext;
+    CefRefPtr<CefV8Value>                   _makePromise;
+    std::unordered_map<int, PendingRequest> _pendingList;
+    int                                     _nextRequestId = 0;
+
+    // Renderer side. State changes call the function the page registered with
+    // ktmacOnStateChange() directly, with one V8 string per state built once per context, rather
+    // than compiling a script for every change.
+    CefRefPtr<CefV8Context>                                _stateContext;
+    CefRefPtr<CefV8Value>                                  _stateCallback;
+    std::unordered_map<std::string, CefRefPtr<CefV8Value>> _stateValueList;
+    CefV8ValueList                                         _stateArguments;
+    std::string                                            _lastState;
+
   private:
     IMPLEMENT_REFCOUNTING(ktmac::gui::App);
 };
@@ -0,0 +1,25 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_GUI_ASSET_SCHEME_HH
+#define KTMAC_GUI_ASSET_SCHEME_HH
+
+#include <include/cef_scheme.h>
+
+namespace ktmac::gui
+{
+
+// The GUI is served from the asset bundle under this origin, e.g. ktmac://app/View.html.
+constexpr char const AssetScheme[] = "ktmac";
+constexpr char const AssetDomain[] = "app";
+constexpr char const AssetOrigin[] = "ktmac://app/";
+
+// Must be called in every process, from CefApp::OnRegisterCustomSchemes().
+void AddAssetScheme(CefRawPtr<CefSchemeRegistrar> registrar);
+
+// Must be called in the browser process once CEF is initialized.
+void RegisterAssetSchemeHandler();
+
+}
+
+#endif
@@ -6,7 +6,14 @@
 
 #include <include/cef_client.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 class SimpleHandler :
     public CefClient,
@@ -14,6 +21,15 @@ class SimpleHandler :
     public CefLifeSpanHandler,
     public CefLoadHandler
 {
+  private:
+    struct SendJob
+    {
+        CefRefPtr<CefFrame>                   frame;
+        int                                   request_id;
+        std::vector<CefString>                message_list;
+        std::chrono::steady_clock::time_point start;
+    };
+
   public:
     explicit SimpleHandler(bool use_views);
     ~SimpleHandler();
@@ -69,9 +85,19 @@ class SimpleHandler :
                                           CefProcessId                 source_process,
                                           CefRefPtr<CefProcessMessage> message);
 
-    void NotifyStateChange(const char* state);
+    // May be called from any thread. Sends the state to every browser on the CEF UI thread; of the
+    // changes made before that happens, only the latest is sent.
+    static void NotifyStateChange(const char* state);
 
   private:
+    static void FlushStateChange();
+    void        SendStateChange(CefRefPtr<CefBrowser> browser, const char* state);
+
+    // Sends the batches in order on a thread of their own, as each message may wait for the rate
+    // limiter and for KakaoTalk, and replies to the renderer from the CEF UI thread.
+    void        RunSends();
+    static void SendReply(CefRefPtr<CefFrame> frame, CefRefPtr<CefProcessMessage> reply);
+
     // Platform-specific implementation.
     void PlatformTitleChange(CefRefPtr<CefBrowser> browser, const CefString& title);
 
@@ -84,6 +110,17 @@ class SimpleHandler :
 
     bool is_closing_;
 
+    // The state last sent to each browser, by identifier, and the message sending it. Only
+    // accessed on the CEF UI thread.
+    std::unordered_map<int, const char*> sent_state_list_;
+    CefRefPtr<CefProcessMessage>         state_message_;
+
+    std::mutex              send_mtx_;
+    std::condition_variable send_cv_;
+    std::deque<SendJob>     send_job_list_;
+    bool                    send_stopping_;
+    std::thread             send_thread_;
+
     // Include the default reference counting implementation.
     IMPLEMENT_REFCOUNTING(SimpleHandler);
 };
@@ -0,0 +1,25 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_GUI_LEAN_MODE_HH
+#define KTMAC_GUI_LEAN_MODE_HH
+
+#include <include/cef_command_line.h>
+
+namespace ktmac::gui
+{
+
+// Started with --lean, ktmac runs CEF with what a 300x150 page needs and no more, and the window
+// starts minimized, with its browser created only once it is first restored.
+constexpr char const LeanModeSwitch[] = "lean";
+
+// The V8 heap of the renderer is capped at this many megabytes in the lean mode.
+constexpr int LeanModeHeapLimitMb = 32;
+
+// Must be called from CefApp::OnBeforeCommandLineProcessing() of the browser process, which passes
+// what the child processes need on to them.
+void AddLeanModeSwitches(CefRefPtr<CefCommandLine> commandLine);
+
+}
+
+#endif
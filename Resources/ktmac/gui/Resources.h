@@ -1,5 +1,5 @@
 // Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
 // Licensed under the MIT License.
 
-#define KTMAC_RESTYPE_HTML 256
-#define KTMAC_RES_VIEW_HTML 101
+#define KTMAC_RESTYPE_ASSETS 256
+#define KTMAC_RES_ASSETS 101
@@ -0,0 +1,1218 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ControlServer.hh>
+
+#include "SocketUtils.hh"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+using namespace ktmac::sockets;
+
+// Headers larger than this are refused.
+constexpr size_t MaxHeaderBytes = 8192;
+
+constexpr uint8_t ContinuationFrame = 0x0;
+constexpr uint8_t TextFrame         = 0x1;
+constexpr uint8_t BinaryFrame       = 0x2;
+constexpr uint8_t CloseFrame        = 0x8;
+constexpr uint8_t PingFrame         = 0x9;
+constexpr uint8_t PongFrame         = 0xA;
+
+constexpr uint16_t ProtocolError   = 1002;
+constexpr uint16_t UnsupportedData = 1003;
+constexpr uint16_t MessageTooBig   = 1009;
+
+uint32_t RotateLeft(uint32_t value, int count)
+{
+    return (value << count) | (value >> (32 - count));
+}
+
+std::array<uint8_t, 20> Sha1(std::string_view data)
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    std::string message { data };
+    uint64_t    numBits = (uint64_t)data.size() * 8;
+    message += (char)0x80;
+    while (message.size() % 64 != 56) message += '\0';
+    for (int i = 7; i >= 0; --i) message += (char)(uint8_t)(numBits >> (i * 8));
+
+    for (size_t chunk = 0; chunk < message.size(); chunk += 64)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i)
+        {
+            auto bytes = (uint8_t const*)message.data() + chunk + i * 4;
+            w[i] = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8
+                   | (uint32_t)bytes[3];
+        }
+        for (int i = 16; i < 80; ++i)
+            w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i)
+        {
+            uint32_t f, k;
+            if (i < 20)
+                f = (b & c) | (~b & d), k = 0x5A827999;
+            else if (i < 40)
+                f = b ^ c ^ d, k = 0x6ED9EBA1;
+            else if (i < 60)
+                f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+            else
+                f = b ^ c ^ d, k = 0xCA62C1D6;
+
+            uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+            e             = d;
+            d             = c;
+            c             = RotateLeft(b, 30);
+            b             = a;
+            a             = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    std::array<uint8_t, 20> digest;
+    for (int i = 0; i < 20; ++i) digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+    return digest;
+}
+
+std::string EncodeBase64(uint8_t const* data, size_t size)
+{
+    static constexpr char Alphabet[]
+        = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string encoded;
+    for (size_t i = 0; i < size; i += 3)
+    {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < size)
+            group |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < size)
+            group |= data[i + 2];
+
+        encoded += Alphabet[(group >> 18) & 0x3F];
+        encoded += Alphabet[(group >> 12) & 0x3F];
+        encoded += i + 1 < size ? Alphabet[(group >> 6) & 0x3F] : '=';
+        encoded += i + 2 < size ? Alphabet[group & 0x3F] : '=';
+    }
+    return encoded;
+}
+
+// The Sec-WebSocket-Accept value answering `key`, as RFC 6455 defines it.
+std::string MakeAcceptKey(std::string_view key)
+{
+    std::string             input { key };
+    std::array<uint8_t, 20> digest = Sha1(input + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    return EncodeBase64(digest.data(), digest.size());
+}
+
+void AppendFrame(std::string& out, uint8_t opcode, std::string_view payload)
+{
+    char   header[10];
+    size_t headerSize = 2;
+    header[0]         = (char)(0x80 | opcode);
+    if (payload.size() < 126)
+        header[1] = (char)payload.size();
+    else if (payload.size() <= 0xFFFF)
+    {
+        header[1]  = 126;
+        header[2]  = (char)(payload.size() >> 8);
+        header[3]  = (char)(payload.size() & 0xFF);
+        headerSize = 4;
+    }
+    else
+    {
+        header[1] = 127;
+        for (int i = 0; i < 8; ++i)
+            header[2 + i] = (char)((uint64_t)payload.size() >> (56 - i * 8));
+        headerSize = 10;
+    }
+
+    out.append(header, headerSize);
+    out.append(payload.data(), payload.size());
+}
+
+void AppendJsonString(std::string& out, std::string_view text)
+{
+    static constexpr char Digits[] = "0123456789abcdef";
+
+    out += '"';
+    for (char ch : text)
+    {
+        switch (ch)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((uint8_t)ch < 0x20)
+            {
+                out += "\\u00";
+                out += Digits[(uint8_t)ch >> 4];
+                out += Digits[(uint8_t)ch & 0xF];
+            }
+            else
+                out += ch;
+        }
+    }
+    out += '"';
+}
+
+void AppendUtf8(std::string& out, uint32_t codePoint)
+{
+    if (codePoint < 0x80)
+        out += (char)codePoint;
+    else if (codePoint < 0x800)
+    {
+        out += (char)(0xC0 | (codePoint >> 6));
+        out += (char)(0x80 | (codePoint & 0x3F));
+    }
+    else if (codePoint < 0x10000)
+    {
+        out += (char)(0xE0 | (codePoint >> 12));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        out += (char)(0x80 | (codePoint & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | (codePoint >> 18));
+        out += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        out += (char)(0x80 | (codePoint & 0x3F));
+    }
+}
+
+// Reads just enough JSON for the requests the server takes.
+class JsonReader
+{
+  private:
+    static constexpr int MaxDepth = 32;
+
+  private:
+    std::string_view _text;
+    size_t           _offset;
+
+  public:
+    explicit JsonReader(std::string_view text) : _text { text }, _offset { 0 } {}
+
+  public:
+    bool IsAtEnd()
+    {
+        SkipSpace();
+        return _offset == _text.size();
+    }
+
+    bool Consume(char ch)
+    {
+        SkipSpace();
+        if (_offset == _text.size() || _text[_offset] != ch)
+            return false;
+        ++_offset;
+        return true;
+    }
+
+    bool ReadString(std::string& out)
+    {
+        out.clear();
+        if (!Consume('"'))
+            return false;
+
+        while (_offset < _text.size())
+        {
+            char ch = _text[_offset++];
+            if (ch == '"')
+                return true;
+            if ((uint8_t)ch < 0x20)
+                return false;
+            if (ch != '\\')
+            {
+                out += ch;
+                continue;
+            }
+
+            if (_offset == _text.size())
+                return false;
+            switch (_text[_offset++])
+            {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u':
+            {
+                uint32_t codePoint;
+                if (!ReadHex4(codePoint))
+                    return false;
+
+                // A high surrogate has to be followed by a low one.
+                if (codePoint >= 0xD800 && codePoint < 0xDC00)
+                {
+                    uint32_t low;
+                    if (_text.substr(_offset, 2) != "\\u")
+                        return false;
+                    _offset += 2;
+                    if (!ReadHex4(low) || low < 0xDC00 || low >= 0xE000)
+                        return false;
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                else if (codePoint >= 0xDC00 && codePoint < 0xE000)
+                    return false;
+
+                AppendUtf8(out, codePoint);
+                break;
+            }
+            default: return false;
+            }
+        }
+        return false;
+    }
+
+    bool ReadInteger(int64_t& out)
+    {
+        SkipSpace();
+        size_t start = _offset;
+        if (_offset < _text.size() && _text[_offset] == '-')
+            ++_offset;
+        while (_offset < _text.size() && _text[_offset] >= '0' && _text[_offset] <= '9') ++_offset;
+        if (_offset == start || _offset - start > 18)
+            return false;
+
+        std::string digits { _text.substr(start, _offset - start) };
+        out = std::strtoll(digits.c_str(), nullptr, 10);
+        return true;
+    }
+
+    bool ReadStringArray(std::vector<std::string>& out)
+    {
+        out.clear();
+        if (!Consume('['))
+            return false;
+        if (Consume(']'))
+            return true;
+
+        do
+        {
+            out.emplace_back();
+            if (!ReadString(out.back()))
+                return false;
+        } while (Consume(','));
+        return Consume(']');
+    }
+
+    bool SkipValue(int depth = 0)
+    {
+        if (depth > MaxDepth)
+            return false;
+
+        SkipSpace();
+        if (_offset == _text.size())
+            return false;
+
+        std::string scratch;
+        switch (_text[_offset])
+        {
+        case '"': return ReadString(scratch);
+        case '[':
+        {
+            ++_offset;
+            if (Consume(']'))
+                return true;
+            do
+            {
+                if (!SkipValue(depth + 1))
+                    return false;
+            } while (Consume(','));
+            return Consume(']');
+        }
+        case '{':
+        {
+            ++_offset;
+            if (Consume('}'))
+                return true;
+            do
+            {
+                if (!ReadString(scratch) || !Consume(':') || !SkipValue(depth + 1))
+                    return false;
+            } while (Consume(','));
+            return Consume('}');
+        }
+        default:
+        {
+            size_t start = _offset;
+            while (_offset < _text.size()
+                   && std::strchr("+-.0123456789Eaeflnrstu", _text[_offset]) != nullptr)
+                ++_offset;
+            return _offset != start;
+        }
+        }
+    }
+
+  private:
+    void SkipSpace()
+    {
+        while (_offset < _text.size()
+               && (_text[_offset] == ' ' || _text[_offset] == '\t' || _text[_offset] == '\n'
+                   || _text[_offset] == '\r'))
+            ++_offset;
+    }
+
+    bool ReadHex4(uint32_t& out)
+    {
+        if (_text.size() - _offset < 4)
+            return false;
+
+        out = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char ch = _text[_offset++];
+            out <<= 4;
+            if (ch >= '0' && ch <= '9')
+                out |= (uint32_t)(ch - '0');
+            else if (ch >= 'a' && ch <= 'f')
+                out |= (uint32_t)(ch - 'a' + 10);
+            else if (ch >= 'A' && ch <= 'F')
+                out |= (uint32_t)(ch - 'A' + 10);
+            else
+                return false;
+        }
+        return true;
+    }
+};
+
+struct ControlRequest
+{
+    std::string              type;
+    int64_t                  id;
+    std::string              message;
+    std::vector<std::string> messageList;
+};
+
+bool ParseControlRequest(std::string_view text, ControlRequest& request)
+{
+    JsonReader reader { text };
+    request.id = 0;
+    if (!reader.Consume('{'))
+        return false;
+    if (reader.Consume('}'))
+        return reader.IsAtEnd();
+
+    std::string key;
+    do
+    {
+        if (!reader.ReadString(key) || !reader.Consume(':'))
+            return false;
+
+        bool valid;
+        if (key == "type")
+            valid = reader.ReadString(request.type);
+        else if (key == "id")
+            valid = reader.ReadInteger(request.id);
+        else if (key == "message")
+            valid = reader.ReadString(request.message);
+        else if (key == "messages")
+            valid = reader.ReadStringArray(request.messageList);
+        else
+            valid = reader.SkipValue();
+
+        if (!valid)
+            return false;
+    } while (reader.Consume(','));
+
+    return reader.Consume('}') && reader.IsAtEnd();
+}
+
+std::string MakeStateMessage(std::string_view state)
+{
+    std::string message = "{\"type\":\"state\",\"state\":";
+    AppendJsonString(message, state);
+    message += '}';
+    return message;
+}
+
+std::string MakeErrorMessage(int64_t id, std::string_view error)
+{
+    std::string message = "{\"type\":\"error\",\"id\":" + std::to_string(id) + ",\"error\":";
+    AppendJsonString(message, error);
+    message += '}';
+    return message;
+}
+
+void AppendSuccess(std::string& out, std::vector<bool> const& successList, bool batch)
+{
+    if (!batch)
+    {
+        out += !successList.empty() && successList[0] ? "true" : "false";
+        return;
+    }
+
+    out += '[';
+    for (size_t i = 0; i < successList.size(); ++i)
+    {
+        if (i != 0)
+            out += ',';
+        out += successList[i] ? "true" : "false";
+    }
+    out += ']';
+}
+
+struct HttpRequest
+{
+    std::string_view method;
+    std::string_view path;
+    std::string_view version;
+    std::string_view host;
+    std::string_view origin;
+    std::string_view connection;
+    std::string_view upgrade;
+    std::string_view webSocketKey;
+    std::string_view webSocketVersion;
+    std::string_view transferEncoding;
+    size_t           contentLength;
+    bool             validContentLength;
+};
+
+std::string_view Trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    return text;
+}
+
+bool EqualsIgnoringCase(std::string_view lhs, std::string_view rhs)
+{
+    return lhs.size() == rhs.size()
+           && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char l, char r) {
+                  return std::tolower((unsigned char)l) == std::tolower((unsigned char)r);
+              });
+}
+
+// Whether the comma-separated header value has `token` in it, as Connection: keep-alive, Upgrade
+// does.
+bool HasToken(std::string_view value, std::string_view token)
+{
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        if (EqualsIgnoringCase(Trim(value.substr(0, comma)), token))
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// DNS rebinding lets a web page reach the loopback address under a name of its own, so the Host
+// has to be one of the loopback names.
+bool IsLoopbackHost(std::string_view host)
+{
+    size_t colon = host.rfind(':');
+    if (colon != std::string_view::npos)
+        host = host.substr(0, colon);
+    return host == "127.0.0.1" || EqualsIgnoringCase(host, "localhost");
+}
+
+bool ParseHttpHeader(std::string_view header, HttpRequest& request)
+{
+    request = HttpRequest {};
+
+    size_t lineEnd = header.find("\r\n");
+    if (lineEnd == std::string_view::npos)
+        lineEnd = header.size();
+
+    std::string_view requestLine = header.substr(0, lineEnd);
+    size_t           firstSpace  = requestLine.find(' ');
+    size_t           secondSpace = requestLine.find(' ', firstSpace + 1);
+    if (firstSpace == std::string_view::npos || secondSpace == std::string_view::npos)
+        return false;
+
+    request.method  = requestLine.substr(0, firstSpace);
+    request.path    = requestLine.substr(firstSpace + 1, secondSpace - firstSpace - 1);
+    request.version = requestLine.substr(secondSpace + 1);
+    request.path    = request.path.substr(0, request.path.find('?'));
+    request.validContentLength = true;
+
+    header.remove_prefix(std::min(header.size(), lineEnd + 2));
+    while (!header.empty())
+    {
+        lineEnd = header.find("\r\n");
+        std::string_view line = header.substr(0, lineEnd);
+        header.remove_prefix(lineEnd == std::string_view::npos ? header.size() : lineEnd + 2);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+            return false;
+
+        std::string_view name  = Trim(line.substr(0, colon));
+        std::string_view value = Trim(line.substr(colon + 1));
+        if (EqualsIgnoringCase(name, "Host"))
+            request.host = value;
+        else if (EqualsIgnoringCase(name, "Origin"))
+            request.origin = value;
+        else if (EqualsIgnoringCase(name, "Connection"))
+            request.connection = value;
+        else if (EqualsIgnoringCase(name, "Upgrade"))
+            request.upgrade = value;
+        else if (EqualsIgnoringCase(name, "Sec-WebSocket-Key"))
+            request.webSocketKey = value;
+        else if (EqualsIgnoringCase(name, "Sec-WebSocket-Version"))
+            request.webSocketVersion = value;
+        else if (EqualsIgnoringCase(name, "Transfer-Encoding"))
+            request.transferEncoding = value;
+        else if (EqualsIgnoringCase(name, "Content-Length"))
+        {
+            request.contentLength = 0;
+            request.validContentLength = !value.empty() && value.size() <= 9;
+            for (char ch : value)
+            {
+                if (ch < '0' || ch > '9')
+                    request.validContentLength = false;
+                else
+                    request.contentLength = request.contentLength * 10 + (size_t)(ch - '0');
+            }
+        }
+    }
+    return true;
+}
+
+char const* GetReasonPhrase(int status)
+{
+    switch (status)
+    {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 426: return "Upgrade Required";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+    }
+}
+
+}
+
+namespace ktmac
+{
+
+ControlServer::ControlServer(ControlSendHandler&& sendHandler, int portNumber) :
+    _listener { (intptr_t)InvalidSocket },
+    _wakeup { (intptr_t)InvalidSocket },
+    _portNumber { portNumber },
+    _sendHandler { std::move(sendHandler) },
+    _pendingMtx {},
+    _pendingState {},
+    _statePending { false },
+    _resultList {},
+    _batch {},
+    _wakeupPending { false },
+    _jobMtx {},
+    _jobCv {},
+    _jobList {},
+    _sendStopping { false },
+    _sendThread {},
+    _state {},
+    _clientList {},
+    _nextClientId { 1 },
+    _numClients { 0 },
+    _stopping { false }
+{
+    Socket listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (!IsValid(listener))
+        throw std::runtime_error { "Failed to create a listen socket." };
+
+#ifdef _WIN32
+    BOOL exclusive = TRUE;
+    setsockopt(
+        listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (char const*)&exclusive, sizeof exclusive);
+#else
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+#endif
+
+    sockaddr_in  address = MakeLoopbackAddress(portNumber);
+    SocketLength length  = sizeof address;
+    if (bind(listener, (sockaddr*)&address, sizeof address) != 0
+        || listen(listener, SOMAXCONN) != 0
+        || getsockname(listener, (sockaddr*)&address, &length) != 0)
+    {
+        CloseSocket(listener);
+        throw std::runtime_error { "Failed to listen on the control port." };
+    }
+    SetNonBlocking(listener);
+
+    Socket wakeup = MakeWakeupSocket();
+    if (!IsValid(wakeup))
+    {
+        CloseSocket(listener);
+        throw std::runtime_error { "Failed to create the wakeup socket." };
+    }
+
+    _listener   = (intptr_t)listener;
+    _wakeup     = (intptr_t)wakeup;
+    _portNumber = ntohs(address.sin_port);
+    _sendThread = std::thread { &ControlServer::RunSends, this };
+}
+
+ControlServer::~ControlServer()
+{
+    {
+        std::lock_guard<std::mutex> guard { _jobMtx };
+        _sendStopping = true;
+    }
+    _jobCv.notify_one();
+    _sendThread.join();
+
+    for (auto& client : _clientList) CloseSocket((Socket)client.socket);
+    CloseSocket((Socket)_wakeup);
+    CloseSocket((Socket)_listener);
+}
+
+void ControlServer::PublishState(std::string_view state)
+{
+    {
+        std::lock_guard<std::mutex> guard { _pendingMtx };
+        _pendingState.assign(state.data(), state.size());
+        _statePending = true;
+    }
+    Wake();
+}
+
+void ControlServer::Run()
+{
+    std::vector<PollFd> fdList;
+    std::string         stateFrame;
+
+    while (!_stopping.load(std::memory_order_acquire))
+    {
+        fdList.clear();
+        fdList.push_back(PollFd { (Socket)_listener, POLLIN, 0 });
+        fdList.push_back(PollFd { (Socket)_wakeup, POLLIN, 0 });
+        for (auto& client : _clientList)
+        {
+            short events = client.closing ? 0 : POLLIN;
+            if (client.numSent != client.outbound.size())
+                events |= POLLOUT;
+            fdList.push_back(PollFd { (Socket)client.socket, events, 0 });
+        }
+
+        if (Poll(fdList.data(), fdList.size()) < 0 && !WouldBlock())
+            return;
+
+        if (fdList[1].revents != 0)
+            DrainWakeup(_wakeup, _wakeupPending);
+
+        bool statePending;
+        {
+            std::lock_guard<std::mutex> guard { _pendingMtx };
+            statePending = _statePending;
+            if (statePending)
+                _state.swap(_pendingState);
+            _statePending = false;
+            _batch.clear();
+            _batch.swap(_resultList);
+        }
+
+        // Framed once for every subscriber.
+        if (statePending)
+        {
+            stateFrame.clear();
+            AppendFrame(stateFrame, TextFrame, MakeStateMessage(_state));
+            for (auto& client : _clientList)
+            {
+                if (client.webSocket && !client.closing)
+                    Queue(client, stateFrame);
+            }
+        }
+
+        for (auto& result : _batch) HandleResult(result);
+
+        // Walked backwards so dropping a client does not disturb the indices still to be visited.
+        // `fdList` only describes the clients that existed before this round.
+        size_t numPolled = fdList.size() - 2;
+        for (size_t i = _clientList.size(); i-- > 0;)
+        {
+            Client& client  = _clientList[i];
+            short   revents = i < numPolled ? fdList[i + 2].revents : 0;
+
+            bool closed = (revents & (POLLERR | POLLNVAL)) != 0;
+            if (!closed && (revents & (POLLIN | POLLHUP)) != 0 && !client.closing)
+                closed = !Receive(client);
+
+            if (closed || !Flush(client)
+                || client.outbound.size() - client.numSent > MaxBufferedBytes
+                || (client.closing && client.numSent == client.outbound.size())
+                || (client.closing && (revents & POLLHUP) != 0))
+                Drop(i);
+        }
+
+        if ((fdList[0].revents & POLLIN) != 0)
+            Accept();
+    }
+}
+
+void ControlServer::Stop()
+{
+    _stopping.store(true, std::memory_order_release);
+    Wake();
+}
+
+void ControlServer::Wake()
+{
+    sockets::Wake(_wakeup, _wakeupPending);
+}
+
+void ControlServer::RunSends()
+{
+    std::unique_lock<std::mutex> lock { _jobMtx };
+    while (true)
+    {
+        _jobCv.wait(lock, [this]() { return _sendStopping || !_jobList.empty(); });
+        if (_sendStopping)
+            return;
+
+        SendJob job = std::move(_jobList.front());
+        _jobList.pop_front();
+        lock.unlock();
+
+        SendResult result { job.clientId, job.requestId, job.batch, {} };
+        for (auto& message : job.messageList)
+            result.successList.push_back(_sendHandler && _sendHandler(message));
+
+        {
+            std::lock_guard<std::mutex> guard { _pendingMtx };
+            _resultList.push_back(std::move(result));
+        }
+        Wake();
+
+        lock.lock();
+    }
+}
+
+void ControlServer::Accept()
+{
+    while (true)
+    {
+        Socket socket = accept((Socket)_listener, nullptr, nullptr);
+        if (!IsValid(socket))
+            return;
+
+        SetNonBlocking(socket);
+
+        int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof noDelay);
+
+        Client client {};
+        client.socket = (intptr_t)socket;
+        client.id     = _nextClientId++;
+        _clientList.push_back(std::move(client));
+        _numClients.store(_clientList.size(), std::memory_order_relaxed);
+    }
+}
+
+// Returns false if the connection is closed.
+bool ControlServer::Receive(Client& client)
+{
+    char buffer[16384];
+    while (true)
+    {
+        int result = recv((Socket)client.socket, buffer, (int)sizeof buffer, 0);
+        if (result == 0)
+            return false;
+        if (result < 0)
+        {
+            if (!WouldBlock())
+                return false;
+            break;
+        }
+
+        client.inbound.append(buffer, (size_t)result);
+        if ((size_t)result < sizeof buffer)
+            break;
+    }
+
+    // A client waiting for a send cannot have its next request parsed, but it cannot queue
+    // requests without limit either.
+    if (client.inbound.size() - client.numParsed > MaxRequestBytes + MaxHeaderBytes)
+        return false;
+
+    Process(client);
+    return true;
+}
+
+void ControlServer::Process(Client& client)
+{
+    while (!client.busy && !client.closing && client.numParsed < client.inbound.size())
+    {
+        bool parsed = client.webSocket ? ProcessWebSocketFrame(client) : ProcessHttpRequest(client);
+        if (!parsed)
+            break;
+    }
+
+    client.inbound.erase(0, client.numParsed);
+    client.numParsed = 0;
+}
+
+// Returns false if the request is not complete yet.
+bool ControlServer::ProcessHttpRequest(Client& client)
+{
+    std::string_view inbound { client.inbound };
+    inbound.remove_prefix(client.numParsed);
+
+    size_t headerEnd = inbound.find("\r\n\r\n");
+    if (headerEnd == std::string_view::npos)
+    {
+        if (inbound.size() > MaxHeaderBytes)
+            QueueHttpResponse(client, 413, "{\"error\":\"headers too large\"}", true);
+        return false;
+    }
+
+    HttpRequest request;
+    if (headerEnd > MaxHeaderBytes || !ParseHttpHeader(inbound.substr(0, headerEnd), request)
+        || !request.validContentLength)
+    {
+        QueueHttpResponse(client, 400, "{\"error\":\"malformed request\"}", true);
+        return false;
+    }
+    if (!request.transferEncoding.empty())
+    {
+        QueueHttpResponse(client, 501, "{\"error\":\"unsupported transfer encoding\"}", true);
+        return false;
+    }
+    if (request.contentLength > MaxRequestBytes)
+    {
+        QueueHttpResponse(client, 413, "{\"error\":\"request too large\"}", true);
+        return false;
+    }
+
+    size_t requestSize = headerEnd + 4 + request.contentLength;
+    if (inbound.size() < requestSize)
+        return false;
+
+    std::string_view body = inbound.substr(headerEnd + 4, request.contentLength);
+    client.numParsed += requestSize;
+
+    bool close = request.version != "HTTP/1.1" || HasToken(request.connection, "close");
+    if (!request.origin.empty() || !IsLoopbackHost(request.host))
+    {
+        QueueHttpResponse(client, 403, "{\"error\":\"only local programs may connect\"}", true);
+        return true;
+    }
+
+    if (request.path == "/state")
+    {
+        if (request.method != "GET")
+        {
+            QueueHttpResponse(client, 405, "{\"error\":\"method not allowed\"}", close);
+            return true;
+        }
+
+        std::string response = "{\"state\":";
+        AppendJsonString(response, _state);
+        response += '}';
+        QueueHttpResponse(client, 200, response, close);
+        return true;
+    }
+    else if (request.path == "/events")
+    {
+        if (request.method != "GET" || !HasToken(request.upgrade, "websocket")
+            || !HasToken(request.connection, "upgrade"))
+        {
+            QueueHttpResponse(client, 426, "{\"error\":\"expected a WebSocket upgrade\"}", true);
+            return true;
+        }
+        if (request.webSocketVersion != "13" || request.webSocketKey.empty())
+        {
+            QueueHttpResponse(client, 400, "{\"error\":\"unsupported WebSocket version\"}", true);
+            return true;
+        }
+
+        std::string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                               "Upgrade: websocket\r\n"
+                               "Connection: Upgrade\r\n"
+                               "Sec-WebSocket-Accept: ";
+        response += MakeAcceptKey(request.webSocketKey);
+        response += "\r\n\r\n";
+        Queue(client, response);
+
+        client.webSocket = true;
+        if (!_state.empty())
+            QueueFrame(client, TextFrame, MakeStateMessage(_state));
+        return true;
+    }
+    else if (request.path == "/send" || request.path == "/batch")
+    {
+        if (request.method != "POST")
+        {
+            QueueHttpResponse(client, 405, "{\"error\":\"method not allowed\"}", close);
+            return true;
+        }
+
+        SendJob job { client.id, 0, request.path == "/batch", {} };
+        if (!job.batch)
+            job.messageList.emplace_back(body);
+        else
+        {
+            JsonReader reader { body };
+            if (!reader.ReadStringArray(job.messageList) || !reader.IsAtEnd())
+            {
+                QueueHttpResponse(
+                    client, 400, "{\"error\":\"expected an array of strings\"}", close);
+                return true;
+            }
+        }
+
+        // The response is written once the send thread is done; requests pipelined behind this
+        // one wait until then. HTTP requests have no ID of their own, so -1 asks for the connection
+        // to be closed after the response.
+        client.busy = true;
+        if (close)
+            job.requestId = -1;
+        {
+            std::lock_guard<std::mutex> guard { _jobMtx };
+            _jobList.push_back(std::move(job));
+        }
+        _jobCv.notify_one();
+        return true;
+    }
+
+    QueueHttpResponse(client, 404, "{\"error\":\"not found\"}", close);
+    return true;
+}
+
+// Returns false if the frame is not complete yet.
+bool ControlServer::ProcessWebSocketFrame(Client& client)
+{
+    auto   data = (uint8_t const*)client.inbound.data() + client.numParsed;
+    size_t size = client.inbound.size() - client.numParsed;
+    if (size < 2)
+        return false;
+
+    bool     fin        = (data[0] & 0x80) != 0;
+    uint8_t  opcode     = data[0] & 0x0F;
+    bool     masked     = (data[1] & 0x80) != 0;
+    uint64_t length     = data[1] & 0x7F;
+    size_t   headerSize = 2;
+
+    auto fail = [this, &client](uint16_t code) {
+        char payload[2] = { (char)(code >> 8), (char)(code & 0xFF) };
+        QueueFrame(client, CloseFrame, std::string_view { payload, 2 });
+        client.closing = true;
+        return false;
+    };
+
+    // Clients must mask every frame, and no extension is negotiated.
+    if ((data[0] & 0x70) != 0 || !masked)
+        return fail(ProtocolError);
+
+    if (length == 126)
+    {
+        if (size < 4)
+            return false;
+        length     = (uint64_t)data[2] << 8 | data[3];
+        headerSize = 4;
+    }
+    else if (length == 127)
+    {
+        if (size < 10)
+            return false;
+        length = 0;
+        for (int i = 0; i < 8; ++i) length = length << 8 | data[2 + i];
+        headerSize = 10;
+    }
+
+    if (length > MaxRequestBytes)
+        return fail(MessageTooBig);
+    if (size < headerSize + 4 + length)
+        return false;
+
+    uint8_t const* mask = data + headerSize;
+    std::string    payload((size_t)length, '\0');
+    for (size_t i = 0; i < payload.size(); ++i)
+        payload[i] = (char)(data[headerSize + 4 + i] ^ mask[i % 4]);
+    client.numParsed += headerSize + 4 + (size_t)length;
+
+    if ((opcode & 0x08) != 0)
+    {
+        if (!fin || length > 125)
+            return fail(ProtocolError);
+
+        if (opcode == CloseFrame)
+        {
+            QueueFrame(client, CloseFrame, std::string_view { payload }.substr(0, 2));
+            client.closing = true;
+        }
+        else if (opcode == PingFrame)
+            QueueFrame(client, PongFrame, payload);
+        else if (opcode != PongFrame)
+            return fail(ProtocolError);
+        return true;
+    }
+
+    if (opcode == ContinuationFrame)
+    {
+        if (client.messageOpcode == 0)
+            return fail(ProtocolError);
+    }
+    else if (opcode == TextFrame || opcode == BinaryFrame)
+    {
+        if (client.messageOpcode != 0)
+            return fail(ProtocolError);
+        client.messageOpcode = opcode;
+        client.message.clear();
+    }
+    else
+        return fail(ProtocolError);
+
+    if (client.message.size() + payload.size() > MaxRequestBytes)
+        return fail(MessageTooBig);
+    client.message += payload;
+
+    if (fin)
+    {
+        uint8_t messageOpcode = client.messageOpcode;
+        client.messageOpcode  = 0;
+        if (messageOpcode != TextFrame)
+            return fail(UnsupportedData);
+        HandleWebSocketMessage(client);
+    }
+    return true;
+}
+
+void ControlServer::HandleWebSocketMessage(Client& client)
+{
+    ControlRequest request;
+    if (!ParseControlRequest(client.message, request))
+    {
+        QueueFrame(client, TextFrame, MakeErrorMessage(0, "malformed request"));
+        return;
+    }
+
+    if (request.type == "state")
+    {
+        QueueFrame(client, TextFrame, MakeStateMessage(_state));
+        return;
+    }
+    if (request.type != "send" && request.type != "batch")
+    {
+        QueueFrame(client, TextFrame, MakeErrorMessage(request.id, "unknown request type"));
+        return;
+    }
+    if (client.numPending >= MaxPendingSends)
+    {
+        QueueFrame(client, TextFrame, MakeErrorMessage(request.id, "too many pending sends"));
+        return;
+    }
+
+    SendJob job { client.id, request.id, request.type == "batch", {} };
+    if (job.batch)
+        job.messageList = std::move(request.messageList);
+    else
+        job.messageList.push_back(std::move(request.message));
+
+    ++client.numPending;
+    {
+        std::lock_guard<std::mutex> guard { _jobMtx };
+        _jobList.push_back(std::move(job));
+    }
+    _jobCv.notify_one();
+}
+
+void ControlServer::HandleResult(SendResult const& result)
+{
+    auto it = std::find_if(_clientList.begin(), _clientList.end(), [&](Client const& client) {
+        return client.id == result.clientId;
+    });
+    if (it == _clientList.end())
+        return;
+
+    Client& client = *it;
+    if (client.webSocket)
+    {
+        std::string message = "{\"type\":\"result\",\"id\":" + std::to_string(result.requestId)
+                              + ",\"success\":";
+        AppendSuccess(message, result.successList, result.batch);
+        message += '}';
+
+        --client.numPending;
+        QueueFrame(client, TextFrame, message);
+        return;
+    }
+
+    std::string response = "{\"success\":";
+    AppendSuccess(response, result.successList, result.batch);
+    response += '}';
+
+    client.busy = false;
+    QueueHttpResponse(client, 200, response, result.requestId < 0);
+    Process(client);
+}
+
+void ControlServer::Queue(Client& client, std::string_view data)
+{
+    if (client.numSent == client.outbound.size())
+    {
+        client.outbound.clear();
+        client.numSent = 0;
+    }
+    client.outbound.append(data.data(), data.size());
+}
+
+void ControlServer::QueueHttpResponse(Client&          client,
+                                      int              status,
+                                      std::string_view body,
+                                      bool             close)
+{
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + GetReasonPhrase(status)
+                           + "\r\nContent-Type: application/json\r\nContent-Length: "
+                           + std::to_string(body.size()) + "\r\n";
+    if (close)
+        response += "Connection: close\r\n";
+    response += "\r\n";
+    response += body;
+
+    Queue(client, response);
+    if (close)
+        client.closing = true;
+}
+
+void ControlServer::QueueFrame(Client& client, uint8_t opcode, std::string_view payload)
+{
+    Queue(client, {});
+    AppendFrame(client.outbound, opcode, payload);
+}
+
+bool ControlServer::Flush(Client& client)
+{
+    return sockets::Flush(client.socket, client.outbound, client.numSent);
+}
+
+void ControlServer::Drop(size_t index)
+{
+    sockets::Drop(_clientList, index, _numClients);
+}
+
+}
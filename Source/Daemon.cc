@@ -0,0 +1,133 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+// Runs a core without any window and lets other programs drive it through ControlServer.
+//
+//   ktmac-daemon [--port <port>] [--reactor]
+
+#include <ktmac/ControlServer.hh>
+#include <ktmac/KakaoStateManager.hh>
+#include <ktmac/ProcessWatcherSocket.hh>
+
+#include <Windows.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#undef SendMessage
+
+using namespace ktmac;
+
+namespace
+{
+
+// The state handler may still run while the server is being destroyed.
+std::mutex     g_serverMtx;
+ControlServer* g_server = nullptr;
+
+void PublishState(void*, KakaoState state)
+{
+    std::lock_guard<std::mutex> guard { g_serverMtx };
+    if (g_server != nullptr)
+        g_server->PublishState(GetKakaoStateName(state));
+}
+
+BOOL WINAPI HandleConsoleControl(DWORD)
+{
+    std::lock_guard<std::mutex> guard { g_serverMtx };
+    if (g_server != nullptr)
+        g_server->Stop();
+    return TRUE;
+}
+
+// The server speaks UTF-8; SetMessage(char const*) would take the ANSI code page.
+bool Send(KakaoStateManager& manager, std::string const& message)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, message.data(), (int)message.size(), NULL, 0);
+    if (length <= 0 && !message.empty())
+        return false;
+
+    std::wstring wideMessage((size_t)length, L'\0');
+    MultiByteToWideChar(
+        CP_UTF8, 0, message.data(), (int)message.size(), wideMessage.data(), length);
+
+    return manager.SetMessage(wideMessage) && manager.SendMessage();
+}
+
+void PrintStartupTimings(StartupTimings const& timings)
+{
+    auto ms = [](std::chrono::microseconds time) { return time.count() / 1000.0; };
+    std::cout << "Started in " << ms(timings.total) << " ms: subscribe " << ms(timings.subscribe)
+              << ", process scan " << ms(timings.processScan) << ", window scan "
+              << ms(timings.windowScan) << ", hook launch " << ms(timings.hookLaunch)
+              << ", initial state " << ms(timings.initialState) << ", threads "
+              << ms(timings.threadStart) << (timings.sharedHook ? " (shared hook)" : "")
+              << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+try
+{
+    int                portNumber = ControlServerPort;
+    KakaoThreadingMode mode       = KakaoThreadingMode::Threaded;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            portNumber = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--reactor") == 0)
+            mode = KakaoThreadingMode::Reactor;
+    }
+
+    if (!ProcessWatcherSocket::InitializeWinSock())
+        throw std::runtime_error { "Windows Socket initialization failed." };
+
+    {
+        std::unique_ptr<KakaoStateManager> manager;
+        auto server = std::make_unique<ControlServer>(
+            [&manager](std::string const& message) { return Send(*manager, message); },
+            portNumber);
+
+        {
+            std::lock_guard<std::mutex> guard { g_serverMtx };
+            g_server = server.get();
+        }
+
+        // Sends only start once Run() does, after the manager exists.
+        manager = std::make_unique<KakaoStateManager>(
+            mode,
+            std::initializer_list<KakaoStateManager::HandlerPairType> {
+                { nullptr, &PublishState },
+            });
+        server->PublishState(GetKakaoStateName(manager->GetCurrentState()));
+        PrintStartupTimings(manager->GetStartupTimings());
+
+        SetConsoleCtrlHandler(&HandleConsoleControl, TRUE);
+        std::cout << "Listening on 127.0.0.1:" << server->GetPortNumber() << std::endl;
+        server->Run();
+
+        {
+            std::lock_guard<std::mutex> guard { g_serverMtx };
+            g_server = nullptr;
+        }
+
+        // Joins the send thread while the manager it sends through is still there.
+        server.reset();
+        manager.reset();
+    }
+
+    ProcessWatcherSocket::UninitializeWinSock();
+    return 0;
+}
+catch (std::exception const& ex)
+{
+    std::cerr << "ktmac-daemon: " << ex.what() << std::endl;
+    return 1;
+}
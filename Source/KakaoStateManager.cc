@@ -2,8 +2,18 @@
 // Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
 // Licensed under the MIT License.
 
+#include <ktmac/CircuitBreaker.hh>
 #include <ktmac/KakaoStateManager.hh>
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/ProcessInfo.hh>
+#include <ktmac/ProcessWatcherBroker.hh>
+#include <ktmac/ProcessWatcherChannel.hh>
 #include <ktmac/ProcessWatcherSocket.hh>
+#include <ktmac/RateLimiter.hh>
+#include <ktmac/Reactor.hh>
+#include <ktmac/SpscRing.hh>
+#include <ktmac/TextInjector.hh>
+#include <ktmac/WindowEventOrder.hh>
 #include <ktmac/WindowHook.hh>
 
 #include <Windows.h>
@@ -11,7 +21,15 @@
 #include <TlHelp32.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <cwchar>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -25,7 +43,23 @@ namespace ktmac
 struct KakaoStateManager::Impl
 {
   private:
-    static void HandleWindowHook(void* context, HWND window, DWORD event);
+    struct WindowEventRecord
+    {
+        HookEventRecord hook;
+        int64_t         queuedNs;
+    };
+
+    static constexpr size_t WindowEventRingSize  = 1024;
+    static constexpr size_t WindowEventBatchSize = 64;
+
+  private:
+    static void HandleWindowHook(void* context, HookEventRecord const& record);
+
+    static int64_t GetQueueTime()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
 
   private:
     std::vector<HandlerPairType> _handlerList;
@@ -35,17 +69,76 @@ struct KakaoStateManager::Impl
     DWORD       _messageThreadId;
     KakaoState  _currentState;
 
-    size_t                       _numProcesses;
-    uint32_t                     _currentProcessId;
-    std::unordered_set<uint32_t> _processIdList;
+    size_t                                     _numProcesses;
+    uint32_t                                   _currentProcessId;
+    std::unordered_map<uint32_t, ProcessEvent> _processIdList;
 
     HWND _loginWindow;
     HWND _mainWindow, _online, _contactList, _chatroomList, _misc, _lock;
     HWND _chatroomWindow;
 
+    // Only the thread pumping the hook's messages changes `_hookHandle`, but the state thread
+    // updates the hook's windows and statistics are read from any thread, neither of which may
+    // touch a hook that is being stopped.
+    std::mutex    _hookHandleMtx;
     HWINEVENTHOOK _hookHandle;
 
-    ProcessWatcherSocket _watcherSocket;
+    SpscRing<WindowEventRecord, WindowEventRingSize> _eventRing;
+    std::thread                                      _stateThread;
+    HANDLE                                           _eventReady;
+    std::atomic<bool>                                _stateThreadWaiting;
+    std::atomic<bool>                                _stateThreadStopping;
+    std::atomic<bool>                                _resyncRequested;
+    std::atomic<uint64_t>                            _numOverflowed;
+    std::atomic<uint64_t>                            _numResyncs;
+    std::atomic<uint64_t>                            _numStale;
+    WindowEventOrder                                 _eventOrder;
+    LatencyHistogram                                 _eventToStateLatency;
+    LatencyHistogram                                 _queueLatency;
+
+    // Declared before the transports, whose receiving threads post to it until they are joined.
+    KakaoThreadingMode       _threadingMode;
+    std::unique_ptr<Reactor> _reactor;
+    std::thread              _reactorThread;
+    std::atomic<size_t>      _numThreads;
+
+    // Whether a timer looks for the windows of a process that has just started. Only touched on
+    // the reactor thread, or before it starts.
+    bool _initialStatePending;
+
+    std::unique_ptr<ProcessWatcherSubscriber> _watcherSubscriber;
+    std::unique_ptr<ProcessWatcherChannel>    _watcherChannel;
+    std::unique_ptr<ProcessWatcherSocket>     _watcherSocket;
+
+    // `_hookMtx` guards `_watcherChannel`, which a restart replaces, but is never held while a
+    // channel is destroyed, as its receiving thread may be waiting for it in the miss handler.
+    std::mutex            _hookMtx;
+    std::mutex            _processHookMtx;
+    HeartbeatConfig       _heartbeatConfig;
+    uint32_t              _hookGeneration;
+    std::thread           _restartThread;
+    bool                  _restartRunning;
+    bool                  _restartStopping;
+    std::atomic<uint64_t> _numRestarts;
+    std::atomic<uint64_t> _numFailedRestarts;
+
+    RateLimiter _rateLimiter;
+
+    std::mutex           _injectorMtx;
+    TextInjectorSelector _injectorSelector;
+
+    std::mutex                               _deliveryMtx;
+    std::condition_variable                  _probeCondition;
+    std::unordered_map<HWND, CircuitBreaker> _breakerList;
+    CircuitBreakerConfig                     _breakerConfig;
+    DeliveryMetrics                          _deliveryMetrics;
+    std::thread                              _probeThread;
+    bool                                     _probeRunning;
+    bool                                     _probeStopping;
+    std::atomic<uint32_t>                    _deliveryTimeoutMs;
+
+    // Written only during the construction.
+    StartupTimings _startupTimings;
 
   public:
     KakaoState GetCurrentState()
@@ -53,9 +146,15 @@ struct KakaoStateManager::Impl
         return _currentState;
     }
 
+    StartupTimings GetStartupTimings()
+    {
+        return _startupTimings;
+    }
+
   public:
-    inline Impl() : Impl(std::initializer_list<HandlerPairType> {}) {}
-    Impl(std::initializer_list<HandlerPairType> init);
+    inline Impl() : Impl(KakaoThreadingMode::Threaded, std::initializer_list<HandlerPairType> {})
+    {}
+    Impl(KakaoThreadingMode threadingMode, std::initializer_list<HandlerPairType> init);
     ~Impl();
 
   public:
@@ -77,6 +176,31 @@ struct KakaoStateManager::Impl
     bool SendMessage();
 #pragma pop_macro("SendMessage")
 
+    inline RateLimiter& GetRateLimiter()
+    {
+        return _rateLimiter;
+    }
+
+    RateLimiterLevels GetRateLimiterLevels();
+
+    void SetTextInjectionMethod(size_t minLength, TextInjectionMethod method);
+
+    inline void SetDeliveryTimeout(uint32_t timeoutMs)
+    {
+        _deliveryTimeoutMs = timeoutMs;
+    }
+
+    void            SetCircuitBreakerConfig(CircuitBreakerConfig config);
+    DeliveryMetrics GetDeliveryMetrics();
+
+    WindowEventStatistics GetWindowEventStatistics();
+    WindowEventLatency    GetWindowEventLatency();
+    ProcessEvent          GetProcessInfo();
+    size_t                GetNumThreads();
+
+    void              SetHeartbeatConfig(HeartbeatConfig config);
+    ProcessHookHealth GetProcessHookHealth();
+
   private:
     inline void CallHandlers()
     {
@@ -85,10 +209,33 @@ struct KakaoStateManager::Impl
 
     void RunThread();
     void HandleMessageLoop();
+    void HandleReactor();
+    void StopReactor();
+    void StartWindowHook();
+    void StopWindowHook();
     void Clean(bool clearHandlerList = true, bool clearProcessIdList = true);
-    void FindInitialState();
-    void HandleProcessHook(ProcessWatcherMessage message, uint32_t processId);
+    void Initialize();
+    bool FindInitialState();
+    bool DiscoverWindows();
+    void EvaluateState();
+    void ConnectProcessHook(std::unique_lock<std::mutex>& hookLock);
+    void HandleProcessHook(ProcessEvent const& event);
+
+    std::unique_ptr<ProcessWatcherChannel> LaunchChannel();
+    void                                   HandleHookMissed();
+    void                                   RestartProcessHook();
+    void                                   StopProcessHook();
+    void PushWindowEvent(HookEventRecord const& record);
+    void HandleStateEvents();
+    void ApplyWindowEvent(HookEventRecord const& record, int64_t queueDelayNs);
+    void Resync();
     void HandleWindowHook(HWND window, DWORD event);
+    void UpdateHookWindows();
+
+    bool AllowDelivery(HWND window);
+    void ReportDelivery(HWND window, TextInjectionResult result);
+    void HandleProbes();
+    void StopProbes();
 };
 
 }
@@ -100,20 +247,36 @@ struct KakaoStateManager::Impl
 namespace
 {
 
-std::unordered_set<uint32_t> GetKakaoTalkProcessIdList()
+// Taken once at startup unless a shared process hook sends a snapshot instead; afterwards the
+// process list is kept up to date from the metadata the process hook sends with every event.
+std::unordered_map<uint32_t, ktmac::ProcessEvent> GetKakaoTalkProcessIdList()
 {
     PROCESSENTRY32 entry = {};
     entry.dwSize         = sizeof(PROCESSENTRY32);
 
     HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, NULL);
 
-    std::unordered_set<uint32_t> rtn;
+    std::unordered_map<uint32_t, ktmac::ProcessEvent> rtn;
     if (Process32First(snapshot, &entry) == TRUE)
     {
         while (Process32Next(snapshot, &entry) == TRUE)
         {
-            if (_stricmp(entry.szExeFile, "KakaoTalk.exe") == 0)
-                rtn.insert(entry.th32ProcessID);
+            if (_stricmp(entry.szExeFile, "KakaoTalk.exe") != 0)
+                continue;
+
+            ktmac::ProcessEvent event = {};
+            event.state               = ktmac::ProcessState::Running;
+            event.processId           = entry.th32ProcessID;
+            event.parentProcessId     = entry.th32ParentProcessID;
+            ktmac::SetProcessImageName(event, entry.szExeFile);
+
+            HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, event.processId);
+            if (process != NULL)
+            {
+                ktmac::QueryProcessInfo(process, event);
+                CloseHandle(process);
+            }
+            rtn.emplace(event.processId, event);
         }
     }
 
@@ -121,6 +284,12 @@ std::unordered_set<uint32_t> GetKakaoTalkProcessIdList()
     return rtn;
 }
 
+// Both creation times must be known to tell two processes with the same ID apart.
+bool IsSameProcess(ktmac::ProcessEvent const& lhs, ktmac::ProcessEvent const& rhs)
+{
+    return lhs.creationTime == 0 || rhs.creationTime == 0 || lhs.creationTime == rhs.creationTime;
+}
+
 HWND FindKakaoTalkChatroomWindow()
 {
     HWND window = NULL;
@@ -201,6 +370,31 @@ HWND FindKakaoTalkLoginWindow()
     return NULL;
 }
 
+using StartupClock = std::chrono::steady_clock;
+
+std::chrono::microseconds ToMicroseconds(StartupClock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+// Counts a thread of the manager for as long as it is in scope.
+class ThreadCounter
+{
+  private:
+    std::atomic<size_t>& _counter;
+
+  public:
+    explicit ThreadCounter(std::atomic<size_t>& counter) : _counter { counter }
+    {
+        _counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~ThreadCounter()
+    {
+        _counter.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
 }
 
 #pragma endregion
@@ -210,20 +404,26 @@ HWND FindKakaoTalkLoginWindow()
 namespace ktmac
 {
 
-void KakaoStateManager::Impl::HandleWindowHook(void* context, HWND window, DWORD event)
+void KakaoStateManager::Impl::HandleWindowHook(void* context, HookEventRecord const& record)
 {
     auto& manager = *(ktmac::KakaoStateManager::Impl*)context;
-    manager.HandleWindowHook(window, event);
+
+    // The reactor thread is the one pumping the messages the callback arrives with.
+    if (manager._reactor)
+        manager.ApplyWindowEvent(record, 0);
+    else
+        manager.PushWindowEvent(record);
 }
 
-KakaoStateManager::Impl::Impl(std::initializer_list<HandlerPairType> handlerList) :
+KakaoStateManager::Impl::Impl(KakaoThreadingMode                     threadingMode,
+                              std::initializer_list<HandlerPairType> handlerList) :
     _handlerList(std::move(handlerList)),
     _messageThread {},
     _stateMtx {},
     _messageThreadId { NULL },
     _currentState { KakaoState::NotRunning },
     _currentProcessId { NULL },
-    _processIdList(GetKakaoTalkProcessIdList()),
+    _processIdList {},
     _loginWindow { NULL },
     _mainWindow { NULL },
     _online { NULL },
@@ -232,21 +432,153 @@ KakaoStateManager::Impl::Impl(std::initializer_list<HandlerPairType> handlerList
     _misc { NULL },
     _lock { NULL },
     _chatroomWindow { NULL },
+    _hookHandleMtx {},
     _hookHandle { NULL },
-    _watcherSocket {
-        ProcessWatcherSocket::MakeServerSocket(
-            23456,
-            std::bind(&KakaoStateManager::Impl::HandleProcessHook, this, _1, _2)),
-    }
+    _eventRing {},
+    _stateThread {},
+    _eventReady { CreateEvent(NULL, FALSE, FALSE, NULL) },
+    _stateThreadWaiting { false },
+    _stateThreadStopping { false },
+    _resyncRequested { false },
+    _numOverflowed { 0 },
+    _numResyncs { 0 },
+    _numStale { 0 },
+    _eventOrder {},
+    _eventToStateLatency {},
+    _queueLatency {},
+    _threadingMode { threadingMode },
+    _reactor {},
+    _reactorThread {},
+    _numThreads { 0 },
+    _initialStatePending { false },
+    _watcherSubscriber {},
+    _watcherChannel {},
+    _watcherSocket {},
+    _hookMtx {},
+    _processHookMtx {},
+    _heartbeatConfig { std::chrono::milliseconds { 1000 }, 3 },
+    _hookGeneration { 0 },
+    _restartThread {},
+    _restartRunning { false },
+    _restartStopping { false },
+    _numRestarts { 0 },
+    _numFailedRestarts { 0 },
+    _rateLimiter {},
+    _injectorMtx {},
+    _injectorSelector {},
+    _deliveryMtx {},
+    _probeCondition {},
+    _breakerList {},
+    _breakerConfig { 3, std::chrono::milliseconds { 1000 } },
+    _deliveryMetrics {},
+    _probeThread {},
+    _probeRunning { false },
+    _probeStopping { false },
+    _deliveryTimeoutMs { 500 },
+    _startupTimings {}
 {
-    FindInitialState();
-    CallHandlers();
-    RunThread();
+    if (_eventReady == NULL)
+        throw std::runtime_error { "Failed to create the window event notification." };
+
+    _injectorSelector.Set(0, MakeTextInjector(TextInjectionMethod::SetText));
+
+    if (_threadingMode == KakaoThreadingMode::Reactor)
+        _reactor = std::make_unique<Reactor>();
+
+    auto start = StartupClock::now();
+
+    // Events of the hook ConnectProcessHook() launches or subscribes to wait here until the initial
+    // state is known, so a hook that connects before the scan below is done cannot report processes
+    // to an empty list.
+    std::unique_lock hookLock { _processHookMtx, std::defer_lock };
+
+    // Neither the process scan nor waiting for the main window needs the process hook, so both run
+    // while it starts, which may take as long as the user takes to answer the elevation prompt.
+    // FindInitialState() finds the windows again afterwards, at once if they were waited for here.
+    std::unordered_map<uint32_t, ProcessEvent> scannedList;
+    std::atomic<bool>                          scanStopping { false };
+    std::thread                                scanThread { [&]() {
+        using namespace std::chrono_literals;
+        ThreadCounter counter { _numThreads };
+
+        auto scanStart              = StartupClock::now();
+        scannedList                 = GetKakaoTalkProcessIdList();
+        auto scanEnd                = StartupClock::now();
+        _startupTimings.processScan = ToMicroseconds(scanEnd - scanStart);
+
+        MainWindow mainWindow = {};
+        while (!scannedList.empty() && !scanStopping && !FindKakaoTalkMainWindow(mainWindow))
+        {
+            mainWindow = {};
+            std::this_thread::sleep_for(0.1s);
+        }
+        _startupTimings.windowScan = ToMicroseconds(StartupClock::now() - scanEnd);
+    } };
+
+    try
+    {
+        ConnectProcessHook(hookLock);
+    }
+    catch (...)
+    {
+        scanStopping = true;
+        scanThread.join();
+        throw;
+    }
+
+    auto connected = StartupClock::now();
+    scanThread.join();
+
+    // A shared process hook already sent the list.
+    if (!_startupTimings.sharedHook)
+    {
+        std::lock_guard guard { _stateMtx };
+        _processIdList = std::move(scannedList);
+    }
+
+    Initialize();
+    auto initialized             = StartupClock::now();
+    _startupTimings.initialState = ToMicroseconds(initialized - connected);
+
+    // Started last, so process events that arrived in the meantime are applied after the initial
+    // state rather than racing with it.
+    if (_reactor)
+    {
+        // A polled channel has no thread of its own to send heartbeats from. Channels are only
+        // released on the reactor thread, so the one taken here outlives the call.
+        _reactor->AddTimer(std::chrono::milliseconds { 0 }, [this]() {
+            ProcessWatcherChannel* channel = nullptr;
+            {
+                std::lock_guard guard { _hookMtx };
+                channel = _watcherChannel.get();
+            }
+
+            uint32_t delayMs = channel != nullptr ? channel->Heartbeat()
+                                                  : ProcessWatcherChannel::HeartbeatRecheckMs;
+            return std::chrono::milliseconds { delayMs };
+        });
+        _reactorThread = std::thread { &KakaoStateManager::Impl::HandleReactor, this };
+    }
+
+    auto end                    = StartupClock::now();
+    _startupTimings.threadStart = ToMicroseconds(end - initialized);
+    _startupTimings.total       = ToMicroseconds(end - start);
 }
 
 KakaoStateManager::Impl::~Impl()
 {
+    {
+        std::lock_guard guard { _hookMtx };
+        _restartStopping = true;
+    }
+    if (_restartThread.joinable())
+        _restartThread.join();
+
+    StopProcessHook();
+    StopProbes();
+    StopReactor();
     Clean();
+    CloseHandle(_eventReady);
 }
 
 bool KakaoStateManager::Impl::SetMessage(wchar_t const* message)
@@ -263,30 +595,32 @@ bool KakaoStateManager::Impl::SetMessage(wchar_t const* message)
     if (richEdit == NULL)
         return false;
 
-    SetLastError(NOERROR);
-    SendMessageW(richEdit, WM_SETTEXT, NULL, reinterpret_cast<LPARAM>(message));
+    if (!AllowDelivery(chatroom))
+        return false;
+
+    size_t              length = wcslen(message);
+    TextInjectionResult result = TextInjectionResult::Failed;
+    {
+        std::lock_guard<std::mutex> guard { _injectorMtx };
+        if (TextInjector* injector = _injectorSelector.Select(length); injector != nullptr)
+            result = injector->Inject(richEdit, message, length, _deliveryTimeoutMs);
+    }
 
-    return GetLastError() == NOERROR;
+    ReportDelivery(chatroom, result);
+    return result == TextInjectionResult::Succeeded;
 }
 
 bool KakaoStateManager::Impl::SetMessage(char const* message)
 {
-    HWND chatroom = NULL;
-    {
-        std::lock_guard<std::mutex> mtx { _stateMtx };
-        chatroom = _chatroomWindow;
-    }
-    if (chatroom == NULL)
+    int length = MultiByteToWideChar(CP_ACP, 0, message, -1, NULL, 0);
+    if (length <= 0)
         return false;
 
-    HWND richEdit = FindWindowExW(chatroom, NULL, L"RICHEDIT50W", NULL);
-    if (richEdit == NULL)
+    std::wstring wideMessage(length - 1, L'\0');
+    if (MultiByteToWideChar(CP_ACP, 0, message, -1, wideMessage.data(), length) <= 0)
         return false;
 
-    SetLastError(NOERROR);
-    SendMessageA(richEdit, WM_SETTEXT, NULL, reinterpret_cast<LPARAM>(message));
-
-    return GetLastError() == NOERROR;
+    return SetMessage(wideMessage.c_str());
 }
 
 #pragma push_macro("SendMessage")
@@ -306,6 +640,23 @@ bool KakaoStateManager::Impl::SendMessage()
     if (richEdit == NULL)
         return false;
 
+    if (!AllowDelivery(chatroom))
+        return false;
+
+    // Over-budget sends are deferred rather than refused, so callers can keep submitting at full
+    // speed and the limiter paces them at exactly the configured rate.
+    _rateLimiter.Acquire(reinterpret_cast<uintptr_t>(chatroom));
+
+    // The wait may be long enough for the chatroom to be closed, or replaced by another one that
+    // the message was not typed into.
+    {
+        std::lock_guard<std::mutex> mtx { _stateMtx };
+        if (_chatroomWindow != chatroom)
+            return false;
+    }
+    if (!IsWindow(richEdit))
+        return false;
+
     if (!PostMessage(richEdit, WM_KEYDOWN, VK_RETURN, NULL))
         return false;
 
@@ -315,19 +666,199 @@ bool KakaoStateManager::Impl::SendMessage()
     return true;
 }
 
+RateLimiterLevels KakaoStateManager::Impl::GetRateLimiterLevels()
+{
+    HWND chatroom = NULL;
+    {
+        std::lock_guard<std::mutex> mtx { _stateMtx };
+        chatroom = _chatroomWindow;
+    }
+
+    return _rateLimiter.GetLevels(reinterpret_cast<uintptr_t>(chatroom));
+}
+
+void KakaoStateManager::Impl::SetTextInjectionMethod(size_t minLength, TextInjectionMethod method)
+{
+    std::lock_guard<std::mutex> guard { _injectorMtx };
+    _injectorSelector.Set(minLength, MakeTextInjector(method));
+}
+
+void KakaoStateManager::Impl::SetCircuitBreakerConfig(CircuitBreakerConfig config)
+{
+    std::lock_guard<std::mutex> guard { _deliveryMtx };
+    _breakerConfig = config;
+}
+
+DeliveryMetrics KakaoStateManager::Impl::GetDeliveryMetrics()
+{
+    std::lock_guard<std::mutex> guard { _deliveryMtx };
+    return _deliveryMetrics;
+}
+
+bool KakaoStateManager::Impl::AllowDelivery(HWND window)
+{
+    std::lock_guard<std::mutex> guard { _deliveryMtx };
+
+    auto it = _breakerList.find(window);
+    if (it == _breakerList.end() || it->second.Allow())
+        return true;
+
+    ++_deliveryMetrics.numRejected;
+    return false;
+}
+
+void KakaoStateManager::Impl::ReportDelivery(HWND window, TextInjectionResult result)
+{
+    std::lock_guard<std::mutex> guard { _deliveryMtx };
+
+    if (result == TextInjectionResult::Succeeded)
+    {
+        if (auto it = _breakerList.find(window); it != _breakerList.end())
+        {
+            if (it->second.RecordSuccess())
+                ++_deliveryMetrics.numBreakerClosed;
+        }
+        return;
+    }
+
+    if (result != TextInjectionResult::TimedOut)
+        return;
+
+    ++_deliveryMetrics.numTimeouts;
+    if (!_breakerList[window].RecordFailure(_breakerConfig, CircuitBreaker::Clock::now()))
+        return;
+
+    ++_deliveryMetrics.numBreakerOpened;
+    if (!_probeRunning && !_probeStopping)
+    {
+        // The previous probe thread has already left its loop, so joining it here is immediate.
+        if (_probeThread.joinable())
+            _probeThread.join();
+
+        _probeRunning = true;
+        _probeThread  = std::thread { &KakaoStateManager::Impl::HandleProbes, this };
+    }
+}
+
+void KakaoStateManager::Impl::HandleProbes()
+{
+    ThreadCounter                counter { _numThreads };
+    std::unique_lock<std::mutex> lock { _deliveryMtx };
+
+    std::vector<HWND> dueList;
+    while (!_probeStopping)
+    {
+        auto now = CircuitBreaker::Clock::now();
+
+        dueList.clear();
+        for (auto& [window, breaker] : _breakerList)
+        {
+            if (breaker.BeginProbe(now))
+                dueList.push_back(window);
+        }
+
+        if (!dueList.empty())
+        {
+            uint32_t timeoutMs = _deliveryTimeoutMs;
+            lock.unlock();
+
+            std::vector<std::pair<HWND, bool>> resultList;
+            for (HWND window : dueList)
+            {
+                DWORD_PTR result = 0;
+                bool      alive  = false;
+                if (IsWindow(window))
+                {
+                    alive = SendMessageTimeoutW(window,
+                                                WM_NULL,
+                                                0,
+                                                0,
+                                                SMTO_ABORTIFHUNG | SMTO_ERRORONEXIT,
+                                                timeoutMs,
+                                                &result)
+                            != 0;
+                }
+                resultList.push_back(std::make_pair(window, alive));
+            }
+
+            lock.lock();
+            now = CircuitBreaker::Clock::now();
+            for (auto [window, alive] : resultList)
+            {
+                ++_deliveryMetrics.numProbes;
+
+                auto it = _breakerList.find(window);
+                if (it == _breakerList.end())
+                    continue;
+
+                if (!IsWindow(window))
+                    _breakerList.erase(it);
+                else if (alive)
+                {
+                    if (it->second.RecordSuccess())
+                        ++_deliveryMetrics.numBreakerClosed;
+                }
+                else
+                    it->second.RecordFailure(_breakerConfig, now);
+            }
+        }
+
+        bool anyOpen   = false;
+        auto nextProbe = now + _breakerConfig.probeInterval;
+        for (auto& [window, breaker] : _breakerList)
+        {
+            if (breaker.GetState() == CircuitState::Closed)
+                continue;
+
+            anyOpen   = true;
+            nextProbe = std::min(nextProbe, breaker.GetNextProbe());
+        }
+
+        if (!anyOpen)
+            break;
+
+        _probeCondition.wait_until(lock, nextProbe);
+    }
+
+    _probeRunning = false;
+}
+
+void KakaoStateManager::Impl::StopProbes()
+{
+    {
+        std::lock_guard<std::mutex> guard { _deliveryMtx };
+        _probeStopping = true;
+    }
+    _probeCondition.notify_all();
+
+    if (_probeThread.joinable())
+        _probeThread.join();
+}
+
 void KakaoStateManager::Impl::RunThread()
 {
-    if (_currentProcessId)
+    if (!_currentProcessId)
+        return;
+
+    // The hook has to be installed by the thread that pumps its messages.
+    if (_reactor)
     {
-        _messageThread   = std::thread { &KakaoStateManager::Impl::HandleMessageLoop, this };
-        _messageThreadId = GetThreadId(_messageThread.native_handle());
+        _reactor->Post([this]() { StartWindowHook(); });
+        return;
     }
+
+    _messageThread   = std::thread { &KakaoStateManager::Impl::HandleMessageLoop, this };
+    _messageThreadId = GetThreadId(_messageThread.native_handle());
 }
 
 void KakaoStateManager::Impl::HandleMessageLoop()
 {
-    if (_currentProcessId)
-        _hookHandle = HookStart(_currentProcessId, HandleWindowHook, this);
+    ThreadCounter counter { _numThreads };
+
+    // Callbacks only arrive once the loop below pumps messages.
+    StartWindowHook();
+    _stateThreadStopping = false;
+    _stateThread         = std::thread { &KakaoStateManager::Impl::HandleStateEvents, this };
 
     MSG msg = {};
     while (GetMessage(&msg, NULL, 0, 0))
@@ -336,16 +867,73 @@ void KakaoStateManager::Impl::HandleMessageLoop()
         DispatchMessage(&msg);
     }
 
+    StopWindowHook();
+
+    _stateThreadStopping = true;
+    SetEvent(_eventReady);
+    _stateThread.join();
+}
+
+void KakaoStateManager::Impl::HandleReactor()
+{
+    ThreadCounter counter { _numThreads };
+    _reactor->Run();
+}
+
+void KakaoStateManager::Impl::StopReactor()
+{
+    if (!_reactorThread.joinable())
+        return;
+
+    // UnhookWinEvent() fails on any thread but the one that installed the hook.
+    _reactor->Post([this]() { StopWindowHook(); });
+    _reactor->Stop();
+    _reactorThread.join();
+}
+
+void KakaoStateManager::Impl::StartWindowHook()
+{
+    _resyncRequested = false;
+    _eventOrder.Resync(GetTickCount());
+
+    if (_currentProcessId)
+    {
+        // Chatrooms and the login window are found by class when they are created; everything
+        // else HandleWindowHook looks at is one of the windows it already knows.
+        HookFilter filter    = {};
+        filter.events        = HookEventAll;
+        filter.classNames[0] = "#32770";
+        filter.classNames[1] = "EVA_Window";
+
+        HWINEVENTHOOK hookHandle = HookStart(_currentProcessId, HandleWindowHook, this, &filter);
+        {
+            std::lock_guard<std::mutex> guard { _hookHandleMtx };
+            _hookHandle = hookHandle;
+        }
+        UpdateHookWindows();
+    }
+}
+
+void KakaoStateManager::Impl::StopWindowHook()
+{
+    std::lock_guard<std::mutex> guard { _hookHandleMtx };
     if (_hookHandle)
         HookStop(_hookHandle);
+
     _hookHandle = NULL;
 }
 
 void KakaoStateManager::Impl::Clean(bool clearHandlerList, bool clearProcessIdList)
 {
-    PostThreadMessage(_messageThreadId, WM_QUIT, NULL, NULL);
-    if (_messageThread.joinable())
-        _messageThread.join();
+    // In the reactor mode, this runs either on the reactor thread or after it was joined.
+    if (_reactor)
+        StopWindowHook();
+    else
+    {
+        PostThreadMessage(_messageThreadId, WM_QUIT, NULL, NULL);
+        if (_messageThread.joinable())
+            _messageThread.join();
+    }
 
     if (clearHandlerList)
         _handlerList.clear();
@@ -365,47 +953,102 @@ void KakaoStateManager::Impl::Clean(bool clearHandlerList, bool clearProcessIdLi
     _misc           = NULL;
     _lock           = NULL;
     _chatroomWindow = NULL;
-    _hookHandle     = NULL;
 }
 
-void KakaoStateManager::Impl::FindInitialState()
+// Finds the initial state, tells the handlers, and starts watching the windows. A process that has
+// just started may not have created them yet. In the reactor mode they are looked for again from a
+// timer, as waiting would stall every other source of the reactor thread.
+void KakaoStateManager::Impl::Initialize()
 {
     using namespace std::chrono_literals;
 
+    if (!_reactor)
+    {
+        while (!FindInitialState()) std::this_thread::sleep_for(0.1s);
+    }
+    else if (!FindInitialState())
+    {
+        // A process that starts while its predecessor's windows are still awaited reuses the
+        // timer that is already running.
+        if (_initialStatePending)
+            return;
+
+        _initialStatePending = true;
+        _reactor->AddTimer(100ms, [this]() {
+            std::lock_guard<std::mutex> hookGuard { _processHookMtx };
+            {
+                std::lock_guard guard { _stateMtx };
+                if (_processIdList.empty())
+                {
+                    _initialStatePending = false;
+                    return Reactor::StopTimer;
+                }
+            }
+
+            if (!FindInitialState())
+                return std::chrono::milliseconds { 100 };
+
+            _initialStatePending = false;
+            CallHandlers();
+            RunThread();
+            return Reactor::StopTimer;
+        });
+        return;
+    }
+
+    CallHandlers();
+    RunThread();
+}
+
+// Returns false if the process has not created its main window yet.
+bool KakaoStateManager::Impl::FindInitialState()
+{
     std::lock_guard guard { _stateMtx };
     if (_processIdList.empty())
     {
         _currentState = KakaoState::NotRunning;
-        return;
+        return true;
     }
 
-    while (true)
+    if (!DiscoverWindows())
+        return false;
+
+    DWORD processId = NULL;
+    GetWindowThreadProcessId(_mainWindow, &processId);
+
+    if (_processIdList.find(processId) == _processIdList.end())
     {
-        _loginWindow = FindKakaoTalkLoginWindow();
-        if (MainWindow mainWindow; FindKakaoTalkMainWindow(mainWindow))
-        {
-            _mainWindow   = mainWindow.mainWindow;
-            _online       = mainWindow.online;
-            _lock         = mainWindow.lock;
-            _contactList  = mainWindow.contactList;
-            _chatroomList = mainWindow.chatroomList;
-            _misc         = mainWindow.misc;
-        }
-        _chatroomWindow = FindKakaoTalkChatroomWindow();
+        ProcessEvent event = {};
+        event.state        = ProcessState::Running;
+        event.processId    = processId;
+        _processIdList.emplace(processId, event);
+    }
+    _currentProcessId = processId;
 
-        if (_mainWindow != NULL)
-        {
-            DWORD processId = NULL;
-            GetWindowThreadProcessId(_mainWindow, &processId);
+    EvaluateState();
+    return true;
+}
 
-            _processIdList.insert(processId);
-            _currentProcessId = processId;
-            break;
-        }
+bool KakaoStateManager::Impl::DiscoverWindows()
+{
+    MainWindow mainWindow;
+    if (!FindKakaoTalkMainWindow(mainWindow))
+        return false;
 
-        std::this_thread::sleep_for(0.1s);
-    }
+    _loginWindow    = FindKakaoTalkLoginWindow();
+    _mainWindow     = mainWindow.mainWindow;
+    _online         = mainWindow.online;
+    _lock           = mainWindow.lock;
+    _contactList    = mainWindow.contactList;
+    _chatroomList   = mainWindow.chatroomList;
+    _misc           = mainWindow.misc;
+    _chatroomWindow = FindKakaoTalkChatroomWindow();
 
+    return true;
+}
+
+void KakaoStateManager::Impl::EvaluateState()
+{
     if (_loginWindow != NULL)
     {
         _currentState = KakaoState::LoggedOut;
@@ -435,11 +1078,265 @@ void KakaoStateManager::Impl::FindInitialState()
         _currentState = KakaoState::MiscIsVisible;
 }
 
-void KakaoStateManager::Impl::HandleProcessHook(ProcessWatcherMessage message, uint32_t processId)
+// Prefers the shared memory channel, and falls back to a socket on an endpoint private to this
+// instance if the channel cannot be created or the hook exits without opening it. `hookLock` is
+// taken before any transport is set up and left to the constructor to release. In the reactor
+// mode, the channel is polled by the reactor, and the transports that keep a receiving thread post
+// their events to it.
+void KakaoStateManager::Impl::ConnectProcessHook(std::unique_lock<std::mutex>& hookLock)
+{
+    ProcessWatcherSocketHandler postingHandler = std::bind(&Impl::HandleProcessHook, this, _1);
+    if (_reactor)
+    {
+        postingHandler = [this](ProcessEvent const& event) {
+            _reactor->Post([this, event]() { HandleProcessHook(event); });
+        };
+    }
+
+    // A process hook started by another instance is shared, which also spares the user another
+    // elevation prompt. Its snapshot replaces the scan the constructor runs meanwhile. Like the
+    // events of a hook of this instance, those of the subscriber wait for `hookLock`, and until it
+    // is known whether the subscriber is kept at all: one that attaches only after the timeout
+    // must neither report to this instance nor be stuck in HandleProcessHook() while destroyed.
+    hookLock.lock();
+
+    std::promise<bool> decision;
+    auto               adopted = decision.get_future().share();
+    auto               start   = StartupClock::now();
+
+    std::unique_ptr<ProcessWatcherSubscriber> subscriber {
+        new ProcessWatcherSubscriber {
+            ProcessWatcherBroker::MakeEndpoint(),
+            [adopted, postingHandler](ProcessEvent const& event) {
+                if (adopted.get())
+                    postingHandler(event);
+            },
+        },
+    };
+
+    std::vector<ProcessEvent> snapshot;
+    bool attached = subscriber->WaitForSnapshot(snapshot, std::chrono::milliseconds { 500 });
+    _startupTimings.subscribe = ToMicroseconds(StartupClock::now() - start);
+    decision.set_value(attached);
+    if (attached)
+    {
+        {
+            std::lock_guard guard { _stateMtx };
+            for (auto& event : snapshot) _processIdList.emplace(event.processId, event);
+        }
+
+        // A broker that stops answering is given up on like a hook of this instance would be.
+        std::lock_guard guard { _hookMtx };
+        subscriber->SetHeartbeatConfig(_heartbeatConfig);
+        subscriber->SetHeartbeatMissHandler([this](uint32_t) { HandleHookMissed(); });
+        _watcherSubscriber         = std::move(subscriber);
+        _startupTimings.sharedHook = true;
+        return;
+    }
+    subscriber.reset();
+
+    start = StartupClock::now();
+    if (std::unique_ptr<ProcessWatcherChannel> channel = LaunchChannel())
+    {
+        _startupTimings.hookLaunch = ToMicroseconds(StartupClock::now() - start);
+
+        std::lock_guard guard { _hookMtx };
+        _watcherChannel = std::move(channel);
+        return;
+    }
+
+    std::string endpoint = ProcessWatcherSocket::MakeEndpoint(GetCurrentProcessId());
+    _watcherSocket.reset(new ProcessWatcherSocket {
+        ProcessWatcherSocket::MakeServerSocket(endpoint, std::move(postingHandler)),
+    });
+
+    std::string argument = "socket:" + endpoint;
+    void*       client   = LaunchProcessHook(argument.c_str());
+    if (client == nullptr)
+        throw std::runtime_error { "Failed to launch client." };
+
+    if (!_watcherSocket->WaitForClient(client))
+        throw std::runtime_error { "The process hook exited before it connected." };
+
+    _startupTimings.hookLaunch = ToMicroseconds(StartupClock::now() - start);
+}
+
+// Returns null if the channel cannot be created or the hook exits without opening it. Every call
+// uses a channel of its own, as an abandoned hook may still hold on to the previous one.
+std::unique_ptr<ProcessWatcherChannel> KakaoStateManager::Impl::LaunchChannel()
+{
+    uint32_t        generation = _hookGeneration++;
+    HeartbeatConfig config     = {};
+    {
+        std::lock_guard guard { _hookMtx };
+        config = _heartbeatConfig;
+    }
+
+    std::unique_ptr<ProcessWatcherChannel> channel;
+    try
+    {
+        channel.reset(new ProcessWatcherChannel { ProcessWatcherChannel::MakeServerChannel(
+            ProcessWatcherChannel::MakeName(GetCurrentProcessId(), generation),
+            std::bind(&Impl::HandleProcessHook, this, _1)) });
+    }
+    catch (std::runtime_error const&)
+    {
+        return nullptr;
+    }
+
+    channel->SetHeartbeatConfig(config);
+    channel->SetHeartbeatMissHandler([this](uint32_t) { HandleHookMissed(); });
+
+    std::string argument = "channel:" + std::to_string(GetCurrentProcessId());
+    if (generation != 0)
+        argument += ":" + std::to_string(generation);
+
+    void* client = LaunchProcessHook(argument.c_str());
+    if (client == nullptr)
+        throw std::runtime_error { "Failed to launch client." };
+
+    if (!channel->WaitForClient(client, !_reactor))
+        return nullptr;
+
+    if (_reactor)
+    {
+        ProcessWatcherChannel* polled = channel.get();
+        _reactor->AddSource((intptr_t)channel->GetDoorbell(), [polled]() { polled->Poll(); });
+    }
+    return channel;
+}
+
+// Called from wherever heartbeats are sent. Relaunching waits for the elevation prompt, so it
+// runs on a thread of its own in either mode.
+void KakaoStateManager::Impl::HandleHookMissed()
+{
+    std::lock_guard guard { _hookMtx };
+    if (_restartRunning || _restartStopping)
+        return;
+
+    // The previous restart thread has already left, so joining it here is immediate.
+    if (_restartThread.joinable())
+        _restartThread.join();
+
+    _restartRunning = true;
+    _restartThread  = std::thread { &KakaoStateManager::Impl::RestartProcessHook, this };
+}
+
+// A shared hook that stopped answering is left to its other subscribers, and replaced by a hook of
+// this instance.
+void KakaoStateManager::Impl::RestartProcessHook()
+{
+    ThreadCounter counter { _numThreads };
+
+    std::unique_ptr<ProcessWatcherSubscriber> subscriber;
+    std::unique_ptr<ProcessWatcherChannel>    channel;
+    {
+        std::lock_guard guard { _hookMtx };
+        subscriber = std::move(_watcherSubscriber);
+        channel    = std::move(_watcherChannel);
+    }
+
+    // Outside the lock, as its thread may be waiting for it in the miss handler.
+    subscriber.reset();
+
+    if (channel)
+    {
+        channel->Abandon();
+        if (_reactor)
+        {
+            // It may be in the middle of Poll() or Heartbeat() on the reactor thread.
+            ProcessWatcherChannel* polled = channel.release();
+            _reactor->Post([this, polled]() {
+                _reactor->RemoveSource((intptr_t)polled->GetDoorbell());
+                delete polled;
+            });
+        }
+        else
+            channel.reset();
+    }
+
+    try
+    {
+        channel = LaunchChannel();
+    }
+    catch (std::runtime_error const&)
+    {
+        channel.reset();
+    }
+
+    _numRestarts.fetch_add(1, std::memory_order_relaxed);
+    if (!channel)
+        _numFailedRestarts.fetch_add(1, std::memory_order_relaxed);
+
+    // The new hook reports the processes that are running, but not those that exited while no hook
+    // was watching.
+    std::vector<ProcessEvent> stoppedList;
+    {
+        std::lock_guard guard { _stateMtx };
+
+        auto runningList = GetKakaoTalkProcessIdList();
+        for (auto& [processId, event] : _processIdList)
+        {
+            auto it = runningList.find(processId);
+            if (it != runningList.end() && IsSameProcess(it->second, event))
+                continue;
+
+            ProcessEvent stopped = event;
+            stopped.state        = ProcessState::Stopped;
+            stoppedList.push_back(stopped);
+        }
+    }
+
+    for (auto& event : stoppedList)
+    {
+        if (_reactor)
+            _reactor->Post([this, event]() { HandleProcessHook(event); });
+        else
+            HandleProcessHook(event);
+    }
+
+    std::lock_guard guard { _hookMtx };
+    _watcherChannel = std::move(channel);
+    _restartRunning = false;
+}
+
+// The receiving threads of the transports use members declared after them and may start the
+// message thread, so the transports go before anything else is torn down.
+void KakaoStateManager::Impl::StopProcessHook()
+{
+    std::unique_ptr<ProcessWatcherSubscriber> subscriber;
+    std::unique_ptr<ProcessWatcherChannel>    channel;
+    {
+        std::lock_guard guard { _hookMtx };
+        subscriber = std::move(_watcherSubscriber);
+        channel    = std::move(_watcherChannel);
+    }
+
+    subscriber.reset();
+    _watcherSocket.reset();
+
+    if (channel && _reactorThread.joinable())
+    {
+        // It may be in the middle of Poll() or Heartbeat() on the reactor thread.
+        ProcessWatcherChannel* polled = channel.release();
+        _reactor->Post([this, polled]() {
+            _reactor->RemoveSource((intptr_t)polled->GetDoorbell());
+            delete polled;
+        });
+    }
+    channel.reset();
+}
+
+void KakaoStateManager::Impl::HandleProcessHook(ProcessEvent const& event)
 {
     using namespace std::chrono_literals;
 
-    if (message == ProcessWatcherMessage::Running)
+    // Only a restart of the hook calls this from a second thread. The constructor holds the lock
+    // from the setup of its transport, shared or not, until the initial state is known.
+    std::lock_guard<std::mutex> hookGuard { _processHookMtx };
+
+    uint32_t processId = event.processId;
+    if (event.state == ProcessState::Running)
     {
         bool initialize = false;
         {
@@ -449,23 +1346,27 @@ void KakaoStateManager::Impl::HandleProcessHook(ProcessWatcherMessage message, u
                 _currentProcessId = processId;
                 initialize        = true;
             }
-            _processIdList.insert(processId);
+
+            // A known process is reported again when the hook starts; a different creation time
+            // means the ID was reused after an exit we never saw.
+            auto [it, inserted] = _processIdList.try_emplace(processId, event);
+            if (!inserted && (!IsSameProcess(it->second, event) || it->second.creationTime == 0))
+                it->second = event;
         }
 
         if (initialize)
-        {
-            FindInitialState();
-            CallHandlers();
-            RunThread();
-        }
+            Initialize();
     }
-    else if (message == ProcessWatcherMessage::Stopped)
+    else if (event.state == ProcessState::Stopped)
     {
         std::lock_guard guard { _stateMtx };
 
+        // An exit of an earlier process with the same ID must not remove the current one.
         auto it = _processIdList.find(processId);
-        if (it != _processIdList.end())
-            _processIdList.erase(it);
+        if (it == _processIdList.end() || !IsSameProcess(it->second, event))
+            return;
+
+        _processIdList.erase(it);
 
         if (_processIdList.empty())
         {
@@ -477,6 +1378,88 @@ void KakaoStateManager::Impl::HandleProcessHook(ProcessWatcherMessage message, u
     }
 }
 
+// Runs inside the WinEvent callback, so it must return quickly and never block.
+void KakaoStateManager::Impl::PushWindowEvent(HookEventRecord const& record)
+{
+    if (!_eventRing.TryPush(WindowEventRecord { record, GetQueueTime() }))
+    {
+        // The event is lost, so whatever state it would have produced has to be rediscovered.
+        _numOverflowed.fetch_add(1, std::memory_order_relaxed);
+        _resyncRequested = true;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_stateThreadWaiting.load(std::memory_order_relaxed))
+        SetEvent(_eventReady);
+}
+
+void KakaoStateManager::Impl::HandleStateEvents()
+{
+    ThreadCounter     counter { _numThreads };
+    WindowEventRecord batch[WindowEventBatchSize];
+    while (true)
+    {
+        if (_resyncRequested.exchange(false))
+        {
+            // Events queued before the overflow describe a state the resync replaces anyway.
+            while (_eventRing.PopBatch(batch, WindowEventBatchSize) != 0) continue;
+            Resync();
+            continue;
+        }
+
+        if (size_t count = _eventRing.PopBatch(batch, WindowEventBatchSize); count != 0)
+        {
+            int64_t dequeuedNs = GetQueueTime();
+            for (size_t i = 0; i < count; ++i)
+                ApplyWindowEvent(batch[i].hook, dequeuedNs - batch[i].queuedNs);
+            continue;
+        }
+
+        if (_stateThreadStopping)
+            break;
+
+        _stateThreadWaiting = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_eventRing.IsEmpty() && !_resyncRequested && !_stateThreadStopping)
+            WaitForSingleObject(_eventReady, INFINITE);
+        _stateThreadWaiting = false;
+    }
+}
+
+void KakaoStateManager::Impl::ApplyWindowEvent(HookEventRecord const& record, int64_t queueDelayNs)
+{
+    _queueLatency.Record((uint64_t)queueDelayNs);
+
+    // Events from different threads of KakaoTalk can arrive out of order. One older than what the
+    // state already reflects of its window would only move it backwards.
+    if (!_eventOrder.Admit((uintptr_t)record.window, record.eventTimeMs))
+    {
+        _numStale.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    HandleWindowHook(record.window, record.event);
+
+    DWORD elapsedMs = GetTickCount() - record.eventTimeMs;
+    _eventToStateLatency.Record(uint64_t { elapsedMs } * 1000000);
+}
+
+void KakaoStateManager::Impl::Resync()
+{
+    std::lock_guard<std::mutex> guard { _stateMtx };
+    if (_currentState == KakaoState::NotRunning || !DiscoverWindows())
+        return;
+
+    KakaoState oldState = _currentState;
+    EvaluateState();
+    _eventOrder.Resync(GetTickCount());
+    _numResyncs.fetch_add(1, std::memory_order_relaxed);
+
+    if (_currentState != oldState)
+        CallHandlers();
+    UpdateHookWindows();
+}
+
 void KakaoStateManager::Impl::HandleWindowHook(HWND window, DWORD event)
 {
     if (_currentState != KakaoState::NotRunning)
@@ -663,10 +1646,101 @@ void KakaoStateManager::Impl::HandleWindowHook(HWND window, DWORD event)
             _chatroomWindow = newChatroomWindow;
 
             CallHandlers();
+            UpdateHookWindows();
         }
     }
 }
 
+void KakaoStateManager::Impl::UpdateHookWindows()
+{
+    std::lock_guard<std::mutex> guard { _hookHandleMtx };
+    if (_hookHandle == NULL)
+        return;
+
+    HWND windowList[] = {
+        _loginWindow, _mainWindow, _online, _contactList,
+        _chatroomList, _misc, _lock, _chatroomWindow,
+    };
+    HookSetWindows(_hookHandle, windowList, sizeof windowList / sizeof windowList[0]);
+}
+
+WindowEventStatistics KakaoStateManager::Impl::GetWindowEventStatistics()
+{
+    HookStatistics statistics = {};
+    {
+        std::lock_guard<std::mutex> guard { _hookHandleMtx };
+        if (_hookHandle != NULL)
+            HookGetStatistics(_hookHandle, &statistics);
+    }
+
+    return WindowEventStatistics {
+        statistics.numForwarded,
+        statistics.numDropped,
+        _numOverflowed.load(std::memory_order_relaxed),
+        _numResyncs.load(std::memory_order_relaxed),
+        _numStale.load(std::memory_order_relaxed),
+    };
+}
+
+WindowEventLatency KakaoStateManager::Impl::GetWindowEventLatency()
+{
+    return WindowEventLatency {
+        _eventToStateLatency.GetSnapshot(),
+        _queueLatency.GetSnapshot(),
+    };
+}
+
+ProcessEvent KakaoStateManager::Impl::GetProcessInfo()
+{
+    std::lock_guard guard { _stateMtx };
+
+    auto it = _processIdList.find(_currentProcessId);
+    if (it == _processIdList.end())
+        return ProcessEvent {};
+
+    return it->second;
+}
+
+size_t KakaoStateManager::Impl::GetNumThreads()
+{
+    std::lock_guard guard { _hookMtx };
+
+    // The transports' receiving threads are not counted by the manager itself.
+    bool receiving = _watcherSubscriber || _watcherSocket || (_watcherChannel && !_reactor);
+    return _numThreads.load(std::memory_order_relaxed) + (receiving ? 1 : 0);
+}
+
+void KakaoStateManager::Impl::SetHeartbeatConfig(HeartbeatConfig config)
+{
+    std::lock_guard guard { _hookMtx };
+
+    _heartbeatConfig = config;
+    if (_watcherChannel)
+        _watcherChannel->SetHeartbeatConfig(config);
+    if (_watcherSubscriber)
+        _watcherSubscriber->SetHeartbeatConfig(config);
+}
+
+ProcessHookHealth KakaoStateManager::Impl::GetProcessHookHealth()
+{
+    std::lock_guard guard { _hookMtx };
+
+    ProcessHookHealth health = {};
+    if (_watcherChannel)
+    {
+        health.heartbeat = _watcherChannel->GetHeartbeatStatistics();
+        health.connected = true;
+    }
+    else if (_watcherSubscriber)
+    {
+        health.heartbeat = _watcherSubscriber->GetHeartbeatStatistics();
+        health.connected = true;
+    }
+    health.numRestarts       = _numRestarts.load(std::memory_order_relaxed);
+    health.numFailedRestarts = _numFailedRestarts.load(std::memory_order_relaxed);
+    return health;
+}
+
 }
 
 #pragma endregion
@@ -695,7 +1769,12 @@ KakaoState ktmac::KakaoStateManager::GetCurrentState()
 }
 
 KakaoStateManager::KakaoStateManager(std::initializer_list<HandlerPairType> init) :
-    _impl { new KakaoStateManager::Impl { std::move(init) } }
+    _impl { new KakaoStateManager::Impl { KakaoThreadingMode::Threaded, std::move(init) } }
+{}
+
+KakaoStateManager::KakaoStateManager(KakaoThreadingMode                     mode,
+                                     std::initializer_list<HandlerPairType> init) :
+    _impl { new KakaoStateManager::Impl { mode, std::move(init) } }
 {}
 
 KakaoStateManager::~KakaoStateManager()
@@ -734,6 +1813,112 @@ bool KakaoStateManager::SendMessage()
 }
 #pragma pop_macro("SendMessage")
 
+void KakaoStateManager::SetGlobalRateLimit(RateLimit limit)
+{
+    if (_impl)
+        _impl->GetRateLimiter().SetGlobalLimit(limit);
+}
+
+void KakaoStateManager::SetChatroomRateLimit(RateLimit limit)
+{
+    if (_impl)
+        _impl->GetRateLimiter().SetRoomLimit(limit);
+}
+
+RateLimit KakaoStateManager::GetGlobalRateLimit()
+{
+    if (_impl)
+        return _impl->GetRateLimiter().GetGlobalLimit();
+    return RateLimit {};
+}
+
+RateLimit KakaoStateManager::GetChatroomRateLimit()
+{
+    if (_impl)
+        return _impl->GetRateLimiter().GetRoomLimit();
+    return RateLimit {};
+}
+
+RateLimiterLevels KakaoStateManager::GetRateLimiterLevels()
+{
+    if (_impl)
+        return _impl->GetRateLimiterLevels();
+    return RateLimiterLevels {};
+}
+
+void KakaoStateManager::SetTextInjectionMethod(size_t minLength, TextInjectionMethod method)
+{
+    if (_impl)
+        _impl->SetTextInjectionMethod(minLength, method);
+}
+
+void KakaoStateManager::SetDeliveryTimeout(uint32_t timeoutMs)
+{
+    if (_impl)
+        _impl->SetDeliveryTimeout(timeoutMs);
+}
+
+void KakaoStateManager::SetCircuitBreakerConfig(CircuitBreakerConfig config)
+{
+    if (_impl)
+        _impl->SetCircuitBreakerConfig(config);
+}
+
+DeliveryMetrics KakaoStateManager::GetDeliveryMetrics()
+{
+    if (_impl)
+        return _impl->GetDeliveryMetrics();
+    return DeliveryMetrics {};
+}
+
+WindowEventStatistics KakaoStateManager::GetWindowEventStatistics()
+{
+    if (_impl)
+        return _impl->GetWindowEventStatistics();
+    return WindowEventStatistics {};
+}
+
+WindowEventLatency KakaoStateManager::GetWindowEventLatency()
+{
+    if (_impl)
+        return _impl->GetWindowEventLatency();
+    return WindowEventLatency {};
+}
+
+ProcessEvent KakaoStateManager::GetProcessInfo()
+{
+    if (_impl)
+        return _impl->GetProcessInfo();
+    return ProcessEvent {};
+}
+
+size_t KakaoStateManager::GetNumThreads()
+{
+    if (_impl)
+        return _impl->GetNumThreads();
+    return 0;
+}
+
+void KakaoStateManager::SetHeartbeatConfig(HeartbeatConfig config)
+{
+    if (_impl)
+        _impl->SetHeartbeatConfig(config);
+}
+
+ProcessHookHealth KakaoStateManager::GetProcessHookHealth()
+{
+    if (_impl)
+        return _impl->GetProcessHookHealth();
+    return ProcessHookHealth {};
+}
+
+StartupTimings KakaoStateManager::GetStartupTimings()
+{
+    if (_impl)
+        return _impl->GetStartupTimings();
+    return StartupTimings {};
+}
+
 }
 
 #pragma endregion
\ No newline at end of file
@@ -2,6 +2,8 @@
 // Licensed under the MIT License.
 
 #include <ktmac/ProcessWatcher.hh>
+#include <ktmac/ProcessWatcherBroker.hh>
+#include <ktmac/ProcessWatcherChannel.hh>
 #include <ktmac/ProcessWatcherSocket.hh>
 
 #include <Windows.h>
@@ -10,27 +12,135 @@
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 
 using namespace ktmac;
 
-int Run(int portNumber)
-try
+namespace
 {
-    ProcessWatcherSocket socket { ProcessWatcherSocket::MakeClientSocket(portNumber) };
 
+constexpr char const ChannelPrefix[] = "channel:";
+constexpr char const SocketPrefix[]  = "socket:";
+
+void Watch(ProcessWatcherSocket& socket)
+{
     ProcessWatcher watcher {
-        "KakaoTalk.exe",
-        [&socket](ProcessState state, uint32_t processId) {
-            if (state == ProcessState::Running)
-                socket.Send(ProcessWatcherMessage::Running, processId);
-            else
-                socket.Send(ProcessWatcherMessage::Stopped, processId);
-        },
+        std::vector<std::string> { "KakaoTalk.exe" },
+        [&socket](ProcessEvent const* events, size_t numEvents) { socket.Send(events, numEvents); },
     };
 
     socket.WaitUntilQuit();
+}
+
+// Best effort: another hook of the same user and session may already be serving the endpoint, in
+// which case only the spawning core is served.
+std::unique_ptr<ProcessWatcherBroker> MakeBroker()
+{
+    if (!ProcessWatcherSocket::InitializeWinSock())
+        return nullptr;
+
+    try
+    {
+        return std::make_unique<ProcessWatcherBroker>();
+    }
+    catch (std::runtime_error const&)
+    {
+        ProcessWatcherSocket::UninitializeWinSock();
+        return nullptr;
+    }
+}
+
+}
+
+int Run(std::string const& endpoint)
+try
+{
+    ProcessWatcherSocket socket { ProcessWatcherSocket::MakeClientSocket(endpoint) };
+    Watch(socket);
+
+    return 0;
+}
+catch (std::exception const& ex)
+{
+    MessageBox(NULL, ex.what(), "ktmac-process-hook error", MB_OK | MB_ICONERROR);
+    return 1;
+}
+
+// The core passes its own process ID and the generation of the hook; the channel is named after
+// them, and the hook quits if the core goes away without closing the channel. Events are also
+// published to the broker, if there is one, for cores that did not start this hook.
+int RunChannel(uint32_t serverProcessId, uint32_t generation)
+try
+{
+    HANDLE server = OpenProcess(SYNCHRONIZE, FALSE, serverProcessId);
+    if (server == NULL)
+        return 1;
+
+    std::unique_ptr<ProcessWatcherChannel> channel { new ProcessWatcherChannel {
+        ProcessWatcherChannel::MakeClientChannel(
+            ProcessWatcherChannel::MakeName(serverProcessId, generation), server) } };
+    std::mutex channelMtx;
+
+    std::unique_ptr<ProcessWatcherBroker> broker = MakeBroker();
+    std::thread                           brokerThread;
+    if (broker)
+        brokerThread = std::thread { &ProcessWatcherBroker::Run, broker.get() };
+
+    // One watcher serves the hook from start to end, so no event is lost when the spawning core
+    // goes away; only its targets change.
+    std::unique_ptr<ProcessWatcher> watcher;
+    try
+    {
+        watcher = std::make_unique<ProcessWatcher>(
+            std::vector<std::string> { "KakaoTalk.exe" },
+            [&channel, &channelMtx, &broker](ProcessEvent const* events, size_t numEvents) {
+                {
+                    std::lock_guard<std::mutex> guard { channelMtx };
+                    if (channel)
+                        channel->Send(events, numEvents);
+                }
+                if (broker)
+                    broker->Publish(events, numEvents);
+            });
+
+        channel->WaitUntilQuit();
+    }
+    catch (...)
+    {
+        watcher.reset();
+        if (broker)
+        {
+            broker->Stop();
+            brokerThread.join();
+        }
+        throw;
+    }
+
+    // The spawning core is gone, but the hook keeps watching for as long as subscribers remain.
+    std::unique_ptr<ProcessWatcherChannel> closed;
+    {
+        std::lock_guard<std::mutex> guard { channelMtx };
+        closed = std::move(channel);
+    }
+    closed.reset();
+
+    if (broker)
+    {
+        broker->StopWhenIdle();
+        brokerThread.join();
+    }
+
+    watcher.reset();
+    if (broker)
+    {
+        broker.reset();
+        ProcessWatcherSocket::UninitializeWinSock();
+    }
 
     return 0;
 }
@@ -45,21 +155,48 @@ int WINAPI WinMain(__in HINSTANCE, __in_opt HINSTANCE, __in LPSTR commandLine, _
     if (!ProcessWatcher::CheckAdministratorPrivilege())
         return 1;
 
-    int portNumber = 0;
-    if (std::from_chars(commandLine, commandLine + strlen(commandLine), portNumber).ec
-        != std::errc {})
+    // "socket:<endpoint>"; the endpoint is a path and takes the rest of the line.
+    if (strncmp(commandLine, SocketPrefix, sizeof SocketPrefix - 1) == 0)
+    {
+        std::string endpoint = commandLine + sizeof SocketPrefix - 1;
+        if (endpoint.empty() || !ProcessWatcher::InitializeCom())
+            return 1;
+
+        if (!ProcessWatcherSocket::InitializeWinSock())
+        {
+            ProcessWatcher::UninitializeCom();
+            return 1;
+        }
+
+        int exitCode = Run(endpoint);
+
+        ProcessWatcher::UninitializeCom();
+        ProcessWatcherSocket::UninitializeWinSock();
+
+        return exitCode;
+    }
+
+    if (strncmp(commandLine, ChannelPrefix, sizeof ChannelPrefix - 1) != 0)
         return 1;
 
-    if (!ProcessWatcher::InitializeCom())
+    char const* number = commandLine + sizeof ChannelPrefix - 1;
+    char const* end    = number + strlen(number);
+
+    uint32_t id  = 0;
+    auto     rtn = std::from_chars(number, end, id);
+    if (rtn.ec != std::errc {})
         return 1;
 
-    if (!ProcessWatcherSocket::InitializeWinSock())
+    // "channel:<pid>:<generation>" once the core has restarted the hook.
+    uint32_t generation = 0;
+    if (rtn.ptr != end
+        && (*rtn.ptr != ':' || std::from_chars(rtn.ptr + 1, end, generation).ec != std::errc {}))
         return 1;
 
-    int rtn = Run(portNumber);
+    if (!ProcessWatcher::InitializeCom())
+        return 1;
 
+    int exitCode = RunChannel(id, generation);
     ProcessWatcher::UninitializeCom();
-    ProcessWatcherSocket::UninitializeWinSock();
-
-    return rtn;
+    return exitCode;
 }
@@ -0,0 +1,96 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessInfo.hh>
+
+#include <Windows.h>
+
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+using Version = std::array<uint16_t, 4>;
+
+std::mutex                               _versionMtx;
+std::unordered_map<std::wstring, Version> _versionList;
+
+Version QueryFileVersion(wchar_t const* path)
+{
+    {
+        std::lock_guard<std::mutex> guard { _versionMtx };
+        if (auto it = _versionList.find(path); it != _versionList.end())
+            return it->second;
+    }
+
+    Version rtn {};
+    DWORD   handle = 0;
+    if (DWORD size = GetFileVersionInfoSizeW(path, &handle); size != 0)
+    {
+        std::vector<char> buffer(size);
+        VS_FIXEDFILEINFO* info   = nullptr;
+        UINT              length = 0;
+        if (GetFileVersionInfoW(path, 0, size, buffer.data())
+            && VerQueryValueW(buffer.data(), L"\\", (LPVOID*)&info, &length) && info != nullptr)
+        {
+            rtn[0] = HIWORD(info->dwFileVersionMS);
+            rtn[1] = LOWORD(info->dwFileVersionMS);
+            rtn[2] = HIWORD(info->dwFileVersionLS);
+            rtn[3] = LOWORD(info->dwFileVersionLS);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard { _versionMtx };
+    _versionList.emplace(path, rtn);
+    return rtn;
+}
+
+}
+
+namespace ktmac
+{
+
+bool QueryProcessInfo(void* process, ProcessEvent& event)
+{
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes((HANDLE)process, &creation, &exit, &kernel, &user))
+        return false;
+
+    event.creationTime = ((uint64_t)creation.dwHighDateTime << 32) | creation.dwLowDateTime;
+
+    DWORD sessionId = 0;
+    if (ProcessIdToSessionId(event.processId, &sessionId))
+        event.sessionId = sessionId;
+
+    wchar_t path[MAX_PATH];
+    DWORD   length = MAX_PATH;
+    if (QueryFullProcessImageNameW((HANDLE)process, 0, path, &length))
+    {
+        Version version = QueryFileVersion(path);
+        memcpy(event.version, version.data(), sizeof event.version);
+
+        if (event.imageName[0] == '\0')
+        {
+            wchar_t const* name = wcsrchr(path, L'\\');
+            name                = name != nullptr ? name + 1 : path;
+            WideCharToMultiByte(
+                CP_UTF8, 0, name, -1, event.imageName, sizeof event.imageName, NULL, NULL);
+            event.imageName[sizeof event.imageName - 1] = '\0';
+        }
+    }
+
+    return true;
+}
+
+void SetProcessImageName(ProcessEvent& event, char const* imageName)
+{
+    strncpy(event.imageName, imageName, sizeof event.imageName - 1);
+    event.imageName[sizeof event.imageName - 1] = '\0';
+}
+
+}
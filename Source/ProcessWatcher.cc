@@ -1,6 +1,7 @@
 // Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
 // Licensed under the MIT License.
 
+#include <ktmac/ProcessInfo.hh>
 #include <ktmac/ProcessWatcher.hh>
 
 #include <WbemIdl.h>
@@ -8,7 +9,10 @@
 #include <comdef.h>
 #include <wrl.h>
 
+#include <TlHelp32.h>
+
 #include <stdexcept>
+#include <vector>
 
 using Microsoft::WRL::ComPtr;
 
@@ -63,6 +67,27 @@ ComPtr<IUnsecuredApartment> CreateUnsecuredApartment()
     return unsecuredApt;
 }
 
+std::string MakeStartQuery(std::vector<std::string> const& processNameList)
+{
+    std::string query = "SELECT * FROM Win32_ProcessStartTrace WHERE ";
+    for (size_t i = 0; i < processNameList.size(); ++i)
+    {
+        if (i != 0)
+            query += " OR ";
+
+        query += "ProcessName = '";
+        for (char ch : processNameList[i])
+        {
+            if (ch == '\\' || ch == '\'')
+                query += '\\';
+            query += ch;
+        }
+        query += '\'';
+    }
+
+    return query;
+}
+
 ComPtr<IWbemObjectSink> CreateObjectSink(ktmac::WmiEventSink* eventSink,
                                          IUnsecuredApartment* unsecuredApt)
 {
@@ -77,6 +102,15 @@ ComPtr<IWbemObjectSink> CreateObjectSink(ktmac::WmiEventSink* eventSink,
     return stubSink;
 }
 
+uint32_t GetUint32(IWbemClassObject* object, wchar_t const* name)
+{
+    VARIANT value = {};
+    if (FAILED(object->Get(name, 0, &value, NULL, NULL)))
+        return 0;
+
+    return value.uintVal;
+}
+
 }
 
 namespace ktmac
@@ -124,42 +158,33 @@ void ProcessWatcher::UninitializeCom()
 }
 
 ProcessWatcher::ProcessWatcher(std::string&& processName, ProcessStateHandler&& stateHandler) :
+    ProcessWatcher(std::vector<std::string> { std::move(processName) },
+                   MakeBatchHandler(std::move(stateHandler)))
+{}
+
+ProcessWatcher::ProcessWatcher(std::vector<std::string>&& processNameList,
+                               ProcessEventBatchHandler&& batchHandler) :
+    ProcessEventSource { std::move(batchHandler) },
     _wbemLocator { std::move(CreateWbemLocator()) },
     _services { std::move(CreateWbemServices(_wbemLocator.Get())) },
     _unsecuredApt { std::move(CreateUnsecuredApartment()) },
     _processStartDetector {
         new WmiEventSink([this](long numObjects, IWbemClassObject** objects) {
-            if (_stateHandler)
-            {
-                for (long i = 0; i < numObjects; ++i)
-                {
-                    VARIANT value = {};
-                    objects[i]->Get(L"ProcessID", 0, &value, NULL, NULL);
-                    _stateHandler(ProcessState::Running, value.uintVal);
-                }
-            }
-        }),
-    },
-    _processStopDetector {
-        new WmiEventSink([this](long numObjects, IWbemClassObject** objects) {
-            if (_stateHandler)
-            {
-                for (long i = 0; i < numObjects; ++i)
-                {
-                    VARIANT value = {};
-                    objects[i]->Get(L"ProcessID", 0, &value, NULL, NULL);
-                    _stateHandler(ProcessState::Stopped, value.uintVal);
-                }
-            }
+            HandleStart(numObjects, objects);
         }),
     },
     _processStartSink { CreateObjectSink(_processStartDetector, _unsecuredApt.Get()) },
-    _processStopSink { CreateObjectSink(_processStopDetector, _unsecuredApt.Get()) },
-    _processName { std::move(processName) },
-    _stateHandler { std::move(stateHandler) }
+    _processNameList { std::move(processNameList) },
+    _waitMtx {},
+    _waitCondition {},
+    _waitList {},
+    _numActiveCallbacks { 0 },
+    _stopping { false }
 {
-    std::string processStartQuery
-        = "SELECT * FROM Win32_ProcessStartTrace where ProcessName LIKE '%" + _processName + "%'";
+    if (_processNameList.empty())
+        throw std::invalid_argument { "processNameList is empty." };
+
+    std::string processStartQuery = MakeStartQuery(_processNameList);
     if (FAILED(_services->ExecNotificationQueryAsync(_bstr_t("WQL"),
                                                      _bstr_t(processStartQuery.c_str()),
                                                      WBEM_FLAG_SEND_STATUS,
@@ -167,20 +192,221 @@ ProcessWatcher::ProcessWatcher(std::string&& processName, ProcessStateHandler&&
                                                      _processStartSink.Get())))
         throw std::runtime_error { "Failed to execute win32_ProcessStartTrace query." };
 
-    std::string processStopQuery
-        = "SELECT * FROM Win32_ProcessStopTrace where ProcessName LIKE '%" + _processName + "%'";
-    if (FAILED(_services->ExecNotificationQueryAsync(_bstr_t("WQL"),
-                                                     _bstr_t(processStopQuery.c_str()),
-                                                     WBEM_FLAG_SEND_STATUS,
-                                                     NULL,
-                                                     _processStopSink.Get())))
-        throw std::runtime_error { "Failed to execute win32_ProcessStopTrace query." };
+    WatchExisting();
 }
 
 ProcessWatcher::~ProcessWatcher()
 {
     _services->CancelAsyncCall(_processStartSink.Get());
-    _services->CancelAsyncCall(_processStopSink.Get());
+
+    std::unordered_map<uint32_t, std::unique_ptr<ExitWait>> waitList;
+    {
+        std::unique_lock<std::mutex> lock { _waitMtx };
+        _stopping = true;
+        _waitCondition.wait(lock, [this]() { return _numActiveCallbacks == 0; });
+        waitList.swap(_waitList);
+    }
+
+    // Blocks until a callback that already started for the wait has returned.
+    for (auto& pair : waitList)
+    {
+        UnregisterWaitEx(pair.second->wait, INVALID_HANDLE_VALUE);
+        CloseHandle(pair.second->process);
+    }
+}
+
+void CALLBACK ProcessWatcher::HandleExit(PVOID context, BOOLEAN timedOut)
+{
+    auto&           exitWait  = *(ExitWait*)context;
+    ProcessWatcher& watcher   = *exitWait.watcher;
+    uint32_t        processId = exitWait.info.processId;
+
+    std::unique_ptr<ExitWait> finished;
+    {
+        std::lock_guard<std::mutex> guard { watcher._waitMtx };
+        if (watcher._stopping)
+            return;
+
+        auto it = watcher._waitList.find(processId);
+        if (it == watcher._waitList.end() || it->second.get() != &exitWait)
+            return;
+
+        finished = std::move(it->second);
+        watcher._waitList.erase(it);
+        ++watcher._numActiveCallbacks;
+    }
+
+    // A wait must be unregistered even after it has fired; with a null completion event this does
+    // not block, so it is safe from inside the callback.
+    UnregisterWaitEx(finished->wait, NULL);
+    CloseHandle(finished->process);
+
+    ProcessEvent event = finished->info;
+    event.state        = ProcessState::Stopped;
+    watcher.Report(&event, 1);
+
+    std::lock_guard<std::mutex> guard { watcher._waitMtx };
+    if (--watcher._numActiveCallbacks == 0)
+        watcher._waitCondition.notify_all();
+}
+
+void ProcessWatcher::HandleStart(long numObjects, IWbemClassObject** objects)
+{
+    std::vector<ProcessEvent> eventList;
+    std::vector<HANDLE>       processList;
+    eventList.reserve(numObjects);
+    processList.reserve(numObjects);
+    for (long i = 0; i < numObjects; ++i)
+    {
+        // The query already filters by name; this guards against WMI matching more loosely than
+        // an exact comparison, e.g. through collation.
+        VARIANT name = {};
+        if (FAILED(objects[i]->Get(L"ProcessName", 0, &name, NULL, NULL)))
+            continue;
+
+        ProcessEvent event   = {};
+        bool         watched = false;
+        if (name.vt == VT_BSTR)
+        {
+            _bstr_t processName { name.bstrVal };
+            watched = IsWatched(processName);
+            SetProcessImageName(event, processName);
+        }
+        VariantClear(&name);
+        if (!watched)
+            continue;
+
+        event.state           = ProcessState::Running;
+        event.processId       = GetUint32(objects[i], L"ProcessID");
+        event.parentProcessId = GetUint32(objects[i], L"ParentProcessID");
+        event.sessionId       = GetUint32(objects[i], L"SessionID");
+
+        // Opened before the start is reported so the creation time and version go with it.
+        HANDLE process = NULL;
+        if (!Open(event, process))
+            process = INVALID_HANDLE_VALUE;
+
+        eventList.push_back(event);
+        processList.push_back(process);
+    }
+
+    if (eventList.empty())
+        return;
+
+    Report(eventList.data(), eventList.size());
+
+    // Exits are only reported after the starts they belong to.
+    size_t numStarted = eventList.size();
+    for (size_t i = 0; i < numStarted; ++i)
+    {
+        if (processList[i] != INVALID_HANDLE_VALUE)
+            Watch(eventList[i], processList[i]);
+        else
+        {
+            eventList.push_back(eventList[i]);
+            eventList.back().state = ProcessState::Stopped;
+        }
+    }
+
+    Report(eventList.data() + numStarted, eventList.size() - numStarted);
+}
+
+bool ProcessWatcher::IsWatched(char const* processName) const
+{
+    for (auto& name : _processNameList)
+    {
+        if (_stricmp(name.c_str(), processName) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Returns false if the process has already exited. `process` is left null if the process exists
+// but cannot be opened.
+bool ProcessWatcher::Open(ProcessEvent& event, HANDLE& process)
+{
+    process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, event.processId);
+    if (process == NULL)
+        return GetLastError() != ERROR_INVALID_PARAMETER;
+
+    QueryProcessInfo(process, event);
+    return true;
+}
+
+void ProcessWatcher::Watch(ProcessEvent const& event, HANDLE process)
+{
+    if (process == NULL)
+        return;
+
+    std::lock_guard<std::mutex> guard { _waitMtx };
+    if (_stopping || _waitList.find(event.processId) != _waitList.end())
+    {
+        CloseHandle(process);
+        return;
+    }
+
+    auto exitWait = std::make_unique<ExitWait>(ExitWait { this, event, process, NULL });
+    if (!RegisterWaitForSingleObject(&exitWait->wait,
+                                     process,
+                                     HandleExit,
+                                     exitWait.get(),
+                                     INFINITE,
+                                     WT_EXECUTEONLYONCE))
+    {
+        CloseHandle(process);
+        return;
+    }
+
+    // The callback cannot look the entry up before we release the lock.
+    _waitList.emplace(event.processId, std::move(exitWait));
+}
+
+void ProcessWatcher::WatchExisting()
+{
+    PROCESSENTRY32 entry = {};
+    entry.dwSize         = sizeof(PROCESSENTRY32);
+
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, NULL);
+    if (snapshot == INVALID_HANDLE_VALUE)
+        return;
+
+    std::vector<ProcessEvent> eventList;
+    if (Process32First(snapshot, &entry) == TRUE)
+    {
+        do
+        {
+            if (!IsWatched(entry.szExeFile))
+                continue;
+
+            ProcessEvent event    = {};
+            event.state           = ProcessState::Running;
+            event.processId       = entry.th32ProcessID;
+            event.parentProcessId = entry.th32ParentProcessID;
+            SetProcessImageName(event, entry.szExeFile);
+            eventList.push_back(event);
+        } while (Process32Next(snapshot, &entry) == TRUE);
+    }
+    CloseHandle(snapshot);
+
+    // Processes that exit between the snapshot and here are dropped; the rest are reported as
+    // running so a receiver gets their metadata without taking its own snapshot.
+    std::vector<HANDLE> processList;
+    size_t              numAlive = 0;
+    for (auto& event : eventList)
+    {
+        HANDLE process = NULL;
+        if (!Open(event, process))
+            continue;
+
+        eventList[numAlive++] = event;
+        processList.push_back(process);
+    }
+    eventList.resize(numAlive);
+
+    Report(eventList.data(), eventList.size());
+
+    for (size_t i = 0; i < numAlive; ++i) Watch(eventList[i], processList[i]);
 }
 
 }
\ No newline at end of file
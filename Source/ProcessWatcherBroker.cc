@@ -0,0 +1,713 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessWatcherBroker.hh>
+
+#include "SocketUtils.hh"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+
+using namespace ktmac::sockets;
+
+// Blocking, unlike every socket the broker itself uses.
+Socket Connect(std::string const& endpoint)
+{
+    sockaddr_un address;
+    if (!MakeUnixAddress(endpoint, address))
+        return InvalidSocket;
+
+    Socket socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!IsValid(socket))
+        return socket;
+
+    if (connect(socket, (sockaddr*)&address, sizeof address) != 0)
+    {
+        CloseSocket(socket);
+        return InvalidSocket;
+    }
+    return socket;
+}
+
+// A creation time of 0 means it is not known, in which case the process ID has to do.
+bool IsSameProcess(ktmac::ProcessEvent const& lhs, ktmac::ProcessEvent const& rhs)
+{
+    return lhs.creationTime == 0 || rhs.creationTime == 0 || lhs.creationTime == rhs.creationTime;
+}
+
+void Track(std::unordered_map<uint32_t, ktmac::ProcessEvent>& runningList,
+           ktmac::ProcessEvent const&                         event)
+{
+    if (event.state == ktmac::ProcessState::Running)
+        runningList[event.processId] = event;
+    else if (event.state == ktmac::ProcessState::Stopped)
+    {
+        auto it = runningList.find(event.processId);
+        if (it != runningList.end() && IsSameProcess(it->second, event))
+            runningList.erase(it);
+    }
+}
+
+int64_t NowNs()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Sequence numbers restart with every broker, so each one needs an ID no earlier one had.
+uint64_t MakeInstanceId()
+{
+    uint64_t time  = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    uint64_t value = ((uint64_t)std::random_device {}() << 32) ^ time;
+    return value != 0 ? value : 1;
+}
+
+}
+
+namespace ktmac
+{
+
+std::string ProcessWatcherBroker::MakeEndpoint()
+{
+#ifdef _WIN32
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    uint32_t id = (uint32_t)sessionId;
+#else
+    uint32_t id = (uint32_t)getuid();
+#endif
+
+    return GetTemporaryDirectory() + "ktmac-process-broker-" + std::to_string(id) + ".sock";
+}
+
+ProcessWatcherBroker::ProcessWatcherBroker(std::string const& endpoint) :
+    _endpoint { endpoint },
+    _listener { (intptr_t)InvalidSocket },
+    _wakeup { (intptr_t)InvalidSocket },
+    _instanceId { MakeInstanceId() },
+    _pendingMtx {},
+    _pending {},
+    _batch {},
+    _wakeupPending { false },
+    _sequence { 0 },
+    _replayList {},
+    _runningList {},
+    _encoder {},
+    _clientList {},
+    _numClients { 0 },
+    _stopping { false },
+    _stopWhenIdle { false }
+{
+    sockaddr_un address;
+    if (!MakeUnixAddress(endpoint, address))
+        throw std::runtime_error { "The endpoint path is too long." };
+
+    // A socket file is left behind by a broker that crashed, and has to go before bind() can
+    // succeed. One that still answers belongs to a broker that is running.
+    if (Socket running = Connect(endpoint); IsValid(running))
+    {
+        CloseSocket(running);
+        throw std::runtime_error { "Another broker is already listening on the endpoint." };
+    }
+    RemoveEndpoint(endpoint);
+
+    Socket listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!IsValid(listener))
+        throw std::runtime_error { "Failed to create a listen socket." };
+
+    if (bind(listener, (sockaddr*)&address, sizeof address) != 0)
+    {
+        CloseSocket(listener);
+        throw std::runtime_error { "Failed to bind the broker endpoint." };
+    }
+
+#ifndef _WIN32
+    // On Windows, the socket file inherits the ACL of the user's temporary directory.
+    chmod(endpoint.c_str(), S_IRUSR | S_IWUSR);
+#endif
+
+    if (listen(listener, SOMAXCONN) != 0)
+    {
+        CloseSocket(listener);
+        RemoveEndpoint(endpoint);
+        throw std::runtime_error { "Failed to listen on the broker endpoint." };
+    }
+    SetNonBlocking(listener);
+
+    Socket wakeup = MakeWakeupSocket();
+    if (!IsValid(wakeup))
+    {
+        CloseSocket(listener);
+        RemoveEndpoint(endpoint);
+        throw std::runtime_error { "Failed to create the wakeup socket." };
+    }
+
+    _listener = (intptr_t)listener;
+    _wakeup   = (intptr_t)wakeup;
+}
+
+ProcessWatcherBroker::~ProcessWatcherBroker()
+{
+    for (auto& client : _clientList) CloseSocket((Socket)client.socket);
+    CloseSocket((Socket)_wakeup);
+    CloseSocket((Socket)_listener);
+    RemoveEndpoint(_endpoint);
+}
+
+void ProcessWatcherBroker::Publish(ProcessEvent const* events, size_t numEvents)
+{
+    if (numEvents == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard { _pendingMtx };
+        _pending.insert(_pending.end(), events, events + numEvents);
+    }
+    Wake();
+}
+
+void ProcessWatcherBroker::Run()
+{
+    std::vector<PollFd> fdList;
+
+    while (!_stopping.load(std::memory_order_acquire))
+    {
+        if (_stopWhenIdle.load(std::memory_order_acquire) && _clientList.empty())
+            return;
+
+        fdList.clear();
+        fdList.push_back(PollFd { (Socket)_listener, POLLIN, 0 });
+        fdList.push_back(PollFd { (Socket)_wakeup, POLLIN, 0 });
+        for (auto& client : _clientList)
+        {
+            short events = POLLIN;
+            if (client.numSent != client.outbound.size())
+                events |= POLLOUT;
+            fdList.push_back(PollFd { (Socket)client.socket, events, 0 });
+        }
+
+        if (Poll(fdList.data(), fdList.size()) < 0 && !WouldBlock())
+            return;
+
+        if (fdList[1].revents != 0)
+            DrainWakeup(_wakeup, _wakeupPending);
+
+        {
+            std::lock_guard<std::mutex> guard { _pendingMtx };
+            _batch.clear();
+            _batch.swap(_pending);
+        }
+
+        // Encoded once for every subscriber.
+        _encoder.Clear();
+        if (!_batch.empty())
+        {
+            _encoder.AddSequencedEvents(ProcessWatcherSequence { _instanceId, _sequence + 1 },
+                                        _batch.data(),
+                                        _batch.size());
+            Apply(_batch);
+        }
+
+        // Walked backwards so dropping a client does not disturb the indices still to be visited.
+        // `fdList` only describes the clients that existed before this round.
+        size_t numPolled = fdList.size() - 2;
+        for (size_t i = _clientList.size(); i-- > 0;)
+        {
+            Client& client  = _clientList[i];
+            short   revents = i < numPolled ? fdList[i + 2].revents : 0;
+
+            // Until a subscriber has said Hello, it does not know where its stream starts. A Hello
+            // read below is answered with state that already includes this round's events.
+            bool closed = (revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+            if (!closed && client.attached && _encoder.GetSize() != 0)
+            {
+                client.outbound.erase(client.outbound.begin(),
+                                      client.outbound.begin() + client.numSent);
+                client.numSent = 0;
+                client.outbound.insert(client.outbound.end(),
+                                       _encoder.GetData(),
+                                       _encoder.GetData() + _encoder.GetSize());
+            }
+
+            if (!closed && (revents & POLLIN) != 0)
+                closed = !Receive(client);
+
+            if (closed || !Flush(client)
+                || client.outbound.size() - client.numSent > MaxBufferedBytes)
+                Drop(i);
+        }
+
+        if ((fdList[0].revents & POLLIN) != 0)
+            Accept();
+    }
+}
+
+void ProcessWatcherBroker::Stop()
+{
+    _stopping.store(true, std::memory_order_release);
+    Wake();
+}
+
+void ProcessWatcherBroker::StopWhenIdle()
+{
+    _stopWhenIdle.store(true, std::memory_order_release);
+    Wake();
+}
+
+void ProcessWatcherBroker::Wake()
+{
+    sockets::Wake(_wakeup, _wakeupPending);
+}
+
+void ProcessWatcherBroker::Apply(std::vector<ProcessEvent> const& batch)
+{
+    for (auto& event : batch)
+    {
+        ++_sequence;
+        _replayList.push_back(event);
+        if (_replayList.size() > ReplayCapacity)
+            _replayList.pop_front();
+
+        Track(_runningList, event);
+    }
+}
+
+// Replays what the subscriber missed if it all is still there, and sends a snapshot otherwise.
+void ProcessWatcherBroker::Attach(Client& client, ProcessWatcherSequence const& hello)
+{
+    ProcessWatcherEncoder encoder;
+
+    uint64_t firstSequence = _sequence - _replayList.size() + 1;
+    if (hello.instanceId == _instanceId && hello.sequence <= _sequence
+        && hello.sequence + 1 >= firstSequence)
+    {
+        std::vector<ProcessEvent> missedList(_replayList.begin()
+                                                 + (size_t)(hello.sequence + 1 - firstSequence),
+                                             _replayList.end());
+        encoder.AddSequencedEvents(ProcessWatcherSequence { _instanceId, hello.sequence + 1 },
+                                   missedList.data(),
+                                   missedList.size());
+    }
+    else
+    {
+        std::vector<ProcessEvent> snapshot;
+        for (auto& [processId, event] : _runningList) snapshot.push_back(event);
+        encoder.AddSnapshot(
+            ProcessWatcherSequence { _instanceId, _sequence }, snapshot.data(), snapshot.size());
+    }
+
+    client.outbound.insert(
+        client.outbound.end(), encoder.GetData(), encoder.GetData() + encoder.GetSize());
+    client.attached = true;
+}
+
+// Returns false if the connection is closed or the subscriber broke the protocol.
+bool ProcessWatcherBroker::Receive(Client& client)
+{
+    size_t size   = 0;
+    char*  buffer = client.inbound.GetWriteBuffer(size);
+    int    result = recv((Socket)client.socket, buffer, (int)size, 0);
+    if (result == 0)
+        return false;
+    if (result < 0)
+        return WouldBlock();
+    client.inbound.Commit((size_t)result);
+
+    return client.inbound.Decode(
+        [this, &client](ProcessWatcherFrameType type, char const* payload, uint32_t length) {
+            if (type == ProcessWatcherFrameType::Ping)
+            {
+                if (length != sizeof(uint64_t))
+                    return false;
+
+                // Answered from the thread that serves every subscriber, so a Pong also tells the
+                // subscriber that its events are still being forwarded.
+                ProcessWatcherEncoder encoder;
+                encoder.AddFrame(ProcessWatcherFrameType::Pong, payload, length);
+                client.outbound.insert(client.outbound.end(),
+                                       encoder.GetData(),
+                                       encoder.GetData() + encoder.GetSize());
+                return true;
+            }
+
+            if (type != ProcessWatcherFrameType::Hello)
+                return true;
+            if (length != sizeof(ProcessWatcherSequence))
+                return false;
+
+            ProcessWatcherSequence hello;
+            std::memcpy(&hello, payload, sizeof hello);
+            if (!client.attached)
+                Attach(client, hello);
+            return true;
+        });
+}
+
+void ProcessWatcherBroker::Accept()
+{
+    while (true)
+    {
+        Socket socket = accept((Socket)_listener, nullptr, nullptr);
+        if (!IsValid(socket))
+            return;
+
+        SetNonBlocking(socket);
+
+        // Subscribers only ever send Hello and Ping, so their inbound buffers can stay tiny.
+        _clientList.push_back(Client {
+            (intptr_t)socket,
+            false,
+            ProcessWatcherDecoder { sizeof(ProcessWatcherSequence) },
+            {},
+            0,
+        });
+        _numClients.store(_clientList.size(), std::memory_order_relaxed);
+    }
+}
+
+bool ProcessWatcherBroker::Flush(Client& client)
+{
+    return sockets::Flush(client.socket, client.outbound, client.numSent);
+}
+
+void ProcessWatcherBroker::Drop(size_t index)
+{
+    sockets::Drop(_clientList, index, _numClients);
+}
+
+ProcessWatcherSubscriber::ProcessWatcherSubscriber(std::string const&            endpoint,
+                                                   ProcessWatcherSocketHandler&& handler) :
+    _endpoint { endpoint },
+    _handler { std::move(handler) },
+    _socketMtx {},
+    _socket { (intptr_t)InvalidSocket },
+    _stopping { false },
+    _stopCv {},
+    _attached { false },
+    _unreachable { false },
+    _attachCv {},
+    _snapshot {},
+    _numAttaches { 0 },
+    _lastSequence {},
+    _runningList {},
+    _heartbeatIntervalMs { 0 },
+    _missThreshold { 0 },
+    _missHandler {},
+    _nextHeartbeatNs { 0 },
+    _lastPing { 0 },
+    _lastPong { 0 },
+    _roundTrip {},
+    _numHeartbeats { 0 },
+    _numAnswered { 0 },
+    _numMissed { 0 },
+    _numConsecutiveMissed { 0 },
+    _recvThread {}
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        throw std::runtime_error { "Windows Socket initialization failed." };
+#endif
+
+    _recvThread = std::thread { &ProcessWatcherSubscriber::HandleIncomingData, this };
+}
+
+ProcessWatcherSubscriber::~ProcessWatcherSubscriber()
+{
+    {
+        std::lock_guard<std::mutex> guard { _socketMtx };
+        _stopping = true;
+        if (IsValid((Socket)_socket))
+            shutdown((Socket)_socket, ShutdownFlags);
+    }
+    _stopCv.notify_all();
+    _recvThread.join();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+bool ProcessWatcherSubscriber::WaitForSnapshot(std::vector<ProcessEvent>& snapshot,
+                                               std::chrono::milliseconds  timeout)
+{
+    std::unique_lock<std::mutex> lock { _socketMtx };
+    _attachCv.wait_for(lock, timeout, [this]() { return _attached || _unreachable; });
+    if (!_attached)
+        return false;
+
+    snapshot = _snapshot;
+    return true;
+}
+
+void ProcessWatcherSubscriber::SetHeartbeatConfig(HeartbeatConfig config)
+{
+    _heartbeatIntervalMs.store((uint32_t)config.interval.count(), std::memory_order_relaxed);
+    _missThreshold.store(config.missThreshold, std::memory_order_relaxed);
+}
+
+void ProcessWatcherSubscriber::SetHeartbeatMissHandler(HeartbeatMissHandler&& handler)
+{
+    std::lock_guard<std::mutex> guard { _socketMtx };
+    _missHandler = std::move(handler);
+}
+
+HeartbeatStatistics ProcessWatcherSubscriber::GetHeartbeatStatistics() const
+{
+    return HeartbeatStatistics {
+        _roundTrip.GetSnapshot(),
+        _numHeartbeats.load(std::memory_order_relaxed),
+        _numAnswered.load(std::memory_order_relaxed),
+        _numMissed.load(std::memory_order_relaxed),
+        _numConsecutiveMissed.load(std::memory_order_relaxed),
+        0,
+    };
+}
+
+void ProcessWatcherSubscriber::HandleIncomingData()
+{
+    std::chrono::milliseconds delay = MinRetryDelay;
+    while (true)
+    {
+        Heartbeat((intptr_t)InvalidSocket);
+
+        Socket socket = Connect(_endpoint);
+        {
+            std::lock_guard<std::mutex> guard { _socketMtx };
+            if (_stopping)
+            {
+                if (IsValid(socket))
+                    CloseSocket(socket);
+                return;
+            }
+            _socket      = (intptr_t)socket;
+            _unreachable = _unreachable || !IsValid(socket);
+        }
+        _attachCv.notify_all();
+
+        if (IsValid(socket))
+        {
+            if (Serve((intptr_t)socket))
+                delay = MinRetryDelay;
+
+            {
+                std::lock_guard<std::mutex> guard { _socketMtx };
+                _socket = (intptr_t)InvalidSocket;
+            }
+            CloseSocket(socket);
+        }
+
+        std::unique_lock<std::mutex> lock { _socketMtx };
+        if (_stopCv.wait_for(lock, delay, [this]() { return _stopping; }))
+            return;
+        delay = std::min(delay * 2, MaxRetryDelay);
+    }
+}
+
+// Runs one connection until it breaks. Returns whether the broker answered the Hello.
+bool ProcessWatcherSubscriber::Serve(intptr_t socket)
+{
+    ProcessWatcherEncoder encoder;
+    encoder.AddFrame(ProcessWatcherFrameType::Hello, &_lastSequence, sizeof _lastSequence);
+    if (!SendAll((Socket)socket, encoder.GetData(), encoder.GetSize()))
+        return false;
+
+    ProcessWatcherDecoder     decoder;
+    std::vector<ProcessEvent> snapshot;
+    bool                      attached = false;
+    while (true)
+    {
+        PollFd fd { (Socket)socket, POLLIN, 0 };
+        int    numReady = Poll(&fd, 1, (int)Heartbeat(socket));
+        if (numReady < 0 && !WouldBlock())
+            return attached;
+        if (numReady <= 0)
+            continue;
+
+        size_t size   = 0;
+        char*  buffer = decoder.GetWriteBuffer(size);
+        int    result = recv((Socket)socket, buffer, (int)size, 0);
+        if (result <= 0)
+            return attached;
+        decoder.Commit((size_t)result);
+
+        bool quit  = false;
+        bool valid = decoder.Decode([&](ProcessWatcherFrameType type,
+                                        char const*             payload,
+                                        uint32_t                length) {
+            ProcessWatcherSequence sequence = {};
+            if (type == ProcessWatcherFrameType::Quit)
+                quit = true;
+            else if (type == ProcessWatcherFrameType::Pong)
+            {
+                if (length != sizeof(uint64_t))
+                    return false;
+
+                uint64_t pong = 0;
+                std::memcpy(&pong, payload, sizeof pong);
+                ReceivePong(pong);
+                return true;
+            }
+            else if (type == ProcessWatcherFrameType::Snapshot)
+            {
+                snapshot.clear();
+                if (!ProcessWatcherDecoder::ForEachSequencedEvent(
+                        payload, length, sequence, [&snapshot](ProcessEvent const& event) {
+                            snapshot.push_back(event);
+                        }))
+                    return false;
+                HandleSnapshot(sequence, snapshot);
+            }
+            else if (type == ProcessWatcherFrameType::SequencedEvents)
+            {
+                // Numbers are only meaningful after a snapshot from the same broker.
+                bool wellFormed = ProcessWatcherDecoder::ForEachSequencedEvent(
+                    payload, length, sequence, [&](ProcessEvent const& event) {
+                        if (sequence.instanceId != _lastSequence.instanceId)
+                            return;
+                        if (sequence.sequence > _lastSequence.sequence)
+                        {
+                            HandleEvent(event);
+                            _lastSequence.sequence = sequence.sequence;
+                        }
+                        ++sequence.sequence;
+                    });
+                if (!wellFormed || sequence.instanceId != _lastSequence.instanceId)
+                    return false;
+            }
+            else
+                return true;
+
+            if (!attached)
+            {
+                attached = true;
+                _numAttaches.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        });
+
+        if (!valid || quit)
+            return attached;
+    }
+}
+
+// Counts the previous heartbeat as missed if it is still unanswered, sends the next one if one is
+// due and `socket` is connected, and returns the milliseconds until the next.
+uint32_t ProcessWatcherSubscriber::Heartbeat(intptr_t socket)
+{
+    uint32_t intervalMs = _heartbeatIntervalMs.load(std::memory_order_relaxed);
+    if (intervalMs == 0)
+    {
+        _nextHeartbeatNs = 0;
+        return ProcessWatcherChannel::HeartbeatRecheckMs;
+    }
+
+    int64_t now = NowNs();
+    if (_nextHeartbeatNs != 0 && now < _nextHeartbeatNs)
+        return (uint32_t)((_nextHeartbeatNs - now + 999999) / 1000000);
+
+    if (_lastPing != 0 && _lastPong != _lastPing)
+    {
+        _numMissed.fetch_add(1, std::memory_order_relaxed);
+
+        uint32_t numMissed = _numConsecutiveMissed.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (numMissed == _missThreshold.load(std::memory_order_relaxed))
+        {
+            HeartbeatMissHandler handler;
+            {
+                std::lock_guard<std::mutex> guard { _socketMtx };
+                handler = _missHandler;
+            }
+            if (handler)
+                handler(numMissed);
+        }
+    }
+
+    _lastPing = (uint64_t)now;
+    _numHeartbeats.fetch_add(1, std::memory_order_relaxed);
+    if (IsValid((Socket)socket))
+    {
+        // A failed send shows up as a broken connection in Serve().
+        ProcessWatcherEncoder encoder;
+        encoder.AddFrame(ProcessWatcherFrameType::Ping, &_lastPing, sizeof _lastPing);
+        SendAll((Socket)socket, encoder.GetData(), encoder.GetSize());
+    }
+
+    _nextHeartbeatNs = now + (int64_t)intervalMs * 1000000;
+    return intervalMs;
+}
+
+void ProcessWatcherSubscriber::ReceivePong(uint64_t pong)
+{
+    _lastPong = pong;
+
+    // An answer to an earlier heartbeat comes too late; that one was already counted as missed.
+    if (pong == _lastPing)
+    {
+        _roundTrip.Record((uint64_t)(NowNs() - (int64_t)pong));
+        _numAnswered.fetch_add(1, std::memory_order_relaxed);
+        _numConsecutiveMissed.store(0, std::memory_order_relaxed);
+    }
+}
+
+void ProcessWatcherSubscriber::HandleSnapshot(ProcessWatcherSequence const&    sequence,
+                                              std::vector<ProcessEvent> const& snapshot)
+{
+    std::unordered_map<uint32_t, ProcessEvent> runningList;
+    for (auto& event : snapshot) runningList.emplace(event.processId, event);
+
+    bool first = false;
+    {
+        std::lock_guard<std::mutex> guard { _socketMtx };
+        first = !_attached;
+    }
+
+    // Whatever happened while disconnected is reported as the difference between the two states:
+    // exits first, so a reused process ID reads as a stop followed by a start.
+    if (!first && _handler)
+    {
+        for (auto& [processId, known] : _runningList)
+        {
+            auto it = runningList.find(processId);
+            if (it == runningList.end() || !IsSameProcess(it->second, known))
+            {
+                ProcessEvent event = known;
+                event.state        = ProcessState::Stopped;
+                _handler(event);
+            }
+        }
+
+        for (auto& [processId, event] : runningList)
+        {
+            auto it = _runningList.find(processId);
+            if (it == _runningList.end() || !IsSameProcess(it->second, event))
+                _handler(event);
+        }
+    }
+
+    _runningList  = std::move(runningList);
+    _lastSequence = sequence;
+
+    if (first)
+    {
+        {
+            std::lock_guard<std::mutex> guard { _socketMtx };
+            _snapshot = snapshot;
+            _attached = true;
+        }
+        _attachCv.notify_all();
+    }
+}
+
+void ProcessWatcherSubscriber::HandleEvent(ProcessEvent const& event)
+{
+    Track(_runningList, event);
+    if (_handler)
+        _handler(event);
+}
+
+}
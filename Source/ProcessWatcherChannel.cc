@@ -0,0 +1,620 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessWatcherChannel.hh>
+#include <ktmac/SpscRing.hh>
+
+#ifdef _WIN32
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <linux/futex.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <new>
+#include <stdexcept>
+
+namespace ktmac
+{
+
+struct ProcessWatcherChannel::Block
+{
+    static_assert(std::atomic<uint32_t>::is_always_lock_free
+                      && std::atomic<size_t>::is_always_lock_free,
+                  "Atomics in shared memory must be lock-free");
+
+    SpscRing<ProcessEvent, RingSize> ring;
+
+    // `doorbell` and `clientDoorbell` double as futex words on Linux.
+    alignas(64) std::atomic<uint32_t> consumerWaiting;
+    std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> attached;
+    std::atomic<uint32_t> closed;
+
+    // The server stamps `ping` and the client echoes it into `pong`; the client also stamps
+    // `clientBeat` on its own. Stamps are taken from the system-wide monotonic clock.
+    alignas(64) std::atomic<uint32_t> clientDoorbell;
+    std::atomic<uint32_t> intervalMs;
+    std::atomic<uint64_t> ping;
+    std::atomic<uint64_t> pong;
+    std::atomic<uint64_t> clientBeat;
+};
+
+}
+
+namespace
+{
+
+constexpr uint32_t Infinite = UINT32_MAX;
+
+int64_t NowNs()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef _WIN32
+
+void* MapBlock(std::string const& name, bool create, size_t size, void*& mapping)
+{
+    HANDLE handle = create ? CreateFileMappingA(INVALID_HANDLE_VALUE,
+                                                NULL,
+                                                PAGE_READWRITE,
+                                                0,
+                                                (DWORD)size,
+                                                name.c_str())
+                           : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (handle == NULL)
+        return nullptr;
+
+    // Someone else owns a channel with this name; its layout may not even match ours.
+    if (create && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(handle);
+        return nullptr;
+    }
+
+    void* block = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (block == nullptr)
+    {
+        CloseHandle(handle);
+        return nullptr;
+    }
+
+    mapping = handle;
+    return block;
+}
+
+void UnmapBlock(std::string const& name, bool created, void* block, size_t size, void* mapping)
+{
+    UnmapViewOfFile(block);
+    CloseHandle((HANDLE)mapping);
+}
+
+void* OpenDoorbell(std::string const& name, bool create, bool manualReset)
+{
+    if (create)
+        return CreateEventA(NULL, manualReset, FALSE, name.c_str());
+    return OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, name.c_str());
+}
+
+void CloseDoorbell(void* event)
+{
+    if (event != nullptr)
+        CloseHandle((HANDLE)event);
+}
+
+void RingDoorbell(std::atomic<uint32_t>& word, void* event)
+{
+    SetEvent((HANDLE)event);
+}
+
+// Returns false if `peer` exited before the doorbell rang or the time ran out.
+bool WaitDoorbell(std::atomic<uint32_t>& word,
+                  uint32_t               seen,
+                  void*                  event,
+                  void*                  peer,
+                  uint32_t               timeoutMs = Infinite)
+{
+    HANDLE handleList[] = { (HANDLE)event, (HANDLE)peer };
+    DWORD  result       = WaitForMultipleObjects(peer != nullptr ? 2 : 1,
+                                          handleList,
+                                          FALSE,
+                                          timeoutMs == Infinite ? INFINITE : timeoutMs);
+    return result == WAIT_OBJECT_0 || result == WAIT_TIMEOUT;
+}
+
+void WaitForPeer(void* peer)
+{
+    WaitForSingleObject((HANDLE)peer, INFINITE);
+}
+
+// The client runs elevated, so this usually fails unless the server does as well.
+void TerminatePeer(void* peer)
+{
+    TerminateProcess((HANDLE)peer, 1);
+}
+
+void ClosePeer(void* peer)
+{
+    CloseHandle((HANDLE)peer);
+}
+
+#else
+
+void* MapBlock(std::string const& name, bool create, size_t size, void*& mapping)
+{
+    std::string path = "/" + name;
+
+    int fd = create ? shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600)
+                    : shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        return nullptr;
+
+    if (create && ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        shm_unlink(path.c_str());
+        return nullptr;
+    }
+
+    void* block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED)
+    {
+        if (create)
+            shm_unlink(path.c_str());
+        return nullptr;
+    }
+
+    mapping = nullptr;
+    return block;
+}
+
+void UnmapBlock(std::string const& name, bool created, void* block, size_t size, void*)
+{
+    munmap(block, size);
+    if (created)
+        shm_unlink(("/" + name).c_str());
+}
+
+// Everything a doorbell needs lives in the block itself.
+void CloseDoorbell(void*) {}
+
+void RingDoorbell(std::atomic<uint32_t>& word, void*)
+{
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool WaitDoorbell(std::atomic<uint32_t>& word,
+                  uint32_t               seen,
+                  void*,
+                  void*,
+                  uint32_t               timeoutMs = Infinite)
+{
+    timespec timeout = { (time_t)(timeoutMs / 1000), (long)(timeoutMs % 1000) * 1000000 };
+    syscall(SYS_futex,
+            (uint32_t*)&word,
+            FUTEX_WAIT,
+            seen,
+            timeoutMs == Infinite ? nullptr : &timeout,
+            nullptr,
+            0);
+    return true;
+}
+
+void WaitForPeer(void*) {}
+
+void TerminatePeer(void*) {}
+
+void ClosePeer(void*) {}
+
+#endif
+
+}
+
+namespace ktmac
+{
+
+std::string ProcessWatcherChannel::MakeName(uint32_t serverProcessId, uint32_t generation)
+{
+#ifdef _WIN32
+    std::string name = "Local\\ktmac-process-hook-" + std::to_string(serverProcessId);
+#else
+    std::string name = "ktmac-process-hook-" + std::to_string(serverProcessId);
+#endif
+    if (generation != 0)
+        name += "-" + std::to_string(generation);
+    return name;
+}
+
+ProcessWatcherChannel
+ProcessWatcherChannel::MakeServerChannel(std::string const&            name,
+                                         ProcessWatcherSocketHandler&& handler)
+{
+    return ProcessWatcherChannel { name, ChannelType::Server, nullptr, std::move(handler) };
+}
+
+ProcessWatcherChannel ProcessWatcherChannel::MakeClientChannel(std::string const& name,
+                                                               void*              server)
+{
+    return ProcessWatcherChannel { name, ChannelType::Client, server };
+}
+
+ProcessWatcherChannel::ProcessWatcherChannel(std::string const&            name,
+                                             ChannelType                   channelType,
+                                             void*                         peer,
+                                             ProcessWatcherSocketHandler&& handler) :
+    _name { name },
+    _block { nullptr },
+    _mapping { nullptr },
+    _readyEvent { nullptr },
+    _clientEvent { nullptr },
+    _peer { peer },
+    _channelType { channelType },
+    _handler { std::move(handler) },
+    _recvThread {},
+    _sendMtx {},
+    _heartbeatIntervalMs { 0 },
+    _missThreshold { 0 },
+    _missHandler {},
+    _nextHeartbeatNs { 0 },
+    _lastPing { 0 },
+    _lastPong { 0 },
+    _lastClientBeat { 0 },
+    _roundTrip {},
+    _numHeartbeats { 0 },
+    _numAnswered { 0 },
+    _numMissed { 0 },
+    _numConsecutiveMissed { 0 },
+    _numClientBeats { 0 }
+{
+    bool create = _channelType == ChannelType::Server;
+
+    _block = (Block*)MapBlock(_name, create, sizeof(Block), _mapping);
+    if (_block == nullptr)
+    {
+        if (_peer != nullptr)
+            ClosePeer(_peer);
+        throw std::runtime_error { "Failed to map the shared memory block." };
+    }
+
+    if (create)
+        new (_block) Block {};
+
+#ifdef _WIN32
+    _readyEvent  = OpenDoorbell(_name + "-ready", create, false);
+    _clientEvent = OpenDoorbell(_name + "-client", create, false);
+    if (_readyEvent == nullptr || _clientEvent == nullptr)
+    {
+        Close();
+        throw std::runtime_error { "Failed to open the doorbell events." };
+    }
+#endif
+
+    if (!create)
+    {
+        _block->attached.store(1, std::memory_order_release);
+        _block->doorbell.fetch_add(1, std::memory_order_release);
+        RingDoorbell(_block->doorbell, _readyEvent);
+    }
+}
+
+ProcessWatcherChannel::~ProcessWatcherChannel()
+{
+    if (_channelType == ChannelType::Invalid)
+        return;
+
+    if (_channelType == ChannelType::Server)
+    {
+        _block->closed.store(1, std::memory_order_release);
+        _block->clientDoorbell.fetch_add(1, std::memory_order_release);
+        RingDoorbell(_block->clientDoorbell, _clientEvent);
+
+        _block->doorbell.fetch_add(1, std::memory_order_release);
+        RingDoorbell(_block->doorbell, _readyEvent);
+
+        if (_recvThread.joinable())
+            _recvThread.join();
+
+        if (_peer != nullptr)
+            WaitForPeer(_peer);
+    }
+
+    Close();
+}
+
+bool ProcessWatcherChannel::WaitForClient(void* client, bool receive)
+{
+    if (_channelType != ChannelType::Server || _peer != nullptr || _recvThread.joinable())
+        return false;
+
+    _peer = client;
+    while (_block->attached.load(std::memory_order_acquire) == 0)
+    {
+        uint32_t seen = _block->doorbell.load(std::memory_order_acquire);
+        if (_block->attached.load(std::memory_order_acquire) != 0)
+            break;
+
+        if (!WaitDoorbell(_block->doorbell, seen, _readyEvent, _peer))
+            return false;
+    }
+
+    // A consumer that never sleeps in HandleIncomingData() is always about to, as far as Send()
+    // can tell, so every batch rings the doorbell.
+    if (!receive)
+    {
+        _block->consumerWaiting.store(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Started only now so the attach doorbell cannot wake the wrong waiter.
+    _recvThread = std::thread { &ProcessWatcherChannel::HandleIncomingData, this };
+    return true;
+}
+
+void ProcessWatcherChannel::Poll()
+{
+    if (_channelType != ChannelType::Server || _recvThread.joinable())
+        return;
+
+    ProcessEvent eventList[BatchSize];
+    while (size_t numEvents = _block->ring.PopBatch(eventList, BatchSize))
+    {
+        if (_handler)
+        {
+            for (size_t i = 0; i < numEvents; ++i) _handler(eventList[i]);
+        }
+    }
+
+    ReceiveHeartbeat();
+}
+
+void ProcessWatcherChannel::Abandon()
+{
+    if (_channelType != ChannelType::Server)
+        return;
+
+    _block->closed.store(1, std::memory_order_release);
+    _block->clientDoorbell.fetch_add(1, std::memory_order_release);
+    RingDoorbell(_block->clientDoorbell, _clientEvent);
+
+    if (_peer != nullptr)
+    {
+        TerminatePeer(_peer);
+        ClosePeer(_peer);
+        _peer = nullptr;
+    }
+}
+
+void ProcessWatcherChannel::SetHeartbeatConfig(HeartbeatConfig config)
+{
+    _heartbeatIntervalMs.store((uint32_t)config.interval.count(), std::memory_order_relaxed);
+    _missThreshold.store(config.missThreshold, std::memory_order_relaxed);
+}
+
+void ProcessWatcherChannel::SetHeartbeatMissHandler(HeartbeatMissHandler&& handler)
+{
+    _missHandler = std::move(handler);
+}
+
+HeartbeatStatistics ProcessWatcherChannel::GetHeartbeatStatistics() const
+{
+    return HeartbeatStatistics {
+        _roundTrip.GetSnapshot(),
+        _numHeartbeats.load(std::memory_order_relaxed),
+        _numAnswered.load(std::memory_order_relaxed),
+        _numMissed.load(std::memory_order_relaxed),
+        _numConsecutiveMissed.load(std::memory_order_relaxed),
+        _numClientBeats.load(std::memory_order_relaxed),
+    };
+}
+
+uint32_t ProcessWatcherChannel::Heartbeat()
+{
+    if (_channelType != ChannelType::Server)
+        return HeartbeatRecheckMs;
+
+    ReceiveHeartbeat();
+
+    uint32_t intervalMs = _heartbeatIntervalMs.load(std::memory_order_relaxed);
+    if (intervalMs == 0)
+    {
+        _nextHeartbeatNs = 0;
+        return HeartbeatRecheckMs;
+    }
+
+    int64_t now = NowNs();
+    if (_nextHeartbeatNs != 0 && now < _nextHeartbeatNs)
+        return (uint32_t)((_nextHeartbeatNs - now + 999999) / 1000000);
+
+    if (_lastPing != 0 && _lastPong != _lastPing)
+    {
+        _numMissed.fetch_add(1, std::memory_order_relaxed);
+
+        uint32_t numMissed = _numConsecutiveMissed.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (numMissed == _missThreshold.load(std::memory_order_relaxed) && _missHandler)
+            _missHandler(numMissed);
+    }
+
+    _lastPing = (uint64_t)now;
+    _block->intervalMs.store(intervalMs, std::memory_order_relaxed);
+    _block->ping.store(_lastPing, std::memory_order_release);
+    _block->clientDoorbell.fetch_add(1, std::memory_order_release);
+    RingDoorbell(_block->clientDoorbell, _clientEvent);
+    _numHeartbeats.fetch_add(1, std::memory_order_relaxed);
+
+    _nextHeartbeatNs = now + (int64_t)intervalMs * 1000000;
+    return intervalMs;
+}
+
+void ProcessWatcherChannel::WaitUntilQuit()
+{
+    if (_channelType != ChannelType::Client)
+        return;
+
+    int64_t lastBeatNs = 0;
+    while (true)
+    {
+        uint32_t seen = _block->clientDoorbell.load(std::memory_order_acquire);
+        if (_block->closed.load(std::memory_order_acquire) != 0)
+            return;
+
+        AnswerHeartbeat(lastBeatNs);
+
+        uint32_t intervalMs = _block->intervalMs.load(std::memory_order_relaxed);
+        if (!WaitDoorbell(_block->clientDoorbell,
+                          seen,
+                          _clientEvent,
+                          _peer,
+                          intervalMs != 0 ? intervalMs : Infinite))
+            return;
+    }
+}
+
+void ProcessWatcherChannel::Send(ProcessEvent const* events, size_t numEvents)
+{
+    if (_channelType != ChannelType::Client || numEvents == 0)
+        return;
+
+    // Exits are reported from thread pool callbacks, starts from the WMI thread.
+    std::lock_guard<std::mutex> guard { _sendMtx };
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        while (!_block->ring.TryPush(events[i]))
+        {
+            if (_block->closed.load(std::memory_order_acquire) != 0)
+                return;
+
+            // The consumer must be awake to make room.
+            _block->doorbell.fetch_add(1, std::memory_order_release);
+            RingDoorbell(_block->doorbell, _readyEvent);
+            std::this_thread::yield();
+        }
+    }
+
+    // Pairs with the fence in HandleIncomingData(): either the consumer sees the new events before
+    // it sleeps, or we see that it is about to.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_block->consumerWaiting.load(std::memory_order_relaxed) != 0)
+    {
+        _block->doorbell.fetch_add(1, std::memory_order_release);
+        RingDoorbell(_block->doorbell, _readyEvent);
+    }
+}
+
+void ProcessWatcherChannel::HandleIncomingData()
+{
+    ProcessEvent eventList[BatchSize];
+    while (true)
+    {
+        size_t numEvents = _block->ring.PopBatch(eventList, BatchSize);
+        if (numEvents != 0)
+        {
+            if (_handler)
+            {
+                for (size_t i = 0; i < numEvents; ++i) _handler(eventList[i]);
+            }
+        }
+
+        // Also between batches, so a steady stream of events cannot hold heartbeats back.
+        uint32_t delayMs = Heartbeat();
+        if (numEvents != 0)
+            continue;
+
+        if (_block->closed.load(std::memory_order_acquire) != 0)
+            return;
+
+        _block->consumerWaiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        uint32_t seen = _block->doorbell.load(std::memory_order_acquire);
+        if (_block->ring.IsEmpty() && !HasHeartbeatNews()
+            && _block->closed.load(std::memory_order_acquire) == 0)
+            WaitDoorbell(_block->doorbell, seen, _readyEvent, nullptr, delayMs);
+
+        _block->consumerWaiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+void ProcessWatcherChannel::ReceiveHeartbeat()
+{
+    uint64_t pong = _block->pong.load(std::memory_order_acquire);
+    if (pong != _lastPong)
+    {
+        _lastPong = pong;
+
+        // An answer to an earlier heartbeat comes too late; that one was already counted as missed.
+        if (pong == _lastPing)
+        {
+            _roundTrip.Record((uint64_t)(NowNs() - (int64_t)pong));
+            _numAnswered.fetch_add(1, std::memory_order_relaxed);
+            _numConsecutiveMissed.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t clientBeat = _block->clientBeat.load(std::memory_order_acquire);
+    if (clientBeat != _lastClientBeat)
+    {
+        _lastClientBeat = clientBeat;
+        _numClientBeats.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool ProcessWatcherChannel::HasHeartbeatNews() const
+{
+    return _block->pong.load(std::memory_order_acquire) != _lastPong
+           || _block->clientBeat.load(std::memory_order_acquire) != _lastClientBeat;
+}
+
+// Besides echoing every heartbeat, the client beats on its own whenever a whole interval passed
+// without one, so the server can tell whether its heartbeats or the client are stuck.
+void ProcessWatcherChannel::AnswerHeartbeat(int64_t& lastBeatNs)
+{
+    int64_t  now        = NowNs();
+    uint32_t intervalMs = _block->intervalMs.load(std::memory_order_relaxed);
+    uint64_t ping       = _block->ping.load(std::memory_order_acquire);
+
+    bool answer = ping != _block->pong.load(std::memory_order_relaxed);
+    bool beat   = answer || (intervalMs != 0 && now - lastBeatNs >= (int64_t)intervalMs * 1000000);
+    if (!beat)
+        return;
+
+    if (answer)
+        _block->pong.store(ping, std::memory_order_release);
+    _block->clientBeat.store((uint64_t)now, std::memory_order_release);
+    lastBeatNs = now;
+
+    // Same handshake as in Send().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_block->consumerWaiting.load(std::memory_order_relaxed) != 0)
+    {
+        _block->doorbell.fetch_add(1, std::memory_order_release);
+        RingDoorbell(_block->doorbell, _readyEvent);
+    }
+}
+
+void ProcessWatcherChannel::Close()
+{
+    CloseDoorbell(_readyEvent);
+    CloseDoorbell(_clientEvent);
+    UnmapBlock(_name, _channelType == ChannelType::Server, _block, sizeof(Block), _mapping);
+    if (_peer != nullptr)
+        ClosePeer(_peer);
+
+    _block       = nullptr;
+    _mapping     = nullptr;
+    _readyEvent  = nullptr;
+    _clientEvent = nullptr;
+    _peer        = nullptr;
+    _channelType = ChannelType::Invalid;
+    _handler     = nullptr;
+}
+
+}
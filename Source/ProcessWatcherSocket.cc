@@ -3,43 +3,99 @@
 
 #include <ktmac/ProcessWatcherSocket.hh>
 
-#include <WS2tcpip.h>
-#include <WinSock2.h>
-#include <Windows.h>
+#include "SocketUtils.hh"
 
+#include <cerrno>
 #include <cstdio>
+#include <random>
 #include <stdexcept>
 
 namespace
 {
 
-HANDLE RunClient(int portNumber)
+using namespace ktmac::sockets;
+
+#ifdef _WIN32
+
+constexpr int ShutdownSend = SD_SEND;
+
+// Returns false if `peer` exited before anyone connected.
+bool WaitForConnection(Socket listener, void* peer)
+{
+    WSAEVENT event = WSACreateEvent();
+    if (event == NULL)
+        return false;
+
+    WSAEventSelect(listener, event, FD_ACCEPT);
+    HANDLE handleList[] = { event, (HANDLE)peer };
+    DWORD  result = WaitForMultipleObjects(peer != nullptr ? 2 : 1, handleList, FALSE, INFINITE);
+
+    // WSAEventSelect() made the listener nonblocking, which accepted sockets would inherit.
+    unsigned long nonBlocking = 0;
+    WSAEventSelect(listener, event, 0);
+    ioctlsocket(listener, FIONBIO, &nonBlocking);
+    WSACloseEvent(event);
+
+    return result == WAIT_OBJECT_0;
+}
+
+void WaitForPeer(void* peer)
+{
+    WaitForSingleObject((HANDLE)peer, INFINITE);
+}
+
+void ClosePeer(void* peer)
+{
+    CloseHandle((HANDLE)peer);
+}
+
+#else
+
+constexpr int ShutdownSend = SHUT_WR;
+
+bool WaitForConnection(Socket listener, void*)
+{
+    pollfd fd = { listener, POLLIN, 0 };
+    while (poll(&fd, 1, -1) < 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+void WaitForPeer(void*) {}
+
+void ClosePeer(void*) {}
+
+#endif
+
+}
+
+namespace ktmac
 {
-    char argument[12];
-    sprintf_s(argument, "%d", portNumber);
 
+#ifdef _WIN32
+
+void* LaunchProcessHook(char const* arguments)
+{
     SHELLEXECUTEINFO shellExecuteInfo = {};
     shellExecuteInfo.cbSize           = sizeof shellExecuteInfo;
     shellExecuteInfo.fMask            = SEE_MASK_NOCLOSEPROCESS;
     shellExecuteInfo.hwnd             = NULL;
     shellExecuteInfo.lpVerb           = "runas";
     shellExecuteInfo.lpFile           = "ktmac-process-hook.exe";
-    shellExecuteInfo.lpParameters     = argument;
+    shellExecuteInfo.lpParameters     = arguments;
     shellExecuteInfo.lpDirectory      = NULL;
     shellExecuteInfo.nShow            = SW_SHOW;
     shellExecuteInfo.hInstApp         = NULL;
 
     if (!ShellExecuteEx(&shellExecuteInfo))
-        return NULL;
+        return nullptr;
 
     return shellExecuteInfo.hProcess;
 }
 
-}
-
-namespace ktmac
-{
-
 bool ProcessWatcherSocket::InitializeWinSock()
 {
     WSADATA wsaData;
@@ -51,147 +107,185 @@ void ProcessWatcherSocket::UninitializeWinSock()
     WSACleanup();
 }
 
-ProcessWatcherSocket ProcessWatcherSocket::MakeServerSocket(int portNumber,
+#else
+
+bool ProcessWatcherSocket::InitializeWinSock()
+{
+    return true;
+}
+
+void ProcessWatcherSocket::UninitializeWinSock() {}
+
+#endif
+
+std::string ProcessWatcherSocket::MakeEndpoint(uint32_t serverProcessId)
+{
+    char suffix[12];
+    std::snprintf(suffix, sizeof suffix, "-%08x", (unsigned int)std::random_device {}());
+
+    return GetTemporaryDirectory() + "ktmac-process-hook-" + std::to_string(serverProcessId)
+           + suffix + ".sock";
+}
+
+ProcessWatcherSocket ProcessWatcherSocket::MakeServerSocket(std::string const&            endpoint,
                                                             ProcessWatcherSocketHandler&& handler)
 {
     if (!InitializeWinSock())
         throw std::runtime_error { "Windows Socket initialization failed." };
 
-    HANDLE client = RunClient(portNumber);
-    if (client == NULL)
-        throw std::runtime_error { "Failed to launch client." };
-
-    addrinfo hints    = {};
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_flags    = AI_PASSIVE;
-
-    char portNumberStr[12];
-    sprintf_s(portNumberStr, sizeof portNumberStr - 1, "%d", portNumber);
+    sockaddr_un address;
+    if (!MakeUnixAddress(endpoint, address))
+        throw std::runtime_error { "The endpoint path is too long." };
 
-    addrinfo* result = nullptr;
-    if (getaddrinfo(NULL, portNumberStr, &hints, &result) != 0)
-        throw std::runtime_error { "Failed to getaddrinfo()." };
+    // A socket file left behind by a crashed server would make bind() fail.
+    RemoveEndpoint(endpoint);
 
-    SOCKET listenSocket = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (listenSocket == INVALID_SOCKET)
-    {
-        freeaddrinfo(result);
+    Socket listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!IsValid(listener))
         throw std::runtime_error { "Failed to create a listen socket." };
-    }
 
-    if (bind(listenSocket, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR)
+    if (bind(listener, (sockaddr*)&address, sizeof address) != 0)
     {
-        freeaddrinfo(result);
-        closesocket(listenSocket);
+        CloseSocket(listener);
         throw std::runtime_error { "Failed to bind the listen socket." };
     }
 
-    freeaddrinfo(result);
+#ifndef _WIN32
+    // On Windows, the socket file inherits the ACL of the user's temporary directory.
+    chmod(endpoint.c_str(), S_IRUSR | S_IWUSR);
+#endif
 
-    if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+    if (listen(listener, 1) != 0)
     {
-        closesocket(listenSocket);
+        CloseSocket(listener);
+        RemoveEndpoint(endpoint);
         throw std::runtime_error { "Failed to listen()." };
     }
 
-    SOCKET socket = accept(listenSocket, NULL, NULL);
-    if (socket == INVALID_SOCKET)
-    {
-        closesocket(listenSocket);
-        throw std::runtime_error { "Failed to accept()." };
-    }
-
-    closesocket(listenSocket);
-
-    return ProcessWatcherSocket { (void*)socket, SocketType::Server, client, std::move(handler) };
+    return ProcessWatcherSocket {
+        endpoint,
+        (intptr_t)listener,
+        (intptr_t)InvalidSocket,
+        SocketType::Server,
+        std::move(handler),
+    };
 }
 
-ProcessWatcherSocket ProcessWatcherSocket::MakeClientSocket(int portNumber)
+ProcessWatcherSocket ProcessWatcherSocket::MakeClientSocket(std::string const& endpoint)
 {
     if (!InitializeWinSock())
         throw std::runtime_error { "Windows Socket initialization failed." };
 
-    addrinfo hints    = {};
-    hints.ai_family   = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+    sockaddr_un address;
+    if (!MakeUnixAddress(endpoint, address))
+        throw std::runtime_error { "The endpoint path is too long." };
 
-    char portNumberStr[12];
-    sprintf_s(portNumberStr, sizeof portNumberStr - 1, "%d", portNumber);
-
-    addrinfo* result = nullptr;
-    if (getaddrinfo("127.0.0.1", portNumberStr, &hints, &result) != 0)
-        throw std::runtime_error { "Failed to getaddrinfo()." };
+    Socket socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!IsValid(socket))
+        throw std::runtime_error { "Failed to create a socket." };
 
-    SOCKET socket = INVALID_SOCKET;
-    for (addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next)
+    if (connect(socket, (sockaddr*)&address, sizeof address) != 0)
     {
-        socket = ::socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (socket == INVALID_SOCKET)
-            throw std::runtime_error { "Failed to create a socket." };
-
-        if (connect(socket, ptr->ai_addr, (int)ptr->ai_addrlen) != SOCKET_ERROR)
-            break;
-
-        socket = INVALID_SOCKET;
+        CloseSocket(socket);
+        throw std::runtime_error { "Failed to connect to the core." };
     }
 
-    freeaddrinfo(result);
-
-    if (socket == INVALID_SOCKET)
-        throw std::runtime_error { "Failed to create a socket." };
-
-    return ProcessWatcherSocket { (void*)socket, SocketType::Client };
+    return ProcessWatcherSocket {
+        endpoint, (intptr_t)InvalidSocket, (intptr_t)socket, SocketType::Client
+    };
 }
 
-ProcessWatcherSocket::ProcessWatcherSocket(void*                         socket,
+ProcessWatcherSocket::ProcessWatcherSocket(std::string const&            endpoint,
+                                           intptr_t                      listener,
+                                           intptr_t                      socket,
                                            SocketType                    socketType,
-                                           void*                         client,
                                            ProcessWatcherSocketHandler&& handler) :
-    _client { client },
+    _endpoint { endpoint },
+    _listener { listener },
     _socket { socket },
+    _client { nullptr },
     _socketType { socketType },
     _handler { std::move(handler) },
-    _recvThread { &ProcessWatcherSocket::HandleIncomingData, this }
-{}
+    _sendMtx {},
+    _encoder {},
+    _recvThread {}
+{
+    if (_socketType == SocketType::Client)
+        _recvThread = std::thread { &ProcessWatcherSocket::HandleIncomingData, this };
+}
 
 ProcessWatcherSocket::~ProcessWatcherSocket()
 {
     if (_socketType == SocketType::Invalid)
         return;
 
-    SOCKET socket = (SOCKET)_socket;
-    if (socket != INVALID_SOCKET)
+    Socket socket = (Socket)_socket;
+    if (IsValid(socket))
     {
         if (_socketType == SocketType::Server)
         {
-            auto message = ProcessWatcherMessage::Quit;
-            send(socket, (const char*)&message, 1, 0);
+            std::lock_guard<std::mutex> guard { _sendMtx };
+            _encoder.Clear();
+            _encoder.AddFrame(ProcessWatcherFrameType::Quit, nullptr, 0);
+            SendAll(socket, _encoder.GetData(), _encoder.GetSize());
         }
 
         if (_recvThread.joinable())
             _recvThread.join();
 
-        shutdown(socket, SD_SEND);
-        closesocket(socket);
+        shutdown(socket, ShutdownSend);
+        CloseSocket(socket);
+    }
 
-        if (_socketType == SocketType::Server)
-        {
-            WaitForSingleObject(_client, INFINITE);
-            CloseHandle(_client);
-        }
+    if (IsValid((Socket)_listener))
+    {
+        CloseSocket((Socket)_listener);
+        RemoveEndpoint(_endpoint);
+    }
 
-        _client     = nullptr;
-        _socket     = (void*)INVALID_SOCKET;
-        _socketType = SocketType::Invalid;
-        _handler    = nullptr;
+    if (_client != nullptr)
+    {
+        WaitForPeer(_client);
+        ClosePeer(_client);
     }
 
+    _listener   = (intptr_t)InvalidSocket;
+    _socket     = (intptr_t)InvalidSocket;
+    _client     = nullptr;
+    _socketType = SocketType::Invalid;
+    _handler    = nullptr;
+
     UninitializeWinSock();
 }
 
+bool ProcessWatcherSocket::WaitForClient(void* client)
+{
+    if (_socketType != SocketType::Server || !IsValid((Socket)_listener))
+        return false;
+
+    Socket listener = (Socket)_listener;
+    Socket socket   = InvalidSocket;
+    if (WaitForConnection(listener, client))
+        socket = accept(listener, nullptr, nullptr);
+
+    // Nobody else can connect once the endpoint is gone.
+    CloseSocket(listener);
+    RemoveEndpoint(_endpoint);
+    _listener = (intptr_t)InvalidSocket;
+
+    if (!IsValid(socket))
+    {
+        if (client != nullptr)
+            ClosePeer(client);
+        return false;
+    }
+
+    _socket     = (intptr_t)socket;
+    _client     = client;
+    _recvThread = std::thread { &ProcessWatcherSocket::HandleIncomingData, this };
+    return true;
+}
+
 void ProcessWatcherSocket::WaitUntilQuit()
 {
     if (_socketType == SocketType::Client)
@@ -204,51 +298,62 @@ void ProcessWatcherSocket::Send(ProcessWatcherMessage message, uint32_t processI
     {
         if (message == ProcessWatcherMessage::Running || message == ProcessWatcherMessage::Stopped)
         {
-            send((SOCKET)_socket, (const char*)&message, sizeof message, 0);
-            send((SOCKET)_socket, (const char*)&processId, sizeof processId, 0);
+            ProcessEvent event = {};
+            event.state        = message == ProcessWatcherMessage::Running ? ProcessState::Running
+                                                                           : ProcessState::Stopped;
+            event.processId    = processId;
+            Send(&event, 1);
         }
     }
 }
 
-void ProcessWatcherSocket::HandleIncomingData()
+void ProcessWatcherSocket::Send(ProcessEvent const* events, size_t numEvents)
 {
-    ProcessWatcherMessage message   = ProcessWatcherMessage::Quit;
-    uint32_t              processId = 0;
+    if (_socketType != SocketType::Client || numEvents == 0)
+        return;
+
+    // Exits are reported from thread pool callbacks, so several threads may send at once.
+    std::lock_guard<std::mutex> guard { _sendMtx };
+    _encoder.Clear();
+    _encoder.AddEvents(events, numEvents);
+    SendAll((Socket)_socket, _encoder.GetData(), _encoder.GetSize());
+}
 
+void ProcessWatcherSocket::HandleIncomingData()
+{
     if (_socketType == SocketType::Invalid)
         return;
 
+    ProcessWatcherDecoder decoder;
     while (true)
     {
-        int result = recv((SOCKET)_socket, (char*)&message, sizeof message, 0);
+        size_t size   = 0;
+        char*  buffer = decoder.GetWriteBuffer(size);
+        int    result = recv((Socket)_socket, buffer, (int)size, 0);
         if (result <= 0)
             return;
-
-        if (_socketType == SocketType::Server)
-        {
-            if (_handler)
+        decoder.Commit((size_t)result);
+
+        bool quit  = false;
+        bool valid = decoder.Decode([this, &quit](ProcessWatcherFrameType type,
+                                                  char const*             payload,
+                                                  uint32_t                length) {
+            if (type == ProcessWatcherFrameType::Quit)
+                quit = true;
+            else if (type == ProcessWatcherFrameType::Events && _socketType == SocketType::Server)
             {
-                auto pProcessId = (char*)&processId;
-                int  lengthRead = 0;
-                while (lengthRead < sizeof processId)
-                {
-                    int result = recv((SOCKET)_socket, (char*)&processId, sizeof processId, 0);
-                    if (result <= 0)
-                        return;
-                    lengthRead += result;
-                }
-
-                if (message == ProcessWatcherMessage::Running
-                    || message == ProcessWatcherMessage::Stopped)
-                    _handler(message, processId);
+                return ProcessWatcherDecoder::ForEachEvent(
+                    payload, length, [this](ProcessEvent const& event) {
+                        if (_handler)
+                            _handler(event);
+                    });
             }
-        }
-        else
-        {
-            if (message == ProcessWatcherMessage::Quit)
-                return;
-        }
+            return true;
+        });
+
+        if (!valid || (quit && _socketType == SocketType::Client))
+            return;
     }
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,317 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcfsProcessWatcher.hh>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef SYS_pidfd_open
+#    define SYS_pidfd_open 434
+#endif
+
+namespace
+{
+
+constexpr uint64_t WakeupKey     = ~uint64_t { 0 };
+constexpr size_t   MaxCommLength = 15;
+
+int ParseProcessId(char const* name)
+{
+    int processId = 0;
+    for (char const* it = name; *it != '\0'; ++it)
+    {
+        if (*it < '0' || *it > '9')
+            return 0;
+        processId = processId * 10 + (*it - '0');
+    }
+    return processId;
+}
+
+bool ReadProcFile(int processId, char const* file, char* buffer, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/%s", processId, file);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length <= 0)
+        return false;
+
+    buffer[length] = '\0';
+    return true;
+}
+
+// Fills in what /proc/<pid>/stat tells: the parent and the start time, in clock ticks since boot.
+bool ReadStat(int processId, ktmac::ProcessEvent& event)
+{
+    char stat[512];
+    if (!ReadProcFile(processId, "stat", stat, sizeof stat))
+        return false;
+
+    // The name in parentheses may contain anything, including spaces and parentheses.
+    char const* fields = strrchr(stat, ')');
+    if (fields == nullptr)
+        return false;
+
+    char               state     = 0;
+    int                parent    = 0;
+    unsigned long long startTime = 0;
+    if (sscanf(fields + 1,
+               " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+               &state,
+               &parent,
+               &startTime)
+        != 3)
+        return false;
+
+    event.parentProcessId = (uint32_t)parent;
+    event.creationTime    = (uint64_t)startTime;
+    return true;
+}
+
+// Zombies keep their /proc entry until they are reaped, but they are gone as far as we care.
+bool IsAlive(int processId)
+{
+    char stat[512];
+    if (!ReadProcFile(processId, "stat", stat, sizeof stat))
+        return false;
+
+    char const* state = strrchr(stat, ')');
+    return state != nullptr && state[1] == ' ' && state[2] != 'Z' && state[2] != 'X';
+}
+
+}
+
+namespace ktmac
+{
+
+ProcfsProcessWatcher::ProcfsProcessWatcher(std::vector<std::string>&& processNameList,
+                                           ProcessEventBatchHandler&& batchHandler,
+                                           ProcfsWatcherConfig        config) :
+    ProcessEventSource { std::move(batchHandler) },
+    _processNameList { std::move(processNameList) },
+    _commList {},
+    _config { config },
+    _epoll { -1 },
+    _wakeup { -1 },
+    _knownList {},
+    _numScans { 0 },
+    _batch {},
+    _thread {}
+{
+    if (_processNameList.empty())
+        throw std::invalid_argument { "processNameList is empty." };
+
+    for (auto& name : _processNameList) _commList.push_back(name.substr(0, MaxCommLength));
+
+    _epoll  = epoll_create1(EPOLL_CLOEXEC);
+    _wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_epoll < 0 || _wakeup < 0)
+    {
+        if (_epoll >= 0)
+            close(_epoll);
+        if (_wakeup >= 0)
+            close(_wakeup);
+        throw std::runtime_error { "Failed to create the epoll instance." };
+    }
+
+    epoll_event event = {};
+    event.events      = EPOLLIN;
+    event.data.u64    = WakeupKey;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &event);
+
+    Scan(true);
+    _thread = std::thread { &ProcfsProcessWatcher::Run, this };
+}
+
+ProcfsProcessWatcher::~ProcfsProcessWatcher()
+{
+    uint64_t value = 1;
+    write(_wakeup, &value, sizeof value);
+    _thread.join();
+
+    for (auto& pair : _knownList)
+    {
+        if (pair.second.pidfd >= 0)
+            close(pair.second.pidfd);
+    }
+    close(_wakeup);
+    close(_epoll);
+}
+
+void ProcfsProcessWatcher::Run()
+{
+    constexpr int MaxEvents = 64;
+    epoll_event   eventList[MaxEvents];
+
+    Clock::time_point nextScan = Clock::now() + _config.scanInterval;
+    while (true)
+    {
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(nextScan - Clock::now());
+        int  timeoutMs = remaining.count() > 0 ? (int)remaining.count() : 0;
+
+        int numEvents = epoll_wait(_epoll, eventList, MaxEvents, timeoutMs);
+        if (numEvents < 0 && errno != EINTR)
+            return;
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            if (eventList[i].data.u64 == WakeupKey)
+                return;
+
+            Stop((int)eventList[i].data.u64);
+        }
+        Flush();
+
+        if (Clock::now() >= nextScan)
+        {
+            Scan(false);
+            nextScan = Clock::now() + _config.scanInterval;
+        }
+    }
+}
+
+void ProcfsProcessWatcher::Scan(bool initial)
+{
+    DIR* dir = opendir("/proc");
+    if (dir == nullptr)
+        return;
+
+    uint64_t          scan = ++_numScans;
+    Clock::time_point now  = Clock::now();
+    while (dirent* entry = readdir(dir))
+    {
+        int processId = ParseProcessId(entry->d_name);
+        if (processId <= 0)
+            continue;
+
+        Known  candidate { Kind::Candidate, -1, now, 0, {} };
+        auto   inserted = _knownList.try_emplace(processId, candidate);
+        Known& known    = inserted.first->second;
+        known.lastScan  = scan;
+
+        if (known.kind == Kind::Candidate)
+        {
+            if (Matches(processId, known.event))
+            {
+                _batch.push_back(known.event);
+                if (!Track(processId, known))
+                    Stop(processId);
+            }
+            else if (initial || now - known.firstSeen >= _config.recheckWindow)
+                known.kind = Kind::Ignored;
+        }
+        else if (known.kind == Kind::Tracked && !_config.usePidfd && !IsAlive(processId))
+            Stop(processId);
+        else if (known.kind == Kind::Exited && IsAlive(processId))
+            known = Known { Kind::Candidate, -1, now, scan, {} };  // Reaped and reused in between
+    }
+    closedir(dir);
+
+    for (auto it = _knownList.begin(); it != _knownList.end();)
+    {
+        if (it->second.lastScan == scan)
+        {
+            ++it;
+            continue;
+        }
+
+        // Gone from /proc: either a reaped tracked process whose pidfd we have not handled yet, or
+        // one we no longer care about.
+        if (it->second.pidfd >= 0)
+            close(it->second.pidfd);
+        if (it->second.kind == Kind::Tracked)
+        {
+            _batch.push_back(it->second.event);
+            _batch.back().state = ProcessState::Stopped;
+        }
+        it = _knownList.erase(it);
+    }
+
+    Flush();
+}
+
+bool ProcfsProcessWatcher::Track(int processId, Known& known)
+{
+    known.kind = Kind::Tracked;
+    if (!_config.usePidfd)
+        return IsAlive(processId);
+
+    int pidfd = (int)syscall(SYS_pidfd_open, processId, 0);
+    if (pidfd < 0)
+        return false;
+
+    epoll_event event = {};
+    event.events      = EPOLLIN;
+    event.data.u64    = (uint64_t)processId;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, pidfd, &event) != 0)
+    {
+        close(pidfd);
+        return false;
+    }
+
+    known.pidfd = pidfd;
+    return true;
+}
+
+void ProcfsProcessWatcher::Stop(int processId)
+{
+    auto it = _knownList.find(processId);
+    if (it == _knownList.end() || it->second.kind != Kind::Tracked)
+        return;
+
+    // The entry stays until the process is reaped, so a zombie is not taken for a new process.
+    if (it->second.pidfd >= 0)
+        close(it->second.pidfd);
+    it->second.kind  = Kind::Exited;
+    it->second.pidfd = -1;
+
+    _batch.push_back(it->second.event);
+    _batch.back().state = ProcessState::Stopped;
+}
+
+// Fills in `event` if the process has one of the names.
+bool ProcfsProcessWatcher::Matches(int processId, ProcessEvent& event) const
+{
+    char comm[32];
+    if (!ReadProcFile(processId, "comm", comm, sizeof comm))
+        return false;
+
+    comm[strcspn(comm, "\n")] = '\0';
+    for (size_t i = 0; i < _commList.size(); ++i)
+    {
+        if (_commList[i] != comm)
+            continue;
+
+        event           = {};
+        event.state     = ProcessState::Running;
+        event.processId = (uint32_t)processId;
+        ReadStat(processId, event);
+        strncpy(event.imageName, _processNameList[i].c_str(), ProcessImageNameLength - 1);
+        return true;
+    }
+    return false;
+}
+
+void ProcfsProcessWatcher::Flush()
+{
+    Report(_batch.data(), _batch.size());
+    _batch.clear();
+}
+
+}
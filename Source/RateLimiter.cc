@@ -0,0 +1,218 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/RateLimiter.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace
+{
+
+int64_t ToNanoseconds(ktmac::RateLimiter::TimePoint timePoint)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint.time_since_epoch())
+        .count();
+}
+
+ktmac::RateLimiter::TimePoint FromNanoseconds(int64_t nanoseconds)
+{
+    return ktmac::RateLimiter::TimePoint { std::chrono::duration_cast<
+        ktmac::RateLimiter::Clock::duration>(std::chrono::nanoseconds { nanoseconds }) };
+}
+
+size_t GetRoomIndex(uintptr_t room)
+{
+    uint64_t hash = static_cast<uint64_t>(room) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> 32) % ktmac::RateLimiter::MaxRooms;
+}
+
+}
+
+namespace ktmac
+{
+
+void RateLimiter::StoreLimit(Limit& limit, RateLimit newLimit)
+{
+    int64_t interval = 0;
+    if (newLimit.messagesPerSecond > 0.0 && std::isfinite(newLimit.messagesPerSecond))
+        interval = std::max<int64_t>(1, static_cast<int64_t>(1e9 / newLimit.messagesPerSecond));
+
+    limit.burst.store(std::max<int64_t>(1, newLimit.burst), std::memory_order_relaxed);
+    limit.interval.store(interval, std::memory_order_relaxed);
+}
+
+RateLimit RateLimiter::LoadLimit(Limit const& limit)
+{
+    int64_t interval = limit.interval.load(std::memory_order_relaxed);
+    int64_t burst    = limit.burst.load(std::memory_order_relaxed);
+
+    return RateLimit {
+        interval > 0 ? 1e9 / static_cast<double>(interval) : 0.0,
+        static_cast<uint32_t>(burst),
+    };
+}
+
+int64_t RateLimiter::Reserve(Bucket& bucket, Limit const& limit, int64_t arrival)
+{
+    int64_t interval = limit.interval.load(std::memory_order_relaxed);
+    if (interval <= 0)
+        return arrival;
+
+    int64_t tolerance   = (limit.burst.load(std::memory_order_relaxed) - 1) * interval;
+    int64_t arrivalTime = bucket.theoreticalArrivalTime.load(std::memory_order_relaxed);
+    while (true)
+    {
+        int64_t allowed = std::max(arrival, arrivalTime - tolerance);
+        int64_t next    = std::max(arrival, arrivalTime) + interval;
+        if (bucket.theoreticalArrivalTime.compare_exchange_weak(
+                arrivalTime, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+            return allowed;
+    }
+}
+
+double RateLimiter::GetTokens(Bucket const& bucket, Limit const& limit, int64_t now)
+{
+    int64_t interval = limit.interval.load(std::memory_order_relaxed);
+    if (interval <= 0)
+        return std::numeric_limits<double>::infinity();
+
+    double  burst       = static_cast<double>(limit.burst.load(std::memory_order_relaxed));
+    int64_t arrivalTime = bucket.theoreticalArrivalTime.load(std::memory_order_acquire);
+    if (arrivalTime <= now)
+        return burst;
+
+    return burst - static_cast<double>(arrivalTime - now) / static_cast<double>(interval);
+}
+
+RateLimiter::RateLimiter(RateLimit globalLimit, RateLimit roomLimit) :
+    _globalLimit {},
+    _roomLimit {},
+    _globalBucket {},
+    _rooms {}
+{
+    StoreLimit(_globalLimit, globalLimit);
+    StoreLimit(_roomLimit, roomLimit);
+}
+
+void RateLimiter::SetGlobalLimit(RateLimit limit)
+{
+    StoreLimit(_globalLimit, limit);
+}
+
+void RateLimiter::SetRoomLimit(RateLimit limit)
+{
+    StoreLimit(_roomLimit, limit);
+}
+
+RateLimit RateLimiter::GetGlobalLimit() const
+{
+    return LoadLimit(_globalLimit);
+}
+
+RateLimit RateLimiter::GetRoomLimit() const
+{
+    return LoadLimit(_roomLimit);
+}
+
+RateLimiter::TimePoint RateLimiter::Reserve(uintptr_t room)
+{
+    int64_t now     = ToNanoseconds(Clock::now());
+    int64_t allowed = now;
+
+    // The room bucket goes first so that the global bucket sees the send at the time the room
+    // actually allows it, instead of charging the global budget for a send that is still waiting.
+    if (room != 0)
+        allowed = Reserve(FindRoomBucket(room, now), _roomLimit, allowed);
+
+    allowed = Reserve(_globalBucket, _globalLimit, allowed);
+
+    return FromNanoseconds(allowed);
+}
+
+void RateLimiter::Acquire(uintptr_t room)
+{
+    TimePoint allowed = Reserve(room);
+    if (allowed > Clock::now())
+        std::this_thread::sleep_until(allowed);
+}
+
+RateLimiterLevels RateLimiter::GetLevels(uintptr_t room) const
+{
+    int64_t now = ToNanoseconds(Clock::now());
+
+    RateLimiterLevels rtn;
+    rtn.globalTokens = GetTokens(_globalBucket, _globalLimit, now);
+
+    if (Bucket const* bucket = FindRoomBucket(room); bucket != nullptr)
+        rtn.roomTokens = GetTokens(*bucket, _roomLimit, now);
+    else if (_roomLimit.interval.load(std::memory_order_relaxed) > 0)
+        rtn.roomTokens = static_cast<double>(_roomLimit.burst.load(std::memory_order_relaxed));
+    else
+        rtn.roomTokens = std::numeric_limits<double>::infinity();
+
+    return rtn;
+}
+
+RateLimiter::Bucket& RateLimiter::FindRoomBucket(uintptr_t room, int64_t now)
+{
+    size_t index = GetRoomIndex(room);
+
+    for (size_t i = 0; i < MaxRooms; ++i)
+    {
+        RoomSlot& slot = _rooms[(index + i) % MaxRooms];
+
+        uintptr_t current = slot.room.load(std::memory_order_acquire);
+        if (current == room)
+            return slot.bucket;
+
+        if (current == 0)
+        {
+            if (slot.room.compare_exchange_strong(current, room, std::memory_order_acq_rel)
+                || current == room)
+                return slot.bucket;
+        }
+    }
+
+    // Every slot is taken. A bucket whose theoretical arrival time has passed is full, which is
+    // indistinguishable from a fresh bucket, so it can be handed over to the new room.
+    for (size_t i = 0; i < MaxRooms; ++i)
+    {
+        RoomSlot& slot = _rooms[(index + i) % MaxRooms];
+
+        if (slot.bucket.theoreticalArrivalTime.load(std::memory_order_acquire) > now)
+            continue;
+
+        uintptr_t current = slot.room.load(std::memory_order_acquire);
+        if (slot.room.compare_exchange_strong(current, room, std::memory_order_acq_rel)
+            || current == room)
+            return slot.bucket;
+    }
+
+    // Sharing a bucket with another room only makes the limit stricter.
+    return _rooms[index].bucket;
+}
+
+RateLimiter::Bucket const* RateLimiter::FindRoomBucket(uintptr_t room) const
+{
+    if (room == 0)
+        return nullptr;
+
+    size_t index = GetRoomIndex(room);
+    for (size_t i = 0; i < MaxRooms; ++i)
+    {
+        RoomSlot const& slot = _rooms[(index + i) % MaxRooms];
+
+        uintptr_t current = slot.room.load(std::memory_order_acquire);
+        if (current == room)
+            return &slot.bucket;
+        if (current == 0)
+            return nullptr;
+    }
+
+    return nullptr;
+}
+
+}
@@ -0,0 +1,331 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/Reactor.hh>
+
+#ifdef _WIN32
+#    include <Windows.h>
+#else
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <unistd.h>
+
+#    include <cerrno>
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+
+#ifdef _WIN32
+
+void Signal(intptr_t workEvent)
+{
+    SetEvent((HANDLE)workEvent);
+}
+
+void Reset(intptr_t workEvent) {}
+
+#else
+
+constexpr int MaxEventsPerWait = 16;
+
+void Signal(intptr_t workEvent)
+{
+    uint64_t value = 1;
+    while (write((int)workEvent, &value, sizeof value) < 0 && errno == EINTR) continue;
+}
+
+void Reset(intptr_t workEvent)
+{
+    uint64_t value = 0;
+    while (read((int)workEvent, &value, sizeof value) < 0 && errno == EINTR) continue;
+}
+
+#endif
+
+}
+
+namespace ktmac
+{
+
+Reactor::Reactor() :
+    _workEvent { -1 },
+    _poller { -1 },
+    _sourceList {},
+    _numSources { 0 },
+    _timerList {},
+    _workMtx {},
+    _workList {},
+    _runList {},
+    _workPending { false },
+    _stopping { false },
+    _threadId {},
+    _numWakeups { 0 }
+{
+#ifdef _WIN32
+    HANDLE workEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (workEvent == NULL)
+        throw std::runtime_error { "Failed to create the work event." };
+    _workEvent = (intptr_t)workEvent;
+#else
+    _workEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_workEvent < 0)
+        throw std::runtime_error { "Failed to create the work event." };
+
+    _poller = epoll_create1(EPOLL_CLOEXEC);
+
+    epoll_event event = {};
+    event.events      = EPOLLIN;
+    event.data.fd     = (int)_workEvent;
+    if (_poller < 0 || epoll_ctl((int)_poller, EPOLL_CTL_ADD, (int)_workEvent, &event) != 0)
+    {
+        if (_poller >= 0)
+            close((int)_poller);
+        close((int)_workEvent);
+        throw std::runtime_error { "Failed to create the poller." };
+    }
+#endif
+}
+
+Reactor::~Reactor()
+{
+#ifdef _WIN32
+    CloseHandle((HANDLE)_workEvent);
+#else
+    close((int)_poller);
+    close((int)_workEvent);
+#endif
+}
+
+bool Reactor::AddSource(intptr_t handle, Handler&& handler)
+{
+    if (_numSources.fetch_add(1, std::memory_order_relaxed) >= MaxSources)
+    {
+        _numSources.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto shared = std::make_shared<Handler>(std::move(handler));
+    if (IsReactorThread())
+        Register(handle, shared);
+    else
+        Post([this, handle, shared]() { Register(handle, shared); });
+    return true;
+}
+
+void Reactor::RemoveSource(intptr_t handle)
+{
+    if (IsReactorThread())
+        Unregister(handle);
+    else
+        Post([this, handle]() { Unregister(handle); });
+}
+
+void Reactor::AddTimer(std::chrono::milliseconds delay, TimerHandler&& handler)
+{
+    auto shared = std::make_shared<TimerHandler>(std::move(handler));
+    auto add    = [this, delay, shared]() {
+        _timerList.push_back(Timer { std::chrono::steady_clock::now() + delay, shared });
+    };
+
+    if (IsReactorThread())
+        add();
+    else
+        Post(add);
+}
+
+void Reactor::Post(Handler&& work)
+{
+    {
+        std::lock_guard<std::mutex> guard { _workMtx };
+        _workList.push_back(std::move(work));
+    }
+
+    // One signal per batch; RunWork() clears the flag before it takes the batch.
+    if (!_workPending.exchange(true, std::memory_order_acq_rel))
+        Signal(_workEvent);
+}
+
+void Reactor::Run()
+{
+    _threadId.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+#ifdef _WIN32
+    std::vector<HANDLE> handleList;
+    while (!_stopping)
+    {
+        handleList.clear();
+        handleList.push_back((HANDLE)_workEvent);
+        for (auto& source : _sourceList) handleList.push_back((HANDLE)source.handle);
+
+        int   timeout    = GetTimeout();
+        DWORD numHandles = (DWORD)handleList.size();
+        DWORD result     = MsgWaitForMultipleObjectsEx(numHandles,
+                                                   handleList.data(),
+                                                   timeout < 0 ? INFINITE : (DWORD)timeout,
+                                                   QS_ALLINPUT,
+                                                   MWMO_INPUTAVAILABLE);
+        if (result == WAIT_TIMEOUT)
+        {
+            RunTimers();
+            continue;
+        }
+        if (result > WAIT_OBJECT_0 + numHandles)
+            break;
+
+        _numWakeups.fetch_add(1, std::memory_order_relaxed);
+        if (result == WAIT_OBJECT_0)
+            RunWork();
+        else if (result < WAIT_OBJECT_0 + numHandles)
+            Dispatch((intptr_t)handleList[result - WAIT_OBJECT_0]);
+
+        // The wait reports the lowest ready index only, so messages are drained after every
+        // wakeup; otherwise a busy source could starve them. WinEvent callbacks run in here.
+        MSG msg = {};
+        while (!_stopping && PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+        {
+            if (msg.message == WM_QUIT)
+            {
+                _stopping = true;
+                break;
+            }
+
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        RunTimers();
+    }
+#else
+    epoll_event eventList[MaxEventsPerWait];
+    while (!_stopping)
+    {
+        int numEvents = epoll_wait((int)_poller, eventList, MaxEventsPerWait, GetTimeout());
+        if (numEvents < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (numEvents != 0)
+            _numWakeups.fetch_add(1, std::memory_order_relaxed);
+
+        for (int i = 0; i < numEvents && !_stopping; ++i)
+        {
+            if (eventList[i].data.fd == (int)_workEvent)
+                RunWork();
+            else
+                Dispatch(eventList[i].data.fd);
+        }
+
+        RunTimers();
+    }
+#endif
+
+    _threadId.store(std::thread::id {}, std::memory_order_relaxed);
+}
+
+void Reactor::Stop()
+{
+    Post([this]() { _stopping = true; });
+}
+
+void Reactor::RunWork()
+{
+    Reset(_workEvent);
+    _workPending.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> guard { _workMtx };
+        _runList.swap(_workList);
+    }
+
+    for (auto& work : _runList) work();
+    _runList.clear();
+}
+
+void Reactor::Dispatch(intptr_t handle)
+{
+    for (auto& source : _sourceList)
+    {
+        if (source.handle == handle)
+        {
+            std::shared_ptr<Handler> handler = source.handler;
+            (*handler)();
+            return;
+        }
+    }
+}
+
+void Reactor::RunTimers()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    // By index, as a handler may add timers.
+    for (size_t i = 0; i < _timerList.size() && !_stopping; ++i)
+    {
+        if (_timerList[i].deadline > now)
+            continue;
+
+        std::shared_ptr<TimerHandler> handler = _timerList[i].handler;
+        std::chrono::milliseconds     delay   = (*handler)();
+        if (delay == StopTimer)
+            _timerList.erase(_timerList.begin() + i--);
+        else
+            _timerList[i].deadline = std::chrono::steady_clock::now() + delay;
+    }
+}
+
+int Reactor::GetTimeout() const
+{
+    if (_timerList.empty())
+        return -1;
+
+    auto deadline = _timerList.front().deadline;
+    for (auto& timer : _timerList) deadline = std::min(deadline, timer.deadline);
+
+    auto now = std::chrono::steady_clock::now();
+    if (deadline <= now)
+        return 0;
+
+    // Rounded up, or the wait would return just before the deadline and spin.
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+    return (int)std::min<int64_t>(remaining.count(), INT_MAX);
+}
+
+void Reactor::Register(intptr_t handle, std::shared_ptr<Handler> const& handler)
+{
+#ifndef _WIN32
+    epoll_event event = {};
+    event.events      = EPOLLIN;
+    event.data.fd     = (int)handle;
+    if (epoll_ctl((int)_poller, EPOLL_CTL_ADD, (int)handle, &event) != 0)
+    {
+        _numSources.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+#endif
+    _sourceList.push_back(Source { handle, handler });
+}
+
+void Reactor::Unregister(intptr_t handle)
+{
+    auto it = std::find_if(_sourceList.begin(), _sourceList.end(), [handle](Source const& s) {
+        return s.handle == handle;
+    });
+    if (it == _sourceList.end())
+        return;
+
+#ifndef _WIN32
+    epoll_ctl((int)_poller, EPOLL_CTL_DEL, (int)handle, nullptr);
+#endif
+    _sourceList.erase(it);
+    _numSources.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}
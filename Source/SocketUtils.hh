@@ -0,0 +1,250 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef KTMAC_SOCKET_UTILS_HH
+#define KTMAC_SOCKET_UTILS_HH
+
+// What the socket code of ProcessWatcherSocket, ProcessWatcherBroker and ControlServer shares. The
+// latter two serve every connection from a single thread blocked in poll(), WSAPoll() on Windows,
+// that other threads wake through a datagram socket connected to itself. Not part of the public
+// headers, as it pulls in the socket headers of the platform.
+
+#ifdef _WIN32
+#    include <WS2tcpip.h>
+#    include <WinSock2.h>
+#    include <Windows.h>
+#    include <afunix.h>
+#else
+#    include <arpa/inet.h>
+#    include <fcntl.h>
+#    include <netinet/in.h>
+#    include <netinet/tcp.h>
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ktmac::sockets
+{
+
+#ifdef _WIN32
+
+using Socket       = SOCKET;
+using PollFd       = WSAPOLLFD;
+using SocketLength = int;
+
+constexpr int SendFlags     = 0;
+constexpr int ShutdownFlags = SD_BOTH;
+
+inline bool IsValid(Socket socket)
+{
+    return socket != INVALID_SOCKET;
+}
+
+inline void CloseSocket(Socket socket)
+{
+    closesocket(socket);
+}
+
+inline bool WouldBlock()
+{
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+inline void SetNonBlocking(Socket socket)
+{
+    unsigned long nonBlocking = 1;
+    ioctlsocket(socket, FIONBIO, &nonBlocking);
+}
+
+inline int Poll(PollFd* fds, size_t numFds, int timeoutMs = -1)
+{
+    return WSAPoll(fds, (ULONG)numFds, timeoutMs);
+}
+
+inline void RemoveEndpoint(std::string const& endpoint)
+{
+    DeleteFileA(endpoint.c_str());
+}
+
+// Private to the user, as are the socket files created in it, which inherit its ACL.
+inline std::string GetTemporaryDirectory()
+{
+    char  path[MAX_PATH + 1];
+    DWORD length = GetTempPathA(sizeof path, path);
+    if (length == 0 || length > sizeof path)
+        return ".\\";
+    return std::string { path, length };
+}
+
+#else
+
+using Socket       = int;
+using PollFd       = pollfd;
+using SocketLength = socklen_t;
+
+// A peer that went away must not kill the process with SIGPIPE.
+constexpr int SendFlags     = MSG_NOSIGNAL;
+constexpr int ShutdownFlags = SHUT_RDWR;
+
+inline bool IsValid(Socket socket)
+{
+    return socket >= 0;
+}
+
+inline void CloseSocket(Socket socket)
+{
+    close(socket);
+}
+
+inline bool WouldBlock()
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+inline void SetNonBlocking(Socket socket)
+{
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+}
+
+inline int Poll(PollFd* fds, size_t numFds, int timeoutMs = -1)
+{
+    return poll(fds, (nfds_t)numFds, timeoutMs);
+}
+
+inline void RemoveEndpoint(std::string const& endpoint)
+{
+    unlink(endpoint.c_str());
+}
+
+// Private to the user unless it falls back to /tmp, which is why socket files are made 0600.
+inline std::string GetTemporaryDirectory()
+{
+    char const* directory = std::getenv("XDG_RUNTIME_DIR");
+    if (directory == nullptr || *directory == '\0')
+        directory = "/tmp";
+    return std::string { directory } + "/";
+}
+
+#endif
+
+constexpr Socket InvalidSocket = (Socket)-1;
+
+inline sockaddr_in MakeLoopbackAddress(int portNumber)
+{
+    sockaddr_in address     = {};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons((unsigned short)portNumber);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+inline bool MakeUnixAddress(std::string const& endpoint, sockaddr_un& address)
+{
+    address            = {};
+    address.sun_family = AF_UNIX;
+    if (endpoint.size() >= sizeof address.sun_path)
+        return false;
+
+    std::memcpy(address.sun_path, endpoint.c_str(), endpoint.size() + 1);
+    return true;
+}
+
+// Blocking; for sockets that are not polled.
+inline bool SendAll(Socket socket, char const* buffer, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size)
+    {
+        int result = send(socket, buffer + sent, (int)(size - sent), SendFlags);
+        if (result <= 0)
+            return false;
+        sent += (size_t)result;
+    }
+    return true;
+}
+
+// A datagram socket connected to itself: sending to it makes it readable, which is how other
+// threads interrupt poll().
+inline Socket MakeWakeupSocket()
+{
+    Socket socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (!IsValid(socket))
+        return socket;
+
+    sockaddr_in  address = MakeLoopbackAddress(0);
+    SocketLength length  = sizeof address;
+    if (bind(socket, (sockaddr*)&address, sizeof address) != 0
+        || getsockname(socket, (sockaddr*)&address, &length) != 0
+        || connect(socket, (sockaddr*)&address, sizeof address) != 0)
+    {
+        CloseSocket(socket);
+        return InvalidSocket;
+    }
+
+    SetNonBlocking(socket);
+    return socket;
+}
+
+// May be called from any thread. One datagram in flight is enough; the loop picks up everything
+// queued when it wakes.
+inline void Wake(intptr_t wakeup, std::atomic<bool>& wakeupPending)
+{
+    if (wakeupPending.exchange(true, std::memory_order_acq_rel))
+        return;
+
+    char byte = 0;
+    send((Socket)wakeup, &byte, 1, SendFlags);
+}
+
+// Called by the polling thread once the wakeup socket is readable. The flag is cleared only once
+// drained, or a datagram sent in between would be swallowed with the flag left set, and no later
+// Wake() would send another.
+inline void DrainWakeup(intptr_t wakeup, std::atomic<bool>& wakeupPending)
+{
+    char scratch[64];
+    while (recv((Socket)wakeup, scratch, sizeof scratch, 0) > 0) continue;
+    wakeupPending.store(false, std::memory_order_release);
+}
+
+// Writes as much of `outbound` as the socket takes without blocking, advancing `numSent`. Returns
+// false if the connection is broken.
+template <typename Buffer>
+bool Flush(intptr_t socket, Buffer const& outbound, size_t& numSent)
+{
+    while (numSent < outbound.size())
+    {
+        int result = send((Socket)socket,
+                          outbound.data() + numSent,
+                          (int)(outbound.size() - numSent),
+                          SendFlags);
+        if (result < 0)
+            return WouldBlock();
+        numSent += (size_t)result;
+    }
+    return true;
+}
+
+// Closes the connection of the client at `index` and forgets it.
+template <typename Client>
+void Drop(std::vector<Client>& clientList, size_t index, std::atomic<size_t>& numClients)
+{
+    CloseSocket((Socket)clientList[index].socket);
+    clientList.erase(clientList.begin() + index);
+    numClients.store(clientList.size(), std::memory_order_relaxed);
+}
+
+}
+
+#endif
@@ -0,0 +1,257 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/TextInjector.hh>
+
+#include <Windows.h>
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+using ktmac::TextInjectionResult;
+
+namespace
+{
+
+TextInjectionResult SendBounded(
+    HWND window, UINT message, WPARAM wParam, LPARAM lParam, uint32_t timeoutMs)
+{
+    DWORD_PTR result = 0;
+
+    SetLastError(NOERROR);
+    if (SendMessageTimeoutW(window,
+                            message,
+                            wParam,
+                            lParam,
+                            SMTO_ABORTIFHUNG | SMTO_ERRORONEXIT,
+                            timeoutMs,
+                            &result)
+        != 0)
+        return TextInjectionResult::Succeeded;
+
+    // SMTO_ABORTIFHUNG returns immediately without setting an error when the target is already
+    // considered hung, which is a timeout as far as the caller is concerned.
+    DWORD error = GetLastError();
+    if (error == ERROR_TIMEOUT || error == NOERROR)
+        return TextInjectionResult::TimedOut;
+
+    return TextInjectionResult::Failed;
+}
+
+class SetTextInjector : public ktmac::TextInjector
+{
+  public:
+    virtual char const* GetName() const override
+    {
+        return "WM_SETTEXT";
+    }
+
+    virtual TextInjectionResult Inject(void*          window,
+                                       wchar_t const* text,
+                                       size_t         length,
+                                       uint32_t       timeoutMs) override
+    {
+        return SendBounded(
+            (HWND)window, WM_SETTEXT, NULL, reinterpret_cast<LPARAM>(text), timeoutMs);
+    }
+};
+
+class ReplaceSelectionInjector : public ktmac::TextInjector
+{
+  public:
+    virtual char const* GetName() const override
+    {
+        return "EM_REPLACESEL";
+    }
+
+    virtual TextInjectionResult Inject(void*          window,
+                                       wchar_t const* text,
+                                       size_t         length,
+                                       uint32_t       timeoutMs) override
+    {
+        TextInjectionResult result = SendBounded((HWND)window, EM_SETSEL, 0, -1, timeoutMs);
+        if (result != TextInjectionResult::Succeeded)
+            return result;
+
+        return SendBounded(
+            (HWND)window, EM_REPLACESEL, FALSE, reinterpret_cast<LPARAM>(text), timeoutMs);
+    }
+};
+
+// Copies of every clipboard format whose data can be duplicated, taken and put back while the
+// clipboard is open. Formats held in GDI objects or private handles are left out, except for
+// enhanced metafiles; Windows synthesizes the common ones again from what is kept, e.g. CF_BITMAP
+// from CF_DIB.
+class ClipboardSnapshot
+{
+  private:
+    std::vector<std::pair<UINT, HANDLE>> _formatList;
+
+  public:
+    ClipboardSnapshot() = default;
+    ClipboardSnapshot(ClipboardSnapshot const&) = delete;
+    ClipboardSnapshot& operator=(ClipboardSnapshot const&) = delete;
+
+    ~ClipboardSnapshot()
+    {
+        for (auto& [format, data] : _formatList) Free(format, data);
+    }
+
+  public:
+    void Save()
+    {
+        for (UINT format = EnumClipboardFormats(0); format != 0;
+             format      = EnumClipboardFormats(format))
+        {
+            HANDLE data = GetClipboardData(format);
+            if (data == NULL)
+                continue;
+
+            HANDLE copy = NULL;
+            if (format == CF_ENHMETAFILE)
+                copy = CopyEnhMetaFileW((HENHMETAFILE)data, NULL);
+            else if (IsGlobalMemory(format))
+                copy = CopyGlobal((HGLOBAL)data);
+
+            if (copy != NULL)
+                _formatList.emplace_back(format, copy);
+        }
+    }
+
+    // The clipboard takes over every copy it accepts.
+    void Restore()
+    {
+        for (auto& [format, data] : _formatList)
+        {
+            if (SetClipboardData(format, data) == NULL)
+                Free(format, data);
+        }
+        _formatList.clear();
+    }
+
+  private:
+    static bool IsGlobalMemory(UINT format)
+    {
+        switch (format)
+        {
+        case CF_BITMAP:
+        case CF_METAFILEPICT:
+        case CF_PALETTE:
+        case CF_OWNERDISPLAY:
+        case CF_DSPBITMAP:
+        case CF_DSPMETAFILEPICT:
+        case CF_DSPENHMETAFILE: return false;
+        }
+        return !(format >= CF_PRIVATEFIRST && format <= CF_PRIVATELAST)
+               && !(format >= CF_GDIOBJFIRST && format <= CF_GDIOBJLAST);
+    }
+
+    static HGLOBAL CopyGlobal(HGLOBAL source)
+    {
+        SIZE_T size   = GlobalSize(source);
+        void*  buffer = GlobalLock(source);
+        if (buffer == nullptr)
+            return NULL;
+
+        HGLOBAL copy = GlobalAlloc(GMEM_MOVEABLE, size);
+        if (copy != NULL)
+        {
+            memcpy(GlobalLock(copy), buffer, size);
+            GlobalUnlock(copy);
+        }
+        GlobalUnlock(source);
+        return copy;
+    }
+
+    static void Free(UINT format, HANDLE data)
+    {
+        if (format == CF_ENHMETAFILE)
+            DeleteEnhMetaFile((HENHMETAFILE)data);
+        else
+            GlobalFree((HGLOBAL)data);
+    }
+};
+
+// Replaces the clipboard content temporarily and restores every format it held afterwards.
+class ClipboardPasteInjector : public ktmac::TextInjector
+{
+  private:
+    static HGLOBAL CopyToGlobal(wchar_t const* text, size_t length)
+    {
+        HGLOBAL memory = GlobalAlloc(GMEM_MOVEABLE, (length + 1) * sizeof(wchar_t));
+        if (memory == NULL)
+            return NULL;
+
+        auto buffer = (wchar_t*)GlobalLock(memory);
+        memcpy(buffer, text, length * sizeof(wchar_t));
+        buffer[length] = L'\0';
+        GlobalUnlock(memory);
+
+        return memory;
+    }
+
+  public:
+    virtual char const* GetName() const override
+    {
+        return "WM_PASTE";
+    }
+
+    virtual TextInjectionResult Inject(void*          window,
+                                       wchar_t const* text,
+                                       size_t         length,
+                                       uint32_t       timeoutMs) override
+    {
+        if (!OpenClipboard(NULL))
+            return TextInjectionResult::Failed;
+
+        ClipboardSnapshot previous;
+        previous.Save();
+
+        HGLOBAL memory = CopyToGlobal(text, length);
+        if (memory == NULL || !EmptyClipboard() || SetClipboardData(CF_UNICODETEXT, memory) == NULL)
+        {
+            if (memory != NULL)
+                GlobalFree(memory);
+            CloseClipboard();
+            return TextInjectionResult::Failed;
+        }
+        CloseClipboard();
+
+        TextInjectionResult result = SendBounded((HWND)window, EM_SETSEL, 0, -1, timeoutMs);
+        if (result == TextInjectionResult::Succeeded)
+            result = SendBounded((HWND)window, WM_PASTE, 0, 0, timeoutMs);
+
+        // A timed-out WM_PASTE may still run later, so the clipboard has to keep our text.
+        if (result == TextInjectionResult::TimedOut)
+            return result;
+
+        if (OpenClipboard(NULL))
+        {
+            EmptyClipboard();
+            previous.Restore();
+            CloseClipboard();
+        }
+
+        return result;
+    }
+};
+
+}
+
+namespace ktmac
+{
+
+std::unique_ptr<TextInjector> MakeTextInjector(TextInjectionMethod method)
+{
+    switch (method)
+    {
+    case TextInjectionMethod::SetText: return std::make_unique<SetTextInjector>();
+    case TextInjectionMethod::ReplaceSelection: return std::make_unique<ReplaceSelectionInjector>();
+    case TextInjectionMethod::ClipboardPaste: return std::make_unique<ClipboardPasteInjector>();
+    }
+
+    return nullptr;
+}
+
+}
@@ -1,21 +1,47 @@
 // Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
 // Licensed under the MIT License.
 
+#include <ktmac/HookTable.hh>
 #include <ktmac/WindowHook.hh>
 
 #include <TlHelp32.h>
 
-#include <mutex>
-#include <unordered_map>
+#include <atomic>
+#include <cstring>
 
 namespace ktmac
 {
 
+// Out-of-context hooks are called back on the thread that registered them, so the class cache is
+// only touched by one thread. The windows of interest can be replaced from any thread.
+struct HookFilterState
+{
+    static constexpr size_t CacheSize = 64;
+
+    struct CacheEntry
+    {
+        HWND window;
+        int  classIndex;
+    };
+
+    DWORD             events;
+    size_t            numClassNames;
+    char              classNames[HookFilterMaxClassNames][64];
+    std::atomic<HWND> windows[HookFilterMaxWindows];
+    CacheEntry        cache[CacheSize];
+
+    std::atomic<uint64_t> numForwarded;
+    std::atomic<uint64_t> numDropped;
+};
+
+// Exactly one of `handler` and `recordHandler` is set.
 struct HookListEntry
 {
-    ::HWINEVENTHOOK  hook;
-    HookEventHandler handler;
-    HookEventContext context;
+    ::HWINEVENTHOOK        hook;
+    HookEventHandler       handler;
+    HookEventRecordHandler recordHandler;
+    HookEventContext       context;
+    HookFilterState*       filter;
 };
 
 namespace
@@ -23,8 +49,73 @@ namespace
 
 HINSTANCE _instance = NULL;
 
-std::unordered_map<HWINEVENTHOOK, HookListEntry> _hookList;
-std::mutex                                       _hookListMtx;
+HookTable<HookListEntry> _hookList;
+
+DWORD ToEventMask(DWORD event)
+{
+    if (event < EVENT_OBJECT_CREATE || event > EVENT_OBJECT_HIDE)
+        return 0;
+    return 1 << (event - EVENT_OBJECT_CREATE);
+}
+
+HookFilterState::CacheEntry& GetCacheEntry(HookFilterState& filter, HWND window)
+{
+    return filter.cache[((uintptr_t)window >> 4) % HookFilterState::CacheSize];
+}
+
+// Returns the index of the filter class `window` belongs to, or -1 if it matches none.
+int FindClassIndex(HookFilterState& filter, HWND window)
+{
+    auto& entry = GetCacheEntry(filter, window);
+    if (entry.window != window)
+    {
+        entry.window     = window;
+        entry.classIndex = -1;
+
+        char className[64];
+        if (GetClassName(window, className, sizeof className))
+        {
+            for (size_t i = 0; i < filter.numClassNames; ++i)
+            {
+                if (strcmp(className, filter.classNames[i]) == 0)
+                {
+                    entry.classIndex = (int)i;
+                    break;
+                }
+            }
+        }
+    }
+
+    return entry.classIndex;
+}
+
+bool IsInteresting(HookFilterState& filter, HWND window, DWORD event)
+{
+    bool rtn = false;
+    if ((filter.events & ToEventMask(event)) != 0)
+    {
+        for (auto& windowOfInterest : filter.windows)
+        {
+            if (windowOfInterest.load(std::memory_order_relaxed) == window)
+            {
+                rtn = true;
+                break;
+            }
+        }
+
+        if (!rtn && filter.numClassNames != 0)
+            rtn = FindClassIndex(filter, window) >= 0;
+    }
+
+    // Window handles are recycled, so a destroyed window must not leave its class behind.
+    if (event == EVENT_OBJECT_DESTROY)
+    {
+        if (auto& entry = GetCacheEntry(filter, window); entry.window == window)
+            entry.window = NULL;
+    }
+
+    return rtn;
+}
 
 void CALLBACK WinEventProc(HWINEVENTHOOK hookHandle,
                            DWORD         event,
@@ -36,22 +127,87 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hookHandle,
 {
     if (objectId == OBJID_WINDOW && childId == CHILDID_SELF)
     {
-        HookEventHandler handler = nullptr;
-        HookEventContext context = nullptr;
-        {
-            std::lock_guard<std::mutex> guard { _hookListMtx };
-            if (auto it = _hookList.find(hookHandle); it != _hookList.end())
+        HookEventHandler       handler       = nullptr;
+        HookEventRecordHandler recordHandler = nullptr;
+        HookEventContext       context       = nullptr;
+        _hookList.Find((uintptr_t)hookHandle, [&](HookListEntry const& entry) {
+            if (entry.filter != nullptr)
             {
-                handler = it->second.handler;
-                context = it->second.context;
+                if (!IsInteresting(*entry.filter, window, event))
+                {
+                    entry.filter->numDropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                entry.filter->numForwarded.fetch_add(1, std::memory_order_relaxed);
             }
-        }
+
+            handler       = entry.handler;
+            recordHandler = entry.recordHandler;
+            context       = entry.context;
+        });
 
         if (handler)
             handler(context, window, event);
+        else if (recordHandler)
+            recordHandler(
+                context,
+                HookEventRecord { event, window, objectId, childId, eventThread, eventTimeMs });
     }
 }
 
+HWINEVENTHOOK StartHook(DWORD processId, HookListEntry entry, HookFilter const* filter)
+{
+    if (processId == NULL)
+        return NULL;
+
+    DWORD            eventMin = EVENT_OBJECT_CREATE, eventMax = EVENT_OBJECT_HIDE;
+    HookFilterState* state    = nullptr;
+    if (filter != nullptr)
+    {
+        DWORD events = filter->events & HookEventAll;
+        if (events == 0)
+            return NULL;
+
+        state         = new HookFilterState {};
+        state->events = events;
+        for (auto className : filter->classNames)
+        {
+            if (className == nullptr || strlen(className) >= sizeof state->classNames[0])
+                continue;
+            strcpy(state->classNames[state->numClassNames++], className);
+        }
+        for (size_t i = 0; i < HookFilterMaxWindows; ++i) state->windows[i] = filter->windows[i];
+
+        // Narrow the hook to the span between the first and the last event kind of interest. The
+        // class cache needs destruction events to stay valid, even if they are not forwarded.
+        DWORD hookEvents = events;
+        if (state->numClassNames != 0)
+            hookEvents |= HookEventDestroy;
+
+        while ((ToEventMask(eventMin) & hookEvents) == 0) ++eventMin;
+        while ((ToEventMask(eventMax) & hookEvents) == 0) --eventMax;
+    }
+
+    HWINEVENTHOOK rtn = SetWinEventHook(
+        eventMin, eventMax, _instance, WinEventProc, processId, NULL, WINEVENT_OUTOFCONTEXT);
+    if (rtn == NULL)
+    {
+        delete state;
+        return NULL;
+    }
+
+    entry.hook   = rtn;
+    entry.filter = state;
+    if (!_hookList.Insert((uintptr_t)rtn, entry))
+    {
+        UnhookWinEvent(rtn);
+        delete state;
+        return NULL;
+    }
+
+    return rtn;
+}
+
 }
 
 BOOL WINAPI DllMain(HINSTANCE instance, DWORD reason, LPVOID reserved)
@@ -63,40 +219,71 @@ BOOL WINAPI DllMain(HINSTANCE instance, DWORD reason, LPVOID reserved)
     return TRUE;
 }
 
-KTMAC_WINDOW_HOOK_PUBLIC HWINEVENTHOOK HookStart(DWORD            processId,
-                                                 HookEventHandler handler,
-                                                 HookEventContext context)
+KTMAC_WINDOW_HOOK_PUBLIC HWINEVENTHOOK HookStart(DWORD             processId,
+                                                 HookEventHandler  handler,
+                                                 HookEventContext  context,
+                                                 HookFilter const* filter)
 {
-    if (processId == NULL)
-        return NULL;
+    return StartHook(processId, HookListEntry { NULL, handler, nullptr, context, nullptr }, filter);
+}
 
-    HWINEVENTHOOK rtn = SetWinEventHook(EVENT_OBJECT_CREATE,
-                                        EVENT_OBJECT_HIDE,
-                                        _instance,
-                                        WinEventProc,
-                                        processId,
-                                        NULL,
-                                        WINEVENT_OUTOFCONTEXT);
-    if (rtn == NULL)
-        return NULL;
+KTMAC_WINDOW_HOOK_PUBLIC HWINEVENTHOOK HookStart(DWORD                  processId,
+                                                 HookEventRecordHandler handler,
+                                                 HookEventContext       context,
+                                                 HookFilter const*      filter)
+{
+    return StartHook(processId, HookListEntry { NULL, nullptr, handler, context, nullptr }, filter);
+}
 
+KTMAC_WINDOW_HOOK_PUBLIC void HookStop(HWINEVENTHOOK hook)
+{
+    HookFilterState* state = nullptr;
+    _hookList.Find((uintptr_t)hook, [&state](HookListEntry const& entry) { state = entry.filter; });
+
+    // Erase() waits until no dispatch can still be looking at the filter.
+    if (_hookList.Erase((uintptr_t)hook))
     {
-        std::lock_guard<std::mutex> guard { _hookListMtx };
-        _hookList.insert(std::make_pair(rtn, HookListEntry { rtn, handler, context }));
+        UnhookWinEvent(hook);
+        delete state;
     }
+}
+
+KTMAC_WINDOW_HOOK_PUBLIC bool HookSetWindows(HWINEVENTHOOK hook,
+                                             HWND const*   windows,
+                                             size_t        numWindows)
+{
+    bool rtn = false;
+    _hookList.Find((uintptr_t)hook, [&](HookListEntry const& entry) {
+        if (entry.filter == nullptr)
+            return;
+
+        for (size_t i = 0; i < HookFilterMaxWindows; ++i)
+        {
+            HWND window = i < numWindows ? windows[i] : NULL;
+            entry.filter->windows[i].store(window, std::memory_order_relaxed);
+        }
+        rtn = true;
+    });
 
     return rtn;
 }
 
-KTMAC_WINDOW_HOOK_PUBLIC void HookStop(HWINEVENTHOOK hook)
+KTMAC_WINDOW_HOOK_PUBLIC bool HookGetStatistics(HWINEVENTHOOK hook, HookStatistics* statistics)
 {
-    std::lock_guard<std::mutex> guard { _hookListMtx };
+    if (statistics == nullptr)
+        return false;
 
-    if (auto it = _hookList.find(hook); it != _hookList.end())
-    {
-        UnhookWinEvent(hook);
-        _hookList.erase(it);
-    }
+    bool rtn = false;
+    _hookList.Find((uintptr_t)hook, [&](HookListEntry const& entry) {
+        if (entry.filter == nullptr)
+            return;
+
+        statistics->numForwarded = entry.filter->numForwarded.load(std::memory_order_relaxed);
+        statistics->numDropped   = entry.filter->numDropped.load(std::memory_order_relaxed);
+        rtn                      = true;
+    });
+
+    return rtn;
 }
 
-}
\ No newline at end of file
+}
@@ -2,34 +2,91 @@
 // Licensed under the MIT License.
 
 #include <ktmac/gui/App.hh>
+#include <ktmac/gui/AssetScheme.hh>
 #include <ktmac/gui/Handler.hh>
-#include <ktmac/gui/ResourceUtils.hh>
-#include <ktmac/gui/Resources.h>
+#include <ktmac/gui/LeanMode.hh>
 
 #include <include/base/cef_bind.h>
 #include <include/cef_command_line.h>
-#include <include/cef_parser.h>
 #include <include/views/cef_browser_view.h>
 #include <include/views/cef_window.h>
 #include <include/wrapper/cef_closure_task.h>
 #include <include/wrapper/cef_helpers.h>
 
+#include <functional>
 #include <string>
 
+#include <Windows.h>
+
 namespace
 {
 
+using BrowserViewFactory = std::function<CefRefPtr<CefBrowserView>()>;
+
 class WindowDelegate : public CefWindowDelegate
 {
+  private:
+    // WinEvent callbacks carry no context, and only the main window defers its browser.
+    static WindowDelegate* _deferred;
+
+    static void CALLBACK HandleRestore(HWINEVENTHOOK hookHandle,
+                                       DWORD         event,
+                                       HWND          window,
+                                       LONG          objectId,
+                                       LONG          childId,
+                                       DWORD         threadId,
+                                       DWORD         eventTime)
+    {
+        if (_deferred != nullptr && objectId == OBJID_WINDOW
+            && window == _deferred->_window->GetWindowHandle())
+            _deferred->CreateBrowserView();
+    }
+
   private:
     CefRefPtr<CefBrowserView> _browserView;
+    BrowserViewFactory        _browserViewFactory;
+    CefRefPtr<CefWindow>      _window;
+    HWINEVENTHOOK             _restoreHook;
 
   public:
-    WindowDelegate(CefRefPtr<CefBrowserView> browserView) : _browserView { browserView } {}
+    WindowDelegate(CefRefPtr<CefBrowserView> browserView) :
+        _browserView { browserView },
+        _browserViewFactory {},
+        _window {},
+        _restoreHook { NULL }
+    {}
+
+    // The browser is created once the window, which starts minimized, is first restored.
+    WindowDelegate(BrowserViewFactory&& browserViewFactory) :
+        _browserView {},
+        _browserViewFactory { std::move(browserViewFactory) },
+        _window {},
+        _restoreHook { NULL }
+    {}
 
   public:
     virtual void OnWindowCreated(CefRefPtr<CefWindow> window) override
     {
+        if (!_browserView)
+        {
+            _window = window;
+            window->Show();
+            window->Minimize();
+
+            // Delivered on this thread while it pumps messages.
+            _deferred    = this;
+            _restoreHook = SetWinEventHook(EVENT_SYSTEM_MINIMIZEEND,
+                                           EVENT_SYSTEM_MINIMIZEEND,
+                                           NULL,
+                                           &HandleRestore,
+                                           GetCurrentProcessId(),
+                                           GetCurrentThreadId(),
+                                           WINEVENT_OUTOFCONTEXT);
+            if (_restoreHook == NULL)
+                CreateBrowserView();
+            return;
+        }
+
         window->AddChildView(_browserView);
         window->Show();
 
@@ -38,7 +95,14 @@ class WindowDelegate : public CefWindowDelegate
 
     virtual void OnWindowDestroyed(CefRefPtr<CefWindow> window) override
     {
+        StopDeferring();
+
+        // Without a browser, nothing else would end the message loop.
+        if (!_browserView && _browserViewFactory)
+            CefQuitMessageLoop();
+
         _browserView = nullptr;
+        _window      = nullptr;
     }
 
     virtual bool CanResize(CefRefPtr<CefWindow>) override
@@ -53,6 +117,9 @@ class WindowDelegate : public CefWindowDelegate
 
     virtual bool CanClose(CefRefPtr<CefWindow>) override
     {
+        if (!_browserView)
+            return true;
+
         CefRefPtr<CefBrowser> browser { _browserView->GetBrowser() };
         if (browser)
             return browser->GetHost()->TryCloseBrowser();
@@ -64,11 +131,35 @@ class WindowDelegate : public CefWindowDelegate
         return CefSize { 300, 150 };
     }
 
+  private:
+    void CreateBrowserView()
+    {
+        StopDeferring();
+
+        _browserView = _browserViewFactory();
+        _window->AddChildView(_browserView);
+        _window->Layout();
+
+        _browserView->RequestFocus();
+    }
+
+    void StopDeferring()
+    {
+        if (_restoreHook != NULL)
+            UnhookWinEvent(_restoreHook);
+
+        _restoreHook = NULL;
+        if (_deferred == this)
+            _deferred = nullptr;
+    }
+
   private:
     IMPLEMENT_REFCOUNTING(WindowDelegate);
     DISALLOW_COPY_AND_ASSIGN(WindowDelegate);
 };
 
+WindowDelegate* WindowDelegate::_deferred = nullptr;
+
 class BrowserViewDelegate : public CefBrowserViewDelegate
 {
   public:
@@ -91,12 +182,14 @@ class BrowserViewDelegate : public CefBrowserViewDelegate
     DISALLOW_COPY_AND_ASSIGN(BrowserViewDelegate);
 };
 
-std::string GetDataURI(void const* data, size_t size, char const* mimeType)
-{
-    using namespace std::string_literals;
-    return "data:"s + mimeType + ";base64,"
-           + CefURIEncode(CefBase64Encode(data, size), false).ToString();
-}
+// Returns a new promise and the function resolving it. CEF cannot call a constructor, so this is
+// left to script.
+constexpr char const MakePromiseScript[]
+    = "(function () {"
+      "  var resolve;"
+      "  var promise = new Promise(function (r) { resolve = r; });"
+      "  return [promise, resolve];"
+      "})";
 
 }
 
@@ -111,8 +204,18 @@ void App::OnContextInitialized()
     CefBrowserSettings       browserSettings;
     CefWindowInfo            windowInfo;
 
-    std::string_view html { LoadResource(KTMAC_RESTYPE_HTML, KTMAC_RES_VIEW_HTML) };
-    std::string      url { GetDataURI(html.data(), html.size(), "text/html") };
+    RegisterAssetSchemeHandler();
+    std::string url { std::string { AssetOrigin } + "View.html" };
+
+    // The core runs from here on either way, as the handler owns it.
+    if (CefCommandLine::GetGlobalCommandLine()->HasSwitch(LeanModeSwitch))
+    {
+        CefWindow::CreateTopLevelWindow(new WindowDelegate([handler, url, browserSettings]() {
+            return CefBrowserView::CreateBrowserView(
+                handler, url, browserSettings, nullptr, nullptr, new BrowserViewDelegate());
+        }));
+        return;
+    }
 
     CefRefPtr<CefBrowserView> browserView = CefBrowserView::CreateBrowserView(
         handler, url, browserSettings, nullptr, nullptr, new BrowserViewDelegate());
@@ -121,6 +224,18 @@ void App::OnContextInitialized()
     CefWindow::CreateTopLevelWindow(new WindowDelegate(browserView));
 }
 
+void App::OnBeforeCommandLineProcessing(const CefString&          processType,
+                                        CefRefPtr<CefCommandLine> commandLine)
+{
+    if (processType.empty() && commandLine->HasSwitch(LeanModeSwitch))
+        AddLeanModeSwitches(commandLine);
+}
+
+void App::OnRegisterCustomSchemes(CefRawPtr<CefSchemeRegistrar> registrar)
+{
+    AddAssetScheme(registrar);
+}
+
 CefRefPtr<CefClient> App::GetDefaultClient()
 {
     return SimpleHandler::GetInstance();
@@ -136,9 +251,46 @@ void App::OnContextCreated(CefRefPtr<CefBrowser>   browser,
     object->SetValue("ktmacSendMessage",
                      CefV8Value::CreateFunction("ktmacSendMessage", this),
                      V8_PROPERTY_ATTRIBUTE_NONE);
+    object->SetValue("ktmacSendBatch",
+                     CefV8Value::CreateFunction("ktmacSendBatch", this),
+                     V8_PROPERTY_ATTRIBUTE_NONE);
     object->SetValue("ktmacGetCurrentState",
                      CefV8Value::CreateFunction("ktmacGetCurrentState", this),
                      V8_PROPERTY_ATTRIBUTE_NONE);
+    object->SetValue("ktmacOnStateChange",
+                     CefV8Value::CreateFunction("ktmacOnStateChange", this),
+                     V8_PROPERTY_ATTRIBUTE_NONE);
+    object->SetValue("ktmacGetStartupTimings",
+                     CefV8Value::CreateFunction("ktmacGetStartupTimings", this),
+                     V8_PROPERTY_ATTRIBUTE_NONE);
+}
+
+void App::OnContextReleased(CefRefPtr<CefBrowser>   browser,
+                            CefRefPtr<CefFrame>     frame,
+                            CefRefPtr<CefV8Context> context)
+{
+    if (_stateContext && _stateContext->IsSame(context))
+    {
+        _stateContext  = nullptr;
+        _stateCallback = nullptr;
+        _stateValueList.clear();
+        _stateArguments.clear();
+    }
+
+    if (_promiseContext && _promiseContext->IsSame(context))
+    {
+        _promiseContext = nullptr;
+        _makePromise    = nullptr;
+    }
+
+    // Replies to requests from the released context have nowhere to go.
+    for (auto it = _pendingList.begin(); it != _pendingList.end();)
+    {
+        if (it->second.context->IsSame(context))
+            it = _pendingList.erase(it);
+        else
+            ++it;
+    }
 }
 
 bool App::Execute(const CefString&       name,
@@ -149,27 +301,96 @@ bool App::Execute(const CefString&       name,
 {
     if (name == "ktmacSendMessage")
     {
-        if (arguments.size() != 1)
+        if (arguments.size() != 1 || !arguments[0]->IsString())
         {
-            exception.FromString("Invalid number of arguments");
+            exception.FromString("Expected a string");
             return true;
         }
 
-        auto content = arguments[0];
+        CefRefPtr<CefListValue> messageList = CefListValue::Create();
+        messageList->SetString(0, arguments[0]->GetStringValue());
+
+        retval = SendMessages(messageList, false);
+        if (!retval)
+            exception.FromString("Could not create a promise");
+        return true;
+    }
+    else if (name == "ktmacSendBatch")
+    {
+        if (arguments.size() != 1 || !arguments[0]->IsArray())
+        {
+            exception.FromString("Expected an array of strings");
+            return true;
+        }
 
-        CefRefPtr<CefProcessMessage> message = CefProcessMessage::Create("ktmac-send-message");
-        CefRefPtr<CefListValue>      args    = message->GetArgumentList();
+        CefRefPtr<CefListValue> messageList = CefListValue::Create();
+        for (int i = 0, length = arguments[0]->GetArrayLength(); i < length; ++i)
+        {
+            CefRefPtr<CefV8Value> content = arguments[0]->GetValue(i);
+            if (!content || !content->IsString())
+            {
+                exception.FromString("Expected an array of strings");
+                return true;
+            }
+            messageList->SetString(i, content->GetStringValue());
+        }
 
-        args->SetString(0, content->GetStringValue().c_str());
+        retval = SendMessages(messageList, true);
+        if (!retval)
+            exception.FromString("Could not create a promise");
+        return true;
+    }
+    else if (name == "ktmacOnStateChange")
+    {
+        if (arguments.size() != 1 || !arguments[0]->IsFunction())
+        {
+            exception.FromString("Expected a function");
+            return true;
+        }
 
-        auto frame = _browser->GetMainFrame();
-        frame->SendProcessMessage(PID_BROWSER, message);
+        CefRefPtr<CefV8Context> context = CefV8Context::GetCurrentContext();
+        if (!_stateContext || !_stateContext->IsSame(context))
+        {
+            _stateValueList.clear();
+            _stateContext = context;
+        }
+        _stateCallback = arguments[0];
 
+        // The initial state may have arrived before the page registered.
+        if (!_lastState.empty())
+            DeliverState();
         return true;
     }
     else if (name == "ktmacGetCurrentState")
     {
+        int requestId = _nextRequestId++;
+        retval        = MakePromise(requestId, false);
+        if (!retval)
+        {
+            exception.FromString("Could not create a promise");
+            return true;
+        }
+
         CefRefPtr<CefProcessMessage> message = CefProcessMessage::Create("ktmac-get-current-state");
+        message->GetArgumentList()->SetInt(0, requestId);
+
+        auto frame = _browser->GetMainFrame();
+        frame->SendProcessMessage(PID_BROWSER, message);
+        return true;
+    }
+    else if (name == "ktmacGetStartupTimings")
+    {
+        int requestId = _nextRequestId++;
+        retval        = MakePromise(requestId, false);
+        if (!retval)
+        {
+            exception.FromString("Could not create a promise");
+            return true;
+        }
+
+        CefRefPtr<CefProcessMessage> message
+            = CefProcessMessage::Create("ktmac-get-startup-timings");
+        message->GetArgumentList()->SetInt(0, requestId);
 
         auto frame = _browser->GetMainFrame();
         frame->SendProcessMessage(PID_BROWSER, message);
@@ -184,24 +405,175 @@ bool App::OnProcessMessageReceived(CefRefPtr<CefBrowser>        browser,
                                    CefProcessId                 source_process,
                                    CefRefPtr<CefProcessMessage> message)
 {
-    using namespace std::string_literals;
-
     if (message->GetName() == "ktmac-state-change")
     {
         auto arguments = message->GetArgumentList();
         if (arguments->GetSize() != 1)
             return false;
 
-        std::wstring script
-            = L"window.dispatchEvent(new CustomEvent('ktmac-state-changed',{'detail':'"s;
-
-        script += arguments->GetString(0);
-        script += L"'}));";
-
-        frame->ExecuteJavaScript(script, frame->GetURL(), 0);
+        _lastState = arguments->GetString(0).ToString();
+        DeliverState();
+        return true;
+    }
+    else if (message->GetName() == "ktmac-send-result")
+    {
+        ResolveSendResult(message->GetArgumentList());
+        return true;
+    }
+    else if (message->GetName() == "ktmac-current-state")
+    {
+        ResolveCurrentState(message->GetArgumentList());
+        return true;
+    }
+    else if (message->GetName() == "ktmac-startup-timings")
+    {
+        ResolveStartupTimings(message->GetArgumentList());
         return true;
     }
     return false;
 }
 
+void App::DeliverState()
+{
+    if (!_stateCallback || !_stateContext || !_stateContext->IsValid() || !_stateContext->Enter())
+        return;
+
+    auto it = _stateValueList.find(_lastState);
+    if (it == _stateValueList.end())
+        it = _stateValueList.emplace(_lastState, CefV8Value::CreateString(_lastState)).first;
+
+    _stateArguments.assign(1, it->second);
+    _stateCallback->ExecuteFunction(nullptr, _stateArguments);
+
+    _stateContext->Exit();
+}
+
+CefRefPtr<CefV8Value> App::MakePromise(int requestId, bool batch)
+{
+    CefRefPtr<CefV8Context> context = CefV8Context::GetCurrentContext();
+    if (!_promiseContext || !_promiseContext->IsSame(context))
+    {
+        CefRefPtr<CefV8Exception> exception;
+        _promiseContext = context;
+        _makePromise    = nullptr;
+        context->Eval(MakePromiseScript, CefString {}, 0, _makePromise, exception);
+    }
+
+    if (!_makePromise || !_makePromise->IsFunction())
+        return nullptr;
+
+    CefRefPtr<CefV8Value> pair = _makePromise->ExecuteFunction(nullptr, CefV8ValueList {});
+    if (!pair || !pair->IsArray())
+        return nullptr;
+
+    _pendingList[requestId] = PendingRequest {
+        context,
+        pair->GetValue(1),
+        std::chrono::steady_clock::now(),
+        batch,
+    };
+    return pair->GetValue(0);
+}
+
+CefRefPtr<CefV8Value> App::SendMessages(CefRefPtr<CefListValue> messageList, bool batch)
+{
+    int                   requestId = _nextRequestId++;
+    CefRefPtr<CefV8Value> promise   = MakePromise(requestId, batch);
+    if (!promise)
+        return nullptr;
+
+    // However many messages there are, they take one message to the browser process.
+    CefRefPtr<CefProcessMessage> message = CefProcessMessage::Create("ktmac-send-messages");
+    CefRefPtr<CefListValue>      args    = message->GetArgumentList();
+
+    args->SetInt(0, requestId);
+    args->SetList(1, messageList);
+
+    auto frame = _browser->GetMainFrame();
+    frame->SendProcessMessage(PID_BROWSER, message);
+    return promise;
+}
+
+bool App::EnterRequest(int requestId, PendingRequest& request)
+{
+    auto it = _pendingList.find(requestId);
+    if (it == _pendingList.end())
+        return false;
+
+    request = std::move(it->second);
+    _pendingList.erase(it);
+    return request.context->IsValid() && request.context->Enter();
+}
+
+void App::ResolveSendResult(CefRefPtr<CefListValue> arguments)
+{
+    PendingRequest request;
+    if (arguments->GetSize() != 4 || !EnterRequest(arguments->GetInt(0), request))
+        return;
+
+    // The browser process reports when it had the result of each message, counting from when the
+    // request arrived, and how long the whole request took. The latency of a message is the time
+    // from the call until the browser process had its result.
+    auto   elapsed   = std::chrono::steady_clock::now() - request.start;
+    double roundTrip = std::chrono::duration<double, std::milli>(elapsed).count();
+
+    CefRefPtr<CefListValue> successList = arguments->GetList(1);
+    CefRefPtr<CefListValue> doneList    = arguments->GetList(2);
+    double                  total       = arguments->GetDouble(3);
+
+    CefRefPtr<CefV8Value> resultList = CefV8Value::CreateArray((int)successList->GetSize());
+    for (int i = 0, size = (int)successList->GetSize(); i < size; ++i)
+    {
+        CefRefPtr<CefV8Value> result = CefV8Value::CreateObject(nullptr, nullptr);
+        result->SetValue("success",
+                         CefV8Value::CreateBool(successList->GetBool(i)),
+                         V8_PROPERTY_ATTRIBUTE_NONE);
+        result->SetValue("latency",
+                         CefV8Value::CreateDouble(roundTrip - (total - doneList->GetDouble(i))),
+                         V8_PROPERTY_ATTRIBUTE_NONE);
+        resultList->SetValue(i, result);
+    }
+
+    CefV8ValueList resolveArguments { request.batch ? resultList : resultList->GetValue(0) };
+    request.resolve->ExecuteFunction(nullptr, resolveArguments);
+    request.context->Exit();
+}
+
+void App::ResolveCurrentState(CefRefPtr<CefListValue> arguments)
+{
+    PendingRequest request;
+    if (arguments->GetSize() != 2 || !EnterRequest(arguments->GetInt(0), request))
+        return;
+
+    CefV8ValueList resolveArguments { CefV8Value::CreateString(arguments->GetString(1)) };
+    request.resolve->ExecuteFunction(nullptr, resolveArguments);
+    request.context->Exit();
+}
+
+// Resolves to an object with the duration of each phase in milliseconds, as
+// ktmac::StartupTimings has them, and whether a shared process hook was used.
+void App::ResolveStartupTimings(CefRefPtr<CefListValue> arguments)
+{
+    PendingRequest request;
+    if (arguments->GetSize() != 2 || !EnterRequest(arguments->GetInt(0), request))
+        return;
+
+    CefRefPtr<CefDictionaryValue> phaseList = arguments->GetDictionary(1);
+    CefRefPtr<CefV8Value>         timings   = CefV8Value::CreateObject(nullptr, nullptr);
+
+    CefDictionaryValue::KeyList keyList;
+    phaseList->GetKeys(keyList);
+    for (auto& key : keyList)
+    {
+        CefRefPtr<CefV8Value> value = phaseList->GetType(key) == VTYPE_BOOL
+                                          ? CefV8Value::CreateBool(phaseList->GetBool(key))
+                                          : CefV8Value::CreateDouble(phaseList->GetDouble(key));
+        timings->SetValue(key, value, V8_PROPERTY_ATTRIBUTE_NONE);
+    }
+
+    CefV8ValueList resolveArguments { timings };
+    request.resolve->ExecuteFunction(nullptr, resolveArguments);
+    request.context->Exit();
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/gui/AssetScheme.hh>
+#include <ktmac/gui/ResourceUtils.hh>
+#include <ktmac/gui/Resources.h>
+
+#include <include/cef_parser.h>
+#include <include/cef_stream.h>
+#include <include/cef_zip_reader.h>
+#include <include/wrapper/cef_stream_resource_handler.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace
+{
+
+// Reads memory that outlives the reader without copying it first.
+class MemoryReadHandler : public CefReadHandler
+{
+  private:
+    std::string_view _data;
+    size_t           _offset;
+
+  public:
+    MemoryReadHandler(std::string_view data) : _data { data }, _offset { 0 } {}
+
+  public:
+    virtual size_t Read(void* ptr, size_t size, size_t n) override
+    {
+        if (size == 0)
+            return 0;
+
+        size_t count = std::min(n, (_data.size() - _offset) / size);
+        std::memcpy(ptr, _data.data() + _offset, count * size);
+        _offset += count * size;
+        return count;
+    }
+
+    virtual int Seek(int64 offset, int whence) override
+    {
+        int64 base;
+        switch (whence)
+        {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (int64)_offset; break;
+        case SEEK_END: base = (int64)_data.size(); break;
+        default: return -1;
+        }
+
+        if (base + offset < 0 || base + offset > (int64)_data.size())
+            return -1;
+
+        _offset = (size_t)(base + offset);
+        return 0;
+    }
+
+    virtual int64 Tell() override
+    {
+        return (int64)_offset;
+    }
+
+    virtual int Eof() override
+    {
+        return _offset >= _data.size() ? 1 : 0;
+    }
+
+    virtual bool MayBlock() override
+    {
+        return false;
+    }
+
+  private:
+    IMPLEMENT_REFCOUNTING(MemoryReadHandler);
+};
+
+std::string ToLower(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char ch) {
+        return (char)std::tolower(ch);
+    });
+    return text;
+}
+
+// Inflates every asset in the bundle the build embedded as a resource. The bundle is read where
+// the resource is mapped.
+std::unordered_map<std::string, std::string> UnpackAssets()
+{
+    std::unordered_map<std::string, std::string> assetList;
+
+    std::string_view bundle { ktmac::gui::LoadResource(KTMAC_RESTYPE_ASSETS, KTMAC_RES_ASSETS) };
+    if (bundle.empty())
+        return assetList;
+
+    CefRefPtr<CefZipReader> reader = CefZipReader::Create(
+        CefStreamReader::CreateForHandler(new MemoryReadHandler { bundle }));
+    if (!reader || !reader->MoveToFirstFile())
+        return assetList;
+
+    do
+    {
+        if (!reader->OpenFile(CefString {}))
+            continue;
+
+        std::string content((size_t)reader->GetFileSize(), '\0');
+        size_t      numRead = 0;
+        while (numRead < content.size())
+        {
+            int result = reader->ReadFile(content.data() + numRead, content.size() - numRead);
+            if (result <= 0)
+                break;
+            numRead += (size_t)result;
+        }
+        reader->CloseFile();
+
+        content.resize(numRead);
+        assetList.emplace(ToLower(reader->GetFileName().ToString()), std::move(content));
+    } while (reader->MoveToNextFile());
+
+    return assetList;
+}
+
+// Runs on the IO thread.
+class AssetSchemeHandlerFactory : public CefSchemeHandlerFactory
+{
+  public:
+    virtual CefRefPtr<CefResourceHandler> Create(CefRefPtr<CefBrowser>,
+                                                 CefRefPtr<CefFrame>,
+                                                 const CefString&,
+                                                 CefRefPtr<CefRequest> request) override
+    {
+        // Unpacked on first use and kept for the lifetime of the process; responses read the
+        // unpacked assets in place.
+        static std::unordered_map<std::string, std::string> const assetList { UnpackAssets() };
+
+        CefURLParts parts;
+        if (!CefParseURL(request->GetURL(), parts))
+            return nullptr;
+
+        std::string path = ToLower(CefString(&parts.path).ToString());
+        if (!path.empty() && path[0] == '/')
+            path.erase(0, 1);
+
+        auto it = assetList.find(path);
+        if (it == assetList.end())
+            return nullptr;
+
+        size_t      dot      = path.rfind('.');
+        std::string mimeType = dot == std::string::npos
+                                   ? std::string {}
+                                   : CefGetMimeType(path.substr(dot + 1)).ToString();
+        if (mimeType.empty())
+            mimeType = "application/octet-stream";
+
+        return new CefStreamResourceHandler(
+            mimeType, CefStreamReader::CreateForHandler(new MemoryReadHandler { it->second }));
+    }
+
+  private:
+    IMPLEMENT_REFCOUNTING(AssetSchemeHandlerFactory);
+};
+
+}
+
+namespace ktmac::gui
+{
+
+void AddAssetScheme(CefRawPtr<CefSchemeRegistrar> registrar)
+{
+    registrar->AddCustomScheme(AssetScheme,
+                               CEF_SCHEME_OPTION_STANDARD | CEF_SCHEME_OPTION_SECURE
+                                   | CEF_SCHEME_OPTION_CORS_ENABLED);
+}
+
+void RegisterAssetSchemeHandler()
+{
+    CefRegisterSchemeHandlerFactory(AssetScheme, AssetDomain, new AssetSchemeHandlerFactory);
+}
+
+}
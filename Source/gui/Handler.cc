@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 #include <ktmac/KakaoStateManager.hh>
+#include <ktmac/gui/AssetScheme.hh>
 #include <ktmac/gui/Handler.hh>
 
 #include <include/base/cef_callback.h>
@@ -12,59 +13,47 @@
 #include <include/wrapper/cef_closure_task.h>
 #include <include/wrapper/cef_helpers.h>
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <sstream>
 #include <string>
 
 namespace
 {
 
-const char*               g_lastState = "";
-SimpleHandler*            g_instance  = nullptr;
-ktmac::KakaoStateManager* g_manager   = nullptr;
-
-// Returns a data: URI with the specified contents.
-std::string GetDataURI(const std::string& data, const std::string& mime_type)
-{
-    return "data:" + mime_type + ";base64,"
-           + CefURIEncode(CefBase64Encode(data.data(), data.size()), false).ToString();
-}
+std::atomic<const char*>  g_lastState { "" };
+std::atomic<bool>         g_statePending { false };
+SimpleHandler*            g_instance = nullptr;
+ktmac::KakaoStateManager* g_manager  = nullptr;
 
 } // namespace
 
-#define HANDLE_CASE(Name, RealName)                                                                \
-    case ktmac::KakaoState::Name:                                                                  \
-    {                                                                                              \
-        g_lastState = RealName;                                                                    \
-        g_instance->NotifyStateChange(RealName);                                                   \
-        break;                                                                                     \
-    }
-
-SimpleHandler::SimpleHandler(bool use_views) : use_views_(use_views), is_closing_(false)
+SimpleHandler::SimpleHandler(bool use_views) :
+    use_views_(use_views), is_closing_(false), send_stopping_(false)
 {
     DCHECK(!g_instance);
     g_instance = this;
     g_manager  = new ktmac::KakaoStateManager {
         {
             this,
-            [](void* browser, ktmac::KakaoState state) {
-                switch (state)
-                {
-                    HANDLE_CASE(NotRunning, "not-running")
-                    HANDLE_CASE(LoggedOut, "logged-out")
-                    HANDLE_CASE(Background, "background")
-                    HANDLE_CASE(Locked, "locked")
-                    HANDLE_CASE(ContactListIsVisible, "contact-list-is-visible")
-                    HANDLE_CASE(ChatroomListIsVisible, "chatroom-list-is-visible")
-                    HANDLE_CASE(MiscIsVisible, "misc-is-visible")
-                    HANDLE_CASE(ChatroomIsVisible, "chatroom-is-visible")
-                }
+            [](void*, ktmac::KakaoState state) {
+                SimpleHandler::NotifyStateChange(ktmac::GetKakaoStateName(state));
             },
         },
     };
+    send_thread_ = std::thread { &SimpleHandler::RunSends, this };
 }
 
 SimpleHandler::~SimpleHandler()
 {
+    {
+        std::lock_guard<std::mutex> guard { send_mtx_ };
+        send_stopping_ = true;
+    }
+    send_cv_.notify_one();
+    send_thread_.join();
+
     g_instance = nullptr;
     delete g_manager;
     g_manager = nullptr;
@@ -128,6 +117,8 @@ void SimpleHandler::OnBeforeClose(CefRefPtr<CefBrowser> browser)
 {
     CEF_REQUIRE_UI_THREAD();
 
+    sent_state_list_.erase(browser->GetIdentifier());
+
     // Remove from the list of existing browsers.
     BrowserList::iterator bit = browser_list_.begin();
     for (; bit != browser_list_.end(); ++bit)
@@ -162,21 +153,27 @@ void SimpleHandler::OnLoadError(CefRefPtr<CefBrowser> browser,
     if (errorCode == ERR_ABORTED)
         return;
 
-    // Display a load error message using a data: URI.
+    // Display a load error message from the asset bundle, unless that is what failed to load.
+    std::string errorPage = std::string { ktmac::gui::AssetOrigin } + "Error.html";
+    if (std::string(failedUrl).compare(0, errorPage.size(), errorPage) == 0)
+        return;
+
     std::stringstream ss;
-    ss << "<html><body bgcolor=\"white\">"
-          "<h2>Failed to load URL "
-       << std::string(failedUrl) << " with error " << std::string(errorText) << " (" << errorCode
-       << ").</h2></body></html>";
+    ss << errorPage << "?url=" << CefURIEncode(failedUrl, false).ToString()
+       << "&text=" << CefURIEncode(errorText, false).ToString() << "&code=" << errorCode;
 
-    frame->LoadURL(GetDataURI(ss.str(), "text/html"));
+    frame->LoadURL(ss.str());
 }
 
 void SimpleHandler::OnLoadEnd(CefRefPtr<CefBrowser> browser,
                               CefRefPtr<CefFrame>   frame,
                               int                   httpStatusCode)
 {
-    NotifyStateChange(g_lastState);
+    CEF_REQUIRE_UI_THREAD();
+
+    // A new page has not seen any state yet.
+    if (frame->IsMain())
+        SendStateChange(browser, g_lastState.load(std::memory_order_acquire));
 }
 
 void SimpleHandler::CloseAllBrowsers(bool force_close)
@@ -214,31 +211,160 @@ bool SimpleHandler::OnProcessMessageReceived(CefRefPtr<CefBrowser>        browse
                                              CefProcessId                 source_process,
                                              CefRefPtr<CefProcessMessage> message)
 {
-    if (message->GetName() == "ktmac-send-message")
+    using Clock = std::chrono::steady_clock;
+
+    if (message->GetName() == "ktmac-send-messages")
     {
-        if (g_manager)
+        auto arguments   = message->GetArgumentList();
+        auto messageList = arguments->GetList(1);
+
+        SendJob job { frame, arguments->GetInt(0), {}, Clock::now() };
+        for (size_t i = 0; messageList && i < messageList->GetSize(); ++i)
+            job.message_list.push_back(messageList->GetString(i));
+
         {
-            auto arguments = message->GetArgumentList();
-            g_manager->SetMessage(arguments->GetString(0).c_str());
-            g_manager->SendMessage();
+            std::lock_guard<std::mutex> guard { send_mtx_ };
+            send_job_list_.push_back(std::move(job));
         }
+        send_cv_.notify_one();
+        return true;
+    }
+    else if (message->GetName() == "ktmac-get-current-state")
+    {
+        ktmac::KakaoState state = g_manager ? g_manager->GetCurrentState()
+                                            : ktmac::KakaoState::NotRunning;
+
+        CefRefPtr<CefProcessMessage> reply = CefProcessMessage::Create("ktmac-current-state");
+        CefRefPtr<CefListValue>      args  = reply->GetArgumentList();
+
+        args->SetInt(0, message->GetArgumentList()->GetInt(0));
+        args->SetString(1, ktmac::GetKakaoStateName(state));
+        frame->SendProcessMessage(PID_RENDERER, reply);
+        return true;
+    }
+    else if (message->GetName() == "ktmac-get-startup-timings")
+    {
+        ktmac::StartupTimings timings = g_manager ? g_manager->GetStartupTimings()
+                                                  : ktmac::StartupTimings {};
+
+        auto ms = [](std::chrono::microseconds time) { return time.count() / 1000.0; };
+
+        CefRefPtr<CefDictionaryValue> phaseList = CefDictionaryValue::Create();
+        phaseList->SetDouble("subscribe", ms(timings.subscribe));
+        phaseList->SetDouble("processScan", ms(timings.processScan));
+        phaseList->SetDouble("windowScan", ms(timings.windowScan));
+        phaseList->SetDouble("hookLaunch", ms(timings.hookLaunch));
+        phaseList->SetDouble("initialState", ms(timings.initialState));
+        phaseList->SetDouble("threadStart", ms(timings.threadStart));
+        phaseList->SetDouble("total", ms(timings.total));
+        phaseList->SetBool("sharedHook", timings.sharedHook);
+
+        CefRefPtr<CefProcessMessage> reply = CefProcessMessage::Create("ktmac-startup-timings");
+        CefRefPtr<CefListValue>      args  = reply->GetArgumentList();
+
+        args->SetInt(0, message->GetArgumentList()->GetInt(0));
+        args->SetDictionary(1, phaseList);
+        frame->SendProcessMessage(PID_RENDERER, reply);
         return true;
     }
     return false;
 }
 
+// static
 void SimpleHandler::NotifyStateChange(const char* state)
 {
-    CefRefPtr<CefProcessMessage> message = CefProcessMessage::Create("ktmac-state-change");
-    CefRefPtr<CefListValue>      args    = message->GetArgumentList();
-    args->SetString(0, state);
+    g_lastState.store(state, std::memory_order_release);
+
+    // Changes arriving before the UI thread gets to the pending task only replace the state it
+    // sends.
+    if (!g_statePending.exchange(true, std::memory_order_acq_rel))
+        CefPostTask(TID_UI, base::Bind(&SimpleHandler::FlushStateChange));
+}
+
+void SimpleHandler::RunSends()
+{
+    using Clock = std::chrono::steady_clock;
 
-    for (auto& browser : browser_list_)
+    std::unique_lock<std::mutex> lock { send_mtx_ };
+    while (true)
     {
-        browser->GetMainFrame()->SendProcessMessage(PID_RENDERER, message);
+        send_cv_.wait(lock, [this]() { return send_stopping_ || !send_job_list_.empty(); });
+        if (send_stopping_)
+            return;
+
+        SendJob job = std::move(send_job_list_.front());
+        send_job_list_.pop_front();
+        lock.unlock();
+
+        // The renderer works out the latency of each message from when its result was known.
+        CefRefPtr<CefListValue> successList = CefListValue::Create();
+        CefRefPtr<CefListValue> doneList    = CefListValue::Create();
+        for (size_t i = 0; i < job.message_list.size(); ++i)
+        {
+            bool success = g_manager && g_manager->SetMessage(job.message_list[i].c_str())
+                           && g_manager->SendMessage();
+
+            auto elapsed = Clock::now() - job.start;
+            successList->SetBool(i, success);
+            doneList->SetDouble(i, std::chrono::duration<double, std::milli>(elapsed).count());
+        }
+
+        CefRefPtr<CefProcessMessage> reply = CefProcessMessage::Create("ktmac-send-result");
+        CefRefPtr<CefListValue>      args  = reply->GetArgumentList();
+
+        auto elapsed = Clock::now() - job.start;
+        args->SetInt(0, job.request_id);
+        args->SetList(1, successList);
+        args->SetList(2, doneList);
+        args->SetDouble(3, std::chrono::duration<double, std::milli>(elapsed).count());
+
+        // Not bound to the handler, which may be on its way out by the time this runs.
+        CefPostTask(TID_UI, base::Bind(&SimpleHandler::SendReply, job.frame, reply));
+
+        lock.lock();
+    }
+}
+
+// static
+void SimpleHandler::SendReply(CefRefPtr<CefFrame> frame, CefRefPtr<CefProcessMessage> reply)
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    if (frame->IsValid())
+        frame->SendProcessMessage(PID_RENDERER, reply);
+}
+
+// static
+void SimpleHandler::FlushStateChange()
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    // Cleared before the state is read, so a change stored after the read posts another task.
+    g_statePending.store(false, std::memory_order_release);
+    const char* state = g_lastState.load(std::memory_order_acquire);
+
+    if (!g_instance)
+        return;
+
+    for (auto& browser : g_instance->browser_list_)
+    {
+        auto it = g_instance->sent_state_list_.find(browser->GetIdentifier());
+        if (it == g_instance->sent_state_list_.end() || it->second != state)
+            g_instance->SendStateChange(browser, state);
     }
 }
 
+void SimpleHandler::SendStateChange(CefRefPtr<CefBrowser> browser, const char* state)
+{
+    // Sending may take over the message's contents, in which case it has to be made again.
+    if (!state_message_ || !state_message_->IsValid())
+        state_message_ = CefProcessMessage::Create("ktmac-state-change");
+
+    state_message_->GetArgumentList()->SetString(0, state);
+    browser->GetMainFrame()->SendProcessMessage(PID_RENDERER, state_message_);
+    sent_state_list_[browser->GetIdentifier()] = state;
+}
+
 void SimpleHandler::PlatformTitleChange(CefRefPtr<CefBrowser> browser, const CefString& title)
 {
     CefWindowHandle hwnd = browser->GetHost()->GetWindowHandle();
@@ -0,0 +1,27 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/gui/LeanMode.hh>
+
+#include <string>
+
+namespace ktmac::gui
+{
+
+void AddLeanModeSwitches(CefRefPtr<CefCommandLine> commandLine)
+{
+    // Pages are composited in software. The display compositor still lives in the GPU process
+    // even then, so that runs as a thread of the browser process instead of a process of its own.
+    commandLine->AppendSwitch("disable-gpu");
+    commandLine->AppendSwitch("disable-gpu-compositing");
+    commandLine->AppendSwitch("in-process-gpu");
+
+    // Every page, including the error page and DevTools, shares one renderer process.
+    commandLine->AppendSwitchWithValue("renderer-process-limit", "1");
+    commandLine->AppendSwitchWithValue(
+        "js-flags", "--max-old-space-size=" + std::to_string(LeanModeHeapLimitMb));
+
+    commandLine->AppendSwitch("disable-extensions");
+}
+
+}
@@ -0,0 +1,300 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+// Reports the memory CEF takes to show a page like the GUI's, with the default settings and in the
+// lean mode. Each mode runs in a child process of its own, as CEF can only be initialized once per
+// process, and is measured once its page has been idle for a while: the resident and proportional
+// set sizes summed over the browser process and every process it started. The browser is rendered
+// off-screen, so no display is needed.
+
+#include <ktmac/gui/LeanMode.hh>
+
+#include <include/base/cef_bind.h>
+#include <include/cef_app.h>
+#include <include/cef_browser.h>
+#include <include/cef_client.h>
+#include <include/cef_command_line.h>
+#include <include/cef_parser.h>
+#include <include/cef_render_handler.h>
+#include <include/wrapper/cef_closure_task.h>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+constexpr char const Page[]
+    = "<html><head><meta charset='utf-8'><style>"
+      "* { margin: 0; padding: 0; }"
+      "textarea { position: absolute; top: 20vh; width: 100vw; height: 60vh; resize: none; }"
+      "button { position: absolute; top: 80vh; width: 100vw; height: 20vh; }"
+      "</style></head><body>"
+      "<div id='state'>background</div><textarea></textarea><button>Send</button>"
+      "</body></html>";
+
+struct MemoryUsage
+{
+    size_t numProcesses;
+    size_t rssKb;
+    size_t pssKb;
+};
+
+// Reads a "Name:   1234 kB" line from a file under /proc.
+size_t ReadKb(std::string const& path, char const* name)
+{
+    std::ifstream file { path };
+    std::string   line;
+    size_t        length = std::strlen(name);
+    while (std::getline(file, line))
+    {
+        if (line.compare(0, length, name) == 0)
+            return (size_t)std::strtoull(line.c_str() + length, nullptr, 10);
+    }
+    return 0;
+}
+
+// Sums this process and all of its descendants.
+MemoryUsage MeasureProcessTree()
+{
+    std::unordered_map<pid_t, std::vector<pid_t>> childList;
+    if (DIR* proc = opendir("/proc"))
+    {
+        while (dirent* entry = readdir(proc))
+        {
+            pid_t pid = (pid_t)std::atoi(entry->d_name);
+            if (pid <= 0)
+                continue;
+
+            // The command name may contain spaces, but not the closing parenthesis.
+            std::ifstream file { std::string { "/proc/" } + entry->d_name + "/stat" };
+            std::string   stat;
+            std::getline(file, stat);
+
+            size_t end = stat.rfind(')');
+            if (end == std::string::npos)
+                continue;
+
+            char  state;
+            pid_t parent;
+            if (std::sscanf(stat.c_str() + end + 1, " %c %d", &state, &parent) == 2)
+                childList[parent].push_back(pid);
+        }
+        closedir(proc);
+    }
+
+    MemoryUsage        usage = {};
+    std::vector<pid_t> queue = { getpid() };
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        std::string path = "/proc/" + std::to_string(queue[i]);
+        usage.numProcesses += 1;
+        usage.rssKb += ReadKb(path + "/status", "VmRSS:");
+        usage.pssKb += ReadKb(path + "/smaps_rollup", "Pss:");
+
+        auto it = childList.find(queue[i]);
+        if (it != childList.end())
+            queue.insert(queue.end(), it->second.begin(), it->second.end());
+    }
+    return usage;
+}
+
+class BenchmarkApp : public CefApp
+{
+  private:
+    bool _lean;
+
+  public:
+    explicit BenchmarkApp(bool lean) : _lean { lean } {}
+
+    virtual void OnBeforeCommandLineProcessing(const CefString&          processType,
+                                               CefRefPtr<CefCommandLine> commandLine) override
+    {
+        if (processType.empty() && _lean)
+            ktmac::gui::AddLeanModeSwitches(commandLine);
+    }
+
+  private:
+    IMPLEMENT_REFCOUNTING(BenchmarkApp);
+};
+
+class BenchmarkClient :
+    public CefClient,
+    public CefLifeSpanHandler,
+    public CefLoadHandler,
+    public CefRenderHandler
+{
+  private:
+    int  _settleMs;
+    bool _measured;
+
+  public:
+    explicit BenchmarkClient(int settleMs) : _settleMs { settleMs }, _measured { false } {}
+
+    bool HasMeasured() const
+    {
+        return _measured;
+    }
+
+    virtual CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() override
+    {
+        return this;
+    }
+
+    virtual CefRefPtr<CefLoadHandler> GetLoadHandler() override
+    {
+        return this;
+    }
+
+    virtual CefRefPtr<CefRenderHandler> GetRenderHandler() override
+    {
+        return this;
+    }
+
+    virtual void GetViewRect(CefRefPtr<CefBrowser> browser, CefRect& rect) override
+    {
+        rect = CefRect { 0, 0, 300, 150 };
+    }
+
+    virtual void OnPaint(CefRefPtr<CefBrowser>,
+                         PaintElementType,
+                         const RectList&,
+                         const void*,
+                         int,
+                         int) override
+    {}
+
+    virtual void OnLoadEnd(CefRefPtr<CefBrowser> browser,
+                           CefRefPtr<CefFrame>   frame,
+                           int                   httpStatusCode) override
+    {
+        if (!frame->IsMain())
+            return;
+
+        CefPostDelayedTask(TID_UI, base::Bind(&BenchmarkClient::Measure, this, browser), _settleMs);
+    }
+
+    virtual void OnBeforeClose(CefRefPtr<CefBrowser> browser) override
+    {
+        CefQuitMessageLoop();
+    }
+
+  private:
+    void Measure(CefRefPtr<CefBrowser> browser)
+    {
+        MemoryUsage usage = MeasureProcessTree();
+        std::printf("%zu %zu %zu\n", usage.numProcesses, usage.rssKb, usage.pssKb);
+        std::fflush(stdout);
+
+        _measured = true;
+        browser->GetHost()->CloseBrowser(true);
+    }
+
+  private:
+    IMPLEMENT_REFCOUNTING(BenchmarkClient);
+};
+
+int RunMode(CefMainArgs const& mainArgs, CefRefPtr<BenchmarkApp> app, int settleMs)
+{
+    CefSettings settings;
+    settings.no_sandbox                   = true;
+    settings.windowless_rendering_enabled = true;
+    if (!CefInitialize(mainArgs, settings, app, nullptr))
+        return 1;
+
+    std::string url = "data:text/html;base64,"
+                      + CefURIEncode(CefBase64Encode(Page, sizeof Page - 1), false).ToString();
+
+    CefWindowInfo windowInfo;
+    windowInfo.SetAsWindowless(kNullWindowHandle);
+
+    CefBrowserSettings browserSettings;
+    browserSettings.windowless_frame_rate = 1;
+
+    CefRefPtr<BenchmarkClient> client { new BenchmarkClient { settleMs } };
+    CefBrowserHost::CreateBrowser(windowInfo, client, url, browserSettings, nullptr, nullptr);
+
+    CefRunMessageLoop();
+    int exitCode = client->HasMeasured() ? 0 : 1;
+
+    client = nullptr;
+    CefShutdown();
+    return exitCode;
+}
+
+// Runs this executable again in `mode` and reads what it measured.
+bool MeasureMode(std::string const& executable, char const* mode, int settleMs, MemoryUsage& usage)
+{
+    std::string command = "'" + executable + "' --mode=" + mode
+                          + " --settle-ms=" + std::to_string(settleMs);
+
+    FILE* child = popen(command.c_str(), "r");
+    if (child == nullptr)
+        return false;
+
+    int numRead
+        = std::fscanf(child, "%zu %zu %zu", &usage.numProcesses, &usage.rssKb, &usage.pssKb);
+    return pclose(child) == 0 && numRead == 3;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    CefRefPtr<CefCommandLine> commandLine { CefCommandLine::CreateCommandLine() };
+    commandLine->InitFromArgv(argc, argv);
+
+    std::string mode = commandLine->GetSwitchValue("mode").ToString();
+
+    CefMainArgs             mainArgs { argc, argv };
+    CefRefPtr<BenchmarkApp> app { new BenchmarkApp { mode == "lean" } };
+    if (int exitCode = CefExecuteProcess(mainArgs, app, nullptr); exitCode >= 0)
+        return exitCode;
+
+    int settleMs = 3000;
+    if (commandLine->HasSwitch("settle-ms"))
+        settleMs = std::atoi(commandLine->GetSwitchValue("settle-ms").ToString().c_str());
+
+    if (!mode.empty())
+        return RunMode(mainArgs, app, settleMs);
+
+    char    executable[4096];
+    ssize_t length = readlink("/proc/self/exe", executable, sizeof executable - 1);
+    if (length <= 0)
+        return 1;
+    executable[length] = '\0';
+
+    MemoryUsage before = {};
+    MemoryUsage after  = {};
+    if (!MeasureMode(executable, "default", settleMs, before)
+        || !MeasureMode(executable, "lean", settleMs, after))
+        return 1;
+
+    std::printf("          processes       RSS       PSS\n");
+    std::printf("default   %9zu %6zu MiB %6zu MiB\n",
+                before.numProcesses,
+                before.rssKb / 1024,
+                before.pssKb / 1024);
+    std::printf("lean      %9zu %6zu MiB %6zu MiB\n",
+                after.numProcesses,
+                after.rssKb / 1024,
+                after.pssKb / 1024);
+    if (before.rssKb > 0 && before.pssKb > 0)
+    {
+        std::printf("saved     %9zd %5.0f %%     %5.0f %%\n",
+                    (ssize_t)before.numProcesses - (ssize_t)after.numProcesses,
+                    100.0 * (1.0 - (double)after.rssKb / before.rssKb),
+                    100.0 * (1.0 - (double)after.pssKb / before.pssKb));
+    }
+
+    // The lean mode has to take less, or there is no point to it.
+    return after.pssKb < before.pssKb ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+// Measures what delivering one state change costs the renderer: compiling and running a script that
+// dispatches a DOM event, as the GUI used to, against calling the function the page registered with
+// a prebuilt argument. The browser is rendered off-screen, so no display is needed.
+
+#include <include/cef_app.h>
+#include <include/cef_browser.h>
+#include <include/cef_client.h>
+#include <include/cef_command_line.h>
+#include <include/cef_parser.h>
+#include <include/cef_render_handler.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+constexpr char const Page[]
+    = "<html><head><script>"
+      "var received = 0;"
+      "window.addEventListener('ktmac-state-changed', function (e) { received++; });"
+      "ktmacOnStateChange(function (state) { received++; });"
+      "</script></head><body></body></html>";
+
+char const* const StateList[] = {
+    "not-running",
+    "logged-out",
+    "background",
+    "locked",
+    "contact-list-is-visible",
+    "chatroom-list-is-visible",
+    "misc-is-visible",
+    "chatroom-is-visible",
+};
+
+constexpr size_t NumStates = sizeof StateList / sizeof StateList[0];
+
+// Both processes run this; only the renderer uses the V8 parts.
+class BenchmarkApp : public CefApp, public CefRenderProcessHandler, public CefV8Handler
+{
+  private:
+    CefRefPtr<CefV8Value> _callback;
+
+  public:
+    virtual void OnBeforeCommandLineProcessing(const CefString&          processType,
+                                               CefRefPtr<CefCommandLine> commandLine) override
+    {
+        commandLine->AppendSwitch("disable-gpu");
+        commandLine->AppendSwitch("disable-gpu-compositing");
+    }
+
+    virtual CefRefPtr<CefRenderProcessHandler> GetRenderProcessHandler() override
+    {
+        return this;
+    }
+
+    virtual void OnContextCreated(CefRefPtr<CefBrowser>   browser,
+                                  CefRefPtr<CefFrame>     frame,
+                                  CefRefPtr<CefV8Context> context) override
+    {
+        context->GetGlobal()->SetValue("ktmacOnStateChange",
+                                       CefV8Value::CreateFunction("ktmacOnStateChange", this),
+                                       V8_PROPERTY_ATTRIBUTE_NONE);
+    }
+
+    virtual bool Execute(const CefString&       name,
+                         CefRefPtr<CefV8Value>  object,
+                         const CefV8ValueList&  arguments,
+                         CefRefPtr<CefV8Value>& retval,
+                         CefString&             exception) override
+    {
+        if (arguments.size() == 1 && arguments[0]->IsFunction())
+            _callback = arguments[0];
+        return true;
+    }
+
+    virtual bool OnProcessMessageReceived(CefRefPtr<CefBrowser>        browser,
+                                          CefRefPtr<CefFrame>          frame,
+                                          CefProcessId                 sourceProcess,
+                                          CefRefPtr<CefProcessMessage> message) override
+    {
+        if (message->GetName() != "ktmac-run")
+            return false;
+
+        int                     numIterations = message->GetArgumentList()->GetInt(0);
+        CefRefPtr<CefV8Context> context       = frame->GetV8Context();
+
+        CefRefPtr<CefV8Value>     retval;
+        CefRefPtr<CefV8Exception> exception;
+
+        auto start = Clock::now();
+        for (int i = 0; i < numIterations; ++i)
+        {
+            std::string script = "window.dispatchEvent(new CustomEvent('ktmac-state-changed',"
+                                 "{'detail':'";
+            script += StateList[i % NumStates];
+            script += "'}));";
+
+            context->Enter();
+            context->Eval(script, frame->GetURL(), 0, retval, exception);
+            context->Exit();
+        }
+        double scriptNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        CefRefPtr<CefV8Value> valueList[NumStates];
+        CefV8ValueList        arguments(1);
+
+        start = Clock::now();
+        for (int i = 0; i < numIterations; ++i)
+        {
+            context->Enter();
+            CefRefPtr<CefV8Value>& value = valueList[i % NumStates];
+            if (!value)
+                value = CefV8Value::CreateString(StateList[i % NumStates]);
+
+            arguments[0] = value;
+            if (_callback)
+                _callback->ExecuteFunction(nullptr, arguments);
+            context->Exit();
+        }
+        double callbackNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        int received = 0;
+        if (context->Eval("received", frame->GetURL(), 0, retval, exception) && retval)
+            received = retval->GetIntValue();
+
+        CefRefPtr<CefProcessMessage> result = CefProcessMessage::Create("ktmac-result");
+        result->GetArgumentList()->SetDouble(0, scriptNs / numIterations);
+        result->GetArgumentList()->SetDouble(1, callbackNs / numIterations);
+        result->GetArgumentList()->SetInt(2, received);
+        frame->SendProcessMessage(PID_BROWSER, result);
+        return true;
+    }
+
+  private:
+    IMPLEMENT_REFCOUNTING(BenchmarkApp);
+};
+
+class BenchmarkClient :
+    public CefClient,
+    public CefLifeSpanHandler,
+    public CefLoadHandler,
+    public CefRenderHandler
+{
+  private:
+    int _numIterations;
+    int _exitCode;
+
+  public:
+    explicit BenchmarkClient(int numIterations) : _numIterations { numIterations }, _exitCode { 1 }
+    {}
+
+    int GetExitCode() const
+    {
+        return _exitCode;
+    }
+
+    virtual CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() override
+    {
+        return this;
+    }
+
+    virtual CefRefPtr<CefLoadHandler> GetLoadHandler() override
+    {
+        return this;
+    }
+
+    virtual CefRefPtr<CefRenderHandler> GetRenderHandler() override
+    {
+        return this;
+    }
+
+    virtual void GetViewRect(CefRefPtr<CefBrowser> browser, CefRect& rect) override
+    {
+        rect = CefRect { 0, 0, 300, 150 };
+    }
+
+    virtual void OnPaint(CefRefPtr<CefBrowser>,
+                         PaintElementType,
+                         const RectList&,
+                         const void*,
+                         int,
+                         int) override
+    {}
+
+    virtual void OnLoadEnd(CefRefPtr<CefBrowser> browser,
+                           CefRefPtr<CefFrame>   frame,
+                           int                   httpStatusCode) override
+    {
+        if (!frame->IsMain())
+            return;
+
+        CefRefPtr<CefProcessMessage> message = CefProcessMessage::Create("ktmac-run");
+        message->GetArgumentList()->SetInt(0, _numIterations);
+        frame->SendProcessMessage(PID_RENDERER, message);
+    }
+
+    virtual bool OnProcessMessageReceived(CefRefPtr<CefBrowser>        browser,
+                                          CefRefPtr<CefFrame>          frame,
+                                          CefProcessId                 sourceProcess,
+                                          CefRefPtr<CefProcessMessage> message) override
+    {
+        if (message->GetName() != "ktmac-result")
+            return false;
+
+        CefRefPtr<CefListValue> arguments = message->GetArgumentList();
+        std::printf("script    %10.0f ns per notification\n", arguments->GetDouble(0));
+        std::printf("callback  %10.0f ns per notification\n", arguments->GetDouble(1));
+
+        // Every notification of both kinds has to reach the page.
+        int received = arguments->GetInt(2);
+        std::printf("%d of %d notifications received\n", received, 2 * _numIterations);
+        _exitCode = received == 2 * _numIterations ? 0 : 1;
+
+        browser->GetHost()->CloseBrowser(true);
+        return true;
+    }
+
+    virtual void OnBeforeClose(CefRefPtr<CefBrowser> browser) override
+    {
+        CefQuitMessageLoop();
+    }
+
+  private:
+    IMPLEMENT_REFCOUNTING(BenchmarkClient);
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    CefMainArgs             mainArgs { argc, argv };
+    CefRefPtr<BenchmarkApp> app { new BenchmarkApp };
+    if (int exitCode = CefExecuteProcess(mainArgs, app, nullptr); exitCode >= 0)
+        return exitCode;
+
+    CefRefPtr<CefCommandLine> commandLine { CefCommandLine::CreateCommandLine() };
+    commandLine->InitFromArgv(argc, argv);
+
+    int numIterations = 100000;
+    if (commandLine->HasSwitch("iterations"))
+        numIterations = std::atoi(commandLine->GetSwitchValue("iterations").ToString().c_str());
+    if (numIterations <= 0)
+        return 1;
+
+    CefSettings settings;
+    settings.no_sandbox                   = true;
+    settings.windowless_rendering_enabled = true;
+    if (!CefInitialize(mainArgs, settings, app, nullptr))
+        return 1;
+
+    std::string url = "data:text/html;base64,"
+                      + CefURIEncode(CefBase64Encode(Page, sizeof Page - 1), false).ToString();
+
+    CefWindowInfo windowInfo;
+    windowInfo.SetAsWindowless(kNullWindowHandle);
+
+    CefBrowserSettings browserSettings;
+    browserSettings.windowless_frame_rate = 1;
+
+    CefRefPtr<BenchmarkClient> client { new BenchmarkClient { numIterations } };
+    CefBrowserHost::CreateBrowser(windowInfo, client, url, browserSettings, nullptr, nullptr);
+
+    CefRunMessageLoop();
+    int exitCode = client->GetExitCode();
+
+    client = nullptr;
+    CefShutdown();
+    return exitCode;
+}
@@ -0,0 +1,476 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ControlServer.hh>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+// Stands in for a core: messages named "fail" are not delivered.
+struct SimulatedCore
+{
+    std::mutex               mtx;
+    std::vector<std::string> sentList;
+    std::atomic<size_t>      numSent { 0 };
+
+    bool Send(std::string const& message)
+    {
+        numSent.fetch_add(1, std::memory_order_relaxed);
+        if (message == "fail")
+            return false;
+
+        std::lock_guard<std::mutex> guard { mtx };
+        if (sentList.size() < 64)
+            sentList.push_back(message);
+        return true;
+    }
+};
+
+bool WaitFor(std::function<bool()> const& condition)
+{
+    auto deadline = Clock::now() + std::chrono::seconds { 10 };
+    while (!condition())
+    {
+        if (Clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds { 1 });
+    }
+    return true;
+}
+
+size_t GetNumThreads()
+{
+    std::ifstream status { "/proc/self/status" };
+    std::string   line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 8, "Threads:") == 0)
+            return (size_t)std::atoll(line.c_str() + 8);
+    }
+    return 0;
+}
+
+int Connect(int portNumber)
+{
+    int socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    sockaddr_in address     = {};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons((unsigned short)portNumber);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(socket, (sockaddr*)&address, sizeof address) != 0)
+    {
+        close(socket);
+        return -1;
+    }
+
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof noDelay);
+    return socket;
+}
+
+void SendAll(int socket, std::string const& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t result = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0)
+            return;
+        sent += (size_t)result;
+    }
+}
+
+// Reads one response, relying on Content-Length, or on the upgrade having no body.
+std::string ReadResponse(int socket, std::string& inbound)
+{
+    char buffer[4096];
+    while (true)
+    {
+        size_t headerEnd = inbound.find("\r\n\r\n");
+        if (headerEnd != std::string::npos)
+        {
+            size_t contentLength = 0;
+            size_t field         = inbound.find("Content-Length: ");
+            if (field != std::string::npos && field < headerEnd)
+                contentLength = (size_t)std::atoll(inbound.c_str() + field + 16);
+
+            size_t size = headerEnd + 4 + contentLength;
+            if (inbound.size() >= size)
+            {
+                std::string response = inbound.substr(0, size);
+                inbound.erase(0, size);
+                return response;
+            }
+        }
+
+        ssize_t result = recv(socket, buffer, sizeof buffer, 0);
+        if (result <= 0)
+            return {};
+        inbound.append(buffer, (size_t)result);
+    }
+}
+
+std::string Request(int portNumber, std::string const& request)
+{
+    int         socket = Connect(portNumber);
+    std::string inbound;
+    SendAll(socket, request);
+    std::string response = ReadResponse(socket, inbound);
+    close(socket);
+    return response;
+}
+
+std::string Post(std::string const& path, std::string const& body, std::string const& extra = {})
+{
+    return "POST " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n" + extra
+           + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+bool Contains(std::string const& text, char const* part)
+{
+    return text.find(part) != std::string::npos;
+}
+
+std::string MakeClientFrame(std::string const& payload)
+{
+    static constexpr uint8_t Mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+    std::string frame;
+    frame += (char)0x81;
+    if (payload.size() < 126)
+        frame += (char)(0x80 | payload.size());
+    else
+    {
+        frame += (char)(0x80 | 126);
+        frame += (char)(payload.size() >> 8);
+        frame += (char)(payload.size() & 0xFF);
+    }
+    frame.append((char const*)Mask, 4);
+    for (size_t i = 0; i < payload.size(); ++i) frame += (char)(payload[i] ^ Mask[i % 4]);
+    return frame;
+}
+
+// Takes one complete server frame off `inbound`.
+bool TakeFrame(std::string& inbound, std::string& payload)
+{
+    if (inbound.size() < 2)
+        return false;
+
+    auto   data       = (uint8_t const*)inbound.data();
+    size_t length     = data[1] & 0x7F;
+    size_t headerSize = 2;
+    if (length == 126)
+    {
+        if (inbound.size() < 4)
+            return false;
+        length     = (size_t)data[2] << 8 | data[3];
+        headerSize = 4;
+    }
+    if (inbound.size() < headerSize + length)
+        return false;
+
+    payload = inbound.substr(headerSize, length);
+    inbound.erase(0, headerSize + length);
+    return true;
+}
+
+int OpenWebSocket(int portNumber, std::string& inbound, std::string* response = nullptr)
+{
+    int socket = Connect(portNumber);
+    SendAll(socket,
+            "GET /events HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+            "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n");
+
+    std::string upgrade = ReadResponse(socket, inbound);
+    if (response != nullptr)
+        *response = upgrade;
+    return socket;
+}
+
+struct Fixture
+{
+    SimulatedCore                  core;
+    std::unique_ptr<ControlServer> server;
+    std::thread                    runThread;
+
+    Fixture()
+    {
+        server = std::make_unique<ControlServer>(
+            [this](std::string const& message) { return core.Send(message); }, 0);
+        server->PublishState("background");
+        runThread = std::thread { &ControlServer::Run, server.get() };
+    }
+
+    ~Fixture()
+    {
+        server->Stop();
+        runThread.join();
+    }
+};
+
+void TestHttp()
+{
+    Fixture fixture;
+    int     port = fixture.server->GetPortNumber();
+
+    std::string response = Request(port, "GET /state HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    Expect("state",
+           Contains(response, "200 OK") && Contains(response, "{\"state\":\"background\"}"));
+
+    response = Request(port, Post("/send", "hello"));
+    Expect("send", Contains(response, "{\"success\":true}"));
+
+    response = Request(port, Post("/send", "fail"));
+    Expect("send failed", Contains(response, "{\"success\":false}"));
+
+    response = Request(port,
+                       Post("/batch", "[\"a\", \"fail\", \"line\\nbreak \\u00e9\\ud83d\\ude00\"]"));
+    Expect("batch", Contains(response, "{\"success\":[true,false,true]}"));
+
+    response = Request(port, Post("/batch", "[\"unterminated]"));
+    Expect("malformed batch", Contains(response, "400 Bad Request"));
+
+    {
+        std::lock_guard<std::mutex> guard { fixture.core.mtx };
+        auto&                       sentList = fixture.core.sentList;
+        Expect("sent in order",
+               sentList.size() == 3 && sentList[0] == "hello" && sentList[1] == "a"
+                   && sentList[2] == "line\nbreak \xC3\xA9\xF0\x9F\x98\x80");
+    }
+
+    // Web pages may not drive the core, whether directly or through a name of their own.
+    response = Request(port, Post("/send", "x", "Origin: https://example.com\r\n"));
+    Expect("origin refused", Contains(response, "403 Forbidden"));
+    response = Request(port, "GET /state HTTP/1.1\r\nHost: attacker.example:23458\r\n\r\n");
+    Expect("host refused", Contains(response, "403 Forbidden"));
+
+    response = Request(port, "GET /nothing HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    Expect("not found", Contains(response, "404 Not Found"));
+
+    // Requests on one connection are answered in order, even behind a send.
+    int         socket = Connect(port);
+    std::string inbound;
+    SendAll(socket,
+            Post("/send", "first") + "GET /state HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    std::string first  = ReadResponse(socket, inbound);
+    std::string second = ReadResponse(socket, inbound);
+    Expect("pipelined", Contains(first, "success") && Contains(second, "state"));
+    close(socket);
+}
+
+void TestWebSocket()
+{
+    Fixture fixture;
+    int     port = fixture.server->GetPortNumber();
+
+    // The key and accept value from RFC 6455.
+    std::string inbound;
+    std::string response;
+    int         socket = OpenWebSocket(port, inbound, &response);
+    Expect("upgraded",
+           Contains(response, "101 Switching Protocols")
+               && Contains(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="));
+
+    std::string payload;
+    char        buffer[4096];
+    auto        next = [&]() {
+        while (!TakeFrame(inbound, payload))
+        {
+            ssize_t result = recv(socket, buffer, sizeof buffer, 0);
+            if (result <= 0)
+                return false;
+            inbound.append(buffer, (size_t)result);
+        }
+        return true;
+    };
+
+    Expect("initial state",
+           next() && payload == "{\"type\":\"state\",\"state\":\"background\"}");
+
+    SendAll(socket, MakeClientFrame("{\"type\":\"batch\",\"id\":7,\"messages\":[\"x\",\"fail\"]}"));
+    Expect("batch result",
+           next() && payload == "{\"type\":\"result\",\"id\":7,\"success\":[true,false]}");
+
+    fixture.server->PublishState("locked");
+    Expect("state change", next() && payload == "{\"type\":\"state\",\"state\":\"locked\"}");
+
+    SendAll(socket, MakeClientFrame("{\"type\":\"send\",\"id\":8,\"message\":\"y\"}"));
+    Expect("send result", next() && payload == "{\"type\":\"result\",\"id\":8,\"success\":true}");
+
+    SendAll(socket, MakeClientFrame("not json"));
+    Expect("error", next() && Contains(payload, "\"type\":\"error\""));
+
+    close(socket);
+}
+
+// Many subscribers each pipeline sends while the state keeps changing. The server answers them all
+// from its own two threads, however many connections there are.
+void TestLoad(size_t numClients, size_t numSendsPerClient)
+{
+    Fixture fixture;
+    int     port = fixture.server->GetPortNumber();
+
+    struct LoadClient
+    {
+        int         socket;
+        std::string inbound;
+        size_t      numResults;
+        std::string lastState;
+    };
+
+    std::vector<LoadClient> clientList(numClients);
+    for (auto& client : clientList)
+    {
+        client.socket     = OpenWebSocket(port, client.inbound);
+        client.numResults = 0;
+    }
+    Expect("all connected",
+           WaitFor([&]() { return fixture.server->GetNumClients() == numClients; }));
+
+    // This thread, the one running the server and its send thread.
+    Expect("no thread per connection", GetNumThreads() <= 3);
+
+    std::atomic<bool> publishing { true };
+    std::thread       publisher { [&]() {
+        char const* const stateList[] = { "locked", "background", "misc-is-visible" };
+        for (size_t i = 0; publishing.load(std::memory_order_relaxed); ++i)
+        {
+            fixture.server->PublishState(stateList[i % 3]);
+            std::this_thread::sleep_for(std::chrono::microseconds { 200 });
+        }
+    } };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < numSendsPerClient; ++i)
+    {
+        std::string frame = MakeClientFrame("{\"type\":\"send\",\"id\":" + std::to_string(i)
+                                            + ",\"message\":\"load\"}");
+        for (auto& client : clientList) SendAll(client.socket, frame);
+    }
+
+    // Drains every connection until each has all of its results.
+    std::vector<pollfd> fdList;
+    std::string         payload;
+    char                buffer[65536];
+    auto                receive = [&](std::function<bool(LoadClient const&)> const& isDone) {
+        auto deadline = Clock::now() + std::chrono::seconds { 30 };
+        while (Clock::now() < deadline)
+        {
+            fdList.clear();
+            for (auto& client : clientList)
+            {
+                if (!isDone(client))
+                    fdList.push_back(pollfd { client.socket, POLLIN, 0 });
+            }
+            if (fdList.empty())
+                return true;
+
+            poll(fdList.data(), fdList.size(), 100);
+            for (size_t i = 0, j = 0; i < clientList.size(); ++i)
+            {
+                LoadClient& client = clientList[i];
+                if (isDone(client))
+                    continue;
+                if ((fdList[j++].revents & POLLIN) == 0)
+                    continue;
+
+                ssize_t result = recv(client.socket, buffer, sizeof buffer, 0);
+                if (result <= 0)
+                    return false;
+                client.inbound.append(buffer, (size_t)result);
+
+                while (TakeFrame(client.inbound, payload))
+                {
+                    if (Contains(payload, "\"type\":\"result\""))
+                        ++client.numResults;
+                    else if (Contains(payload, "\"type\":\"state\""))
+                        client.lastState = payload;
+                }
+            }
+        }
+        return false;
+    };
+
+    bool   answered = receive([&](LoadClient const& client) {
+        return client.numResults == numSendsPerClient;
+    });
+    double seconds  = std::chrono::duration<double>(Clock::now() - start).count();
+    Expect("all answered", answered);
+    Expect("all delivered", fixture.core.numSent == numClients * numSendsPerClient);
+    std::printf("%zu clients, %zu sends in %.1f ms, %.0f sends/s\n",
+                numClients,
+                numClients * numSendsPerClient,
+                seconds * 1000,
+                numClients * numSendsPerClient / seconds);
+
+    publishing = false;
+    publisher.join();
+
+    // Every subscriber ends up with the last state, however many were skipped on the way.
+    std::string finalState = "{\"type\":\"state\",\"state\":\"chatroom-is-visible\"}";
+    start                  = Clock::now();
+    fixture.server->PublishState("chatroom-is-visible");
+    bool fannedOut = receive([&](LoadClient const& client) {
+        return client.lastState == finalState;
+    });
+    double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    Expect("fanned out", fannedOut);
+    std::printf("state reached %zu subscribers in %.2f ms\n", numClients, milliseconds);
+
+    for (auto& client : clientList) close(client.socket);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numClients        = argc > 1 ? (size_t)std::atoll(argv[1]) : 256;
+    size_t numSendsPerClient = argc > 2 ? (size_t)std::atoll(argv[2]) : 200;
+
+    TestHttp();
+    TestWebSocket();
+    TestLoad(numClients, numSendsPerClient);
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+    return 0;
+}
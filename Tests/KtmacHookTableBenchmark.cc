@@ -0,0 +1,145 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/HookTable.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+struct Entry
+{
+    uintptr_t hook;
+    void*     handler;
+    void*     context;
+};
+
+// The table WindowHook.cc used before: one global mutex around an unordered_map.
+class LockedTable
+{
+  private:
+    std::unordered_map<uintptr_t, Entry> _map;
+    std::mutex                           _mtx;
+
+  public:
+    template <typename Func>
+    bool Find(uintptr_t key, Func&& func)
+    {
+        std::lock_guard<std::mutex> guard { _mtx };
+        if (auto it = _map.find(key); it != _map.end())
+        {
+            func(it->second);
+            return true;
+        }
+        return false;
+    }
+
+    bool Insert(uintptr_t key, Entry const& value)
+    {
+        std::lock_guard<std::mutex> guard { _mtx };
+        return _map.insert(std::make_pair(key, value)).second;
+    }
+
+    bool Erase(uintptr_t key)
+    {
+        std::lock_guard<std::mutex> guard { _mtx };
+        return _map.erase(key) != 0;
+    }
+};
+
+constexpr uintptr_t StableKeyBase = 0x10000;
+constexpr uintptr_t ChurnKeyBase  = 0x90000;
+constexpr size_t    NumStableKeys = 8;
+constexpr size_t    NumChurnKeys  = 8;
+
+template <typename Table>
+void Run(char const* name, int numReaders, std::chrono::milliseconds duration)
+{
+    Table table;
+    for (size_t i = 0; i < NumStableKeys; ++i)
+    {
+        uintptr_t key = StableKeyBase + i * 0x10;
+        table.Insert(key, Entry { key, nullptr, nullptr });
+    }
+
+    std::atomic<bool>     running { true };
+    std::atomic<uint64_t> numLookups { 0 }, numMisses { 0 }, numUpdates { 0 };
+
+    std::vector<std::thread> threadList;
+    for (int r = 0; r < numReaders; ++r)
+    {
+        threadList.emplace_back([&, r]() {
+            uint64_t lookups = 0, misses = 0;
+            size_t   i       = r;
+            while (running.load(std::memory_order_relaxed))
+            {
+                uintptr_t key   = StableKeyBase + (i++ % NumStableKeys) * 0x10;
+                bool      found = table.Find(key, [key, &misses](Entry const& entry) {
+                    if (entry.hook != key)
+                        ++misses;
+                });
+                if (!found)
+                    ++misses;
+                ++lookups;
+            }
+            numLookups += lookups;
+            numMisses += misses;
+        });
+    }
+
+    threadList.emplace_back([&]() {
+        uint64_t updates = 0;
+        size_t   i       = 0;
+        while (running.load(std::memory_order_relaxed))
+        {
+            uintptr_t key = ChurnKeyBase + (i++ % NumChurnKeys) * 0x10;
+            table.Insert(key, Entry { key, nullptr, nullptr });
+            table.Erase(key);
+            updates += 2;
+        }
+        numUpdates += updates;
+    });
+
+    std::this_thread::sleep_for(duration);
+    running = false;
+    for (auto& thread : threadList) thread.join();
+
+    double seconds = std::chrono::duration<double>(duration).count();
+    std::printf("%-12s readers=%-3d lookups/s=%-14.0f ns/lookup=%-8.1f updates/s=%-12.0f "
+                "misses=%llu\n",
+                name,
+                numReaders,
+                numLookups / seconds,
+                seconds * 1e9 * numReaders / (double)numLookups,
+                numUpdates / seconds,
+                (unsigned long long)numMisses.load());
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int maxReaders = argc > 1 ? std::atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+    if (maxReaders < 1)
+        maxReaders = 1;
+
+    std::chrono::milliseconds duration { 1000 };
+    for (int numReaders = 1; numReaders <= maxReaders; numReaders *= 2)
+    {
+        Run<HookTable<Entry>>("lock-free", numReaders, duration);
+        Run<LockedTable>("mutex", numReaders, duration);
+    }
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/LatencyHistogram.hh>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+int numFailures = 0;
+
+void Expect(char const* name, uint64_t actual, uint64_t min, uint64_t max)
+{
+    if (actual < min || actual > max)
+    {
+        std::cout << name << ": expected [" << min << ", " << max << "], got " << actual
+                  << std::endl;
+        ++numFailures;
+    }
+}
+
+}
+
+int main()
+{
+    LatencyHistogram histogram;
+
+    auto empty = histogram.GetSnapshot();
+    Expect("empty count", empty.count, 0, 0);
+    Expect("empty p50", empty.GetPercentile(0.5), 0, 0);
+
+    // 990 samples around 1us and 10 around 1ms: p50 and p99 stay in the microsecond range, p999
+    // lands in the millisecond one.
+    for (int i = 0; i < 990; ++i) histogram.Record(1000 + i % 10);
+    for (int i = 0; i < 10; ++i) histogram.Record(1000000);
+
+    auto snapshot = histogram.GetSnapshot();
+    Expect("count", snapshot.count, 1000, 1000);
+    Expect("max", snapshot.maxNs, 1000000, 1000000);
+    Expect("p50", snapshot.GetPercentile(0.5), 512, 2047);
+    Expect("p99", snapshot.GetPercentile(0.99), 512, 2047);
+    Expect("p999", snapshot.GetPercentile(0.999), 524288, 1000000);
+    Expect("p100", snapshot.GetPercentile(1.0), 524288, 1000000);
+    Expect("mean", (uint64_t)snapshot.GetMean(), 10900, 11100);
+
+    histogram.Record(0);
+    Expect("p0", histogram.GetSnapshot().GetPercentile(0.0), 0, 0);
+
+    histogram.Reset();
+    std::vector<std::thread> threadList;
+    for (int t = 0; t < 4; ++t)
+    {
+        threadList.emplace_back([&histogram]() {
+            for (uint64_t i = 1; i <= 10000; ++i) histogram.Record(i);
+        });
+    }
+    for (auto& thread : threadList) thread.join();
+
+    auto concurrent = histogram.GetSnapshot();
+    Expect("concurrent count", concurrent.count, 40000, 40000);
+    Expect("concurrent sum", concurrent.sumNs, 4 * 50005000ull, 4 * 50005000ull);
+    Expect("concurrent max", concurrent.maxNs, 10000, 10000);
+
+    if (numFailures == 0)
+        std::cout << "All checks passed." << std::endl;
+
+    return numFailures == 0 ? 0 : 1;
+}
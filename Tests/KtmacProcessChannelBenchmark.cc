@@ -0,0 +1,263 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/ProcessWatcherChannel.hh>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+using SendFunction = std::function<void(ProcessEvent const* events, size_t numEvents)>;
+
+int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch())
+        .count();
+}
+
+// Whatever the transport, the receiving side ends up here. The send time travels in
+// `creationTime`.
+struct Receiver
+{
+    LatencyHistogram    latency;
+    std::atomic<size_t> numReceived { 0 };
+
+    void Handle(ProcessEvent const& event)
+    {
+        latency.Record((uint64_t)(NowNs() - (int64_t)event.creationTime));
+        numReceived.fetch_add(1, std::memory_order_release);
+    }
+};
+
+// Same framing as ProcessWatcherSocket: a message byte followed by the raw event.
+class TcpTransport
+{
+  private:
+    static constexpr size_t RecordSize = 1 + sizeof(ProcessEvent);
+
+  private:
+    int         _client;
+    int         _server;
+    std::thread _recvThread;
+
+  public:
+    explicit TcpTransport(Receiver& receiver) : _client { -1 }, _server { -1 }, _recvThread {}
+    {
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+        sockaddr_in address     = {};
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length        = sizeof address;
+        if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof address) != 0
+            || listen(listener, 1) != 0 || getsockname(listener, (sockaddr*)&address, &length) != 0)
+        {
+            std::perror("listen");
+            std::exit(1);
+        }
+
+        _client = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(_client, (sockaddr*)&address, sizeof address) != 0)
+        {
+            std::perror("connect");
+            std::exit(1);
+        }
+        _server = accept(listener, nullptr, nullptr);
+        close(listener);
+
+        int noDelay = 1;
+        setsockopt(_client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof noDelay);
+
+        _recvThread = std::thread { [this, &receiver]() {
+            std::vector<char> buffer(RecordSize * 256);
+            size_t            length = 0;
+            while (true)
+            {
+                ssize_t result = recv(_server, buffer.data() + length, buffer.size() - length, 0);
+                if (result <= 0)
+                    return;
+                length += (size_t)result;
+
+                size_t offset = 0;
+                for (; length - offset >= RecordSize; offset += RecordSize)
+                {
+                    ProcessEvent event;
+                    std::memcpy(&event, buffer.data() + offset + 1, sizeof event);
+                    receiver.Handle(event);
+                }
+                std::memmove(buffer.data(), buffer.data() + offset, length - offset);
+                length -= offset;
+            }
+        } };
+    }
+
+    ~TcpTransport()
+    {
+        shutdown(_client, SHUT_WR);
+        _recvThread.join();
+        close(_client);
+        close(_server);
+    }
+
+    void Send(ProcessEvent const* events, size_t numEvents)
+    {
+        std::vector<char> buffer(numEvents * RecordSize);
+        for (size_t i = 0; i < numEvents; ++i)
+        {
+            buffer[i * RecordSize] = (char)events[i].state;
+            std::memcpy(buffer.data() + i * RecordSize + 1, &events[i], sizeof(ProcessEvent));
+        }
+
+        size_t sent = 0;
+        while (sent < buffer.size())
+        {
+            ssize_t result = send(_client, buffer.data() + sent, buffer.size() - sent, 0);
+            if (result <= 0)
+                return;
+            sent += (size_t)result;
+        }
+    }
+};
+
+// Serialized round trips: every event is sent only after the previous one has arrived, so the
+// receiver is asleep each time and the latency includes its wakeup.
+void RunLatency(char const* name, Receiver& receiver, SendFunction const& send, size_t numEvents)
+{
+    ProcessEvent event = {};
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        event.processId    = (uint32_t)i;
+        event.creationTime = (uint64_t)NowNs();
+        send(&event, 1);
+
+        while (receiver.numReceived.load(std::memory_order_acquire) <= i)
+            std::this_thread::yield();
+    }
+
+    auto snapshot = receiver.latency.GetSnapshot();
+    std::printf("%-8s latency    n=%-7llu p50=%8.2fus p99=%8.2fus max=%8.2fus\n",
+                name,
+                (unsigned long long)snapshot.count,
+                snapshot.GetPercentile(0.5) / 1e3,
+                snapshot.GetPercentile(0.99) / 1e3,
+                snapshot.maxNs / 1e3);
+}
+
+void RunThroughput(char const*         name,
+                   Receiver&           receiver,
+                   SendFunction const& send,
+                   size_t              numEvents,
+                   size_t              batchSize)
+{
+    std::vector<ProcessEvent> batch(batchSize, ProcessEvent {});
+
+    int64_t start = NowNs();
+    for (size_t sent = 0; sent < numEvents; sent += batchSize)
+    {
+        for (auto& event : batch) event.creationTime = (uint64_t)NowNs();
+        send(batch.data(), batch.size());
+    }
+    while (receiver.numReceived.load(std::memory_order_acquire) < numEvents)
+        std::this_thread::yield();
+    int64_t elapsed = NowNs() - start;
+
+    std::printf("%-8s batch=%-4zu %10.0f events/s\n",
+                name,
+                batchSize,
+                (double)receiver.numReceived.load() / ((double)elapsed / 1e9));
+}
+
+template <typename Make>
+void Run(char const* name, Make make, size_t numLatency, size_t numThroughput)
+{
+    {
+        Receiver receiver;
+        auto     transport = make(receiver);
+        RunLatency(
+            name,
+            receiver,
+            [&](ProcessEvent const* events, size_t numEvents) {
+                transport->Send(events, numEvents);
+            },
+            numLatency);
+    }
+
+    for (size_t batchSize : { 1, 16 })
+    {
+        Receiver receiver;
+        auto     transport = make(receiver);
+        RunThroughput(
+            name,
+            receiver,
+            [&](ProcessEvent const* events, size_t numEvents) {
+                transport->Send(events, numEvents);
+            },
+            numThroughput,
+            batchSize);
+    }
+}
+
+// Owns both ends of a channel; the client normally lives in ktmac-process-hook.
+struct ChannelPair
+{
+    ProcessWatcherChannel server;
+    ProcessWatcherChannel client;
+
+    ChannelPair(std::string const& name, Receiver& receiver) :
+        server { ProcessWatcherChannel::MakeServerChannel(
+            name, [&receiver](ProcessEvent const& event) { receiver.Handle(event); }) },
+        client { ProcessWatcherChannel::MakeClientChannel(name) }
+    {
+        server.WaitForClient(nullptr);
+    }
+
+    void Send(ProcessEvent const* events, size_t numEvents)
+    {
+        client.Send(events, numEvents);
+    }
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numLatency    = argc > 1 ? (size_t)std::atoll(argv[1]) : 20000;
+    size_t numThroughput = argc > 2 ? (size_t)std::atoll(argv[2]) : 1000000;
+    if (numLatency == 0 || numThroughput == 0)
+        return 1;
+
+    std::string name = ProcessWatcherChannel::MakeName((uint32_t)getpid());
+
+    Run(
+        "channel",
+        [&](Receiver& receiver) { return std::make_unique<ChannelPair>(name, receiver); },
+        numLatency,
+        numThroughput);
+    Run(
+        "tcp",
+        [](Receiver& receiver) { return std::make_unique<TcpTransport>(receiver); },
+        numLatency,
+        numThroughput);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessWatcherChannel.hh>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+constexpr HeartbeatConfig TestConfig { std::chrono::milliseconds { 20 }, 3 };
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+bool WaitFor(std::function<bool()> const& condition)
+{
+    auto deadline = Clock::now() + std::chrono::seconds { 10 };
+    while (!condition())
+    {
+        if (Clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds { 1 });
+    }
+    return true;
+}
+
+// A quiet client that sits in WaitUntilQuit() answers every heartbeat.
+void TestAnswered()
+{
+    std::string name = ProcessWatcherChannel::MakeName((uint32_t)getpid(), 1);
+
+    std::atomic<uint32_t>                  numMissHandled { 0 };
+    std::unique_ptr<ProcessWatcherChannel> server { new ProcessWatcherChannel {
+        ProcessWatcherChannel::MakeServerChannel(name, nullptr) } };
+    server->SetHeartbeatConfig(TestConfig);
+    server->SetHeartbeatMissHandler([&](uint32_t) { numMissHandled.fetch_add(1); });
+
+    ProcessWatcherChannel client { ProcessWatcherChannel::MakeClientChannel(name) };
+    server->WaitForClient(nullptr);
+
+    std::thread clientThread { &ProcessWatcherChannel::WaitUntilQuit, &client };
+
+    Expect("answered",
+           WaitFor([&]() { return server->GetHeartbeatStatistics().numAnswered >= 20; }));
+
+    HeartbeatStatistics statistics = server->GetHeartbeatStatistics();
+    Expect("round trips recorded", statistics.roundTrip.count == statistics.numAnswered);
+    Expect("client beats", statistics.numClientBeats >= statistics.numAnswered);
+    Expect("no miss handled", numMissHandled == 0);
+    std::printf("round trip: p50 %.1f us, p99 %.1f us, %llu of %llu missed\n",
+                statistics.roundTrip.GetPercentile(0.5) / 1000.0,
+                statistics.roundTrip.GetPercentile(0.99) / 1000.0,
+                (unsigned long long)statistics.numMissed,
+                (unsigned long long)statistics.numSent);
+
+    // Closing the server lets the client return.
+    server.reset();
+    clientThread.join();
+}
+
+// A client that never gets to WaitUntilQuit(), like a hook stuck in its setup, is reported once it
+// misses enough heartbeats in a row, and recovers if it starts answering after all.
+void TestMissed()
+{
+    std::string name = ProcessWatcherChannel::MakeName((uint32_t)getpid(), 2);
+
+    std::atomic<uint32_t> numMissHandled { 0 };
+    std::atomic<uint32_t> numMissedWhenHandled { 0 };
+    ProcessWatcherChannel server { ProcessWatcherChannel::MakeServerChannel(name, nullptr) };
+    server.SetHeartbeatConfig(TestConfig);
+    server.SetHeartbeatMissHandler([&](uint32_t numMissed) {
+        numMissedWhenHandled = numMissed;
+        numMissHandled.fetch_add(1);
+    });
+
+    ProcessWatcherChannel client { ProcessWatcherChannel::MakeClientChannel(name) };
+    server.WaitForClient(nullptr);
+
+    auto start = Clock::now();
+    Expect("miss handled", WaitFor([&]() { return numMissHandled != 0; }));
+    double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    HeartbeatStatistics statistics = server.GetHeartbeatStatistics();
+    Expect("threshold", numMissedWhenHandled == TestConfig.missThreshold);
+    Expect("nothing answered", statistics.numAnswered == 0);
+    std::printf("stuck client detected in %.1f ms\n", milliseconds);
+
+    std::thread clientThread { &ProcessWatcherChannel::WaitUntilQuit, &client };
+    Expect("recovered", WaitFor([&]() {
+        HeartbeatStatistics statistics = server.GetHeartbeatStatistics();
+        return statistics.numAnswered != 0 && statistics.numConsecutiveMissed == 0;
+    }));
+    Expect("handled once", numMissHandled == 1);
+
+    // An abandoned client is told to quit right away.
+    server.Abandon();
+    clientThread.join();
+}
+
+}
+
+int main()
+{
+    TestAnswered();
+    TestMissed();
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,197 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/ProcfsProcessWatcher.hh>
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern char** environ;
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// The kernel names a process after the path it was executed from, so running /bin/sleep through a
+// symlink gives the dummies a name nothing else on the system has.
+constexpr char const* DummyName = "ktmac-dummy";
+
+struct Sample
+{
+    int64_t spawnNs;
+    int64_t killNs;
+    int64_t startDetectedNs;
+    int64_t stopDetectedNs;
+};
+
+int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch())
+        .count();
+}
+
+void Print(char const* name, char const* kind, LatencyHistogram const& histogram, size_t numMissed)
+{
+    auto snapshot = histogram.GetSnapshot();
+    std::printf("%-14s %-5s detected=%-6llu missed=%-5zu p50=%8.2fms p99=%8.2fms max=%8.2fms\n",
+                name,
+                kind,
+                (unsigned long long)snapshot.count,
+                numMissed,
+                snapshot.GetPercentile(0.5) / 1e6,
+                snapshot.GetPercentile(0.99) / 1e6,
+                snapshot.maxNs / 1e6);
+}
+
+void Run(std::string const&        dummyPath,
+         ProcfsWatcherConfig       config,
+         size_t                    numProcesses,
+         size_t                    concurrency,
+         std::chrono::microseconds spawnInterval)
+{
+    std::mutex                      mtx;
+    std::vector<Sample>             sampleList(numProcesses, Sample { 0, 0, 0, 0 });
+    std::unordered_map<int, size_t> indexList;
+
+    auto watcher = std::make_unique<ProcfsProcessWatcher>(
+        std::vector<std::string> { DummyName },
+        [&](ProcessEvent const* events, size_t numEvents) {
+            int64_t                     now = NowNs();
+            std::lock_guard<std::mutex> guard { mtx };
+
+            for (size_t i = 0; i < numEvents; ++i)
+            {
+                auto it = indexList.find((int)events[i].processId);
+                if (it == indexList.end())
+                    continue;
+
+                Sample& sample = sampleList[it->second];
+                if (events[i].state == ProcessState::Running)
+                    sample.startDetectedNs = now;
+                else
+                {
+                    sample.stopDetectedNs = now;
+                    indexList.erase(it);
+                }
+            }
+        },
+        config);
+
+    std::deque<std::pair<pid_t, size_t>> aliveList;
+
+    auto killOldest = [&]() {
+        auto [processId, index] = aliveList.front();
+        aliveList.pop_front();
+        {
+            std::lock_guard<std::mutex> guard { mtx };
+            sampleList[index].killNs = NowNs();
+        }
+        kill(processId, SIGKILL);
+        waitpid(processId, nullptr, 0);
+    };
+
+    char* argv[] = { (char*)DummyName, (char*)"60", nullptr };
+    for (size_t i = 0; i < numProcesses; ++i)
+    {
+        if (aliveList.size() >= concurrency)
+            killOldest();
+
+        // Held across the spawn so the watcher cannot report the process before it is known here.
+        std::unique_lock<std::mutex> lock { mtx };
+
+        pid_t processId       = 0;
+        sampleList[i].spawnNs = NowNs();
+        if (posix_spawn(&processId, dummyPath.c_str(), nullptr, nullptr, argv, environ) != 0)
+        {
+            std::perror("posix_spawn");
+            std::exit(1);
+        }
+        indexList[processId] = i;
+        lock.unlock();
+
+        aliveList.emplace_back(processId, i);
+        std::this_thread::sleep_for(spawnInterval);
+    }
+    while (!aliveList.empty()) killOldest();
+
+    std::this_thread::sleep_for(config.scanInterval * 10 + std::chrono::milliseconds { 100 });
+    watcher.reset();
+
+    LatencyHistogram startLatency, stopLatency;
+    size_t           numStartMissed = 0, numStopMissed = 0;
+    for (auto const& sample : sampleList)
+    {
+        if (sample.startDetectedNs != 0)
+            startLatency.Record((uint64_t)(sample.startDetectedNs - sample.spawnNs));
+        else
+            ++numStartMissed;
+
+        // A process that was never seen starting cannot be seen stopping either.
+        if (sample.stopDetectedNs != 0)
+        {
+            int64_t latency = sample.stopDetectedNs - sample.killNs;
+            stopLatency.Record((uint64_t)(latency > 0 ? latency : 0));
+        }
+        else if (sample.startDetectedNs != 0)
+            ++numStopMissed;
+    }
+
+    char name[32];
+    std::snprintf(name,
+                  sizeof name,
+                  "%s/%lldms",
+                  config.usePidfd ? "pidfd" : "scan",
+                  (long long)config.scanInterval.count());
+    Print(name, "start", startLatency, numStartMissed);
+    Print(name, "stop", stopLatency, numStopMissed);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    using namespace std::chrono_literals;
+
+    size_t numProcesses = argc > 1 ? (size_t)std::atoll(argv[1]) : 2000;
+    size_t concurrency  = argc > 2 ? (size_t)std::atoll(argv[2]) : 16;
+    if (numProcesses == 0 || concurrency == 0)
+        return 1;
+
+    char directory[] = "/tmp/ktmac-benchmark-XXXXXX";
+    if (mkdtemp(directory) == nullptr)
+        return 1;
+
+    std::string dummyPath = std::string { directory } + "/" + DummyName;
+    if (symlink("/bin/sleep", dummyPath.c_str()) != 0)
+        return 1;
+
+    ProcfsWatcherConfig configList[] = {
+        { 10ms, 200ms, true },
+        { 10ms, 200ms, false },
+        { 1ms, 200ms, true },
+    };
+    for (auto const& config : configList)
+        Run(dummyPath, config, numProcesses, concurrency, 2ms);
+
+    unlink(dummyPath.c_str());
+    rmdir(directory);
+
+    return 0;
+}
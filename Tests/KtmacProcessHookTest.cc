@@ -8,20 +8,27 @@
 #include <cstdint>
 #include <cstdio>
 #include <iostream>
+#include <string>
 
 using namespace ktmac;
 
 int main(int argc, char* argv[])
 {
-    int portNumber = 23654;
+    std::string endpoint = ProcessWatcherSocket::MakeEndpoint(GetCurrentProcessId());
 
-    auto handler = [](ProcessWatcherMessage message, uint32_t processId) {
-        if (message == ProcessWatcherMessage::Running)
-            std::cout << "Running(" << processId << ")..." << std::endl;
-        else
-            std::cout << "Stopped(" << processId << ")..." << std::endl;
+    auto handler = [](ProcessEvent const& event) {
+        std::cout << (event.state == ProcessState::Running ? "Running(" : "Stopped(")
+                  << event.processId << ", parent=" << event.parentProcessId
+                  << ", session=" << event.sessionId << ", created=" << event.creationTime << ", "
+                  << event.imageName << " " << event.version[0] << "." << event.version[1] << "."
+                  << event.version[2] << "." << event.version[3] << ")..." << std::endl;
     };
 
-    ProcessWatcherSocket socket { ProcessWatcherSocket::MakeServerSocket(portNumber, handler) };
+    ProcessWatcherSocket socket { ProcessWatcherSocket::MakeServerSocket(endpoint, handler) };
+
+    std::string argument = "socket:" + endpoint;
+    if (!socket.WaitForClient(LaunchProcessHook(argument.c_str())))
+        return 1;
+
     std::this_thread::sleep_for(std::chrono::seconds { 10 });
 }
\ No newline at end of file
@@ -0,0 +1,446 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessWatcherBroker.hh>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+bool WaitFor(std::function<bool()> const& condition)
+{
+    auto deadline = Clock::now() + std::chrono::seconds { 10 };
+    while (!condition())
+    {
+        if (Clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds { 1 });
+    }
+    return true;
+}
+
+ProcessEvent MakeEvent(ProcessState state, uint32_t processId)
+{
+    ProcessEvent event = {};
+    event.state        = state;
+    event.processId    = processId;
+    event.creationTime = 1000 + processId;
+    return event;
+}
+
+// Private to this run, so tests running side by side do not meet.
+std::string MakeEndpoint()
+{
+    return "/tmp/ktmac-broker-test-" + std::to_string(getpid()) + ".sock";
+}
+
+sockaddr_un MakeAddress(std::string const& endpoint)
+{
+    sockaddr_un address = {};
+    address.sun_family  = AF_UNIX;
+    std::strncpy(address.sun_path, endpoint.c_str(), sizeof address.sun_path - 1);
+    return address;
+}
+
+int Connect(std::string const& endpoint, int receiveBufferSize, ProcessWatcherSequence hello = {})
+{
+    int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (receiveBufferSize != 0)
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof receiveBufferSize);
+
+    sockaddr_un address = MakeAddress(endpoint);
+    if (connect(socket, (sockaddr*)&address, sizeof address) != 0)
+    {
+        std::perror("connect");
+        std::exit(1);
+    }
+
+    ProcessWatcherEncoder encoder;
+    encoder.AddFrame(ProcessWatcherFrameType::Hello, &hello, sizeof hello);
+    send(socket, encoder.GetData(), encoder.GetSize(), 0);
+    return socket;
+}
+
+// Calls `handler(type, sequence, eventList)` for every Snapshot and SequencedEvents frame until it
+// returns false or the connection is closed.
+template <typename Handler>
+void Read(int socket, Handler&& handler)
+{
+    bool done = false;
+    ProcessWatcherDecoder decoder;
+    while (!done)
+    {
+        size_t  size   = 0;
+        char*   buffer = decoder.GetWriteBuffer(size);
+        ssize_t result = recv(socket, buffer, size, 0);
+        if (result <= 0)
+            return;
+        decoder.Commit((size_t)result);
+
+        bool valid = decoder.Decode(
+            [&](ProcessWatcherFrameType type, char const* payload, uint32_t length) {
+                if (type != ProcessWatcherFrameType::Snapshot
+                    && type != ProcessWatcherFrameType::SequencedEvents)
+                    return true;
+
+                ProcessWatcherSequence    sequence = {};
+                std::vector<ProcessEvent> eventList;
+                if (!ProcessWatcherDecoder::ForEachSequencedEvent(
+                        payload, length, sequence, [&](ProcessEvent const& event) {
+                            eventList.push_back(event);
+                        }))
+                    return false;
+
+                done = done || !handler(type, sequence, eventList);
+                return true;
+            });
+        if (!valid)
+            return;
+    }
+}
+
+struct Answer
+{
+    ProcessWatcherFrameType type;
+    ProcessWatcherSequence  sequence;
+    size_t                  numEvents;
+};
+
+// Says Hello and reads the answer: a snapshot, or the replayed events up to `lastSequence`.
+Answer Attach(std::string const& endpoint, ProcessWatcherSequence hello, uint64_t lastSequence)
+{
+    int    socket = Connect(endpoint, 0, hello);
+    Answer answer = {};
+    Read(socket,
+         [&](ProcessWatcherFrameType          type,
+             ProcessWatcherSequence           sequence,
+             std::vector<ProcessEvent> const& eventList) {
+             if (answer.numEvents == 0)
+                 answer.sequence = sequence;
+             answer.type = type;
+             answer.numEvents += eventList.size();
+             return type == ProcessWatcherFrameType::SequencedEvents
+                    && sequence.sequence + eventList.size() <= lastSequence;
+         });
+    close(socket);
+    return answer;
+}
+
+// Publish() returns before the events are applied; this waits until a snapshot reflects them.
+ProcessWatcherSequence WaitForSequence(std::string const& endpoint, uint64_t sequence)
+{
+    Answer answer = {};
+    Expect("snapshot", WaitFor([&]() {
+               answer = Attach(endpoint, {}, 0);
+               return answer.sequence.sequence == sequence;
+           }));
+    return answer.sequence;
+}
+
+// Checks that process IDs, and sequence numbers, arrive in order.
+struct Reader
+{
+    int                 socket;
+    std::atomic<size_t> numReceived { 0 };
+    std::atomic<bool>   inOrder { true };
+    std::thread         thread;
+
+    explicit Reader(std::string const& endpoint) : socket { Connect(endpoint, 0) }
+    {
+        thread = std::thread { [this]() {
+            Read(socket,
+                 [this](ProcessWatcherFrameType,
+                        ProcessWatcherSequence           sequence,
+                        std::vector<ProcessEvent> const& eventList) {
+                     for (auto& event : eventList)
+                     {
+                         size_t index = numReceived.load(std::memory_order_relaxed);
+                         if (event.processId != (uint32_t)index || sequence.sequence != index + 1)
+                             inOrder.store(false, std::memory_order_relaxed);
+                         ++sequence.sequence;
+                         numReceived.store(index + 1, std::memory_order_release);
+                     }
+                     return true;
+                 });
+        } };
+    }
+
+    ~Reader()
+    {
+        shutdown(socket, SHUT_RDWR);
+        thread.join();
+        close(socket);
+    }
+};
+
+// Several subscribers get every event in order, one that never reads is dropped, and
+// StopWhenIdle() returns once all have left.
+void TestFanOut(size_t numEvents)
+{
+    constexpr size_t NumReaders = 4;
+
+    ProcessWatcherBroker broker { MakeEndpoint() };
+    std::thread          runThread { [&broker]() { broker.Run(); } };
+
+    std::vector<std::unique_ptr<Reader>> readerList;
+    for (size_t i = 0; i < NumReaders; ++i)
+        readerList.push_back(std::make_unique<Reader>(broker.GetEndpoint()));
+
+    int slow = Connect(broker.GetEndpoint(), 4096);
+
+    Expect("accept", WaitFor([&]() { return broker.GetNumClients() == NumReaders + 1; }));
+
+    // The readers are kept within a window of the publisher, so only the slow one can ever fall
+    // far enough behind to be dropped.
+    constexpr size_t BatchSize = 64;
+    constexpr size_t Window    = 4096;
+
+    // Exits of unknown processes, so the broker's running set stays empty as it would in practice.
+    std::vector<ProcessEvent> batch(BatchSize, MakeEvent(ProcessState::Stopped, 0));
+    auto                      start = Clock::now();
+    for (size_t sent = 0; sent < numEvents; sent += BatchSize)
+    {
+        for (size_t i = 0; i < BatchSize; ++i) batch[i].processId = (uint32_t)(sent + i);
+        broker.Publish(batch.data(), batch.size());
+
+        for (auto& reader : readerList)
+        {
+            while (reader->numReceived.load(std::memory_order_acquire) + Window < sent)
+                std::this_thread::yield();
+        }
+    }
+    size_t numSent = (numEvents + BatchSize - 1) / BatchSize * BatchSize;
+
+    bool delivered = WaitFor([&]() {
+        for (auto& reader : readerList)
+        {
+            if (reader->numReceived.load(std::memory_order_acquire) != numSent)
+                return false;
+        }
+        return true;
+    });
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Expect("delivered", delivered);
+    for (auto& reader : readerList)
+        Expect("in order", reader->inOrder.load(std::memory_order_relaxed));
+    Expect("slow dropped", WaitFor([&]() { return broker.GetNumClients() == NumReaders; }));
+
+    std::printf("%zu subscribers %10.0f events/s\n", NumReaders, numSent / seconds);
+
+    close(slow);
+    readerList.clear();
+
+    broker.StopWhenIdle();
+    runThread.join();
+    Expect("idle", broker.GetNumClients() == 0);
+}
+
+// A fresh subscriber gets a snapshot; one that comes back in time gets exactly what it missed,
+// and one that comes back too late a snapshot again. A second broker cannot take the endpoint.
+void TestResume()
+{
+    ProcessWatcherBroker broker { MakeEndpoint() };
+    std::thread          runThread { [&broker]() { broker.Run(); } };
+
+    bool taken = false;
+    try
+    {
+        ProcessWatcherBroker second { broker.GetEndpoint() };
+    }
+    catch (std::runtime_error const&)
+    {
+        taken = true;
+    }
+    Expect("second broker", taken);
+
+    ProcessEvent started[] = {
+        MakeEvent(ProcessState::Running, 1),
+        MakeEvent(ProcessState::Running, 2),
+        MakeEvent(ProcessState::Stopped, 1),
+    };
+    broker.Publish(started, 3);
+
+    std::string const&     endpoint = broker.GetEndpoint();
+    ProcessWatcherSequence snapshot = WaitForSequence(endpoint, 3);
+
+    std::vector<ProcessEvent> missedList;
+    for (uint32_t i = 0; i < 100; ++i)
+        missedList.push_back(MakeEvent(ProcessState::Running, 10 + i));
+    broker.Publish(missedList.data(), missedList.size());
+
+    Answer replay = Attach(endpoint, snapshot, snapshot.sequence + 100);
+    Expect("replay", replay.type == ProcessWatcherFrameType::SequencedEvents);
+    Expect("replay range",
+           replay.sequence.sequence == snapshot.sequence + 1 && replay.numEvents == 100);
+
+    std::vector<ProcessEvent> floodList(ProcessWatcherBroker::ReplayCapacity,
+                                        MakeEvent(ProcessState::Stopped, 5));
+    broker.Publish(floodList.data(), floodList.size());
+    WaitForSequence(endpoint, snapshot.sequence + 100 + floodList.size());
+
+    Answer late = Attach(endpoint, snapshot, 0);
+    Expect("late resume", late.type == ProcessWatcherFrameType::Snapshot && late.numEvents == 101);
+
+    broker.Stop();
+    runThread.join();
+}
+
+// The subscriber reconnects on its own after the broker is restarted over the socket file a crashed
+// one left behind, and reports the difference between the old and the new snapshot.
+void TestResubscribe()
+{
+    std::string endpoint  = MakeEndpoint();
+    auto        broker    = std::make_unique<ProcessWatcherBroker>(endpoint);
+    auto        runThread = std::thread { &ProcessWatcherBroker::Run, broker.get() };
+
+    ProcessEvent running[] = {
+        MakeEvent(ProcessState::Running, 1),
+        MakeEvent(ProcessState::Running, 2),
+    };
+    broker->Publish(running, 2);
+    WaitForSequence(endpoint, 2);
+
+    std::mutex                mtx;
+    std::vector<ProcessEvent> eventList;
+    ProcessWatcherSubscriber  subscriber { endpoint, [&](ProcessEvent const& event) {
+                                             std::lock_guard<std::mutex> guard { mtx };
+                                             eventList.push_back(event);
+                                         } };
+
+    std::vector<ProcessEvent> snapshot;
+    Expect("first snapshot",
+           subscriber.WaitForSnapshot(snapshot, std::chrono::seconds { 10 })
+               && snapshot.size() == 2);
+
+    ProcessEvent third = MakeEvent(ProcessState::Running, 3);
+    broker->Publish(&third, 1);
+    Expect("live event", WaitFor([&]() {
+               std::lock_guard<std::mutex> guard { mtx };
+               return !eventList.empty() && eventList.back().processId == 3;
+           }));
+
+    broker->Stop();
+    runThread.join();
+    broker.reset();
+
+    int         stale   = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = MakeAddress(endpoint);
+    bind(stale, (sockaddr*)&address, sizeof address);
+    close(stale);
+
+    // Process 1 exited and process 4 started while no broker was running.
+    auto start = Clock::now();
+    broker     = std::make_unique<ProcessWatcherBroker>(endpoint);
+    runThread  = std::thread { &ProcessWatcherBroker::Run, broker.get() };
+
+    ProcessEvent restarted[] = {
+        MakeEvent(ProcessState::Running, 2),
+        MakeEvent(ProcessState::Running, 3),
+        MakeEvent(ProcessState::Running, 4),
+    };
+    broker->Publish(restarted, 3);
+
+    bool recovered = WaitFor([&]() {
+        std::lock_guard<std::mutex> guard { mtx };
+        bool stopped = false, started = false;
+        for (auto& event : eventList)
+        {
+            stopped = stopped || (event.processId == 1 && event.state == ProcessState::Stopped);
+            started = started || (event.processId == 4 && event.state == ProcessState::Running);
+        }
+        return stopped && started;
+    });
+    double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    Expect("recovered", recovered);
+    Expect("reattached", subscriber.GetNumAttaches() >= 2);
+    std::printf("recovered from a broker restart in %.2f ms\n", milliseconds);
+
+    broker->Stop();
+    runThread.join();
+}
+
+
+// The broker answers heartbeats while it serves, and once it is gone the misses add up to a single
+// call of the miss handler.
+void TestHeartbeat()
+{
+    std::string endpoint  = MakeEndpoint();
+    auto        broker    = std::make_unique<ProcessWatcherBroker>(endpoint);
+    auto        runThread = std::thread { &ProcessWatcherBroker::Run, broker.get() };
+
+    ProcessWatcherSubscriber  subscriber { endpoint, [](ProcessEvent const&) {} };
+    std::vector<ProcessEvent> snapshot;
+    Expect("heartbeat attach", subscriber.WaitForSnapshot(snapshot, std::chrono::seconds { 10 }));
+
+    std::atomic<uint32_t> numCalls { 0 };
+    subscriber.SetHeartbeatMissHandler([&numCalls](uint32_t) { ++numCalls; });
+    subscriber.SetHeartbeatConfig(HeartbeatConfig { std::chrono::milliseconds { 20 }, 3 });
+
+    Expect("answered",
+           WaitFor([&]() { return subscriber.GetHeartbeatStatistics().numAnswered >= 5; }));
+    HeartbeatStatistics answered = subscriber.GetHeartbeatStatistics();
+    Expect("round trip", answered.roundTrip.count == answered.numAnswered);
+    Expect("not missed while served", numCalls == 0);
+
+    broker->Stop();
+    runThread.join();
+    broker.reset();
+
+    Expect("miss handler", WaitFor([&]() { return numCalls != 0; }));
+    Expect("consecutive misses", subscriber.GetHeartbeatStatistics().numConsecutiveMissed >= 3);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds { 100 });
+    Expect("called once", numCalls == 1);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numEvents = argc > 1 ? (size_t)std::atoll(argv[1]) : 200000;
+
+    TestFanOut(numEvents);
+    TestResume();
+    TestResubscribe();
+    TestHeartbeat();
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+    return 0;
+}
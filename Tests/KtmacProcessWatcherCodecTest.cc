@@ -0,0 +1,302 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessWatcherCodec.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+ProcessEvent MakeEvent(std::mt19937& random)
+{
+    ProcessEvent event    = {};
+    event.state           = random() % 2 == 0 ? ProcessState::Running : ProcessState::Stopped;
+    event.processId       = random();
+    event.parentProcessId = random();
+    event.creationTime    = ((uint64_t)random() << 32) | random();
+    std::snprintf(event.imageName, sizeof event.imageName, "process-%u.exe", (unsigned)random());
+    return event;
+}
+
+// Feeds `stream` to a decoder in pieces of random size, like recv() would hand it over.
+bool Feed(ProcessWatcherDecoder&     decoder,
+          std::vector<char> const&   stream,
+          std::mt19937&              random,
+          std::vector<ProcessEvent>& eventList,
+          size_t&                    numQuits)
+{
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        size_t size   = 0;
+        char*  buffer = decoder.GetWriteBuffer(size);
+        size_t length = 1 + random() % 4096;
+        length        = std::min({ length, size, stream.size() - offset });
+
+        std::memcpy(buffer, stream.data() + offset, length);
+        decoder.Commit(length);
+        offset += length;
+
+        bool valid = decoder.Decode(
+            [&](ProcessWatcherFrameType type, char const* payload, uint32_t payloadLength) {
+                if (type == ProcessWatcherFrameType::Quit)
+                    ++numQuits;
+                if (type != ProcessWatcherFrameType::Events)
+                    return true;
+
+                return ProcessWatcherDecoder::ForEachEvent(
+                    payload, payloadLength, [&](ProcessEvent const& event) {
+                        eventList.push_back(event);
+                    });
+            });
+        if (!valid)
+            return false;
+    }
+    return true;
+}
+
+void TestRoundTrip(std::mt19937& random)
+{
+    std::vector<ProcessEvent> sentList;
+    ProcessWatcherEncoder     encoder;
+    std::vector<char>         stream;
+    size_t                    numQuitsSent = 0;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        // Mostly small batches, now and then one that has to be split over several frames.
+        size_t numEvents = i % 100 == 0 ? 1000 + random() % 1000 : random() % 8;
+
+        std::vector<ProcessEvent> batch;
+        for (size_t j = 0; j < numEvents; ++j) batch.push_back(MakeEvent(random));
+        sentList.insert(sentList.end(), batch.begin(), batch.end());
+
+        encoder.Clear();
+        encoder.AddEvents(batch.data(), batch.size());
+        if (i % 250 == 0)
+        {
+            encoder.AddFrame(ProcessWatcherFrameType::Quit, nullptr, 0);
+            ++numQuitsSent;
+        }
+
+        // A frame type from a newer peer must be skipped.
+        if (i % 10 == 0)
+            encoder.AddFrame((ProcessWatcherFrameType)200, "unknown", 7);
+
+        stream.insert(stream.end(), encoder.GetData(), encoder.GetData() + encoder.GetSize());
+    }
+
+    ProcessWatcherDecoder     decoder;
+    std::vector<ProcessEvent> receivedList;
+    size_t                    numQuitsReceived = 0;
+
+    Expect("round trip valid", Feed(decoder, stream, random, receivedList, numQuitsReceived));
+    Expect("round trip count", receivedList.size() == sentList.size());
+    Expect("round trip quits", numQuitsReceived == numQuitsSent);
+    Expect("round trip contents",
+           receivedList.size() == sentList.size()
+               && std::memcmp(receivedList.data(),
+                              sentList.data(),
+                              sentList.size() * sizeof(ProcessEvent))
+                      == 0);
+}
+
+void TestInvalid(std::mt19937& random)
+{
+    ProcessEvent          event = MakeEvent(random);
+    ProcessWatcherEncoder encoder;
+    encoder.AddEvents(&event, 1);
+
+    auto mutate = [&](size_t offset, char value) {
+        std::vector<char> stream(encoder.GetData(), encoder.GetData() + encoder.GetSize());
+        stream[offset] = value;
+
+        ProcessWatcherDecoder     decoder;
+        std::vector<ProcessEvent> eventList;
+        size_t                    numQuits = 0;
+        return Feed(decoder, stream, random, eventList, numQuits);
+    };
+
+    Expect("bad magic", !mutate(0, 0));
+    Expect("bad version", !mutate(2, ProcessWatcherProtocolVersion + 1));
+    Expect("oversized frame", !mutate(7, (char)0x7F));
+
+    // A payload that is not a whole number of events.
+    ProcessWatcherEncoder truncated;
+    truncated.AddFrame(ProcessWatcherFrameType::Events, &event, sizeof event - 1);
+    std::vector<char> stream(truncated.GetData(), truncated.GetData() + truncated.GetSize());
+
+    ProcessWatcherDecoder     decoder;
+    std::vector<ProcessEvent> eventList;
+    size_t                    numQuits = 0;
+    Expect("partial event", !Feed(decoder, stream, random, eventList, numQuits));
+}
+
+// Sequenced frames are split like plain ones, keep counting across frames, and an empty one still
+// goes out.
+void TestSequenced(std::mt19937& random)
+{
+    std::vector<ProcessEvent> sentList(3000);
+    for (auto& event : sentList) event = MakeEvent(random);
+
+    ProcessWatcherEncoder encoder;
+    encoder.AddSnapshot(ProcessWatcherSequence { 7, 41 }, sentList.data(), 3);
+    encoder.AddSequencedEvents(ProcessWatcherSequence { 7, 42 }, sentList.data(), sentList.size());
+    encoder.AddSequencedEvents(ProcessWatcherSequence { 7, 3042 }, nullptr, 0);
+    std::vector<char> stream(encoder.GetData(), encoder.GetData() + encoder.GetSize());
+
+    ProcessWatcherDecoder decoder;
+    size_t                numFrames   = 0;
+    size_t                numSnapshot = 0;
+    uint64_t              next        = 42;
+    bool                  inOrder     = true;
+    size_t                offset      = 0;
+    while (offset < stream.size())
+    {
+        size_t size   = 0;
+        char*  buffer = decoder.GetWriteBuffer(size);
+        size_t chunk  = std::min({ (size_t)(1 + random() % 4096), size, stream.size() - offset });
+        std::memcpy(buffer, stream.data() + offset, chunk);
+        decoder.Commit(chunk);
+        offset += chunk;
+
+        decoder.Decode([&](ProcessWatcherFrameType type, char const* payload, uint32_t length) {
+            ProcessWatcherSequence sequence = {};
+            ++numFrames;
+            if (type == ProcessWatcherFrameType::Snapshot)
+            {
+                return ProcessWatcherDecoder::ForEachSequencedEvent(
+                    payload, length, sequence, [&](ProcessEvent const&) { ++numSnapshot; });
+            }
+
+            bool valid = ProcessWatcherDecoder::ForEachSequencedEvent(
+                payload, length, sequence, [&](ProcessEvent const& event) {
+                    inOrder = inOrder && sequence.sequence == next
+                              && event.processId == sentList[next - 42].processId;
+                    ++sequence.sequence;
+                    ++next;
+                });
+            inOrder = inOrder && sequence.instanceId == 7 && sequence.sequence == next;
+            return valid;
+        });
+    }
+
+    Expect("sequenced snapshot", numSnapshot == 3);
+    Expect("sequenced order", inOrder && next == 3042);
+    Expect("sequenced frames", numFrames > 3);
+}
+
+// Random garbage and randomly corrupted valid streams. The decoder may reject them or not, but it
+// must never read outside its buffer or hand out more bytes than it was given; run under a
+// sanitizer to catch the former.
+void TestFuzz(std::mt19937& random, size_t numIterations)
+{
+    ProcessWatcherEncoder encoder;
+    for (size_t i = 0; i < numIterations; ++i)
+    {
+        std::vector<char> stream;
+        if (i % 2 == 0)
+        {
+            stream.resize(random() % 4096);
+            for (auto& byte : stream) byte = (char)random();
+        }
+        else
+        {
+            std::vector<ProcessEvent> batch(random() % 32);
+            for (auto& event : batch) event = MakeEvent(random);
+            encoder.Clear();
+            encoder.AddEvents(batch.data(), batch.size());
+            stream.assign(encoder.GetData(), encoder.GetData() + encoder.GetSize());
+            if (!stream.empty())
+            {
+                for (int j = 0; j < 3; ++j) stream[random() % stream.size()] = (char)random();
+            }
+        }
+
+        ProcessWatcherDecoder     decoder;
+        std::vector<ProcessEvent> eventList;
+        size_t                    numQuits = 0;
+        Feed(decoder, stream, random, eventList, numQuits);
+        if (eventList.size() * sizeof(ProcessEvent) > stream.size())
+        {
+            Expect("fuzz bounds", false);
+            return;
+        }
+    }
+}
+
+void Benchmark(std::mt19937& random, size_t numEvents, size_t batchSize)
+{
+    std::vector<ProcessEvent> batch(batchSize);
+    for (auto& event : batch) event = MakeEvent(random);
+
+    ProcessWatcherEncoder encoder;
+    ProcessWatcherDecoder decoder;
+    size_t                numDecoded = 0;
+
+    auto start = Clock::now();
+    for (size_t sent = 0; sent < numEvents; sent += batchSize)
+    {
+        encoder.Clear();
+        encoder.AddEvents(batch.data(), batch.size());
+
+        size_t size   = 0;
+        char*  buffer = decoder.GetWriteBuffer(size);
+        std::memcpy(buffer, encoder.GetData(), encoder.GetSize());
+        decoder.Commit(encoder.GetSize());
+        decoder.Decode([&](ProcessWatcherFrameType, char const* payload, uint32_t length) {
+            return ProcessWatcherDecoder::ForEachEvent(
+                payload, length, [&](ProcessEvent const&) { ++numDecoded; });
+        });
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::printf("batch=%-4zu %10.0f events/s %8.1f MB/s\n",
+                batchSize,
+                numDecoded / seconds,
+                numDecoded * sizeof(ProcessEvent) / seconds / 1e6);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numFuzz = argc > 1 ? (size_t)std::atoll(argv[1]) : 20000;
+
+    std::mt19937 random { 20211 };
+    TestRoundTrip(random);
+    TestInvalid(random);
+    TestSequenced(random);
+    TestFuzz(random, numFuzz);
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+
+    for (size_t batchSize : { 1, 16, 256 }) Benchmark(random, 2000000, batchSize);
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/ProcessWatcherSocket.hh>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+bool WaitFor(std::function<bool()> const& condition)
+{
+    auto deadline = Clock::now() + std::chrono::seconds { 10 };
+    while (!condition())
+    {
+        if (Clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds { 1 });
+    }
+    return true;
+}
+
+bool Exists(std::string const& path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+// Events arrive in order, and nobody else can connect once the client has.
+void TestRoundTrip(size_t numEvents)
+{
+    std::string endpoint = ProcessWatcherSocket::MakeEndpoint((uint32_t)getpid());
+
+    std::atomic<size_t> numReceived { 0 };
+    std::atomic<bool>   ordered { true };
+
+    std::unique_ptr<ProcessWatcherSocket> server { new ProcessWatcherSocket {
+        ProcessWatcherSocket::MakeServerSocket(endpoint, [&](ProcessEvent const& event) {
+            if (event.processId != numReceived)
+                ordered = false;
+            numReceived.fetch_add(1, std::memory_order_release);
+        }) } };
+    Expect("endpoint created", Exists(endpoint));
+
+    std::thread clientThread { [&]() {
+        ProcessWatcherSocket client { ProcessWatcherSocket::MakeClientSocket(endpoint) };
+
+        std::vector<ProcessEvent> eventList(16);
+        for (size_t sent = 0; sent < numEvents; sent += eventList.size())
+        {
+            for (size_t i = 0; i < eventList.size(); ++i)
+            {
+                eventList[i].state     = ProcessState::Running;
+                eventList[i].processId = (uint32_t)(sent + i);
+            }
+            client.Send(eventList.data(), eventList.size());
+        }
+
+        client.WaitUntilQuit();
+    } };
+
+    auto start = Clock::now();
+    Expect("accepted", server->WaitForClient(nullptr));
+    Expect("endpoint removed", !Exists(endpoint));
+
+    bool   received = WaitFor([&]() { return numReceived.load() >= numEvents; });
+    double seconds  = std::chrono::duration<double>(Clock::now() - start).count();
+    Expect("received", received);
+    Expect("ordered", ordered);
+    std::printf("%zu events in %.1f ms, %.0f events/s\n",
+                numReceived.load(),
+                seconds * 1000,
+                numReceived.load() / seconds);
+
+    bool refused = false;
+    try
+    {
+        ProcessWatcherSocket::MakeClientSocket(endpoint);
+    }
+    catch (std::runtime_error const&)
+    {
+        refused = true;
+    }
+    Expect("second client refused", refused);
+
+    // The server's Quit frame lets the client return.
+    server.reset();
+    clientThread.join();
+}
+
+// Instances no longer compete for a fixed port, and a socket file a crashed server left behind
+// does not get in the way.
+void TestEndpoints()
+{
+    std::string first  = ProcessWatcherSocket::MakeEndpoint((uint32_t)getpid());
+    std::string second = ProcessWatcherSocket::MakeEndpoint((uint32_t)getpid());
+    Expect("distinct endpoints", first != second);
+
+    {
+        ProcessWatcherSocket stale { ProcessWatcherSocket::MakeServerSocket(first, nullptr) };
+    }
+    Expect("endpoint removed on destruction", !Exists(first));
+
+    FILE* file = std::fopen(first.c_str(), "w");
+    if (file != nullptr)
+        std::fclose(file);
+
+    bool listening = true;
+    try
+    {
+        ProcessWatcherSocket firstServer { ProcessWatcherSocket::MakeServerSocket(first, nullptr) };
+        ProcessWatcherSocket secondServer { ProcessWatcherSocket::MakeServerSocket(second,
+                                                                                   nullptr) };
+    }
+    catch (std::runtime_error const&)
+    {
+        listening = false;
+    }
+    Expect("both listening", listening);
+    Expect("both removed", !Exists(first) && !Exists(second));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numEvents = argc > 1 ? (size_t)std::atoll(argv[1]) : 200000;
+
+    TestRoundTrip(numEvents);
+    TestEndpoints();
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,174 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/RateLimiter.hh>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock        = RateLimiter::Clock;
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+bool IsNear(double actual, double expected, double tolerance)
+{
+    return std::abs(actual - expected) <= tolerance;
+}
+
+// A burst goes out at once, and every send past it is scheduled exactly one interval after the
+// previous one.
+void TestSpacing()
+{
+    RateLimiter limiter { RateLimit { 100.0, 5 } };
+
+    auto                                start = Clock::now();
+    std::vector<RateLimiter::TimePoint> allowedList;
+    for (int i = 0; i < 20; ++i) allowedList.push_back(limiter.Reserve(0));
+
+    for (int i = 0; i < 5; ++i)
+        Expect("burst", Milliseconds { allowedList[i] - start }.count() < 5.0);
+    Expect("first deferred", IsNear(Milliseconds { allowedList[5] - start }.count(), 10.0, 5.0));
+    for (int i = 6; i < 20; ++i)
+        Expect("spacing", allowedList[i] - allowedList[i - 1] == std::chrono::milliseconds { 10 });
+
+    // Acquire() sleeps until each deferred send is due.
+    RateLimiter paced { RateLimit { 200.0, 1 } };
+    start = Clock::now();
+    for (int i = 0; i < 10; ++i) paced.Acquire(0);
+    double elapsedMs = Milliseconds { Clock::now() - start }.count();
+    Expect("paced", elapsedMs >= 45.0 && elapsedMs < 500.0);
+}
+
+// Rooms have buckets of their own, and the global bucket still caps all of them together.
+void TestRooms()
+{
+    RateLimiter limiter { RateLimit {}, RateLimit { 10.0, 2 } };
+
+    auto start = Clock::now();
+    limiter.Reserve(1);
+    limiter.Reserve(1);
+    Expect("room deferred", Milliseconds { limiter.Reserve(1) - start }.count() >= 50.0);
+    Expect("other room", Milliseconds { limiter.Reserve(2) - start }.count() < 5.0);
+
+    limiter.SetGlobalLimit(RateLimit { 10.0, 1 });
+    limiter.Reserve(3);
+    Expect("global cap", Milliseconds { limiter.Reserve(4) - start }.count() >= 50.0);
+}
+
+// Limits can be changed while the limiter is in use and take effect with the next reservation.
+void TestSetLimits()
+{
+    RateLimiter limiter { RateLimit { 1.0, 1 }, RateLimit { 1.0, 1 } };
+
+    limiter.SetGlobalLimit(RateLimit { 1000.0, 3 });
+    limiter.SetRoomLimit(RateLimit { 500.0, 4 });
+    Expect("global limit",
+           IsNear(limiter.GetGlobalLimit().messagesPerSecond, 1000.0, 0.01)
+               && limiter.GetGlobalLimit().burst == 3);
+    Expect("room limit",
+           IsNear(limiter.GetRoomLimit().messagesPerSecond, 500.0, 0.01)
+               && limiter.GetRoomLimit().burst == 4);
+
+    for (int i = 0; i < 3; ++i) limiter.Reserve(0);
+    auto first  = limiter.Reserve(0);
+    auto second = limiter.Reserve(0);
+    Expect("new rate", second - first == std::chrono::milliseconds { 1 });
+
+    limiter.SetGlobalLimit(RateLimit {});
+    limiter.SetRoomLimit(RateLimit {});
+    Expect("disabled", limiter.GetGlobalLimit().messagesPerSecond == 0.0);
+
+    auto start = Clock::now();
+    for (int i = 0; i < 100; ++i)
+        Expect("unlimited", Milliseconds { limiter.Reserve(7) - start }.count() < 5.0);
+}
+
+// Levels count down with every reservation and go negative while sends are deferred.
+void TestLevels()
+{
+    RateLimiter limiter { RateLimit { 1.0, 4 }, RateLimit { 1.0, 2 } };
+
+    RateLimiterLevels fresh = limiter.GetLevels(1);
+    Expect("fresh global", fresh.globalTokens == 4.0);
+    Expect("fresh room", fresh.roomTokens == 2.0);
+
+    limiter.Reserve(1);
+    RateLimiterLevels one = limiter.GetLevels(1);
+    Expect("one global", IsNear(one.globalTokens, 3.0, 0.05));
+    Expect("one room", IsNear(one.roomTokens, 1.0, 0.05));
+
+    limiter.Reserve(1);
+    limiter.Reserve(1);
+    RateLimiterLevels deferred = limiter.GetLevels(1);
+    Expect("deferred room", IsNear(deferred.roomTokens, -1.0, 0.05));
+    Expect("unseen room", limiter.GetLevels(2).roomTokens == 2.0);
+
+    RateLimiter unlimited;
+    Expect("unlimited levels",
+           std::isinf(unlimited.GetLevels(1).globalTokens)
+               && std::isinf(unlimited.GetLevels(1).roomTokens));
+}
+
+// Once every slot is taken, a new room gets the slot of a room whose bucket has refilled, and
+// shares one otherwise.
+void TestEviction()
+{
+    constexpr uintptr_t NewRoom = RateLimiter::MaxRooms + 1;
+
+    {
+        RateLimiter limiter { RateLimit {}, RateLimit { 1.0, 1 } };
+
+        auto start = Clock::now();
+        for (uintptr_t room = 1; room <= RateLimiter::MaxRooms; ++room)
+            Expect("own slot", Milliseconds { limiter.Reserve(room) - start }.count() < 5.0);
+
+        // No bucket has refilled within the second, so the new room shares a drained one.
+        Expect("shared", Milliseconds { limiter.Reserve(NewRoom) - start }.count() >= 500.0);
+        Expect("not tracked", limiter.GetLevels(NewRoom).roomTokens == 1.0);
+    }
+
+    {
+        RateLimiter limiter { RateLimit {}, RateLimit { 1000.0, 1 } };
+        for (uintptr_t room = 1; room <= RateLimiter::MaxRooms; ++room) limiter.Reserve(room);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds { 5 });
+
+        auto start = Clock::now();
+        Expect("evicted", Milliseconds { limiter.Reserve(NewRoom) - start }.count() < 1.0);
+        Expect("tracked", limiter.GetLevels(NewRoom).roomTokens < 0.5);
+    }
+}
+
+}
+
+int main()
+{
+    TestSpacing();
+    TestRooms();
+    TestSetLimits();
+    TestLevels();
+    TestEviction();
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,503 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/LatencyHistogram.hh>
+#include <ktmac/Reactor.hh>
+#include <ktmac/SpscRing.hh>
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+#define CHECK(Expression)                                                                          \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(Expression))                                                                         \
+        {                                                                                          \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #Expression);   \
+            std::exit(1);                                                                          \
+        }                                                                                          \
+    } while (false)
+
+int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch())
+        .count();
+}
+
+size_t GetNumThreads()
+{
+    std::ifstream status { "/proc/self/status" };
+    std::string   line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 8, "Threads:") == 0)
+            return std::strtoul(line.c_str() + 8, nullptr, 10);
+    }
+    return 0;
+}
+
+uint64_t GetContextSwitches(int who)
+{
+    rusage usage = {};
+    getrusage(who, &usage);
+    return (uint64_t)(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+struct Record
+{
+    uint32_t source;
+    uint32_t sequence;
+    int64_t  sentNs;
+};
+
+// Stands in for one input of the core: the window messages KakaoTalk's threads cause, or the
+// process hook's transport. Like a message queue, it only signals its descriptor when it turns
+// non-empty.
+class SimulatedSource
+{
+  private:
+    int                 _fd;
+    std::mutex          _mtx;
+    std::vector<Record> _pending;
+
+  public:
+    SimulatedSource() : _fd { eventfd(0, EFD_CLOEXEC) }, _mtx {}, _pending {}
+    {
+        CHECK(_fd >= 0);
+    }
+
+    ~SimulatedSource()
+    {
+        close(_fd);
+    }
+
+    int GetDescriptor() const
+    {
+        return _fd;
+    }
+
+    void Push(Record const& record)
+    {
+        bool wasEmpty;
+        {
+            std::lock_guard<std::mutex> guard { _mtx };
+            wasEmpty = _pending.empty();
+            _pending.push_back(record);
+        }
+        if (wasEmpty)
+            Wake();
+    }
+
+    void Wake()
+    {
+        uint64_t value = 1;
+        CHECK(write(_fd, &value, sizeof value) == sizeof value);
+    }
+
+    // Blocks until the source was signaled; the reactor only calls it once it is.
+    void Drain(std::vector<Record>& out)
+    {
+        uint64_t value = 0;
+        CHECK(read(_fd, &value, sizeof value) == sizeof value);
+
+        out.clear();
+        std::lock_guard<std::mutex> guard { _mtx };
+        out.swap(_pending);
+    }
+};
+
+// What the core does with an event. Checks that every source's events arrive complete and in
+// order, and that no two threads apply at once.
+struct State
+{
+    static constexpr size_t NumSources = 2;
+
+    uint32_t            nextSequence[NumSources] = {};
+    uint64_t            digest                   = 0;
+    std::atomic<bool>   applying { false };
+    LatencyHistogram    latency;
+    std::atomic<size_t> numApplied { 0 };
+
+    void Apply(Record const& record)
+    {
+        CHECK(!applying.exchange(true, std::memory_order_acquire));
+        CHECK(record.sequence == nextSequence[record.source]);
+        ++nextSequence[record.source];
+        digest = (digest ^ record.sequence) * 0x100000001B3ull;
+        latency.Record((uint64_t)(NowNs() - record.sentNs));
+        applying.store(false, std::memory_order_release);
+
+        numApplied.fetch_add(1, std::memory_order_release);
+    }
+};
+
+// Adds up the context switches of the threads a model runs.
+class SwitchCounter
+{
+  private:
+    std::atomic<uint64_t>& _total;
+    uint64_t               _start;
+
+  public:
+    explicit SwitchCounter(std::atomic<uint64_t>& total) :
+        _total { total },
+        _start { GetContextSwitches(RUSAGE_THREAD) }
+    {}
+
+    ~SwitchCounter()
+    {
+        _total.fetch_add(GetContextSwitches(RUSAGE_THREAD) - _start);
+    }
+};
+
+// The layout KakaoStateManager has without a reactor: the message thread moves window events into
+// a ring for the state thread, and the transport's thread applies process events under the state
+// lock.
+class ThreadedModel
+{
+  private:
+    static constexpr size_t RingSize = 1024;
+
+  private:
+    SimulatedSource&           _window;
+    SimulatedSource&           _process;
+    State&                     _state;
+    std::atomic<uint64_t>&     _numSwitches;
+    std::mutex                 _stateMtx;
+    SpscRing<Record, RingSize> _ring;
+    int                        _ringReady;
+    std::atomic<bool>          _stateWaiting;
+    std::atomic<bool>          _stopping;
+    std::thread                _messageThread;
+    std::thread                _stateThread;
+    std::thread                _ipcThread;
+
+  public:
+    ThreadedModel(SimulatedSource&       window,
+                  SimulatedSource&       process,
+                  State&                 state,
+                  std::atomic<uint64_t>& numSwitches) :
+        _window { window },
+        _process { process },
+        _state { state },
+        _numSwitches { numSwitches },
+        _stateMtx {},
+        _ring {},
+        _ringReady { eventfd(0, EFD_CLOEXEC) },
+        _stateWaiting { false },
+        _stopping { false }
+    {
+        CHECK(_ringReady >= 0);
+        _messageThread = std::thread { &ThreadedModel::HandleMessages, this };
+        _stateThread   = std::thread { &ThreadedModel::HandleStateEvents, this };
+        _ipcThread     = std::thread { &ThreadedModel::HandleProcessEvents, this };
+    }
+
+    ~ThreadedModel()
+    {
+        _stopping = true;
+        _window.Wake();
+        _process.Wake();
+        _messageThread.join();
+        _ipcThread.join();
+
+        uint64_t value = 1;
+        CHECK(write(_ringReady, &value, sizeof value) == sizeof value);
+        _stateThread.join();
+        close(_ringReady);
+    }
+
+  private:
+    void HandleMessages()
+    {
+        SwitchCounter       counter { _numSwitches };
+        std::vector<Record> batch;
+        while (!_stopping)
+        {
+            _window.Drain(batch);
+            for (auto& record : batch)
+            {
+                // The core drops and resyncs instead; waiting keeps the sequence check meaningful.
+                while (!_ring.TryPush(record))
+                {
+                    WakeStateThread();
+                    std::this_thread::yield();
+                }
+            }
+            WakeStateThread();
+        }
+    }
+
+    void WakeStateThread()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_stateWaiting.load(std::memory_order_relaxed))
+        {
+            uint64_t value = 1;
+            CHECK(write(_ringReady, &value, sizeof value) == sizeof value);
+        }
+    }
+
+    void HandleStateEvents()
+    {
+        SwitchCounter counter { _numSwitches };
+        Record        batch[64];
+        while (true)
+        {
+            if (size_t count = _ring.PopBatch(batch, 64); count != 0)
+            {
+                std::lock_guard<std::mutex> guard { _stateMtx };
+                for (size_t i = 0; i < count; ++i) _state.Apply(batch[i]);
+                continue;
+            }
+
+            if (_stopping)
+                return;
+
+            _stateWaiting = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_ring.IsEmpty() && !_stopping)
+            {
+                uint64_t value = 0;
+                CHECK(read(_ringReady, &value, sizeof value) == sizeof value);
+            }
+            _stateWaiting = false;
+        }
+    }
+
+    void HandleProcessEvents()
+    {
+        SwitchCounter       counter { _numSwitches };
+        std::vector<Record> batch;
+        while (!_stopping)
+        {
+            _process.Drain(batch);
+
+            std::lock_guard<std::mutex> guard { _stateMtx };
+            for (auto& record : batch) _state.Apply(record);
+        }
+    }
+};
+
+// Both sources and the work queue served from one thread; nothing needs the state lock.
+class ReactorModel
+{
+  private:
+    Reactor             _reactor;
+    std::vector<Record> _batch;
+    std::thread         _thread;
+
+  public:
+    ReactorModel(SimulatedSource&       window,
+                 SimulatedSource&       process,
+                 State&                 state,
+                 std::atomic<uint64_t>& numSwitches) :
+        _reactor {},
+        _batch {},
+        _thread {}
+    {
+        for (SimulatedSource* source : { &window, &process })
+        {
+            CHECK(_reactor.AddSource(source->GetDescriptor(), [this, source, &state]() {
+                source->Drain(_batch);
+                for (auto& record : _batch) state.Apply(record);
+            }));
+        }
+
+        _thread = std::thread { [this, &numSwitches]() {
+            SwitchCounter counter { numSwitches };
+            _reactor.Run();
+        } };
+    }
+
+    ~ReactorModel()
+    {
+        _reactor.Stop();
+        _thread.join();
+    }
+};
+
+// Both producers send `numEvents` in bursts of `burstSize`, pausing `pause` between bursts.
+template <typename Model>
+void Run(char const*               name,
+         size_t                    numEvents,
+         size_t                    burstSize,
+         std::chrono::microseconds pause)
+{
+    SimulatedSource       window;
+    SimulatedSource       process;
+    State                 state;
+    std::atomic<uint64_t> numSwitches { 0 };
+
+    size_t   numThreadsBefore = GetNumThreads();
+    uint64_t processSwitches  = GetContextSwitches(RUSAGE_SELF);
+    int64_t  start            = NowNs();
+    size_t   numThreads;
+    {
+        Model model { window, process, state, numSwitches };
+        numThreads = GetNumThreads() - numThreadsBefore;
+
+        std::vector<std::thread> producerList;
+        for (uint32_t source = 0; source < State::NumSources; ++source)
+        {
+            SimulatedSource& target = source == 0 ? window : process;
+            producerList.emplace_back([&target, source, numEvents, burstSize, pause]() {
+                for (uint32_t sequence = 0; sequence < numEvents;)
+                {
+                    for (size_t i = 0; i < burstSize && sequence < numEvents; ++i, ++sequence)
+                        target.Push(Record { source, sequence, NowNs() });
+
+                    if (pause.count() != 0)
+                        std::this_thread::sleep_for(pause);
+                }
+            });
+        }
+        for (auto& producer : producerList) producer.join();
+
+        while (state.numApplied.load(std::memory_order_acquire) < numEvents * State::NumSources)
+            std::this_thread::yield();
+    }
+    int64_t elapsed = NowNs() - start;
+    processSwitches = GetContextSwitches(RUSAGE_SELF) - processSwitches;
+
+    for (uint32_t source = 0; source < State::NumSources; ++source)
+        CHECK(state.nextSequence[source] == numEvents);
+
+    double numApplied = (double)(numEvents * State::NumSources);
+    auto   snapshot   = state.latency.GetSnapshot();
+    std::printf("%-9s burst=%-4zu threads=%zu switches/1k=%7.1f (process %7.1f) %10.0f events/s "
+                "p50=%7.2fus p99=%8.2fus\n",
+                name,
+                burstSize,
+                numThreads,
+                (double)numSwitches.load() * 1000 / numApplied,
+                (double)processSwitches * 1000 / numApplied,
+                numApplied / ((double)elapsed / 1e9),
+                snapshot.GetPercentile(0.5) / 1e3,
+                snapshot.GetPercentile(0.99) / 1e3);
+}
+
+void TestPostOrder()
+{
+    constexpr size_t NumPosters = 4;
+    constexpr size_t NumPosts   = 10000;
+
+    Reactor     reactor;
+    std::thread thread { [&reactor]() { reactor.Run(); } };
+
+    size_t                   nextList[NumPosters] = {};
+    std::vector<std::thread> posterList;
+    for (size_t poster = 0; poster < NumPosters; ++poster)
+    {
+        posterList.emplace_back([&, poster]() {
+            for (size_t i = 0; i < NumPosts; ++i)
+            {
+                reactor.Post([&, poster, i]() {
+                    CHECK(reactor.IsReactorThread());
+                    CHECK(nextList[poster] == i);
+                    ++nextList[poster];
+                });
+            }
+        });
+    }
+    for (auto& poster : posterList) poster.join();
+
+    // Everything posted before Stop() still runs.
+    reactor.Stop();
+    thread.join();
+    CHECK(!reactor.IsReactorThread());
+    for (size_t poster = 0; poster < NumPosters; ++poster) CHECK(nextList[poster] == NumPosts);
+
+    std::printf("post order: %zu posts, %llu wakeups\n",
+                NumPosters * NumPosts,
+                (unsigned long long)reactor.GetNumWakeups());
+}
+
+void TestSources()
+{
+    Reactor          reactor;
+    SimulatedSource  source;
+    std::atomic<int> numDispatched { 0 };
+
+    std::vector<Record> batch;
+    CHECK(reactor.AddSource(source.GetDescriptor(), [&]() {
+        source.Drain(batch);
+        numDispatched.fetch_add((int)batch.size());
+    }));
+
+    std::thread thread { [&reactor]() { reactor.Run(); } };
+
+    source.Push(Record {});
+    while (numDispatched.load() != 1) std::this_thread::yield();
+
+    // Removal is ordered with posted work, so nothing pushed afterwards is dispatched.
+    std::atomic<bool> removed { false };
+    reactor.RemoveSource(source.GetDescriptor());
+    reactor.Post([&removed]() { removed = true; });
+    while (!removed.load()) std::this_thread::yield();
+
+    source.Push(Record {});
+    std::this_thread::sleep_for(std::chrono::milliseconds { 20 });
+    CHECK(numDispatched.load() == 1);
+
+    reactor.Stop();
+    thread.join();
+
+    // Registration fails synchronously once the limit is reached.
+    Reactor                                       full;
+    std::vector<std::unique_ptr<SimulatedSource>> sourceList;
+    for (size_t i = 0; i < Reactor::MaxSources; ++i)
+    {
+        sourceList.push_back(std::make_unique<SimulatedSource>());
+        CHECK(full.AddSource(sourceList.back()->GetDescriptor(), []() {}));
+    }
+    SimulatedSource extra;
+    CHECK(!full.AddSource(extra.GetDescriptor(), []() {}));
+
+    std::printf("sources: ok\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t numEvents = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+
+    TestPostOrder();
+    TestSources();
+
+    for (size_t burstSize : { 1, 16, 256 })
+    {
+        Run<ThreadedModel>("threaded", numEvents, burstSize, std::chrono::microseconds { 0 });
+        Run<ReactorModel>("reactor", numEvents, burstSize, std::chrono::microseconds { 0 });
+    }
+
+    // Paced like a user clicking through KakaoTalk: short bursts with the core idle in between,
+    // where every burst costs each thread on its path a wakeup.
+    for (size_t burstSize : { 1, 16 })
+    {
+        auto pause = std::chrono::microseconds { 200 };
+        Run<ThreadedModel>("threaded", numEvents / 100, burstSize, pause);
+        Run<ReactorModel>("reactor", numEvents / 100, burstSize, pause);
+    }
+}
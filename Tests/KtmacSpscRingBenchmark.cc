@@ -0,0 +1,170 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/SpscRing.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Same size and layout as the record the core queues per window event.
+struct Record
+{
+    uint32_t event;
+    uint64_t window;
+    uint32_t eventThread;
+    int64_t  pushedNs;
+};
+
+int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch())
+        .count();
+}
+
+constexpr size_t RingSize  = 1024;
+constexpr size_t BatchSize = 64;
+
+class RingQueue
+{
+  private:
+    SpscRing<Record, RingSize> _ring;
+
+  public:
+    bool TryPush(Record const& record)
+    {
+        return _ring.TryPush(record);
+    }
+
+    size_t PopBatch(Record* out, size_t maxCount)
+    {
+        return _ring.PopBatch(out, maxCount);
+    }
+};
+
+// What a straightforward implementation would use instead: a bounded deque behind a mutex.
+class LockedQueue
+{
+  private:
+    std::deque<Record> _queue;
+    std::mutex         _mtx;
+
+  public:
+    bool TryPush(Record const& record)
+    {
+        std::lock_guard<std::mutex> guard { _mtx };
+        if (_queue.size() == RingSize)
+            return false;
+        _queue.push_back(record);
+        return true;
+    }
+
+    size_t PopBatch(Record* out, size_t maxCount)
+    {
+        std::lock_guard<std::mutex> guard { _mtx };
+        size_t count = std::min(maxCount, _queue.size());
+        std::copy_n(_queue.begin(), count, out);
+        _queue.erase(_queue.begin(), _queue.begin() + count);
+        return count;
+    }
+};
+
+// Pushes `numEvents` records, `intervalNs` apart (0 means as fast as possible), and measures the
+// time each one spent in the queue until the consumer picked it up.
+template <typename Queue>
+void Run(char const* name, size_t numEvents, int64_t intervalNs)
+{
+    Queue                queue;
+    std::vector<int64_t> latencyList;
+    latencyList.reserve(numEvents);
+
+    std::atomic<bool> producerDone { false };
+    uint64_t          numFull = 0;
+
+    int64_t     begin = NowNs();
+    std::thread consumer { [&]() {
+        Record batch[BatchSize];
+        while (latencyList.size() < numEvents)
+        {
+            size_t count = queue.PopBatch(batch, BatchSize);
+            if (count == 0)
+            {
+                if (producerDone && latencyList.size() >= numEvents)
+                    break;
+                continue;
+            }
+
+            int64_t now = NowNs();
+            for (size_t i = 0; i < count; ++i) latencyList.push_back(now - batch[i].pushedNs);
+        }
+    } };
+
+    int64_t next = begin;
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        if (intervalNs != 0)
+        {
+            next += intervalNs;
+            while (NowNs() < next) continue;
+        }
+
+        Record record { 0x8000, i, 0, NowNs() };
+        while (!queue.TryPush(record))
+        {
+            ++numFull;
+            record.pushedNs = NowNs();
+        }
+    }
+    producerDone = true;
+    consumer.join();
+    int64_t end = NowNs();
+
+    std::sort(latencyList.begin(), latencyList.end());
+    auto percentile = [&latencyList](double p) {
+        return latencyList[std::min(latencyList.size() - 1, (size_t)(latencyList.size() * p))];
+    };
+
+    std::printf("%-6s interval=%-6lld events/s=%-12.0f p50=%-7lldns p99=%-7lldns p999=%-8lldns "
+                "max=%-9lldns full=%llu\n",
+                name,
+                (long long)intervalNs,
+                numEvents * 1e9 / (double)(end - begin),
+                (long long)percentile(0.5),
+                (long long)percentile(0.99),
+                (long long)percentile(0.999),
+                (long long)latencyList.back(),
+                (unsigned long long)numFull);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t numEvents = argc > 1 ? (size_t)std::atoll(argv[1]) : 2000000;
+    if (numEvents == 0)
+        numEvents = 1;
+
+    // Unpaced runs measure throughput; paced ones approximate a burst of window events.
+    for (int64_t intervalNs : { 0, 1000, 10000 })
+    {
+        size_t count = intervalNs == 0 ? numEvents : std::min<size_t>(numEvents, 200000);
+        Run<RingQueue>("spsc", count, intervalNs);
+        Run<LockedQueue>("mutex", count, intervalNs);
+    }
+
+    return 0;
+}
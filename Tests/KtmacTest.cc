@@ -3,6 +3,7 @@
 
 #include <ktmac/KakaoStateManager.hh>
 
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -17,28 +18,45 @@
 
 using namespace ktmac;
 
-int main()
+// Pass --reactor to run the manager in the reactor mode.
+int main(int argc, char** argv)
 {
+    KakaoThreadingMode mode = KakaoThreadingMode::Threaded;
+    if (argc > 1 && strcmp(argv[1], "--reactor") == 0)
+        mode = KakaoThreadingMode::Reactor;
+
     {
         KakaoStateManager manager {
+            mode,
             {
-                nullptr,
-                [](auto, KakaoState state) {
-                    switch (state)
-                    {
-                        HANDLE_CASE(NotRunning)
-                        HANDLE_CASE(LoggedOut)
-                        HANDLE_CASE(Background)
-                        HANDLE_CASE(Locked)
-                        HANDLE_CASE(ContactListIsVisible)
-                        HANDLE_CASE(ChatroomListIsVisible)
-                        HANDLE_CASE(MiscIsVisible)
-                        HANDLE_CASE(ChatroomIsVisible)
-                    }
+                {
+                    nullptr,
+                    [](auto, KakaoState state) {
+                        switch (state)
+                        {
+                            HANDLE_CASE(NotRunning)
+                            HANDLE_CASE(LoggedOut)
+                            HANDLE_CASE(Background)
+                            HANDLE_CASE(Locked)
+                            HANDLE_CASE(ContactListIsVisible)
+                            HANDLE_CASE(ChatroomListIsVisible)
+                            HANDLE_CASE(MiscIsVisible)
+                            HANDLE_CASE(ChatroomIsVisible)
+                        }
+                    },
                 },
             },
         };
 
+        std::cout << "Threads: " << manager.GetNumThreads() << std::endl;
+
+        StartupTimings timings = manager.GetStartupTimings();
+        std::cout << "Startup: " << timings.total.count() << "us (hook launch "
+                  << timings.hookLaunch.count() << "us, process scan "
+                  << timings.processScan.count() << "us, window scan "
+                  << timings.windowScan.count() << "us, initial state "
+                  << timings.initialState.count() << "us)" << std::endl;
+
         std::string message;
         while (true)
         {
@@ -50,6 +68,12 @@ int main()
                 std::cout << "Message was not sent." << std::endl;
         }
 
+        ProcessHookHealth health = manager.GetProcessHookHealth();
+        std::cout << "Process hook: " << health.heartbeat.numAnswered << "/"
+                  << health.heartbeat.numSent << " heartbeats answered, p99 "
+                  << health.heartbeat.roundTrip.GetPercentile(0.99) / 1000 << "us, "
+                  << health.numRestarts << " restarts" << std::endl;
+
         std::cout << "Waiting for cleanup..." << std::endl;
     }
 }
\ No newline at end of file
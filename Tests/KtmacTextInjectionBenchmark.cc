@@ -0,0 +1,185 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/TextInjector.hh>
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <string>
+#include <vector>
+
+using namespace ktmac;
+
+namespace
+{
+
+// Hosts the edit control in a child process running this executable with `--host <title>`, so
+// that every injection crosses a process boundary, like it does when the target is KakaoTalk.
+class EditProcess
+{
+  private:
+    PROCESS_INFORMATION _process;
+    HWND                _edit;
+
+  public:
+    EditProcess() : _process {}, _edit { NULL }
+    {
+        std::wstring title
+            = L"ktmac-text-injection-benchmark-" + std::to_wstring(GetCurrentProcessId());
+
+        wchar_t path[MAX_PATH];
+        GetModuleFileNameW(NULL, path, MAX_PATH);
+
+        std::wstring command     = L"\"" + std::wstring { path } + L"\" --host " + title;
+        STARTUPINFOW startupInfo = {};
+        startupInfo.cb           = sizeof startupInfo;
+        if (!CreateProcessW(
+                NULL, &command[0], NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &_process))
+            return;
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds { 10 };
+        while ((_edit = FindWindowW(L"RICHEDIT50W", title.c_str())) == NULL
+               && std::chrono::steady_clock::now() < deadline
+               && WaitForSingleObject(_process.hProcess, 10) == WAIT_TIMEOUT)
+            continue;
+    }
+
+    ~EditProcess()
+    {
+        if (_process.hProcess == NULL)
+            return;
+
+        if (_edit != NULL)
+            PostMessageW(_edit, WM_CLOSE, NULL, NULL);
+        if (WaitForSingleObject(_process.hProcess, 5000) != WAIT_OBJECT_0)
+            TerminateProcess(_process.hProcess, 1);
+
+        CloseHandle(_process.hThread);
+        CloseHandle(_process.hProcess);
+    }
+
+    EditProcess(EditProcess const&) = delete;
+    EditProcess& operator=(EditProcess const&) = delete;
+
+  public:
+    HWND GetEdit() const
+    {
+        return _edit;
+    }
+};
+
+// The child side of EditProcess. Runs until the control is closed.
+int RunHost(wchar_t const* title)
+{
+    LoadLibraryW(L"Msftedit.dll");
+    HWND edit = CreateWindowExW(0,
+                                L"RICHEDIT50W",
+                                title,
+                                WS_OVERLAPPEDWINDOW | ES_MULTILINE,
+                                CW_USEDEFAULT,
+                                CW_USEDEFAULT,
+                                400,
+                                300,
+                                NULL,
+                                NULL,
+                                GetModuleHandle(NULL),
+                                NULL);
+    if (edit == NULL)
+        return 1;
+
+    MSG msg = {};
+    while (IsWindow(edit) && GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    return 0;
+}
+
+double GetPercentile(std::vector<double>& samples, double percentile)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t index = (size_t)(percentile * (samples.size() - 1));
+    return samples[index];
+}
+
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    using Clock = std::chrono::steady_clock;
+
+    if (argc == 3 && std::wcscmp(argv[1], L"--host") == 0)
+        return RunHost(argv[2]);
+
+    EditProcess host;
+    if (host.GetEdit() == NULL)
+    {
+        std::printf("Failed to create a RICHEDIT50W control in a child process.\n");
+        return 1;
+    }
+
+    TextInjectionMethod methodList[] = {
+        TextInjectionMethod::SetText,
+        TextInjectionMethod::ReplaceSelection,
+        TextInjectionMethod::ClipboardPaste,
+    };
+    size_t lengthList[]  = { 16, 256, 4096, 65536 };
+    int    numIterations = 200;
+
+    std::printf("%-16s %8s %12s %12s %12s\n", "method", "length", "mean(us)", "p50(us)", "p99(us)");
+
+    for (auto method : methodList)
+    {
+        auto injector = MakeTextInjector(method);
+        for (size_t length : lengthList)
+        {
+            std::wstring        message(length, L'x');
+            std::vector<double> samples;
+            samples.reserve(numIterations);
+
+            bool failed = false;
+            for (int i = 0; i < numIterations && !failed; ++i)
+            {
+                message[i % length] = L'a' + (i % 26);
+
+                auto begin = Clock::now();
+                if (injector->Inject(host.GetEdit(), message.c_str(), message.size(), 5000)
+                    != TextInjectionResult::Succeeded)
+                    failed = true;
+
+                // Completion is observed from the caller's side, which includes the round trip to
+                // the process that owns the control.
+                LRESULT actual = SendMessageW(host.GetEdit(), WM_GETTEXTLENGTH, 0, 0);
+                auto    end    = Clock::now();
+
+                if ((size_t)actual != length)
+                    failed = true;
+
+                samples.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+            }
+
+            if (failed)
+            {
+                std::printf("%-16s %8zu %12s\n", injector->GetName(), length, "failed");
+                continue;
+            }
+
+            double sum = 0;
+            for (double sample : samples) sum += sample;
+
+            std::printf("%-16s %8zu %12.1f %12.1f %12.1f\n",
+                        injector->GetName(),
+                        length,
+                        sum / samples.size(),
+                        GetPercentile(samples, 0.5),
+                        GetPercentile(samples, 0.99));
+        }
+    }
+
+    return 0;
+}
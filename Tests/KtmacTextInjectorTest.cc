@@ -0,0 +1,98 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/TextInjector.hh>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace ktmac;
+
+namespace
+{
+
+// Records the injected text instead of talking to a window, so the selection logic can be checked
+// on any platform.
+class SimulatedTextInjector : public TextInjector
+{
+  private:
+    char const*   _name;
+    std::wstring& _target;
+
+  public:
+    SimulatedTextInjector(char const* name, std::wstring& target) :
+        _name { name },
+        _target { target }
+    {}
+
+  public:
+    virtual char const* GetName() const override
+    {
+        return _name;
+    }
+
+    virtual TextInjectionResult Inject(void*, wchar_t const* text, size_t length, uint32_t) override
+    {
+        _target.assign(text, length);
+        return TextInjectionResult::Succeeded;
+    }
+};
+
+int numFailures = 0;
+
+void Expect(TextInjectorSelector const& selector, size_t length, char const* expected)
+{
+    TextInjector* injector = selector.Select(length);
+    char const*   actual   = injector ? injector->GetName() : "(none)";
+    if (strcmp(actual, expected) != 0)
+    {
+        std::cout << "Select(" << length << "): expected " << expected << ", got " << actual
+                  << std::endl;
+        ++numFailures;
+    }
+}
+
+}
+
+int main()
+{
+    std::wstring         target;
+    TextInjectorSelector selector;
+
+    Expect(selector, 0, "(none)");
+
+    selector.Set(0, std::make_unique<SimulatedTextInjector>("short", target));
+    selector.Set(4096, std::make_unique<SimulatedTextInjector>("long", target));
+    selector.Set(256, std::make_unique<SimulatedTextInjector>("medium", target));
+
+    Expect(selector, 0, "short");
+    Expect(selector, 255, "short");
+    Expect(selector, 256, "medium");
+    Expect(selector, 4095, "medium");
+    Expect(selector, 4096, "long");
+    Expect(selector, 1 << 20, "long");
+
+    selector.Set(256, std::make_unique<SimulatedTextInjector>("replaced", target));
+    Expect(selector, 300, "replaced");
+
+    selector.Set(256, nullptr);
+    Expect(selector, 300, "short");
+
+    std::wstring message(5000, L'x');
+    selector.Select(message.size())->Inject(nullptr, message.c_str(), message.size(), 0);
+    if (target != message)
+    {
+        std::cout << "Injected text does not match." << std::endl;
+        ++numFailures;
+    }
+
+    selector.Clear();
+    Expect(selector, 10, "(none)");
+
+    if (numFailures == 0)
+        std::cout << "All checks passed." << std::endl;
+
+    return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2021 Chanjung Kim (paxbun). All rights reserved.
+// Licensed under the MIT License.
+
+#include <ktmac/WindowEventOrder.hh>
+
+#include <iostream>
+
+using namespace ktmac;
+
+namespace
+{
+
+int numFailures = 0;
+
+void Expect(char const* name, bool condition)
+{
+    if (!condition)
+    {
+        std::cout << name << ": failed" << std::endl;
+        ++numFailures;
+    }
+}
+
+}
+
+int main()
+{
+    constexpr uintptr_t WindowA = 0x1000;
+    constexpr uintptr_t WindowB = 0x2000;
+
+    {
+        // The DESTROY of A is older than the SHOW of B, but nothing has superseded it.
+        WindowEventOrder order;
+        Expect("newer show", order.Admit(WindowB, 200));
+        Expect("older destroy of another window", order.Admit(WindowA, 100));
+        Expect("older event of the same window", !order.Admit(WindowB, 150));
+        Expect("same time", order.Admit(WindowB, 200));
+        Expect("newer event of the same window", order.Admit(WindowB, 300));
+    }
+
+    {
+        WindowEventOrder order;
+        Expect("before wrap", order.Admit(WindowA, 0xFFFFFFF0u));
+        Expect("after wrap", order.Admit(WindowA, 0x10));
+        Expect("stale across wrap", !order.Admit(WindowA, 0xFFFFFFF8u));
+
+        // Last heard of long ago rather than out of order.
+        Expect("long ago", order.Admit(WindowA, 0x10 - WindowEventOrder::MaxReorderMs));
+    }
+
+    {
+        // A resync already reflects every window.
+        WindowEventOrder order;
+        order.Admit(WindowA, 500);
+        order.Resync(1000);
+        Expect("resync forgets", order.GetNumWindows() == 0);
+        Expect("older than resync", !order.Admit(WindowB, 900));
+        Expect("newer than resync", order.Admit(WindowA, 1100));
+    }
+
+    {
+        // Past the capacity, the window whose last event is the oldest is forgotten, and a stale
+        // event for it is no longer caught.
+        WindowEventOrder order;
+        for (uintptr_t i = 0; i < WindowEventOrder::Capacity; ++i)
+            order.Admit(WindowA + i, (uint32_t)(1000 + i));
+        Expect("full", order.GetNumWindows() == WindowEventOrder::Capacity);
+
+        order.Admit(WindowB, 5000);
+        Expect("bounded", order.GetNumWindows() == WindowEventOrder::Capacity);
+        Expect("oldest forgotten", order.Admit(WindowA, 999));
+        Expect("others kept", !order.Admit(WindowA + WindowEventOrder::Capacity - 1, 999));
+    }
+
+    if (numFailures != 0)
+        return 1;
+    std::cout << "All checks passed." << std::endl;
+    return 0;
+}